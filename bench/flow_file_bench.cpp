@@ -0,0 +1,31 @@
+#include "core/flow_file.h"
+#include <benchmark/benchmark.h>
+#include <string>
+
+namespace {
+
+// Buffer of the given size in 64-byte lines, loaded with one splice
+std::string make_content(size_t bytes) {
+    std::string line(63, 'x');
+    line += '\n';
+    std::string content;
+    content.reserve(bytes);
+    while (content.size() + line.size() <= bytes) {
+        content += line;
+    }
+    return content;
+}
+
+// A line inserted in the middle of a large flow, without a network: the
+// rope splice, line index update and edit delta encoding
+void BM_InsertContent(benchmark::State& state) {
+    nerd::FlowFile flow(0x1234, "bench");
+    flow.append_content(make_content(static_cast<size_t>(state.range(0))));
+    for (auto _ : state) {
+        flow.insert_content(flow.line_count() / 2, "inserted line");
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_InsertContent)->Arg(1 << 20)->Arg(16 << 20)->Arg(128 << 20)->Unit(benchmark::kMicrosecond);
+
+} // namespace
@@ -0,0 +1,128 @@
+#include "network/flow.h"
+#include "network/loopback_transport.h"
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using nerd::FlowID;
+using nerd::NetworkFlow;
+using nerd::RawPacket;
+
+const FlowID DATA_FLOW = 0x1001;
+const FlowID PING_FLOW = 0x2001;
+const FlowID PONG_FLOW = 0x2002;
+
+// Sequences cycle through this many slots, so streams stay bounded
+const uint32_t SEQUENCE_SLOTS = 4096;
+
+// Complete nodes on one simulated segment: node 0 sends, the rest count
+// what they receive and answer pings. Built once per shape and kept for the
+// process, so thread start-up is not part of any measurement.
+struct Segment {
+    nerd::LoopbackHub hub;
+    std::vector<std::unique_ptr<NetworkFlow>> nodes;
+    std::vector<std::unique_ptr<std::atomic<uint64_t>>> received;
+    std::atomic<uint64_t> pongs;
+
+    Segment(size_t receivers, uint32_t latency_us) : hub(config(latency_us)), pongs(0) {
+        for (size_t i = 0; i <= receivers; ++i) {
+            nodes.push_back(std::make_unique<NetworkFlow>(2));
+            received.push_back(std::make_unique<std::atomic<uint64_t>>(0));
+            NetworkFlow* node = nodes.back().get();
+            std::atomic<uint64_t>* count = received.back().get();
+            node->set_data_handler([this, node, count, i](const RawPacket& packet) {
+                FlowID flow = packet.header().flow_id;
+                if (flow == DATA_FLOW) {
+                    count->fetch_add(1, std::memory_order_relaxed);
+                } else if (flow == PING_FLOW && i == 1) {
+                    RawPacket pong(PONG_FLOW, nerd::FLOW_DATA, packet.payload(), packet.payload_size());
+                    node->transmit_packet(pong);
+                } else if (flow == PONG_FLOW && i == 0) {
+                    pongs.fetch_add(1, std::memory_order_release);
+                }
+            });
+            node->attach_transport(hub.attach());
+            node->start_circulation();
+        }
+    }
+
+    static nerd::LoopbackConfig config(uint32_t latency_us) {
+        nerd::LoopbackConfig config;
+        config.latency_us = latency_us;
+        config.queue_frames = 16384;
+        return config;
+    }
+
+    static Segment& get(size_t receivers, uint32_t latency_us) {
+        static std::map<std::pair<size_t, uint32_t>, std::unique_ptr<Segment>> segments;
+        auto& segment = segments[std::make_pair(receivers, latency_us)];
+        if (!segment) {
+            segment = std::make_unique<Segment>(receivers, latency_us);
+        }
+        return *segment;
+    }
+};
+
+// Chunks stored and circulated by one node and stored by every receiver;
+// the range is the number of receivers
+void BM_LoopbackThroughput(benchmark::State& state) {
+    const uint32_t BATCH = 1024;
+    size_t receivers = static_cast<size_t>(state.range(0));
+    Segment& segment = Segment::get(receivers, 0);
+    NetworkFlow& sender = *segment.nodes[0];
+    std::vector<uint8_t> payload(1400, 0x5a);
+    uint32_t sequence = 0;
+
+    for (auto _ : state) {
+        std::vector<uint64_t> expected;
+        for (size_t i = 1; i <= receivers; ++i) {
+            expected.push_back(segment.received[i]->load(std::memory_order_relaxed) + BATCH);
+        }
+        for (uint32_t n = 0; n < BATCH; ++n) {
+            RawPacket packet(DATA_FLOW, nerd::FLOW_DATA, payload);
+            packet.set_sequence(sequence++ % SEQUENCE_SLOTS);
+            sender.inject_packet(packet);
+        }
+        sender.flush_transmit();
+
+        // Frames a full receive queue drops are counted and not waited for
+        for (size_t i = 1; i <= receivers; ++i) {
+            NetworkFlow& node = *segment.nodes[i];
+            uint64_t dropped = node.traffic_stats().rx_dropped;
+            while (segment.received[i]->load(std::memory_order_relaxed) + node.traffic_stats().rx_dropped - dropped <
+                   expected[i - 1]) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * BATCH);
+    state.SetBytesProcessed(state.iterations() * BATCH * payload.size());
+}
+BENCHMARK(BM_LoopbackThroughput)->Arg(1)->Arg(3)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+// One frame to a peer and its answer back; the range is the simulated
+// one-way latency in microseconds
+void BM_LoopbackRoundTrip(benchmark::State& state) {
+    Segment& segment = Segment::get(1, static_cast<uint32_t>(state.range(0)));
+    NetworkFlow& sender = *segment.nodes[0];
+    std::vector<uint8_t> payload(64, 0x5a);
+
+    for (auto _ : state) {
+        uint64_t target = segment.pongs.load(std::memory_order_relaxed) + 1;
+        RawPacket ping(PING_FLOW, nerd::FLOW_DATA, payload);
+        sender.transmit_packet(ping);
+        sender.flush_transmit();
+        while (segment.pongs.load(std::memory_order_acquire) < target) {
+            std::this_thread::yield();
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LoopbackRoundTrip)->Arg(0)->Arg(50)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+} // namespace
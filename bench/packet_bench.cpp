@@ -0,0 +1,89 @@
+#include "network/packet.h"
+#include "network/packet_codec.h"
+#include <benchmark/benchmark.h>
+#include <vector>
+
+namespace {
+
+using nerd::RawPacket;
+
+RawPacket make_packet(size_t payload_size) {
+    std::vector<uint8_t> payload(payload_size);
+    for (size_t i = 0; i < payload.size(); ++i) {
+        payload[i] = static_cast<uint8_t>(i * 31);
+    }
+    RawPacket packet(0x1234, nerd::FLOW_DATA, payload);
+    packet.set_sequence(7);
+    return packet;
+}
+
+// Header, checksum and payload copy into a transmit slot
+void BM_Serialize(benchmark::State& state) {
+    RawPacket packet = make_packet(static_cast<size_t>(state.range(0)));
+    std::vector<uint8_t> frame(2048);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(packet.serialize_into(frame.data(), frame.size()));
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Serialize)->Arg(64)->Arg(512)->Arg(1400);
+
+// Validation and decode straight out of a receive ring slot
+void BM_Deserialize(benchmark::State& state) {
+    std::vector<uint8_t> frame = make_packet(static_cast<size_t>(state.range(0))).serialize();
+    RawPacket packet;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(packet.deserialize(frame.data(), frame.size()));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Deserialize)->Arg(64)->Arg(512)->Arg(1400);
+
+std::vector<nerd::HeartbeatRecord> make_heartbeats(size_t count) {
+    std::vector<nerd::HeartbeatRecord> records(count);
+    for (size_t i = 0; i < records.size(); ++i) {
+        records[i].flow_id = static_cast<nerd::FlowID>(i);
+        records[i].sequence = static_cast<uint32_t>(i * 7);
+        records[i].version = i;
+    }
+    return records;
+}
+
+// A heartbeat frame built in its pool slab and copied into a transmit slot
+void BM_EncodeHeartbeats(benchmark::State& state) {
+    std::vector<nerd::HeartbeatRecord> records = make_heartbeats(static_cast<size_t>(state.range(0)));
+    std::vector<uint8_t> frame(2048);
+    for (auto _ : state) {
+        RawPacket packet = nerd::encode_packet<nerd::FLOW_HEARTBEAT>(0, nerd::HeartbeatHeader(), records.data(), records.size());
+        benchmark::DoNotOptimize(packet.serialize_into(frame.data(), frame.size()));
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_EncodeHeartbeats)->Arg(1)->Arg(16)->Arg(nerd::PacketCodec<nerd::FLOW_HEARTBEAT>::MAX_RECORDS);
+
+// Heartbeat records read in place from a received payload
+void BM_DecodeHeartbeats(benchmark::State& state) {
+    using Codec = nerd::PacketCodec<nerd::FLOW_HEARTBEAT>;
+    std::vector<nerd::HeartbeatRecord> records = make_heartbeats(static_cast<size_t>(state.range(0)));
+    std::vector<uint8_t> payload(Codec::payload_size(records.size()));
+    Codec::encode(payload.data(), nerd::HeartbeatHeader(), records.data(), records.size());
+    for (auto _ : state) {
+        nerd::HeartbeatHeader header;
+        size_t count = 0;
+        uint64_t sum = 0;
+        if (Codec::parse(payload.data(), payload.size(), header, count)) {
+            for (size_t i = 0; i < count; ++i) {
+                sum += Codec::record(payload.data(), i).sequence;
+            }
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_DecodeHeartbeats)->Arg(1)->Arg(16)->Arg(nerd::PacketCodec<nerd::FLOW_HEARTBEAT>::MAX_RECORDS);
+
+} // namespace
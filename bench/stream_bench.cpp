@@ -0,0 +1,49 @@
+#include "network/packet.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace {
+
+using nerd::PacketStream;
+using nerd::RawPacket;
+
+// Sequences 0..count-1, each displaced by up to depth places: what a
+// stream sees from a segment that reorders within depth
+std::vector<uint32_t> arrival_order(uint32_t count, uint32_t depth) {
+    std::vector<uint32_t> order(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        order[i] = i;
+    }
+    std::mt19937 rng(42);
+    for (uint32_t start = 0; depth > 1 && start < count; start += depth) {
+        std::shuffle(order.begin() + start, order.begin() + std::min(count, start + depth), rng);
+    }
+    return order;
+}
+
+// One flow's worth of chunks inserted into an empty stream per iteration;
+// the range is the reorder depth, 1 for in-order arrival
+void BM_StreamAddPacket(benchmark::State& state) {
+    const uint32_t COUNT = 4096;
+    std::vector<uint32_t> order = arrival_order(COUNT, static_cast<uint32_t>(state.range(0)));
+    std::vector<RawPacket> packets(COUNT);
+    std::vector<uint8_t> payload(1400, 0x5a);
+    for (uint32_t i = 0; i < COUNT; ++i) {
+        packets[i] = RawPacket(0x1234, nerd::FLOW_DATA, payload);
+        packets[i].set_sequence(order[i]);
+    }
+
+    for (auto _ : state) {
+        PacketStream stream(0x1234);
+        for (const auto& packet : packets) {
+            stream.add_packet(packet);
+        }
+        benchmark::DoNotOptimize(stream.size());
+    }
+    state.SetItemsProcessed(state.iterations() * COUNT);
+}
+BENCHMARK(BM_StreamAddPacket)->Arg(1)->Arg(8)->Arg(64)->Arg(1024);
+
+} // namespace
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+
+namespace nerd {
+
+// First occurrence of needle in haystack, or null; an empty needle matches at
+// haystack. Candidates are found by comparing the needle's first and last
+// bytes against a whole vector of positions at once, AVX2 or SSE2 picked at
+// startup, and only those candidates are compared in full. Single bytes go
+// to memchr, which the C library already vectorizes.
+const char* find_bytes(const char* haystack, size_t length, const char* needle, size_t needle_length);
+
+// "avx2", "sse2" or "scalar"
+const char* byte_search_kernel_name();
+
+} // namespace nerd
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace nerd {
+
+// Codec of a compressed FLOW_DATA chunk (FlowPacketHeader::codec). Each
+// chunk is compressed on its own, so any chunk still decodes without its
+// neighbours and the chunk index keeps mapping to a fixed content offset.
+enum ChunkCodec : uint8_t {
+    CODEC_NONE = 0,
+    CODEC_LZ4 = 1,
+    CODEC_ZSTD = 2
+};
+
+// Whether this build can encode and decode codec; missing libraries make a
+// sender fall back to raw chunks
+bool codec_available(ChunkCodec codec);
+const char* codec_name(ChunkCodec codec);
+
+// Compress length bytes of src into dest. Returns the compressed size, or 0
+// when the codec is unavailable or the result would not be smaller than the
+// input, in which case the chunk should go out uncompressed.
+size_t compress_chunk(ChunkCodec codec, uint16_t dictionary, const uint8_t* src, size_t length,
+                      uint8_t* dest, size_t capacity);
+
+// Decompress into dest; true only when exactly expected bytes come out
+bool decompress_chunk(ChunkCodec codec, uint16_t dictionary, const uint8_t* src, size_t length,
+                      uint8_t* dest, size_t expected);
+
+// Shared zstd dictionaries, registered under the same id on every node of a
+// flow family. Id 0 means no dictionary. Registering an id again replaces it.
+bool register_dictionary(uint16_t id, const std::vector<uint8_t>& dictionary);
+bool has_dictionary(uint16_t id);
+
+// Train a dictionary of at most capacity bytes from representative content;
+// empty when zstd is unavailable or the samples are too few
+std::vector<uint8_t> train_dictionary(const std::vector<std::string>& samples, size_t capacity);
+
+} // namespace nerd
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "network/packet.h"
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+namespace nerd {
+
+// Content bytes carried by one FLOW_DATA chunk
+constexpr size_t FLOW_CHUNK_SIZE = 1400;
+
+// Largest flow a peer's chunks may announce unless configured otherwise.
+// Storage for a copy is sized by the announcement, before its chunks
+// arrive, so this bounds what one forged chunk can make a node allocate.
+constexpr size_t DEFAULT_MAX_FLOW_LENGTH = size_t(256) << 20;
+
+// Prefix of every FLOW_DATA payload. Chunk i holds content bytes
+// [i * FLOW_CHUNK_SIZE, (i + 1) * FLOW_CHUNK_SIZE) of a flow whose content
+// was total_length bytes at version. Chunks an edit did not touch are not
+// re-sent, so a complete flow may mix chunks of several versions.
+struct FlowChunkHeader {
+    uint64_t version;
+    uint64_t total_length;
+} __attribute__((packed));
+
+// Prefix of every FLOW_PARITY payload, followed by FLOW_CHUNK_SIZE parity
+// bytes. Group g covers chunks [g * data_chunks, g * data_chunks +
+// group_chunks), all emitted at version; short chunks count as zero-padded.
+struct FlowParityHeader {
+    uint64_t version;
+    uint64_t total_length;
+    uint32_t group;
+    uint8_t data_chunks;
+    uint8_t group_chunks;
+    uint8_t parity_chunks;
+    uint8_t row;              // Parity row within the group
+} __attribute__((packed));
+
+// ChunkReassembler - rebuilds flow content from FLOW_DATA chunks
+//
+// Chunks are accepted in any order and each payload is copied (or
+// decompressed) once, straight to its final offset. A bitmap tracks which chunks are present, so the
+// contiguous prefix can be read while the tail is still in flight and the
+// gaps can be reported for retransmission. When the sender adds FEC parity,
+// lost chunks of a group are rebuilt locally as soon as enough parity has
+// arrived. Not thread-safe.
+class ChunkReassembler {
+public:
+    ChunkReassembler();
+
+    // False for malformed or superseded chunks, and for lengths over the maximum
+    bool accept(const RawPacket& packet);
+    bool accept_parity(const RawPacket& packet);
+    void reset();
+    void set_max_length(size_t max_length) { max_length_ = max_length; }
+    
+    // Start from a saved copy: chunk i is held at version when bit i of
+    // present (one bit per chunk) is set. Later chunks only replace it if newer.
+    void restore(const uint8_t* data, size_t total_length, uint64_t version, const uint64_t* present);
+
+    bool started() const { return chunk_count_ != 0 || version_ != 0; }
+    bool complete() const { return started() && received_ == chunk_count_; }
+    uint64_t version() const { return version_; }
+    size_t total_length() const { return data_.size(); }
+    uint32_t chunk_count() const { return chunk_count_; }
+    uint32_t received() const { return received_; }
+    uint64_t recovered() const { return recovered_; }  // Chunks rebuilt from parity
+
+    // Bytes available from offset 0 without a gap
+    size_t contiguous_bytes() const;
+    const uint8_t* data() const { return data_.data(); }
+    const std::vector<uint64_t>& bitmap() const { return present_; }  // Bit per chunk held
+    uint64_t chunk_version(uint32_t index) const {
+        return index < chunk_count_ && has(index) ? chunk_versions_[index] : 0;
+    }
+
+    // Missing chunk indices in ascending order, at most max of them
+    std::vector<uint32_t> missing(size_t max) const;
+
+private:
+    // Parity blocks received for one group
+    struct ParityGroup {
+        uint64_t version;
+        uint8_t data_chunks;
+        uint8_t group_chunks;
+        uint64_t rows;                 // Bit per parity row received
+        std::vector<uint8_t> blocks;   // parity_chunks blocks of FLOW_CHUNK_SIZE
+    };
+    
+    bool has(uint32_t index) const { return (present_[index >> 6] >> (index & 63)) & 1; }
+    void resize(size_t total_length);
+    bool adopt_version(uint64_t version, uint64_t total_length);
+    void mark(uint32_t index, uint64_t version);
+    void unmark(uint32_t index);
+    void try_recover(uint32_t group);
+
+    std::vector<uint8_t> data_;
+    std::vector<uint64_t> present_;
+    std::vector<uint64_t> chunk_versions_;
+    uint64_t version_;
+    uint32_t chunk_count_;
+    uint32_t received_;
+    size_t max_length_;
+    
+    std::unordered_map<uint32_t, ParityGroup> parity_;
+    uint32_t fec_data_chunks_;   // Group size of the latest parity seen
+    uint64_t recovered_;
+};
+
+} // namespace nerd
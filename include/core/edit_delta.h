@@ -0,0 +1,54 @@
+#pragma once
+
+#include "core/text_buffer.h"
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace nerd {
+
+// One byte-range replacement on flow content; every EditCommand reduces to
+// a short list of these
+struct ContentSplice {
+    uint32_t offset;          // Byte offset in the content the splice applies to
+    uint32_t erase_length;    // Bytes removed at offset
+    std::string insert;       // Bytes inserted in their place
+    
+    ContentSplice() : offset(0), erase_length(0) {}
+    ContentSplice(uint32_t at, uint32_t erase, const std::string& text)
+        : offset(at), erase_length(erase), insert(text) {}
+};
+
+// FLOW_EDIT payload layout: an EditDeltaHeader, then splice_count
+// SpliceRecords each followed by insert_length bytes. The splices apply in
+// order to the content at base_version and produce base_version + 1.
+// Fields are little-endian, copied in host order (see packet.h).
+struct EditDeltaHeader {
+    uint64_t base_version;
+    uint32_t splice_count;
+} __attribute__((packed));
+
+struct SpliceRecord {
+    uint32_t offset;
+    uint32_t erase_length;
+    uint32_t insert_length;
+} __attribute__((packed));
+
+// Pack splices into FLOW_EDIT payloads of at most max_payload bytes, the
+// first against base_version and each later one against its predecessor.
+// Inserts too large for one payload are split across consecutive splices.
+std::vector<std::vector<uint8_t>> encode_edit_deltas(const std::vector<ContentSplice>& splices,
+                                                     uint64_t base_version, size_t max_payload);
+
+// Parse one FLOW_EDIT payload; false on a truncated or malformed payload
+bool decode_edit_delta(const uint8_t* data, size_t length, uint64_t& base_version,
+                       std::vector<ContentSplice>& splices);
+
+// Whether splices applied in order all stay within content of the given size
+bool splices_in_range(size_t size, const std::vector<ContentSplice>& splices);
+
+// Apply splices in order; false (content untouched) if any is out of range
+bool apply_splices(TextBuffer& content, const std::vector<ContentSplice>& splices);
+
+} // namespace nerd
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace nerd {
+
+// Group limits: the Cauchy matrix draws parity rows and data columns from
+// disjoint halves of GF(256)
+constexpr size_t FEC_MAX_DATA = 128;
+constexpr size_t FEC_MAX_PARITY = 64;
+
+// Cauchy Reed-Solomon erasure code over GF(256)
+//
+// Parity block j of a group is sum_i C[j][i] * data[i], where C is a Cauchy
+// matrix with its columns scaled so row 0 is all ones: a single parity
+// block is plain XOR parity, and any e lost data blocks come back from any
+// e parity blocks. Row coefficients depend only on (j, i), so a short last
+// group uses the same matrix with fewer columns. All blocks are block_size
+// bytes; callers zero-pad short ones.
+uint8_t fec_coefficient(uint32_t parity_row, uint32_t data_column);
+
+void fec_encode(const uint8_t* const* data, size_t data_count,
+                uint8_t* const* parity, size_t parity_count, size_t block_size);
+
+// Rebuild the data blocks listed in erased (ascending) into recovered, one
+// block per erasure, from the surviving data blocks and erased.size()
+// parity blocks whose rows are given in parity_rows. data[i] is ignored for
+// erased columns. False when the arguments cannot describe a solvable group.
+bool fec_recover(const uint8_t* const* data, size_t data_count, const std::vector<uint32_t>& erased,
+                 const uint8_t* const* parity, const uint32_t* parity_rows,
+                 uint8_t* const* recovered, size_t block_size);
+
+} // namespace nerd
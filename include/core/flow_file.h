@@ -2,9 +2,19 @@
 
 #include "network/packet.h"
 #include "network/flow.h"
+#include "core/edit_delta.h"
+#include "core/chunk_reassembler.h"
+#include "core/flow_snapshot.h"
+#include "core/text_buffer.h"
+#include "core/spill_file.h"
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
+#include <map>
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <functional>
 
 namespace nerd {
@@ -28,6 +38,25 @@ struct EditCommand {
     EditCommand() : type(APPEND), start_line(0), end_line(0) {}
 };
 
+// One splice as seen by content subscribers. Line numbers refer to the
+// content before the change; inserted is valid for the callback only.
+struct ContentChange {
+    size_t offset;            // Byte offset of the change
+    size_t erased_bytes;      // Bytes removed at offset
+    std::string_view inserted;
+    int first_line;           // Line holding offset
+    int erased_lines;         // Newlines removed
+    int inserted_lines;       // Newlines added
+    uint64_t version;         // Content version once the change is applied
+    bool remote;              // Applied from a peer's delta
+    
+    ContentChange()
+        : offset(0), erased_bytes(0), first_line(0), erased_lines(0), inserted_lines(0),
+          version(0), remote(false) {}
+};
+
+using ContentChangeListener = std::function<void(const ContentChange&)>;
+
 // FlowFile class - represents a file as a living network process
 class FlowFile {
 private:
@@ -35,11 +64,90 @@ private:
     CirculationPattern pattern_;
     std::vector<NetworkNode> circulation_path_;
     std::string name_;
-    std::string content_;
-    bool is_modified_;
+    std::unique_ptr<SpillFile> spill_;   // Backs a large content_, so declared first
+    TextBuffer content_;
+    
+    // Set by local and remote edits alike, so by the editor and receive
+    // threads, and cleared by maintain_flow() on the maintenance thread
+    std::atomic<bool> is_modified_;
+    
+    // Held by every change to content_ and by the readers that run off the
+    // editor thread (maintenance, snapshots); the editor thread, the only
+    // writer, reads without it. Edits nest, hence recursive. Taken after
+    // chunk_mutex_ where both are needed.
+    std::recursive_mutex content_mutex_;
+    
+    // Content version, advanced once per FLOW_EDIT delta; written on the
+    // editor thread and read by the receive thread for chunks and heartbeats
+    std::atomic<uint64_t> version_;
+    
+    // Local splices not yet sent
+    std::vector<ContentSplice> outgoing_;
+    std::vector<ContentChange> outgoing_changes_;
+    bool in_transaction_;     // apply_commands() publishes once at the end
+    
+    // Bytes local edits changed, re-emitted as chunks on the next maintenance
+    // pass: everything from dirty_offset_ on, where an edit changed the
+    // length, and the byte ranges rewritten in place before it. Peers' deltas
+    // and adopted copies are never re-emitted here.
+    size_t dirty_offset_;
+    std::vector<std::pair<size_t, size_t>> dirty_ranges_;
+    
+    // The network builds refreshes and NACK answers from content_ through
+    // chunk_source_ rather than keeping a second copy as packets; each
+    // chunk keeps the header it was last emitted or received with
+    std::shared_ptr<ChunkSource> chunk_source_;
+    std::vector<FlowChunkHeader> chunk_stamps_;
+    
+    // Deltas from peers: queued by the receive thread, applied on the editor thread
+    std::mutex inbox_mutex_;
+    std::vector<RawPacket> inbox_;
+    struct PendingEdit {
+        uint32_t crc;                          // CRC32C of the FLOW_EDIT payload
+        std::vector<ContentSplice> splices;
+    };
+    std::map<uint64_t, PendingEdit> pending_edits_;
+    
+    // CRC32C of the delta that produced each recent version, so a peer's
+    // delta against a version already passed is told apart from a duplicate
+    std::map<uint64_t, uint32_t> delta_history_;
+    
+    // A peer's newer copy arriving as FLOW_DATA chunks; paged_bytes_ is the
+    // prefix of it already paged into content_
+    std::mutex chunk_mutex_;
+    ChunkReassembler reassembler_;
+    size_t paged_bytes_;
+    
+    // Gap detection for FLOW_NACK: one past the highest chunk seen, and when
+    // the last chunk arrived and the last request went out (microseconds)
+    uint32_t chunk_frontier_;
+    uint64_t last_chunk_us_;
+    uint64_t last_nack_us_;
+    bool awaiting_content_;   // Joined a remote flow and has no chunk yet
     
-    // Callback for content changes
-    std::function<void(const std::string&)> content_change_callback_;
+    // The copy no longer matches the version it claims, after a delta that
+    // did not fit it or lost to a concurrent one: it is not served, and the
+    // next complete copy from a holder is adopted whatever its version
+    bool resyncing_;
+    
+    // Restored from a snapshot at catch_up_version_: holders that moved past
+    // it are asked for the chunks that changed since, and a changed chunk
+    // arriving after the newest one still patches the copy
+    bool restored_;
+    uint64_t catch_up_version_;
+    bool chunks_patched_;
+    
+    // What the last snapshot held, so unchanged flows are not rewritten
+    bool snapshot_saved_;
+    uint64_t saved_version_;
+    uint32_t saved_chunks_;
+    
+    // Network the flow's packets are injected into (not owned)
+    NetworkFlow* network_flow_;
+    
+    // Subscribers to content changes, by listener id
+    std::vector<std::pair<size_t, ContentChangeListener>> change_listeners_;
+    size_t next_listener_id_;
     
 public:
     FlowFile(FlowID id, const std::string& name);
@@ -48,7 +156,17 @@ public:
     // File operations
     void maintain_flow();
     void modify_pattern(const EditCommand& cmd);
-    std::string read_from_flow();
+    
+    // Apply commands as one transaction: peers get the splices as one run of
+    // deltas, subscribers a single change spanning everything that moved.
+    // Returns the number of splices made.
+    size_t apply_commands(const std::vector<EditCommand>& commands);
+    
+    // Stream the content as fn(const char* data, size_t length), in order and
+    // without materializing it; a spilled flow is read in place
+    template <typename Fn>
+    void read_from_flow(Fn&& fn) const { content_.for_each_chunk(fn); }
+    
     void write_to_flow(const std::string& data);
     
     // Content management
@@ -57,7 +175,40 @@ public:
     void substitute_content(const std::string& pattern, const std::string& replacement);
     void insert_content(int line, const std::string& content);
     
-    // Flow state
+    // Network attachment; the network serves the flow's chunks from its
+    // content from then on
+    void attach_network(NetworkFlow* network_flow);
+    
+    // Edit deltas from peers; receive_edit() may be called from any thread,
+    // apply_received_edits() runs on the editor thread and returns how many
+    // applied. A delta that does not fit the content, or loses to a
+    // concurrent one, makes the flow refetch a holder's whole copy.
+    void receive_edit(const RawPacket& packet);
+    size_t apply_received_edits();
+    
+    // Data chunks and FEC parity from peers, same threading as edits.
+    // apply_received_chunks() pages in the contiguous prefix of a newer copy
+    // and adopts it once complete
+    void receive_chunk(const RawPacket& packet);
+    size_t apply_received_chunks();
+    std::vector<uint32_t> missing_chunks(size_t max);
+    void set_max_length(size_t max_length);   // Largest copy a peer may announce
+    
+    // Heartbeats let a receiver whose stream went quiet notice a lost tail
+    void receive_heartbeat(const HeartbeatRecord& beat);
+    
+    // The flow was joined from a peer: ask for its chunks at the next heartbeat
+    void await_remote_content();
+    
+    // Local snapshots. save_snapshot() writes the flow to path unless it is
+    // unchanged since the last save; a joiner still fetching its first copy
+    // saves the chunks that have arrived. restore_snapshot() adopts a saved
+    // copy: a complete one is readable at once, a partial one resumes with
+    // just the missing chunks, and either fetches only what changed since.
+    bool save_snapshot(const std::string& path, uint64_t name_key);
+    void restore_snapshot(const FlowSnapshot& snapshot);
+    
+    // Flow state; new FEC or codec settings re-send every chunk at the next maintenance pass
     void update_circulation_pattern(const CirculationPattern& pattern);
     void add_circulation_node(const NetworkNode& node);
     void remove_circulation_node(const std::string& address);
@@ -65,30 +216,50 @@ public:
     // Accessors
     FlowID identifier() const { return identifier_; }
     const std::string& name() const { return name_; }
-    const std::string& content() const { return content_; }
+    const TextBuffer& text() const { return content_; }
+    std::string content() const { return content_.to_string(); }  // Materializes the whole flow
+    
+    // Line index, maintained by the rope as edits land
+    int line_count() const { return content_.line_count(); }
+    std::string_view line(int index, std::string& scratch) const { return content_.line_view(index, scratch); }
+    template <typename Fn>
+    void for_each_line(int first, int count, Fn&& fn) const { content_.for_each_line(first, count, fn); }
     const CirculationPattern& pattern() const { return pattern_; }
     const std::vector<NetworkNode>& circulation_path() const { return circulation_path_; }
     bool is_modified() const { return is_modified_; }
+    uint64_t version() const { return version_; }
     
-    // Callbacks
-    void set_content_change_callback(std::function<void(const std::string&)> callback) {
-        content_change_callback_ = callback;
-    }
+    // Change subscription; listeners run on the thread that made the change,
+    // once per splice, in order
+    size_t add_change_listener(ContentChangeListener listener);
+    void remove_change_listener(size_t id);
     
     // Serialization
     std::vector<uint8_t> serialize_content() const;
     bool deserialize_content(const std::vector<uint8_t>& data);
     
-    // Flow discovery
-    bool discover_existing_flow();
-    void broadcast_existence();
-    
 private:
-    void notify_content_change();
-    void encode_content_in_packets();
-    void decode_content_from_packets(const std::vector<RawPacket>& packets);
-    std::vector<std::string> split_into_lines(const std::string& content) const;
-    std::string join_lines(const std::vector<std::string>& lines) const;
+    void apply_splice(const ContentSplice& splice, std::vector<ContentChange>& changes, bool remote);
+    void mark_dirty(const ContentSplice& splice);
+    void shift_dirty(const ContentSplice& splice);
+    bool chunk_dirty(uint32_t sequence) const;
+    std::vector<std::pair<uint32_t, uint32_t>> dirty_chunks(uint32_t chunk_count, uint32_t group_size) const;
+    void stamp_chunks(uint32_t first, uint32_t end, uint64_t version);
+    void request_missing_chunks(uint64_t now);  // chunk_mutex_ held
+    void resync();                              // chunk_mutex_ and content_mutex_ held
+    void emit_parity(uint32_t group, uint32_t group_chunks, const uint8_t* blocks, std::vector<RawPacket>& packets);
+    void notify_changes(std::vector<ContentChange>& changes, const std::vector<ContentSplice>& splices,
+                        bool remote);
+    void notify_change(ContentChange& change, bool remote);
+    void replace_tail(size_t offset, const char* data, size_t length);  // Large results spill
+    void splice_content(const ContentSplice& splice);
+    void publish_edits();
+    void transmit_edits();
+    void advertise_version();
+    void encode_content_in_packets(std::vector<RawPacket>& packets);  // Built to be sent unlocked
+    void serve_chunks();
+    bool materialize_chunk(uint32_t sequence, uint64_t since_version, RawPacket& packet);
+    size_t build_chunk(uint32_t sequence, const FlowChunkHeader& header, uint8_t* chunk, RawPacket& packet) const;
 };
 
 } // namespace nerd
\ No newline at end of file
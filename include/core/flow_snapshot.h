@@ -0,0 +1,110 @@
+#pragma once
+
+#include "network/flow_pattern.h"
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace nerd {
+
+constexpr uint32_t SNAPSHOT_MAGIC = 0x50414E53;  // "SNAP" in ASCII
+constexpr uint16_t SNAPSHOT_FORMAT = 1;
+
+// File layout: the header, then the name, the chunk bitmap and the content,
+// each at the offset the header gives and 8-byte aligned. Bit i of the
+// bitmap is set when chunk i, content bytes [i * FLOW_CHUNK_SIZE,
+// (i + 1) * FLOW_CHUNK_SIZE), holds data; the bytes of an absent chunk are
+// unspecified. Little-endian, so on little-endian hosts a mapped file is
+// read in place with no parsing.
+struct SnapshotHeader {
+    uint32_t magic;               // SNAPSHOT_MAGIC
+    uint16_t format;              // SNAPSHOT_FORMAT
+    uint16_t name_length;
+    uint64_t name_key;            // flow_name_key() of the flow in its namespace
+    uint64_t version;             // Content version of the chunks held
+    uint64_t total_length;
+    uint32_t chunk_count;
+    uint32_t circulation_rate;    // CirculationPattern fields
+    uint32_t max_packet_age;
+    uint8_t auto_sustain;
+    uint8_t fec_data_chunks;
+    uint8_t fec_parity_chunks;
+    uint8_t codec;
+    uint16_t dictionary;
+    uint16_t reserved;
+    uint32_t content_checksum;    // CRC32C of the content bytes
+    uint64_t name_offset;
+    uint64_t bitmap_offset;
+    uint64_t content_offset;
+    uint32_t reserved2;
+    uint32_t checksum;            // CRC32C of the header bytes before it
+} __attribute__((packed));
+
+static_assert(sizeof(SnapshotHeader) == 88, "snapshot header layout is part of the file format");
+
+// FlowSnapshot - read-only view of a snapshot file
+//
+// The file is mapped, not read: open() checks the header and the content
+// checksum, after which the content is served straight from the page cache.
+// Not thread-safe; the view is valid until close() or destruction.
+class FlowSnapshot {
+public:
+    FlowSnapshot();
+    ~FlowSnapshot();
+
+    FlowSnapshot(const FlowSnapshot&) = delete;
+    FlowSnapshot& operator=(const FlowSnapshot&) = delete;
+
+    // False, with nothing mapped, for a missing, truncated or corrupt file
+    bool open(const std::string& path);
+    void close();
+    bool is_open() const { return base_ != nullptr; }
+
+    const SnapshotHeader& header() const { return *reinterpret_cast<const SnapshotHeader*>(base_); }
+    std::string name() const;
+    CirculationPattern pattern() const;
+    const uint8_t* content() const { return base_ + header().content_offset; }
+    const uint64_t* bitmap() const { return reinterpret_cast<const uint64_t*>(base_ + header().bitmap_offset); }
+    bool has_chunk(uint32_t index) const;
+    bool complete() const;
+
+private:
+    const uint8_t* base_;
+    size_t size_;
+};
+
+// SnapshotWriter - writes a snapshot file atomically
+//
+// The image goes to a temporary file beside path and replaces path only
+// once it is complete and synced, so a crash leaves the old snapshot or the
+// new one, never a torn mix. Content is appended in order and in pieces, so
+// a flow is never materialized to be saved.
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(const std::string& path);
+    ~SnapshotWriter();   // Discards an image that was not committed
+
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+    // header supplies the flow fields; magic, offsets and checksums are filled in
+    bool begin(const SnapshotHeader& header, const std::string& name, const std::vector<uint64_t>& bitmap);
+    bool append(const void* data, size_t length);
+    bool commit();
+
+private:
+    bool write_at(uint64_t offset, const void* data, size_t length);
+
+    std::string path_;
+    std::string temp_path_;
+    int fd_;
+    SnapshotHeader header_;
+    uint64_t written_;
+    bool failed_;
+};
+
+// Header fields for a flow's circulation pattern
+void snapshot_pattern(const CirculationPattern& pattern, SnapshotHeader& header);
+
+} // namespace nerd
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace nerd {
+
+// GF(2^8) arithmetic over the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11d)
+uint8_t gf_mul(uint8_t a, uint8_t b);
+uint8_t gf_div(uint8_t a, uint8_t b);   // b must be non-zero
+uint8_t gf_inv(uint8_t a);              // a must be non-zero
+
+// dst[i] ^= coefficient * src[i] for length bytes. The region kernel is
+// picked once at startup: AVX2 or SSSE3 nibble-table shuffles where the CPU
+// has them, a table lookup loop otherwise.
+void gf_mul_add(uint8_t* dst, const uint8_t* src, uint8_t coefficient, size_t length);
+
+// "avx2", "ssse3" or "scalar"
+const char* gf_kernel_name();
+
+} // namespace nerd
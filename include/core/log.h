@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+namespace nerd {
+
+enum class LogLevel : uint8_t {
+    DEBUG,
+    INFO,
+    WARN,
+    ERROR
+};
+
+// Rate limit for one call site: at most per_second messages a second, the
+// rest counted and reported with the next one admitted. Declare it static
+// next to the call.
+struct LogSite {
+    uint32_t per_second;
+    std::atomic<uint64_t> window;       // Second the count applies to
+    std::atomic<uint32_t> count;
+    std::atomic<uint64_t> suppressed;
+
+    explicit LogSite(uint32_t rate = 10) : per_second(rate), window(0), count(0), suppressed(0) {}
+};
+
+// Messages below the level are discarded before they are formatted
+void set_log_level(LogLevel level);
+LogLevel log_level();
+bool parse_log_level(const std::string& name, LogLevel& level);
+
+// True if a message at level from site should be written now; suppressed
+// receives the number dropped from site since the last one admitted
+bool log_admit(LogLevel level, LogSite& site, uint64_t& suppressed);
+
+// Hand a formatted line to the writer thread: WARN and above go to stderr,
+// the rest to stdout. Never blocks; a full queue drops the line.
+void log_write(LogLevel level, std::string message, uint64_t suppressed = 0);
+
+// Wait until every line queued so far has been written
+void log_flush();
+
+// Leveled, rate-limited, asynchronous logging: arguments are streamed into
+// the message only once it is admitted, on the calling thread, and written
+// out on the logger's own
+template <typename... Args>
+void log_message(LogLevel level, LogSite& site, const Args&... args) {
+    uint64_t suppressed = 0;
+    if (!log_admit(level, site, suppressed)) {
+        return;
+    }
+    std::ostringstream message;
+    (message << ... << args);
+    log_write(level, message.str(), suppressed);
+}
+
+} // namespace nerd
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace nerd {
+
+// SpillFile - append-only, file-backed byte arena for large flow content
+//
+// Bytes appended are written to an unlinked temporary file and read back
+// through one contiguous read-only mapping, so pointers returned by
+// append() stay valid until reset() and a large flow costs page cache
+// rather than heap. touch() records which RESIDENT_GROUP-sized groups were
+// read recently; once more than the resident budget has been touched, the
+// least recently used groups are dropped from the mapping and fault back in
+// from the file when read again. Thread-safe.
+class SpillFile {
+public:
+    static const size_t RESIDENT_GROUP = size_t(1) << 20;
+
+    // directory holds the backing file; empty means $TMPDIR or /tmp
+    explicit SpillFile(size_t resident_budget = size_t(64) << 20, const std::string& directory = std::string());
+    ~SpillFile();
+
+    SpillFile(const SpillFile&) = delete;
+    SpillFile& operator=(const SpillFile&) = delete;
+
+    // Copy length bytes in; null when the file cannot grow
+    const char* append(const char* data, size_t length);
+
+    // Forget everything appended; no pointer into the arena may be used after
+    void reset();
+
+    // Note a read of [data, data + length), which must lie in the arena
+    void touch(const char* data, size_t length);
+
+    size_t size() const { return size_.load(std::memory_order_relaxed); }
+    size_t resident_groups() const;
+
+private:
+    bool map_through(size_t end);
+    void evict_over_budget();   // mutex_ held
+
+    int fd_;
+    char* base_;                 // RESERVE bytes of address space
+    size_t mapped_;              // Bytes of the reservation backed by the file
+    std::atomic<size_t> size_;
+    size_t budget_groups_;
+
+    // Most recent first; last_group_ skips the lock for repeated reads of one group
+    mutable std::mutex mutex_;
+    std::list<size_t> lru_;
+    std::unordered_map<size_t, std::list<size_t>::iterator> resident_;
+    std::atomic<size_t> last_group_;
+};
+
+} // namespace nerd
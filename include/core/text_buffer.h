@@ -0,0 +1,219 @@
+#pragma once
+
+#include "core/spill_file.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace nerd {
+
+// TextBuffer - rope storage for flow content
+//
+// A treap over text leaves ordered by position. Every node caches the byte
+// and newline counts of its subtree, so locating a byte offset or the start
+// of a line, and splicing there, costs O(log n) plus one leaf. Leaves are
+// cut at line boundaries where possible, so a line is usually one leaf and
+// reading a line range never materializes the whole text.
+//
+// Text inserted through insert_spilled() stays in a SpillFile: its leaves
+// are views into the arena, cut like any other and copied to the heap only
+// once an edit lands inside one, so a large flow keeps little but the tree
+// and the leaves being edited in memory.
+//
+// Line numbering follows std::getline: "a\nb" and "a\nb\n" both hold two
+// lines, and the empty buffer holds none.
+class TextBuffer {
+public:
+    static const size_t npos = static_cast<size_t>(-1);
+
+    TextBuffer();
+    explicit TextBuffer(const std::string& text);
+    ~TextBuffer();
+
+    TextBuffer(const TextBuffer&) = delete;
+    TextBuffer& operator=(const TextBuffer&) = delete;
+
+    // Whole-buffer operations
+    void assign(const std::string& text);
+    void assign(const char* data, size_t length);
+    void clear();
+    std::string to_string() const;
+
+    // Byte-level editing
+    void insert(size_t offset, const std::string& text);
+    void erase(size_t offset, size_t length);
+    void replace(size_t offset, size_t length, const std::string& text);
+    
+    // Insert length bytes that are appended to spill and read from there;
+    // spill must outlive the text. Falls back to the heap if the spill fails.
+    void insert_spilled(size_t offset, const char* data, size_t length, SpillFile& spill);
+    size_t spilled_bytes() const;
+
+    // Byte-level reading
+    size_t size() const;
+    bool empty() const { return size() == 0; }
+    char at(size_t offset) const;
+    char back() const { return at(size() - 1); }
+    std::string substr(size_t offset, size_t length) const;
+    size_t copy(size_t offset, size_t length, char* dest) const;
+    size_t find(const std::string& pattern, size_t from = 0) const;
+
+    // Offsets of every non-overlapping occurrence at or after from, in one pass
+    std::vector<size_t> find_all(const std::string& pattern, size_t from = 0) const;
+
+    // Line index
+    int line_count() const;
+    size_t line_offset(int line) const;  // Start of line, size() past the last
+    size_t newlines_before(size_t offset) const;  // Also the line holding offset
+    std::string line(int index) const;   // Without its newline
+
+    // Line views point into the rope and stay valid until the next edit; a
+    // line that spans two leaves is assembled in scratch instead
+    std::string_view line_view(int index, std::string& scratch) const;
+
+    // Visit lines [first, first + count) as fn(index, std::string_view)
+    template <typename Fn>
+    void for_each_line(int first, int count, Fn&& fn) const;
+
+    // Visit the text in order as fn(const char* data, size_t length)
+    template <typename Fn>
+    void for_each_chunk(Fn&& fn) const {
+        visit(root_.get(), fn);
+    }
+
+private:
+    struct Node;
+    using NodePtr = std::unique_ptr<Node>;
+
+    NodePtr root_;
+    uint64_t seed_;
+
+    uint32_t next_priority();
+    // A spilled leaf views spilled, a copy of data in spill; data is what gets scanned
+    NodePtr make_leaf(const char* data, size_t length, SpillFile* spill = nullptr, const char* spilled = nullptr);
+    NodePtr build(const char* data, size_t length, SpillFile* spill = nullptr, const char* spilled = nullptr);
+
+    static void update(Node* node);
+    static NodePtr merge(NodePtr left, NodePtr right);
+    void split(NodePtr node, size_t offset, NodePtr& left, NodePtr& right);
+    static bool insert_in_leaf(Node* node, size_t offset, const std::string& text);
+    static size_t spilled_bytes(const Node* node);
+    static size_t offset_after_newline(const Node* node, size_t newline);
+    const Node* locate(size_t& offset) const;
+
+    template <typename Fn>
+    static void visit(const Node* node, Fn& fn);
+
+    // Non-overlapping matches of a non-empty pattern from offset from, as
+    // fn(offset); fn returns false to stop
+    template <typename Fn>
+    void scan(const std::string& pattern, size_t from, Fn&& fn) const;
+
+    // Visit [begin, end) as fn(data, length); fn returns false to stop
+    template <typename Fn>
+    static bool visit_range(const Node* node, size_t begin, size_t end, Fn&& fn);
+};
+
+struct TextBuffer::Node {
+    std::string text;         // Owned bytes; empty while the leaf is spilled
+    const char* data;         // The leaf's bytes, in text or in spill
+    size_t length;
+    SpillFile* spill;         // Arena of a spilled leaf, else null
+    size_t text_newlines;
+    uint32_t priority;
+    size_t bytes;       // Subtree totals
+    size_t newlines;
+    NodePtr left;
+    NodePtr right;
+};
+
+template <typename Fn>
+void TextBuffer::visit(const Node* node, Fn& fn) {
+    if (!node) {
+        return;
+    }
+    visit(node->left.get(), fn);
+    if (node->spill) {
+        node->spill->touch(node->data, node->length);
+    }
+    fn(node->data, node->length);
+    visit(node->right.get(), fn);
+}
+
+template <typename Fn>
+void TextBuffer::for_each_line(int first, int count, Fn&& fn) const {
+    int lines = line_count();
+    if (first < 0) {
+        count += first;
+        first = 0;
+    }
+    int last = (count > lines - first) ? lines : first + count;
+    if (first >= last) {
+        return;
+    }
+
+    // One pass over the covering leaves; only lines split across leaves are copied
+    std::string pending;
+    int index = first;
+    visit_range(root_.get(), line_offset(first), line_offset(last), [&](const char* data, size_t length) {
+        const char* stop = data + length;
+        while (data < stop) {
+            const char* newline = static_cast<const char*>(std::memchr(data, '\n', stop - data));
+            if (!newline) {
+                pending.append(data, stop - data);
+                break;
+            }
+            if (pending.empty()) {
+                fn(index, std::string_view(data, newline - data));
+            } else {
+                pending.append(data, newline - data);
+                fn(index, std::string_view(pending));
+                pending.clear();
+            }
+            ++index;
+            data = newline + 1;
+        }
+        return true;
+    });
+
+    // Final line without a trailing newline
+    if (index < last) {
+        fn(index, std::string_view(pending));
+    }
+}
+
+template <typename Fn>
+bool TextBuffer::visit_range(const Node* node, size_t begin, size_t end, Fn&& fn) {
+    if (!node || begin >= end) {
+        return true;
+    }
+
+    size_t left_bytes = node->left ? node->left->bytes : 0;
+    if (begin < left_bytes && !visit_range(node->left.get(), begin, std::min(end, left_bytes), fn)) {
+        return false;
+    }
+
+    size_t text_end = left_bytes + node->length;
+    if (begin < text_end && end > left_bytes) {
+        size_t from = std::max(begin, left_bytes) - left_bytes;
+        size_t to = std::min(end, text_end) - left_bytes;
+        if (node->spill) {
+            node->spill->touch(node->data + from, to - from);
+        }
+        if (!fn(node->data + from, to - from)) {
+            return false;
+        }
+    }
+
+    if (end > text_end) {
+        return visit_range(node->right.get(), begin > text_end ? begin - text_end : 0, end - text_end, fn);
+    }
+    return true;
+}
+
+} // namespace nerd
@@ -5,6 +5,8 @@
 #include <string>
 #include <memory>
 #include <functional>
+#include <istream>
+#include <vector>
 
 namespace nerd {
 
@@ -23,25 +25,32 @@ class FlowEditor {
 private:
     std::unique_ptr<FlowManager> flow_manager_;
     EditorState state_;
+    size_t change_listener_;
     
     // Command parsing
     std::string parse_command(const std::string& input);
+    bool parse_edit_command(const std::string& command, EditCommand& edit) const;
     bool execute_command(const std::string& command);
+    void apply_edit(const EditCommand& edit);
+    void apply_transaction(std::vector<EditCommand>& edits);
     
     // Ed-compatible commands
     void append_to_flow(const std::string& line);
     void delete_from_flow(int start, int end);
     void substitute_in_flow(const std::string& pattern, const std::string& replacement);
     void print_flow_state();
+    void print_stats(bool prometheus);
+    bool configure_pattern(std::istream& args);
+    bool manage_dictionary(std::istream& args);
     void write_pattern_changes();
     
     // Helper functions
-    std::vector<std::string> split_lines(const std::string& content);
-    void print_lines(const std::vector<std::string>& lines, int start, int end);
+    void print_lines(int start, int end);
     bool validate_line_range(int start, int end);
+    bool project_edit(const EditCommand& edit, int& lines) const;
     
 public:
-    FlowEditor();
+    explicit FlowEditor(const std::string& flow_namespace = std::string());
     ~FlowEditor();
     
     // Editor interface
@@ -50,6 +59,11 @@ public:
     void run_interactive();
     void run_command(const std::string& command);
     
+    // Batch mode: consecutive edit commands apply as one transaction and the
+    // flow is re-encoded once at the end. Stops at the first failing line,
+    // applying none of that transaction and writing nothing.
+    bool run_script(std::istream& input);
+    
     // Flow operations
     void append_line(const std::string& line);
     void delete_lines(int start, int end);
@@ -71,12 +85,17 @@ public:
     bool has_current_flow() const { return state_.current_flow != nullptr; }
     
     // Network management
-    bool initialize_network(const std::string& interface);
+    bool initialize_network(const std::vector<std::string>& interfaces);
+    void set_transmit_limits(const TransmitLimits& limits);
+    void set_transport_config(const TransportConfig& config);
+    size_t enable_snapshots(const std::string& directory);
+    void set_metrics_file(const std::string& path);
+    void set_max_flow_length(size_t max_length);
     void discover_flows();
     std::vector<std::string> get_available_flows() const;
     
 private:
-    void handle_content_change(const std::string& new_content);
+    void handle_content_change(const ContentChange& change);
     void update_current_line();
     void set_error(const std::string& error);
     void clear_error();
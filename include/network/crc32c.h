@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace nerd {
+
+// CRC-32C (Castagnoli). Extends crc, the result of a previous call or 0, over
+// length more bytes, so a checksum can be built from several pieces. Uses the
+// SSE4.2 or ARMv8 CRC instructions when the CPU has them, picked at startup.
+uint32_t crc32c(uint32_t crc, const void* data, size_t length);
+
+// "sse4.2", "armv8" or "table"
+const char* crc32c_kernel_name();
+
+} // namespace nerd
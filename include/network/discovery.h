@@ -0,0 +1,86 @@
+#pragma once
+
+#include "network/packet.h"
+#include "network/flow_id.h"
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace nerd {
+
+// FLOW_DISCOVERY payloads start with a DiscoveryHeader naming the message
+// kind and the sending node. Nodes announce a Bloom summary of the flow
+// names they hold instead of one message per flow; a node looking for a flow
+// queries by name only when some summary says a peer may have it, and
+// holders answer with the flow's ID.
+enum DiscoveryKind : uint8_t {
+    DISCOVERY_ANNOUNCE = 1,   // Summary partition of the sender's flows
+    DISCOVERY_QUERY = 2,      // Who holds the named flow?
+    DISCOVERY_FOUND = 3       // The sender holds the named flow
+};
+
+struct DiscoveryHeader {
+    uint8_t kind;
+    uint8_t reserved[3];
+    uint64_t node_id;
+} __attribute__((packed));
+
+// Announce: followed by filter_bits / 8 bytes of Bloom filter. Flows are
+// split over partition_count partitions by key so each fits one frame;
+// generation changes whenever the announced flow set does.
+struct AnnounceRecord {
+    uint64_t generation;
+    uint32_t flow_count;        // Flows in this partition
+    uint16_t partition;
+    uint16_t partition_count;
+    uint32_t filter_bits;       // Multiple of 64
+    uint8_t hash_count;
+    uint8_t reserved[3];
+} __attribute__((packed));
+
+// Query and found: followed by name_length bytes of flow name. name_key is
+// flow_name_key() of the name in the sender's namespace, so nodes in other
+// namespaces ignore the message.
+struct FlowNameRecord {
+    uint64_t name_key;
+    FlowID flow_id;             // 0 in queries
+    uint16_t name_length;
+} __attribute__((packed));
+
+// Bloom filter over 64-bit keys using double hashing
+class BloomFilter {
+public:
+    BloomFilter() : hash_count_(0) {}
+    BloomFilter(uint32_t bits, uint8_t hash_count);
+
+    // Filter sized for count keys at about bits_per_key bits each, at most max_bits
+    static BloomFilter for_keys(size_t count, size_t bits_per_key, size_t max_bits);
+
+    void insert(uint64_t key);
+    bool may_contain(uint64_t key) const;
+
+    uint32_t bit_count() const { return static_cast<uint32_t>(words_.size() * 64); }
+    uint8_t hash_count() const { return hash_count_; }
+    const std::vector<uint64_t>& words() const { return words_; }
+    void assign(const uint8_t* data, uint32_t bits, uint8_t hash_count);
+
+private:
+    std::vector<uint64_t> words_;
+    uint8_t hash_count_;
+};
+
+// Largest FLOW_DISCOVERY payload, so every message fits one frame
+constexpr size_t DISCOVERY_MAX_PAYLOAD = 1400;
+
+// Announce payloads covering keys, one per partition
+std::vector<std::vector<uint8_t>> encode_announce(uint64_t node_id, uint64_t generation,
+                                                  const std::vector<uint64_t>& keys);
+std::vector<uint8_t> encode_flow_name(DiscoveryKind kind, uint64_t node_id, uint64_t name_key,
+                                      const std::string& name, FlowID flow_id);
+
+bool decode_discovery_header(const RawPacket& packet, DiscoveryHeader& header);
+bool decode_announce(const RawPacket& packet, AnnounceRecord& record, BloomFilter& filter);
+bool decode_flow_name(const RawPacket& packet, FlowNameRecord& record, std::string& name);
+
+} // namespace nerd
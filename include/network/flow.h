@@ -1,6 +1,17 @@
 #pragma once
 
 #include "network/packet.h"
+#include "network/transport.h"
+#include "network/tx_queue.h"
+#include "network/timer_wheel.h"
+#include "network/flow_table.h"
+#include "network/mpsc_queue.h"
+#include "network/nack.h"
+#include "network/rate_limiter.h"
+#include "network/heartbeat.h"
+#include "network/metrics.h"
+#include <array>
+#include <deque>
 #include <vector>
 #include <map>
 #include <memory>
@@ -8,85 +19,293 @@
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
+#include <functional>
 
 namespace nerd {
 
-// Circulation pattern - defines how data flows through the network
-struct CirculationPattern {
-    FlowID id;
-    std::string name;
-    std::vector<std::string> nodes;  // Network nodes in the circulation path
-    uint32_t circulation_rate;       // Packets per second to maintain flow
-    uint32_t max_packet_age;         // Maximum age of packets in microseconds
-    bool auto_sustain;               // Whether to automatically sustain the flow
-    
-    CirculationPattern() : id(0), circulation_rate(10), max_packet_age(30000000), auto_sustain(true) {}
-};
-
-// Network node information
-struct NetworkNode {
-    std::string address;
-    uint16_t port;
-    std::string interface;
-    bool is_local;
-    
-    NetworkNode() : port(0), is_local(false) {}
-};
-
 // NetworkFlow class - manages active streams and circulation patterns
+//
+// Flows are sharded by FlowID hash. Each shard owns its streams, patterns
+// and timer wheel and is driven by its own circulation worker pinned to a
+// core, so flows on different shards never contend. Producers (the receive
+// thread, FlowFile encoders) hand packets to the owning shard through its
+// lock-free ingress queue and the worker applies them in batches. Lock order
+// inside a shard is mutex, then timers_mutex.
+//
+// Each auto-sustained flow sends circulation_rate packets per second, one
+// per maintenance tick: a heartbeat at least once a second and otherwise its
+// stored packets in rotation. Ticks are phased by flow hash so flows spread
+// across the interval instead of firing together. Their stored packets
+// never age and are stamped as they go out; other flows' packets expire
+// through one sweep per flow rather than a timer each. Every frame, circulation
+// or not, draws on the interface-wide transmit budget before it is sent.
+// A shard's heartbeats are held for up to HEARTBEAT_COALESCE_US and go out
+// packed into as few FLOW_HEARTBEAT frames as the transports' frame size
+// allows; received ones update the flow's liveness instead of being stored.
 class NetworkFlow {
+public:
+    struct IngressStats {
+        uint64_t enqueued;      // Packets handed to a shard worker
+        uint64_t dropped;       // Received packets rejected by a full shard queue
+        uint64_t fallbacks;     // Local packets stored directly instead
+        uint64_t corrupt;       // Frames dropped on the ring for a bad header or checksum
+    };
+    
+    struct RetransmitStats {
+        uint64_t nacks_received;
+        uint64_t packets_resent;
+        uint64_t packets_throttled;   // Requested but over the flow's resend budget
+    };
+    
+    struct CirculationStats {
+        uint64_t heartbeats;          // Flows advertised
+        uint64_t heartbeat_frames;    // Aggregated frames that carried them
+        uint64_t refreshes;           // Stored packets re-sent in rotation
+        uint64_t deferred;            // Ticks pushed back by the transmit budget
+    };
+    
+    struct TrafficStats {
+        uint64_t rx_packets;          // Flow frames read off the ring
+        uint64_t rx_bytes;
+        uint64_t rx_dropped;          // Frames the transport lost before delivery, e.g. a full kernel ring
+        uint64_t tx_packets;          // Frames queued for transmission
+        uint64_t tx_bytes;
+        uint64_t tx_dropped;          // Frames too large for a transmit slot or refused by the kernel
+    };
+    
+    static const size_t INGRESS_CAPACITY = 4096;
+    static const size_t INGRESS_BATCH = 64;
+    
+    // Per-flow resend budget: sustained packets per second and burst size
+    static const uint32_t RESEND_RATE = 4096;
+    static const uint32_t RESEND_BURST = 1024;
+    
+    // Longest a heartbeat waits for others to share its frame
+    static const uint64_t HEARTBEAT_COALESCE_US = 50000;
+    
+    // Latest heartbeat heard from a peer for a flow held here
+    struct FlowLiveness {
+        uint64_t last_heard_us;
+        uint32_t sequence;
+        uint64_t version;
+    };
+    
+    using PacketHandler = std::function<void(const RawPacket&)>;
+    using HeartbeatHandler = std::function<void(const HeartbeatRecord&)>;
+    
 private:
-    std::vector<std::unique_ptr<PacketStream>> active_streams_;
-    std::map<FlowID, CirculationPattern> flow_patterns_;
-    std::map<FlowID, std::vector<NetworkNode>> circulation_paths_;
+    struct Shard {
+        // Streams and patterns, one record per flow
+        FlowTable flows;
+        mutable std::mutex mutex;
+        uint64_t next_generation;
+        
+        // Per-flow expiry sweeps, maintenance ticks and NACK answers
+        TimerWheel timers;
+        std::mutex timers_mutex;
+        std::condition_variable cv;
+        std::thread worker;
+        
+        // Packets waiting for the worker; idle is set while it sleeps
+        MpscQueue<RawPacket> ingress;
+        std::atomic<bool> idle;
+        std::atomic<uint64_t> fallbacks;
+        std::atomic<uint64_t> dropped;    // Received packets only; local ones fall back
+        
+        // Frames waiting for the interface budget, by the time their credit
+        // comes due; guarded by timers_mutex, and paced_wakeup tells a
+        // sleeping worker the front moved
+        std::deque<std::pair<uint64_t, RawPacket>> paced;
+        bool paced_wakeup;
+        
+        // Heartbeats waiting to share a frame, sent by heartbeat_flush_us
+        std::mutex heartbeat_mutex;
+        std::vector<HeartbeatRecord> heartbeats;
+        uint64_t heartbeat_flush_us;
+        
+        // Written by the shard's own worker, and by anyone taking its lock
+        Histogram tick_ns;            // Wall time of circulation ticks that had work
+        Histogram lock_wait_ns;       // Time spent waiting for the shard mutex
+        Histogram reorder_depth;      // How far behind the newest sequence a received packet landed
+        
+        Shard()
+            : next_generation(0), ingress(INGRESS_CAPACITY), idle(false), fallbacks(0), dropped(0), paced_wakeup(false),
+              heartbeat_flush_us(0) {}
+    };
     
-    // Threading for flow maintenance
-    std::thread circulation_thread_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::map<FlowID, std::vector<NetworkNode>> circulation_paths_;
     std::atomic<bool> running_;
-    mutable std::mutex streams_mutex_;
-    mutable std::mutex patterns_mutex_;
-    std::condition_variable circulation_cv_;
     
-    // Raw socket for packet injection
-    int raw_socket_;
-    std::string interface_name_;
+    // Where frames are sent and received: one queue per transport, each
+    // polled by its own receive thread. A flow's frames all leave through
+    // the same queue, so they keep their order on the wire.
+    struct Queue {
+        std::unique_ptr<Transport> transport;
+        std::thread receive_thread;
+        std::atomic<uint64_t> rx_packets;
+        
+        explicit Queue(std::unique_ptr<Transport> t) : transport(std::move(t)), rx_packets(0) {}
+    };
+    std::vector<std::unique_ptr<Queue>> queues_;
+    
+    // Records per heartbeat frame and ranges per NACK, so a frame fits the
+    // smallest max_frame() of the attached transports
+    size_t heartbeat_records_;
+    size_t nack_ranges_;
+    TxQueueConfig tx_config_;
+    TransportConfig transport_config_;
+    
+    // Received FLOW_EDIT deltas go here instead of into a stream;
+    // received FLOW_DATA chunks go here as well as into the stream, unless
+    // the flow has a chunk source
+    PacketHandler edit_handler_;
+    PacketHandler data_handler_;
+    PacketHandler discovery_handler_;
+    HeartbeatHandler heartbeat_handler_;
+    
+    std::atomic<uint64_t> corrupt_frames_;
+    
+    // Selective retransmission counters
+    std::atomic<uint64_t> nacks_received_;
+    std::atomic<uint64_t> packets_resent_;
+    std::atomic<uint64_t> packets_throttled_;
+    
+    // Interface-wide budget, and circulation counters
+    RateLimiter tx_limiter_;
+    std::atomic<uint64_t> heartbeats_sent_;
+    std::atomic<uint64_t> heartbeat_frames_;
+    std::atomic<uint64_t> refreshes_sent_;
+    
+    // Traffic through the ring and the transmit queue
+    Counter rx_packets_;
+    Counter rx_bytes_;
+    Counter tx_packets_;
+    Counter tx_bytes_;
+    Counter tx_dropped_;
     
 public:
-    NetworkFlow();
+    // shard_count 0 uses one shard per hardware thread
+    explicit NetworkFlow(size_t shard_count = 0);
     ~NetworkFlow();
     
-    // Flow management
+    // Flow management. inject_packet() stores the packet in its flow's stream
+    // and sends it; broadcast_packet() only sends it. Both wait out the
+    // transmit budget on the caller's thread, for bulk sends such as encodes,
+    // so callers must not hold locks the flow's readers need.
     void inject_packet(const RawPacket& packet);
+    void broadcast_packet(const RawPacket& packet);
+    void transmit_packet(const RawPacket& packet);
+    
+    // Ask holders of flow_id to resend the given sorted sequences; with
+    // since_version, only the chunks among them that are newer than it.
+    // Each holder answers after a random delay and leaves out the chunks
+    // another holder resent meanwhile.
+    void request_retransmit(FlowID flow_id, const std::vector<uint32_t>& missing, uint64_t since_version = 0);
     void modify_flow_pattern(FlowID id, const CirculationPattern& new_pattern);
     void sustain_circulation();
     
     // Stream management
     void add_stream(FlowID flow_id);
     void remove_stream(FlowID flow_id);
-    PacketStream* get_stream(FlowID flow_id);
+    
+    // A holder that keeps the flow's content serves its chunks instead of
+    // the stream: refreshes and NACK answers are built on demand from source,
+    // and received chunks of the flow are no longer stored
+    void set_chunk_source(FlowID flow_id, std::shared_ptr<ChunkSource> source);
+    
+    // Content version advertised in the flow's heartbeats and, for a chunk
+    // source, how many chunks it serves
+    void set_flow_version(FlowID flow_id, uint64_t version, uint32_t chunks = 0);
+    bool flow_liveness(FlowID flow_id, FlowLiveness& liveness) const;
     
     // Pattern management
     void add_circulation_pattern(const CirculationPattern& pattern);
     void remove_circulation_pattern(FlowID id);
-    CirculationPattern* get_pattern(FlowID id);
     
-    // Network interface
+    // Network interfaces: the configured transports on interface, or any
+    // other transport, such as a LoopbackHub port; each call adds queues,
+    // all before start_circulation(). Interfaces are expected to reach the
+    // same peers, as the ports of one fabric do.
     bool initialize_interface(const std::string& interface);
+    void attach_transport(std::unique_ptr<Transport> transport);
     void close_interface();
+    void set_tx_config(const TxQueueConfig& config) { tx_config_ = config; }
+    void set_transport_config(const TransportConfig& config) { transport_config_ = config; }
+    void set_transmit_limits(const TransmitLimits& limits);
+    TransmitLimits transmit_limits() const { return tx_limiter_.limits(); }
+    void flush_transmit();
+    
+    // Called on the receive thread; set before start_circulation(). The data
+    // handler sees FLOW_DATA and FLOW_PARITY; the heartbeat handler sees each
+    // flow's record out of an aggregated FLOW_HEARTBEAT.
+    void set_edit_handler(PacketHandler handler) { edit_handler_ = std::move(handler); }
+    void set_data_handler(PacketHandler handler) { data_handler_ = std::move(handler); }
+    void set_discovery_handler(PacketHandler handler) { discovery_handler_ = std::move(handler); }
+    void set_heartbeat_handler(HeartbeatHandler handler) { heartbeat_handler_ = std::move(handler); }
     
     // Circulation control
     void start_circulation();
     void stop_circulation();
     
     // Discovery
-    void discover_flows();
     std::vector<FlowID> get_active_flows() const;
+    size_t shard_count() const { return shards_.size(); }
+    IngressStats ingress_stats() const;
+    RetransmitStats retransmit_stats() const;
+    CirculationStats circulation_stats() const;
+    TrafficStats traffic_stats() const;
+    
+    // Distributions merged across shards
+    HistogramSnapshot tick_histogram() const;
+    HistogramSnapshot lock_wait_histogram() const;
+    HistogramSnapshot reorder_histogram() const;
+    
+    // Every counter above, per shard and per flow, in Prometheus text format
+    void render_metrics(MetricsText& out) const;
     
 private:
-    void circulation_worker();
+    Shard& shard_for(FlowID flow_id) const;
+    std::unique_lock<std::mutex> lock_shard(Shard& shard) const;
+    void circulation_worker(Shard& shard);
+    void receive_worker(Queue& queue);
+    void store_packet(const RawPacket& packet);
+    bool enqueue_packet(const RawPacket& packet);
+    void drain_ingress(Shard& shard);
+    void apply_packet(Shard& shard, const RawPacket& packet);
+    
+    // Every frame goes out through send_raw_packet(), which reserves its
+    // credit and, when the interface budget is short, leaves it to the flow's
+    // shard worker to send once that credit is due; it never blocks, so the
+    // receive threads may use it. transmit_now() is the send itself.
     bool send_raw_packet(const RawPacket& packet);
-    void handle_incoming_packet(const RawPacket& packet);
-    void maintain_flow_pattern(FlowID flow_id);
+    bool transmit_now(const RawPacket& packet);
+    void defer_packet(const RawPacket& packet, uint64_t due);
+    void send_paced(Shard& shard, bool all);
+    
+    // Received frames go to receive_frame<Type>, looked up by packet type in
+    // a table built at compile time. A frame is a validated ring slot;
+    // scratch is the worker's packet, for types whose handlers want one.
+    using FrameReceiver = void (NetworkFlow::*)(const uint8_t* frame, uint64_t received_at, RawPacket& scratch);
+    template <PacketType Type>
+    void receive_frame(const uint8_t* frame, uint64_t received_at, RawPacket& scratch);
+    static constexpr std::array<FrameReceiver, 256> make_receive_table();
+    
+    bool next_refresh_packet(FlowRecord& record, RawPacket& packet, std::shared_ptr<ChunkSource>& source);
+    bool materialize(ChunkSource& source, uint32_t sequence, uint64_t since_version, RawPacket& packet);
+    void queue_heartbeats(Shard& shard, const std::vector<HeartbeatRecord>& heartbeats, uint64_t now);
+    void send_heartbeats(const std::vector<HeartbeatRecord>& heartbeats);
+    
+    // Timer wheel scheduling, always on the flow's own shard
+    void sustain_shard(Shard& shard);
+    void schedule_event(Shard& shard, const TimerEvent& event);
+    void schedule_maintenance(Shard& shard, FlowID flow_id, uint64_t generation, uint64_t deadline);
+    void handle_timer_event(Shard& shard, const TimerEvent& event, uint64_t now, std::vector<HeartbeatRecord>& heartbeats);
+    void arm_expiry(Shard& shard, FlowRecord& record, uint64_t deadline);
+    void expire_packets(Shard& shard, const TimerEvent& event, uint64_t now);
+    void answer_nack(Shard& shard, const TimerEvent& event, uint64_t now);
+    void stop_sustaining(Shard& shard, FlowRecord& record, bool was_sustained);
+    void release_if_unused(Shard& shard, FlowRecord& record);
 };
 
 } // namespace nerd
\ No newline at end of file
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "core/flow_file.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace nerd {
+
+// FlowCache - concurrent name -> FlowID -> FlowFile index of open flows
+//
+// Owns the open FlowFiles. Names and IDs hash to separate lock stripes, so
+// opens, lookups and the receive thread's per-packet routing only contend
+// when they land on the same stripe. A file leaves both indexes before
+// erase() hands it back, and with_flow() holds the ID stripe for the whole
+// callback, so a packet is never routed to a file that is being closed.
+class FlowCache {
+public:
+    struct Entry {
+        FlowID id;
+        uint64_t key;        // flow_name_key() of the name
+        FlowFile* file;
+    };
+
+    FlowCache() : size_(0) {}
+
+    FlowCache(const FlowCache&) = delete;
+    FlowCache& operator=(const FlowCache&) = delete;
+
+    // False, keeping file out, when the name or the ID is already present
+    bool insert(const std::string& name, uint64_t key, std::unique_ptr<FlowFile> file);
+
+    // The file under name, out of both indexes; null when absent
+    std::unique_ptr<FlowFile> erase(const std::string& name);
+
+    FlowFile* find(const std::string& name) const;
+    bool lookup(const std::string& name, Entry& entry) const;
+    bool contains_id(FlowID id) const;
+
+    // fn(FlowFile&) with the ID's stripe held; false when no flow has the ID
+    template <typename Fn>
+    bool with_flow(FlowID id, Fn&& fn) const;
+
+    // fn(name, entry) for every flow, one name stripe held at a time
+    template <typename Fn>
+    void for_each(Fn&& fn) const;
+
+    size_t size() const { return size_.load(std::memory_order_relaxed); }
+
+private:
+    static const size_t STRIPES = 16;
+
+    struct Slot {
+        FlowID id;
+        uint64_t key;
+        std::unique_ptr<FlowFile> file;
+    };
+
+    struct NameStripe {
+        alignas(64) mutable std::mutex mutex;
+        std::unordered_map<std::string, Slot> flows;
+    };
+    struct IdStripe {
+        alignas(64) mutable std::mutex mutex;
+        std::unordered_map<FlowID, FlowFile*> flows;
+    };
+
+    NameStripe& name_stripe(const std::string& name) const;
+    IdStripe& id_stripe(FlowID id) const;
+
+    // Lock order: name stripe before ID stripe
+    mutable std::array<NameStripe, STRIPES> names_;
+    mutable std::array<IdStripe, STRIPES> ids_;
+    std::atomic<size_t> size_;
+};
+
+template <typename Fn>
+bool FlowCache::with_flow(FlowID id, Fn&& fn) const {
+    IdStripe& stripe = id_stripe(id);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto it = stripe.flows.find(id);
+    if (it == stripe.flows.end()) {
+        return false;
+    }
+    fn(*it->second);
+    return true;
+}
+
+template <typename Fn>
+void FlowCache::for_each(Fn&& fn) const {
+    for (const NameStripe& stripe : names_) {
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+        for (const auto& flow : stripe.flows) {
+            Entry entry = {flow.second.id, flow.second.key, flow.second.file.get()};
+            fn(flow.first, entry);
+        }
+    }
+}
+
+} // namespace nerd
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "network/packet.h"
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace nerd {
+
+// Fast 64-bit hash of length bytes: 16 bytes per round folded through a
+// 64x64->128 multiply. Stable across nodes and builds, so it may name
+// things on the wire.
+uint64_t hash_bytes(const void* data, size_t length, uint64_t seed);
+
+// Key of name within flow_namespace, shared by every node in that namespace.
+// Discovery summaries and queries carry it, and FlowIDs are derived from it.
+uint64_t flow_name_key(const std::string& flow_namespace, const std::string& name);
+
+// Candidate FlowID number attempt for the flow with name_key. Every node
+// derives the same sequence; attempt 0 is the ID unless a different name
+// already holds it. Never 0, which discovery traffic uses.
+FlowID derive_flow_id(uint64_t name_key, uint32_t attempt = 0);
+
+} // namespace nerd
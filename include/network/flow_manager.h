@@ -2,12 +2,16 @@
 
 #include "core/flow_file.h"
 #include "network/flow.h"
+#include "network/discovery.h"
+#include "network/flow_cache.h"
+#include <condition_variable>
 #include <map>
 #include <memory>
 #include <string>
 #include <vector>
 #include <thread>
 #include <atomic>
+#include <mutex>
 
 namespace nerd {
 
@@ -23,19 +27,56 @@ struct NetworkTopology {
 // FlowManager class - manages active files and network topology
 class FlowManager {
 private:
-    std::map<std::string, std::unique_ptr<FlowFile>> active_files_;
     NetworkTopology topology_;
+    
+    // Open flows by name for the editor and discovery, and by ID for routing
+    // received packets; declared before network_flow_ so the files outlive
+    // the receive thread
+    std::string namespace_;
+    FlowCache flows_;
+    std::atomic<uint64_t> announce_generation_;   // Bumped whenever the open flow set changes
+    
+    // Flow directory built from peers' announcements and query answers
+    struct PeerSummary {
+        uint64_t generation;
+        std::vector<BloomFilter> partitions;
+        uint64_t last_seen_us;
+    };
+    struct RemoteFlow {
+        FlowID flow_id;
+        uint64_t node_id;
+        uint64_t seen_us;
+    };
+    uint64_t node_id_;
+    std::map<uint64_t, PeerSummary> peers_;
+    std::map<std::string, RemoteFlow> remote_flows_;
+    std::mutex directory_mutex_;
+    std::condition_variable directory_cv_;
+    
     std::unique_ptr<NetworkFlow> network_flow_;
     
-    // Flow discovery and maintenance
+    // Local snapshots, one file per flow. The mutex is held while flows are
+    // saved or maintained outside the cache, so none is closed under them.
+    std::string snapshot_dir_;
+    std::mutex snapshot_mutex_;
+    
+    // Prometheus textfile rewritten every announce round; empty for none
+    std::string metrics_file_;
+    
+    // Largest copy of a flow accepted from peers
+    size_t max_flow_length_;
+    
+    // Flow discovery and maintenance; the worker sleeps on worker_cv_ so
+    // shutdown does not wait out an announce interval
     std::thread discovery_thread_;
     std::atomic<bool> running_;
-    
-    // Flow ID generation
-    std::atomic<FlowID> next_flow_id_;
+    std::mutex worker_mutex_;
+    std::condition_variable worker_cv_;
+    bool announce_requested_;         // Flow set changed; announce before the interval ends
     
 public:
-    FlowManager();
+    // Flows are named within flow_namespace; only nodes sharing it see each other's flows
+    explicit FlowManager(const std::string& flow_namespace = std::string());
     ~FlowManager();
     
     // File management
@@ -44,11 +85,26 @@ public:
     void create_circulation_pattern(const std::string& name);
     void sustain_all_flows();
     
-    // Network management
-    bool initialize_network(const std::string& interface);
+    // Network management; false unless at least one interface came up
+    bool initialize_network(const std::vector<std::string>& interfaces);
     void handle_topology_change();
     void discover_network_topology();
     
+    // Warm start: restore every flow of this namespace saved in directory,
+    // then keep their snapshots there current. Call before initialize_network.
+    // Returns the number of flows restored.
+    size_t enable_snapshots(const std::string& directory);
+    void save_snapshots();
+    
+    // Engine and directory metrics in Prometheus text format, and a file to
+    // keep them in for a textfile collector. Call before initialize_network.
+    std::string render_metrics();
+    void set_metrics_file(const std::string& path) { metrics_file_ = path; }
+    
+    // Peers' copies announcing more bytes than this are refused; applies to
+    // flows opened or restored afterwards
+    void set_max_flow_length(size_t max_length) { max_flow_length_ = max_length; }
+    
     // Flow discovery
     std::vector<std::string> discover_existing_flows();
     bool connect_to_flow(const std::string& flow_name);
@@ -58,17 +114,28 @@ public:
     std::vector<std::string> get_active_flow_names() const;
     FlowFile* get_flow(const std::string& name);
     
-    // Flow ID management
-    FlowID generate_flow_id() { return next_flow_id_++; }
+    // Flow ID management: IDs derive from the namespaced name, probing past
+    // IDs that a different local or known remote flow already holds
+    FlowID flow_id_for(const std::string& flow_name);
+    const std::string& flow_namespace() const { return namespace_; }
     
     // Network flow access
     NetworkFlow* network_flow() { return network_flow_.get(); }
     
 private:
+    FlowFile* register_flow(FlowID flow_id, const std::string& flow_name, const FlowSnapshot* snapshot = nullptr);
+    std::string snapshot_path(uint64_t name_key) const;
     void discovery_worker();
     void maintain_flow_circulation();
-    void handle_flow_discovery_response(const RawPacket& packet);
-    void broadcast_flow_existence(const std::string& flow_name);
+    void handle_discovery_packet(const RawPacket& packet);
+    void handle_announce(const DiscoveryHeader& header, const RawPacket& packet);
+    void answer_query(const RawPacket& packet);
+    void record_found(const DiscoveryHeader& header, const RawPacket& packet);
+    void route_packet(const RawPacket& packet);
+    void announce_flows();
+    void request_announce();
+    void expire_peers();
+    void send_discovery(const std::vector<uint8_t>& payload);
     bool validate_flow_name(const std::string& name) const;
 };
 
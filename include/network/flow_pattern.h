@@ -0,0 +1,38 @@
+#pragma once
+
+#include "network/packet.h"
+#include <string>
+#include <vector>
+
+namespace nerd {
+
+// Circulation pattern - defines how data flows through the network
+struct CirculationPattern {
+    FlowID id;
+    std::string name;
+    std::vector<std::string> nodes;  // Network nodes in the circulation path
+    uint32_t circulation_rate;       // Packets per second to maintain flow
+    uint32_t max_packet_age;         // Maximum age of packets in microseconds
+    bool auto_sustain;               // Whether to automatically sustain the flow
+    uint8_t fec_data_chunks;         // Data chunks per FEC group, 0 disables FEC
+    uint8_t fec_parity_chunks;       // Parity packets sent with each group
+    uint8_t codec;                   // ChunkCodec for FLOW_DATA chunks, 0 sends them raw
+    uint16_t dictionary;             // Shared zstd dictionary of the flow family, 0 for none
+    
+    CirculationPattern() : id(0), circulation_rate(10), max_packet_age(30000000), auto_sustain(true),
+                           fec_data_chunks(0), fec_parity_chunks(0), codec(0), dictionary(0) {}
+    
+    bool has_fec() const { return fec_data_chunks != 0 && fec_parity_chunks != 0; }
+};
+
+// Network node information
+struct NetworkNode {
+    std::string address;
+    uint16_t port;
+    std::string interface;
+    bool is_local;
+    
+    NetworkNode() : port(0), is_local(false) {}
+};
+
+} // namespace nerd
\ No newline at end of file
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "network/packet.h"
+#include "network/flow_pattern.h"
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace nerd {
+
+// Builds a flow's FLOW_DATA chunks from content its holder keeps itself, so
+// the stream need not pin them: chunk sequence newer than since_version (any,
+// for 0), or false if there is none or the holder is busy. Called without a
+// shard lock; the mutex is held across each call, so a holder clearing the
+// function also waits out a call in progress.
+struct ChunkSource {
+    using Materializer = std::function<bool(uint32_t sequence, uint64_t since_version, RawPacket& packet)>;
+    
+    std::mutex mutex;
+    Materializer materialize;
+};
+
+// Everything NetworkFlow tracks for one flow, kept in a single record
+struct FlowRecord {
+    FlowID id;
+    std::unique_ptr<PacketStream> stream;   // Resident packets, null until the first packet
+    CirculationPattern pattern;
+    uint64_t pattern_generation;            // 0 while the flow has no pattern
+    
+    // Set while a local holder serves the flow's chunks, sequences below
+    // source_chunks; its stream then stays empty
+    std::shared_ptr<ChunkSource> source;
+    uint32_t source_chunks;
+
+    // Token bucket bounding NACK-driven resends
+    uint32_t resend_tokens;
+    uint64_t resend_refill_us;
+    
+    // NACK answers wait out a random delay so the flow's holders do not all
+    // resend the same chunks: the sorted sequences asked for that no other
+    // holder has resent yet, and when they go out (0 while none is armed).
+    // A chunk source filters at answer time, by the oldest since_version asked.
+    std::vector<uint32_t> nack_pending;
+    uint64_t nack_since;
+    uint64_t nack_due_us;
+    
+    // Circulation: next stored packet to refresh, when the last heartbeat
+    // went out, and the content version it advertises
+    uint32_t refresh_cursor;
+    uint64_t last_heartbeat_us;
+    uint64_t version;
+    
+    // Expiry of an unsustained flow's packets, which are stamped with their
+    // local arrival: when the flow's one sweep is armed for (0 while none
+    // is), and when it last stopped being sustained, which restarts every age
+    uint64_t expire_due_us;
+    uint64_t sustain_end_us;
+    
+    // Liveness: the latest heartbeat a peer sent for this flow
+    uint64_t heard_us;
+    uint32_t heard_sequence;
+    uint64_t heard_version;
+    
+    // Traffic: new packets the stream took, duplicates and rejects aside,
+    // and packets resent on request
+    uint64_t packets_in;
+    uint64_t bytes_in;
+    uint64_t packets_resent;
+
+    FlowRecord()
+        : id(0), pattern_generation(0), source_chunks(0), resend_tokens(0), resend_refill_us(0), nack_since(0),
+          nack_due_us(0), refresh_cursor(0), last_heartbeat_us(0), version(0), expire_due_us(0), sustain_end_us(0),
+          heard_us(0), heard_sequence(0), heard_version(0), packets_in(0), bytes_in(0), packets_resent(0) {}
+
+    bool has_pattern() const { return pattern_generation != 0; }
+};
+
+// splitmix64 finalizer: sequential IDs spread across every bit of the result.
+// FlowTable indexes with the low bits, NetworkFlow picks shards from the high bits.
+inline uint64_t flow_hash(FlowID id) {
+    uint64_t x = id;
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// FlowTable - open-addressing FlowID -> FlowRecord map
+//
+// Linear probing over a power-of-two slot array with backward-shift
+// deletion, so lookups touch a handful of adjacent records and there are
+// no tombstones. Record addresses change when the table grows; streams
+// are heap-allocated and stay put.
+class FlowTable {
+private:
+    struct Slot {
+        bool used;
+        FlowRecord record;
+
+        Slot() : used(false) {}
+    };
+
+    std::vector<Slot> slots_;
+    size_t mask_;
+    size_t size_;
+
+    static size_t hash(FlowID id) { return static_cast<size_t>(flow_hash(id)); }
+    size_t probe(FlowID id) const;
+    void grow();
+
+public:
+    explicit FlowTable(size_t initial_capacity = 16);
+
+    FlowRecord* find(FlowID id);
+    const FlowRecord* find(FlowID id) const;
+    FlowRecord& find_or_insert(FlowID id);
+    bool erase(FlowID id);
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    template <typename Fn>
+    void for_each(Fn&& fn) {
+        for (auto& slot : slots_) {
+            if (slot.used) {
+                fn(slot.record);
+            }
+        }
+    }
+
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for (const auto& slot : slots_) {
+            if (slot.used) {
+                fn(slot.record);
+            }
+        }
+    }
+};
+
+} // namespace nerd
\ No newline at end of file
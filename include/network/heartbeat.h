@@ -0,0 +1,30 @@
+#pragma once
+
+#include "network/packet.h"
+#include <cstdint>
+#include <cstddef>
+
+namespace nerd {
+
+// One flow's entry in an aggregated heartbeat: the sender holds chunks below
+// sequence of the flow whose content it last saw at version
+struct HeartbeatRecord {
+    FlowID flow_id;
+    uint32_t sequence;
+    uint64_t version;
+} __attribute__((packed));
+
+// FLOW_HEARTBEAT payload: a record count followed by that many
+// HeartbeatRecords. The frame's own flow_id is 0; one frame speaks for every
+// flow a circulation tick covered.
+struct HeartbeatHeader {
+    uint16_t record_count;
+    uint16_t reserved;
+} __attribute__((packed));
+
+// Largest heartbeat payload, a full 1500-byte Ethernet frame; transports
+// with less room get fewer records per frame. Encoded and decoded through
+// PacketCodec<FLOW_HEARTBEAT>
+constexpr size_t HEARTBEAT_MAX_PAYLOAD = 1500 - sizeof(FlowPacketHeader);
+
+} // namespace nerd
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "network/transport.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+namespace nerd {
+
+// Simulated segment parameters
+struct LoopbackConfig {
+    uint32_t latency_us;        // One-way delay added to every frame
+    uint32_t queue_frames;      // Frames a port holds before it drops
+    uint32_t frame_size;        // Largest frame carried, flow header included
+
+    LoopbackConfig() : latency_us(0), queue_frames(4096), frame_size(2048) {}
+};
+
+class LoopbackTransport;
+
+// LoopbackHub - an in-process broadcast segment
+//
+// Every transport attached to the hub receives the frames the others send,
+// serialized and checked exactly as on a real wire, so several NetworkFlow
+// nodes can exchange traffic in one process without root or a NIC. The hub
+// must outlive its transports. Thread-safe.
+class LoopbackHub {
+public:
+    explicit LoopbackHub(const LoopbackConfig& config = LoopbackConfig());
+
+    LoopbackHub(const LoopbackHub&) = delete;
+    LoopbackHub& operator=(const LoopbackHub&) = delete;
+
+    std::unique_ptr<LoopbackTransport> attach();
+    const LoopbackConfig& config() const { return config_; }
+
+private:
+    friend class LoopbackTransport;
+
+    void detach(LoopbackTransport* port);
+    bool broadcast(const LoopbackTransport* sender, const RawPacket& packet);
+
+    LoopbackConfig config_;
+    std::shared_mutex ports_mutex_;
+    std::vector<LoopbackTransport*> ports_;
+};
+
+// LoopbackTransport - one node's port on a LoopbackHub
+//
+// Received frames wait in a bounded ring of fixed-size slots until their
+// delivery time; a full ring drops new frames and counts them.
+class LoopbackTransport : public Transport {
+public:
+    ~LoopbackTransport() override;
+
+    bool send(const RawPacket& packet) override;
+    void flush() override {}
+    bool can_receive() const override { return true; }
+    size_t poll(int timeout_ms, const FrameHandler& handler) override;
+    uint64_t receive_drops() override { return drops_.load(std::memory_order_relaxed); }
+
+private:
+    friend class LoopbackHub;
+
+    explicit LoopbackTransport(LoopbackHub& hub);
+    void deliver(const uint8_t* frame, size_t length, uint64_t deliver_at);
+
+    LoopbackHub& hub_;
+    size_t slot_size_;
+
+    // Slot i holds a frame's delivery time, its length and its bytes
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<uint8_t> slots_;
+    std::vector<uint64_t> deliver_at_;
+    std::vector<uint32_t> lengths_;
+    size_t head_;
+    size_t count_;
+
+    std::vector<uint8_t> batch_;   // Receive thread only
+    std::atomic<uint64_t> drops_;
+};
+
+} // namespace nerd
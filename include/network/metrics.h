@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace nerd {
+
+// Stripes a metric is spread across; each thread updates the one it was
+// assigned, so hot counters shared by many threads never bounce a line
+const size_t METRIC_STRIPES = 16;
+
+// Stripe of the calling thread, assigned round-robin on first use
+size_t metric_stripe();
+
+// Counter - monotonically increasing, lock-free, read by summing the stripes
+class Counter {
+public:
+    Counter();
+
+    Counter(const Counter&) = delete;
+    Counter& operator=(const Counter&) = delete;
+
+    void add(uint64_t n = 1) { stripes_[metric_stripe()].value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const;
+
+private:
+    struct alignas(64) Stripe {
+        std::atomic<uint64_t> value;
+    };
+    std::array<Stripe, METRIC_STRIPES> stripes_;
+};
+
+// Point-in-time copy of a Histogram. Bucket 0 counts zeros and bucket i
+// counts values in [2^(i-1), 2^i); the last bucket also takes everything
+// larger.
+struct HistogramSnapshot {
+    static const size_t BUCKETS = 40;
+
+    std::array<uint64_t, BUCKETS> buckets;
+    uint64_t count;
+    uint64_t sum;
+
+    HistogramSnapshot() : buckets(), count(0), sum(0) {}
+
+    void merge(const HistogramSnapshot& other);
+
+    // Upper bound of the bucket holding the q-quantile, 0 when empty
+    uint64_t quantile(double q) const;
+    static uint64_t upper_bound(size_t bucket);
+};
+
+// Histogram - log2-bucketed distribution, lock-free and striped like Counter
+class Histogram {
+public:
+    Histogram();
+
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    void record(uint64_t value);
+    HistogramSnapshot snapshot() const;
+
+private:
+    struct alignas(64) Stripe {
+        std::array<std::atomic<uint64_t>, HistogramSnapshot::BUCKETS> buckets;
+        std::atomic<uint64_t> sum;
+    };
+    std::array<Stripe, METRIC_STRIPES> stripes_;
+};
+
+// MetricsText - Prometheus text exposition format builder
+//
+// Each family is opened with family() and followed by its samples; labels
+// are passed preformatted, as in "shard=\"0\"".
+class MetricsText {
+public:
+    void family(const std::string& name, const char* type, const char* help);
+    void sample(const std::string& name, uint64_t value, const std::string& labels = std::string());
+    void histogram(const std::string& name, const HistogramSnapshot& histogram, const std::string& labels = std::string());
+
+    const std::string& str() const { return text_; }
+
+private:
+    std::string text_;
+};
+
+// Replace path with text atomically, for a textfile collector to scrape
+bool write_metrics_file(const std::string& path, const std::string& text);
+
+} // namespace nerd
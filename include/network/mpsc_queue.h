@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace nerd {
+
+// MpscQueue - bounded lock-free multi-producer/single-consumer queue
+//
+// Array of cells each tagged with a sequence number (Vyukov's bounded
+// queue): producers claim a position with one CAS and publish the cell by
+// bumping its sequence, the single consumer pops without any atomic RMW.
+// A full queue rejects the element instead of blocking; rejections are
+// counted so backpressure shows up as drops rather than stalls.
+template <typename T>
+class MpscQueue {
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    static const size_t CACHE_LINE = 64;
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_;
+
+    alignas(CACHE_LINE) std::atomic<size_t> enqueue_pos_;
+    alignas(CACHE_LINE) size_t dequeue_pos_;   // Consumer only
+
+    alignas(CACHE_LINE) std::atomic<uint64_t> enqueued_;
+    std::atomic<uint64_t> dropped_;
+
+public:
+    // capacity is rounded up to a power of two
+    explicit MpscQueue(size_t capacity = 4096)
+        : enqueue_pos_(0), dequeue_pos_(0), enqueued_(0), dropped_(0) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        cells_.reset(new Cell[size]);
+        mask_ = size - 1;
+        for (size_t i = 0; i < size; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    // Any thread; false (and counted as a drop) when the queue is full
+    bool try_push(const T& value) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->value = value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        enqueued_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Consumer thread only
+    bool try_pop(T& value) {
+        Cell* cell = &cells_[dequeue_pos_ & mask_];
+        if (cell->sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1) {
+            return false;
+        }
+
+        // Move out so the cell drops its hold on any shared resources
+        value = std::move(cell->value);
+        cell->value = T();
+        cell->sequence.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+        ++dequeue_pos_;
+        return true;
+    }
+
+    // Consumer thread only: drain up to max elements into fn
+    template <typename Fn>
+    size_t drain(size_t max, Fn&& fn) {
+        size_t count = 0;
+        T value;
+        while (count < max && try_pop(value)) {
+            fn(value);
+            ++count;
+        }
+        return count;
+    }
+
+    // Consumer thread only
+    bool empty() const {
+        const Cell& cell = cells_[dequeue_pos_ & mask_];
+        return cell.sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1;
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+    uint64_t enqueued() const { return enqueued_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+};
+
+} // namespace nerd
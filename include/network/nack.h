@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace nerd {
+
+// Run of missing sequences [first, first + count)
+struct NackRange {
+    uint32_t first;
+    uint32_t count;
+} __attribute__((packed));
+
+// FLOW_NACK payload: a range count followed by that many NackRanges,
+// encoded and decoded through PacketCodec<FLOW_NACK>. A
+// non-zero since_version asks only for FLOW_DATA chunks newer than it, so
+// a node holding an older copy fetches just what changed.
+struct NackHeader {
+    uint64_t since_version;
+    uint32_t range_count;
+} __attribute__((packed));
+
+// Collapse sorted, distinct sequences into ranges, at most max_ranges of them
+std::vector<NackRange> ranges_from_sequences(const std::vector<uint32_t>& sequences, size_t max_ranges);
+
+} // namespace nerd
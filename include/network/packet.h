@@ -1,5 +1,6 @@
 #pragma once
 
+#include "network/packet_buffer.h"
 #include <cstdint>
 #include <vector>
 #include <string>
@@ -14,50 +15,128 @@ namespace nerd {
 // Flow identifier - unique identifier for a circulation pattern
 using FlowID = uint64_t;
 
+// Magic number for flow packet identification
+constexpr uint32_t FLOW_MAGIC = 0x4E455244; // "NERD" in ASCII
+
+// Ethertype carried by every flow frame
+constexpr uint16_t FLOW_ETHERTYPE = 0x1234;
+
+// Wire format revision carried in FlowPacketHeader::version
+constexpr uint8_t FLOW_WIRE_VERSION = 2;
+
 // Custom packet header for flow identification
+//
+// Version 2 layout: every field is naturally aligned and the wire byte order
+// is little-endian, so on little-endian hosts the struct is the frame header
+// byte for byte. checksum is the CRC32C of the header bytes before it
+// followed by the payload.
 struct FlowPacketHeader {
     uint32_t magic;           // Magic number to identify flow packets
+    uint8_t version;          // FLOW_WIRE_VERSION
+    uint8_t packet_type;      // Type of packet (data, control, heartbeat)
+    uint8_t flags;            // PacketFlags
+    uint8_t codec;            // ChunkCodec of a compressed payload
     FlowID flow_id;           // Unique flow identifier
     uint32_t sequence;        // Sequence number within the flow
-    uint32_t packet_type;     // Type of packet (data, control, heartbeat)
-    uint32_t data_length;     // Length of payload data
-    uint64_t timestamp;       // Timestamp for flow timing
+    uint16_t data_length;     // Length of payload data
+    uint16_t dictionary;      // Shared compression dictionary, 0 for none
+    uint64_t timestamp;       // Sender's monotonic clock; only compared with itself
+    uint32_t checksum;        // CRC32C, filled in when the frame is serialized
 } __attribute__((packed));
 
+static_assert(sizeof(FlowPacketHeader) == 36, "flow header layout is part of the wire format");
+
+// Everything multi-byte nerd puts on the wire or on disk is little-endian and
+// written in host order: this header, the payload records (RecordCodec),
+// FLOW_EDIT deltas, snapshots, and the FlowID hash peers must agree on. A
+// big-endian port would have to convert all of them, not just the header.
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "nerd's wire and file formats assume a little-endian host");
+
+// FlowPacketHeader::flags
+enum PacketFlags : uint8_t {
+    PACKET_COMPRESSED = 0x01  // Payload past its chunk header is compressed
+};
+
+static_assert(sizeof(struct ether_header) + sizeof(FlowPacketHeader) <= PACKET_HEADROOM,
+              "packet headroom must fit the link and flow headers");
+
 // Packet types
 enum PacketType {
     FLOW_DATA = 0x01,         // Data packet carrying file content
     FLOW_CONTROL = 0x02,      // Control packet for flow management
     FLOW_HEARTBEAT = 0x03,    // Heartbeat to maintain circulation
     FLOW_EDIT = 0x04,         // Edit command packet
-    FLOW_DISCOVERY = 0x05     // Flow discovery packet
+    FLOW_DISCOVERY = 0x05,    // Flow discovery packet
+    FLOW_NACK = 0x06,         // Request to resend missing sequences
+    FLOW_PARITY = 0x07        // FEC parity over a group of data chunks
 };
 
+// Current time in the units of FlowPacketHeader::timestamp: microseconds on
+// the local monotonic clock, which wall-clock steps do not move. Timestamps
+// from peers are on their clocks, so packet age is always measured from
+// local receipt instead.
+uint64_t packet_timestamp_now();
+
+// Whether a received frame (flow header onward) has a current header, a
+// payload that fits and a matching checksum. Cheap enough to run on ring
+// slots before any packet is built from them.
+bool validate_frame(const uint8_t* frame, size_t length);
+
+// Header of a frame validate_frame() accepted, in host byte order
+FlowPacketHeader frame_header(const uint8_t* frame);
+
 // Raw packet representation
+//
+// The payload lives in a pooled PacketBuffer behind PACKET_HEADROOM bytes of
+// headroom. Copying a RawPacket shares the slab instead of the bytes, so a
+// packet travels from RX through PacketStream to TX without being copied.
 class RawPacket {
 private:
-    std::vector<uint8_t> data_;
     FlowPacketHeader header_;
+    PacketRef buffer_;
+    uint32_t payload_length_;
+    uint64_t received_at_;    // Local monotonic receipt time, 0 if built locally
+    
+    void assign_payload(const uint8_t* payload, size_t length);
 
 public:
     RawPacket();
     RawPacket(FlowID flow_id, PacketType type, const std::vector<uint8_t>& payload);
+    RawPacket(FlowID flow_id, PacketType type, const uint8_t* payload, size_t length);
+    
+    // A packet with length bytes of payload space, left for the caller to
+    // fill through mutable_payload() before the packet is first copied
+    static RawPacket allocate(FlowID flow_id, PacketType type, size_t length);
     
     // Packet construction
     void set_header(const FlowPacketHeader& header);
     void set_payload(const std::vector<uint8_t>& payload);
+    void set_payload(const uint8_t* payload, size_t length);
     void set_flow_id(FlowID flow_id);
     void set_packet_type(PacketType type);
     void set_sequence(uint32_t seq);
+    void set_timestamp(uint64_t timestamp);
+    void set_compression(uint8_t codec, uint16_t dictionary);
+    void set_received_at(uint64_t received_at) { received_at_ = received_at; }
     
     // Packet access
     const FlowPacketHeader& header() const { return header_; }
-    const std::vector<uint8_t>& data() const { return data_; }
-    std::vector<uint8_t>& data() { return data_; }
+    ByteView data() const { return ByteView(payload(), payload_length_); }
+    const uint8_t* payload() const { return buffer_ ? buffer_.data() + PACKET_HEADROOM : nullptr; }
+    uint8_t* mutable_payload() { return buffer_ ? buffer_.data() + PACKET_HEADROOM : nullptr; }
+    size_t payload_size() const { return payload_length_; }
+    const PacketRef& buffer() const { return buffer_; }
+    uint64_t received_at() const { return received_at_; }
     
     // Serialization
     std::vector<uint8_t> serialize() const;
+    size_t serialize_into(uint8_t* buffer, size_t capacity) const;
+    size_t serialize_header_into(uint8_t* buffer, size_t capacity) const;
     bool deserialize(const std::vector<uint8_t>& raw_data);
+    bool deserialize(const uint8_t* raw_data, size_t length);
+    
+    // deserialize() of a frame validate_frame() already accepted
+    void assign_frame(const uint8_t* frame);
     
     // Validation
     bool is_valid() const;
@@ -65,24 +144,94 @@ public:
 };
 
 // Packet stream for managing packet flow
+//
+// Packets are held in a power-of-two ring indexed by sequence number. The
+// ring covers a sliding window [window_base(), window_end()); a bitmap marks
+// which slots are present, so insert, lookup and removal are O(1) and gaps
+// can be walked a word at a time. Sequence numbers are not expected to wrap;
+// UINT32_MAX itself is never stored.
 class PacketStream {
 private:
     FlowID flow_id_;
-    std::vector<RawPacket> packets_;
+    std::vector<RawPacket> slots_;
+    std::vector<uint64_t> present_;
+    uint32_t mask_;
+    uint32_t base_;
+    uint32_t end_;
+    size_t count_;
+    uint32_t max_capacity_;
+    uint64_t dropped_;
     uint32_t next_sequence_;
     
+    static const uint32_t MIN_CAPACITY = 64;
+    
+    uint32_t capacity() const { return mask_ + 1; }
+    bool test(uint32_t sequence) const {
+        uint32_t index = sequence & mask_;
+        return (present_[index >> 6] >> (index & 63)) & 1;
+    }
+    void set_bit(uint32_t sequence) {
+        uint32_t index = sequence & mask_;
+        present_[index >> 6] |= uint64_t(1) << (index & 63);
+    }
+    void clear_bit(uint32_t sequence) {
+        uint32_t index = sequence & mask_;
+        present_[index >> 6] &= ~(uint64_t(1) << (index & 63));
+    }
+    bool reserve_span(uint32_t first, uint32_t last);
+    void grow(uint32_t span);
+    void evict_below(uint32_t sequence);
+    
 public:
-    explicit PacketStream(FlowID flow_id);
+    static const uint32_t DEFAULT_MAX_CAPACITY = 1 << 18;
     
+    explicit PacketStream(FlowID flow_id, uint32_t max_capacity = DEFAULT_MAX_CAPACITY);
+    
+    // Insert or replace the packet at its sequence number
     void add_packet(const RawPacket& packet);
     void remove_packet(uint32_t sequence);
-    const std::vector<RawPacket>& packets() const { return packets_; }
+    const RawPacket* find(uint32_t sequence) const;
+    RawPacket* find(uint32_t sequence);
+    
     FlowID flow_id() const { return flow_id_; }
     uint32_t next_sequence() { return next_sequence_++; }
+    size_t size() const { return count_; }
+    bool empty() const { return count_ == 0; }
+    uint32_t window_base() const { return base_; }
+    uint32_t window_end() const { return end_; }
+    uint64_t dropped() const { return dropped_; }
+    
+    // First present (or missing) sequence in [from, limit), or limit if none
+    uint32_t next_present(uint32_t from, uint32_t limit) const;
+    uint32_t next_missing(uint32_t from, uint32_t limit) const;
+    
+    // Number of consecutive packets present starting at sequence
+    uint32_t contiguous_from(uint32_t sequence) const;
+    
+    // Visit maximal in-order runs as fn(first_sequence, count)
+    template <typename Fn>
+    void for_each_run(Fn&& fn) const {
+        uint32_t seq = base_;
+        while (seq < end_) {
+            seq = next_present(seq, end_);
+            if (seq == end_) {
+                break;
+            }
+            uint32_t stop = next_missing(seq, end_);
+            fn(seq, stop - seq);
+            seq = stop;
+        }
+    }
     
-    // Flow management
-    void maintain_circulation();
-    void cleanup_old_packets();
+    // Visit every packet in sequence order
+    template <typename Fn>
+    void for_each_packet(Fn&& fn) const {
+        for_each_run([this, &fn](uint32_t first, uint32_t count) {
+            for (uint32_t seq = first; seq < first + count; ++seq) {
+                fn(slots_[seq & mask_]);
+            }
+        });
+    }
 };
 
 } // namespace nerd
\ No newline at end of file
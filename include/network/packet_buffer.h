@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <new>
+#include <mutex>
+#include <vector>
+
+namespace nerd {
+
+// Slab geometry: one Ethernet frame plus headroom for the link and flow headers
+constexpr size_t PACKET_BUFFER_ALIGN = 64;
+constexpr size_t PACKET_BUFFER_SIZE = 2048;
+constexpr size_t PACKET_HEADROOM = 64;
+
+class PacketPool;
+struct PacketArena;
+
+// Control block at the start of every slab; the frame bytes follow it
+struct alignas(PACKET_BUFFER_ALIGN) PacketBuffer {
+    std::atomic<uint32_t> refs;
+    uint32_t capacity;          // Usable bytes after the control block
+    PacketPool* pool;           // Owning pool, nullptr for oversized one-off buffers
+    PacketArena* arena;         // Block the slab was carved from
+    PacketBuffer* next_free;    // Free-list link while the slab is idle
+
+    uint8_t* data() { return reinterpret_cast<uint8_t*>(this) + sizeof(PacketBuffer); }
+    const uint8_t* data() const { return reinterpret_cast<const uint8_t*>(this) + sizeof(PacketBuffer); }
+};
+
+static_assert(sizeof(PacketBuffer) == PACKET_BUFFER_ALIGN, "control block must fill one cache line");
+
+// Intrusive reference to a PacketBuffer; copying shares the slab
+class PacketRef {
+private:
+    PacketBuffer* buffer_;
+
+    void retain() {
+        if (buffer_) {
+            buffer_->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    void release();
+
+public:
+    PacketRef() : buffer_(nullptr) {}
+    explicit PacketRef(PacketBuffer* buffer) : buffer_(buffer) {}  // Adopts one reference
+    PacketRef(const PacketRef& other) : buffer_(other.buffer_) { retain(); }
+    PacketRef(PacketRef&& other) noexcept : buffer_(other.buffer_) { other.buffer_ = nullptr; }
+    ~PacketRef() { release(); }
+
+    PacketRef& operator=(const PacketRef& other) {
+        if (buffer_ != other.buffer_) {
+            PacketRef copy(other);
+            swap(copy);
+        }
+        return *this;
+    }
+    PacketRef& operator=(PacketRef&& other) noexcept {
+        if (this != &other) {
+            release();
+            buffer_ = other.buffer_;
+            other.buffer_ = nullptr;
+        }
+        return *this;
+    }
+
+    void swap(PacketRef& other) noexcept {
+        PacketBuffer* tmp = buffer_;
+        buffer_ = other.buffer_;
+        other.buffer_ = tmp;
+    }
+    void reset() { release(); buffer_ = nullptr; }
+
+    explicit operator bool() const { return buffer_ != nullptr; }
+    uint8_t* data() const { return buffer_ ? buffer_->data() : nullptr; }
+    size_t capacity() const { return buffer_ ? buffer_->capacity : 0; }
+    bool unique() const { return buffer_ && buffer_->refs.load(std::memory_order_acquire) == 1; }
+};
+
+// Read-only view over packet bytes
+struct ByteView {
+    const uint8_t* ptr;
+    size_t length;
+
+    ByteView() : ptr(nullptr), length(0) {}
+    ByteView(const uint8_t* data, size_t size) : ptr(data), length(size) {}
+
+    const uint8_t* data() const { return ptr; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    const uint8_t* begin() const { return ptr; }
+    const uint8_t* end() const { return ptr + length; }
+    uint8_t operator[](size_t index) const { return ptr[index]; }
+};
+
+// PacketPool - recycles fixed-size, cache-aligned frame slabs
+//
+// Each thread keeps a short free list of its own, refilled from and handed
+// back to the shared one a batch at a time, so the pool mutex is taken once
+// per batch instead of once per packet. Arenas whose slabs have all come
+// back are released once the shared list grows past its high-water mark.
+// A pool must outlive the threads that used it.
+class PacketPool {
+private:
+    struct ThreadCache;
+
+    mutable std::mutex mutex_;
+    PacketBuffer* free_list_;
+    std::vector<PacketArena*> arenas_;
+    size_t slabs_per_arena_;
+    size_t total_slabs_;
+    size_t free_slabs_;         // On the shared list; thread caches not included
+    size_t empty_arenas_;       // Arenas with every slab on the shared list
+
+    static ThreadCache& thread_cache();
+    PacketBuffer* take_locked();
+    void put_locked(PacketBuffer* buffer);
+    void refill(ThreadCache& cache);
+    void give_back(ThreadCache& cache, size_t count);
+    void grow_locked();
+    void trim_locked();
+
+public:
+    explicit PacketPool(size_t slabs_per_arena = 256);
+    ~PacketPool();
+
+    PacketPool(const PacketPool&) = delete;
+    PacketPool& operator=(const PacketPool&) = delete;
+
+    // Process-wide pool shared by RX, PacketStream and TX
+    static PacketPool& instance();
+
+    // Slab sized for a frame; larger requests get a one-off buffer
+    PacketRef allocate(size_t capacity = PACKET_BUFFER_SIZE);
+    void recycle(PacketBuffer* buffer);
+
+    size_t total_slabs() const;
+    size_t free_slabs() const;
+};
+
+inline void PacketRef::release() {
+    if (buffer_ && buffer_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        if (buffer_->pool) {
+            buffer_->pool->recycle(buffer_);
+        } else {
+            buffer_->~PacketBuffer();
+            ::operator delete(buffer_, std::align_val_t(PACKET_BUFFER_ALIGN));
+        }
+    }
+}
+
+} // namespace nerd
\ No newline at end of file
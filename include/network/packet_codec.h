@@ -0,0 +1,92 @@
+#pragma once
+
+#include "network/packet.h"
+#include "network/heartbeat.h"
+#include "network/nack.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+
+namespace nerd {
+
+// RecordCodec - a payload of one fixed Header followed by Header::*CountField
+// fixed-size Records
+//
+// Every size is a compile-time constant, so an encoder writes into a
+// payload of exactly the right length and a decoder checks a frame with one
+// comparison and reads records where they lie, without copying them out.
+// Multi-byte fields go out in host order, which packet.h asserts is the
+// little-endian wire order.
+template <typename Header, typename Record, typename Count, Count Header::*CountField>
+struct RecordCodec {
+    using HeaderType = Header;
+    using RecordType = Record;
+
+    static constexpr size_t payload_size(size_t count) { return sizeof(Header) + count * sizeof(Record); }
+
+    // Records that fit in a payload of at most max_payload bytes
+    static constexpr size_t capacity(size_t max_payload) {
+        return max_payload > sizeof(Header)
+            ? std::min<size_t>((max_payload - sizeof(Header)) / sizeof(Record), std::numeric_limits<Count>::max())
+            : 0;
+    }
+
+    // out holds payload_size(count) bytes; header's count field is filled in
+    static void encode(uint8_t* out, Header header, const Record* records, size_t count) {
+        header.*CountField = static_cast<Count>(count);
+        std::memcpy(out, &header, sizeof(header));
+        if (count) {
+            std::memcpy(out + sizeof(Header), records, count * sizeof(Record));
+        }
+    }
+
+    // Header and record count of a payload, or false if its length does not
+    // match the count it claims
+    static bool parse(const uint8_t* data, size_t length, Header& header, size_t& count) {
+        if (length < sizeof(Header)) {
+            return false;
+        }
+        std::memcpy(&header, data, sizeof(header));
+        count = header.*CountField;
+        return length == payload_size(count);
+    }
+
+    static Record record(const uint8_t* data, size_t index) {
+        Record value;
+        std::memcpy(&value, data + sizeof(Header) + index * sizeof(Record), sizeof(value));
+        return value;
+    }
+};
+
+// PacketCodec<Type> - the payload layout of a packet type with a fixed one;
+// the others (data chunks, edits, discovery) have none
+template <PacketType Type>
+struct PacketCodec;
+
+template <>
+struct PacketCodec<FLOW_HEARTBEAT>
+    : RecordCodec<HeartbeatHeader, HeartbeatRecord, uint16_t, &HeartbeatHeader::record_count> {
+    static constexpr size_t MAX_RECORDS = capacity(HEARTBEAT_MAX_PAYLOAD);
+};
+
+template <>
+struct PacketCodec<FLOW_NACK> : RecordCodec<NackHeader, NackRange, uint32_t, &NackHeader::range_count> {
+    // A NACK is an ordinary-sized frame, so one request covers many gaps;
+    // transports with smaller frames take fewer
+    static constexpr size_t MAX_RECORDS = capacity(1400);
+};
+
+// A packet of a fixed-layout type, encoded straight into the pool slab that
+// transmission then sends from
+template <PacketType Type>
+RawPacket encode_packet(FlowID flow_id, const typename PacketCodec<Type>::HeaderType& header,
+                        const typename PacketCodec<Type>::RecordType* records, size_t count) {
+    using Codec = PacketCodec<Type>;
+    RawPacket packet = RawPacket::allocate(flow_id, Type, Codec::payload_size(count));
+    Codec::encode(packet.mutable_payload(), header, records, count);
+    return packet;
+}
+
+} // namespace nerd
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+
+namespace nerd {
+
+// Interface-wide transmit budget; 0 leaves a dimension unlimited
+struct TransmitLimits {
+    uint32_t max_packets_per_second;
+    uint64_t max_bytes_per_second;
+
+    TransmitLimits() : max_packets_per_second(0), max_bytes_per_second(0) {}
+};
+
+// RateLimiter - packet and byte token buckets shared by every sender
+//
+// Every frame reserves its credit before it goes out, foreground and
+// circulation alike. The buckets may go into debt; a frame that finds them
+// there is told how long until the debt it added clears, so bursts are held
+// to the cap too, and senders deferred together leave one after another
+// instead of all retrying at the same moment. The buckets hold BURST_US
+// worth of credit. Thread-safe.
+class RateLimiter {
+public:
+    static const uint64_t BURST_US = 10000;
+
+    RateLimiter();
+
+    void configure(const TransmitLimits& limits, uint64_t now_us);
+    TransmitLimits limits() const;
+    bool limited() const { return enabled_.load(std::memory_order_relaxed); }
+
+    // Take the credit for a frame of bytes: 0 if it may go out now, else
+    // microseconds until it may. Either way the credit is spent.
+    uint64_t reserve(size_t bytes, uint64_t now_us);
+
+    // Give back credit reserved for frames sent smaller than asked, or not at all
+    void refund(uint32_t packets, size_t bytes);
+
+    uint64_t deferred() const { return deferred_.load(std::memory_order_relaxed); }
+
+private:
+    void refill(uint64_t now_us);
+
+    mutable std::mutex mutex_;
+    TransmitLimits limits_;
+    double packet_tokens_;
+    double byte_tokens_;
+    uint64_t refilled_us_;
+    std::atomic<bool> enabled_;
+    std::atomic<uint64_t> deferred_;   // reserve() answers that were not 0
+};
+
+} // namespace nerd
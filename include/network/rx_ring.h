@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <linux/if_packet.h>
+#include <linux/net_tstamp.h>
+
+namespace nerd {
+
+// Geometry of the TPACKET_V3 receive ring
+struct RxRingConfig {
+    uint32_t block_size;        // Bytes per ring block (multiple of the page size)
+    uint32_t block_count;       // Number of blocks in the ring
+    uint32_t frame_size;        // Nominal frame slot size used by the kernel
+    uint32_t retire_timeout_ms; // Hand partially filled blocks to userspace after this long
+
+    // Share the interface's frames with the other rings of a PACKET_FANOUT
+    // group: fanout_type is a PACKET_FANOUT_* mode, and group 0 creates a new
+    // group whose id fanout_group() then reports. PACKET_FANOUT_CBPF splits
+    // by flow ID, since the kernel's own hash is constant for one ethertype.
+    bool fanout;
+    uint16_t fanout_type;
+    uint16_t fanout_group;
+
+    // Use NIC hardware receive stamps. These are on the NIC's PTP clock, so
+    // only ask for them with phc2sys keeping it on CLOCK_REALTIME. A NIC that
+    // stamps nothing yet is switched to stamp every frame until close().
+    bool hardware_timestamps;
+
+    RxRingConfig() : block_size(1 << 20), block_count(64), frame_size(2048), retire_timeout_ms(10),
+        fanout(false), fanout_type(0), fanout_group(0), hardware_timestamps(false) {}
+};
+
+// RxRing - PACKET_MMAP (TPACKET_V3) receive ring for flow frames
+//
+// The socket only accepts FLOW_ETHERTYPE frames and a classic BPF filter
+// drops anything without FLOW_MAGIC before it reaches the ring. Frames are
+// handed to the caller in place, one retired block at a time.
+//
+// Each frame carries the kernel's software receive stamp, or the NIC's
+// hardware stamp when asked for and the driver supports it. Both are taken
+// to be CLOCK_REALTIME, so only the delay between stamping and reading the
+// block is taken from them and applied to the local monotonic clock.
+class RxRing {
+public:
+    // Called with a pointer to the flow header (Ethernet header stripped),
+    // the number of captured bytes and when the frame arrived, in
+    // packet_timestamp_now() units. The memory is only valid for the
+    // duration of the call.
+    using FrameHandler = std::function<void(const uint8_t* frame, size_t length, uint64_t received_at)>;
+
+    RxRing();
+    ~RxRing();
+
+    RxRing(const RxRing&) = delete;
+    RxRing& operator=(const RxRing&) = delete;
+
+    bool open(int ifindex, const RxRingConfig& config = RxRingConfig());
+    void close();
+    bool is_open() const { return socket_ >= 0; }
+    bool hardware_timestamps() const { return hardware_timestamps_; }
+    uint16_t fanout_group() const { return fanout_group_; }
+
+    // Wait up to timeout_ms for retired blocks and dispatch every frame in
+    // them. Returns the number of frames delivered.
+    size_t poll(int timeout_ms, const FrameHandler& handler);
+    
+    // Frames the kernel dropped because the ring was full, since open()
+    uint64_t kernel_drops();
+
+private:
+    bool attach_filter();
+    bool join_fanout();
+    void enable_timestamps(int ifindex);
+    size_t process_block(tpacket_block_desc* block, const FrameHandler& handler);
+    tpacket_block_desc* block_at(uint32_t index) const;
+
+    int socket_;
+    uint8_t* ring_;
+    size_t ring_size_;
+    RxRingConfig config_;
+    uint32_t current_block_;
+    bool hardware_timestamps_;
+    
+    // The NIC's stamping before enable_timestamps() widened it; put back by close()
+    bool restore_hwtstamp_;
+    int hwtstamp_ifindex_;
+    struct hwtstamp_config saved_hwtstamp_;
+    
+    uint16_t fanout_group_;
+    std::atomic<uint64_t> kernel_drops_;   // PACKET_STATISTICS resets on read
+};
+
+} // namespace nerd
\ No newline at end of file
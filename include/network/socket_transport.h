@@ -0,0 +1,44 @@
+#pragma once
+
+#include "network/transport.h"
+#include "network/rx_ring.h"
+#include "network/tx_queue.h"
+#include <memory>
+#include <string>
+
+namespace nerd {
+
+// PacketSocketTransport - flow frames over an AF_PACKET socket
+//
+// Transmission is batched through a TxQueue on a transmit-only raw socket
+// bound to the interface; reception goes through a TPACKET_V3 RxRing on its
+// own socket. Several transports on one interface split its frames through
+// a fanout group, each with its own transmit socket. Needs CAP_NET_RAW.
+class PacketSocketTransport : public Transport {
+public:
+    PacketSocketTransport();
+    ~PacketSocketTransport() override;
+
+    PacketSocketTransport(const PacketSocketTransport&) = delete;
+    PacketSocketTransport& operator=(const PacketSocketTransport&) = delete;
+
+    // Without a receive ring the transport still opens, transmit-only
+    bool open(const std::string& interface, const TxQueueConfig& config = TxQueueConfig(),
+              const RxRingConfig& rx_config = RxRingConfig());
+    void close();
+    uint16_t fanout_group() const { return rx_ring_->fanout_group(); }
+
+    bool send(const RawPacket& packet) override;
+    void flush() override;
+    bool can_receive() const override { return rx_ring_->is_open(); }
+    size_t poll(int timeout_ms, const FrameHandler& handler) override;
+    uint64_t receive_drops() override { return rx_ring_->kernel_drops(); }
+    uint64_t transmit_drops() override { return tx_queue_->frames_dropped(); }
+
+private:
+    int socket_;
+    std::unique_ptr<RxRing> rx_ring_;
+    std::unique_ptr<TxQueue> tx_queue_;
+};
+
+} // namespace nerd
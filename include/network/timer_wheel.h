@@ -0,0 +1,69 @@
+#pragma once
+
+#include "network/packet.h"
+#include <cstdint>
+#include <vector>
+
+namespace nerd {
+
+// Event scheduled on the timing wheel
+struct TimerEvent {
+    enum Kind : uint8_t {
+        PACKET_EXPIRE,      // Drop a flow's packets that outlived max_packet_age
+        FLOW_MAINTAIN,      // Per-flow circulation step (heartbeat)
+        NACK_ANSWER         // Resend the chunks a flow's peers asked for
+    };
+
+    uint64_t deadline;      // Absolute deadline in microseconds
+    FlowID flow_id;
+    Kind kind;
+    uint64_t stamp;         // Expiry or NACK due time, or pattern generation, the event was armed for
+    uint64_t tick;          // FLOW_MAINTAIN: when the tick was due; a deferred retry keeps it
+
+    TimerEvent() : deadline(0), flow_id(0), kind(PACKET_EXPIRE), stamp(0), tick(0) {}
+};
+
+// TimerWheel - hierarchical timing wheel
+//
+// Four levels of 256 slots; level 0 has tick_us resolution and each higher
+// level is 256 times coarser. Scheduling is O(1) and advancing costs one
+// slot visit per elapsed tick plus the events that fall due or cascade, so
+// the cost tracks the events that are due rather than everything resident.
+// Events are never cancelled: callers validate them when they fire.
+class TimerWheel {
+public:
+    static const uint32_t LEVELS = 4;
+    static const uint32_t SLOT_BITS = 8;
+    static const uint32_t SLOTS = 1 << SLOT_BITS;
+
+    explicit TimerWheel(uint64_t tick_us = 1000);
+
+    // Start counting from now_us; events scheduled earlier fire on the next advance
+    void reset(uint64_t now_us);
+
+    void schedule(const TimerEvent& event);
+
+    // Move the wheel forward to now_us, appending every due event to due
+    void advance(uint64_t now_us, std::vector<TimerEvent>& due);
+
+    // Earliest time at which advance() may produce or cascade events
+    uint64_t next_wakeup(uint64_t limit_us) const;
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    uint64_t tick_us() const { return tick_us_; }
+
+private:
+    void place(const TimerEvent& event);
+    void tick(std::vector<TimerEvent>& due);
+    uint64_t to_tick(uint64_t time_us) const { return time_us / tick_us_; }
+    uint64_t deadline_tick(uint64_t time_us) const { return (time_us + tick_us_ - 1) / tick_us_; }
+
+    uint64_t tick_us_;
+    uint64_t current_tick_;
+    size_t size_;
+    std::vector<TimerEvent> wheel_[LEVELS][SLOTS];
+    std::vector<TimerEvent> overflow_;   // Beyond the top level's horizon
+};
+
+} // namespace nerd
\ No newline at end of file
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "network/packet.h"
+#include "network/tx_queue.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace nerd {
+
+// Payload of a standard Ethernet frame, the flow header included
+constexpr size_t ETHERNET_MTU = 1500;
+
+// Transport - how NetworkFlow puts frames on the wire and takes them off
+//
+// One sender path, possibly used by many threads at once, and one receive
+// path polled by NetworkFlow's receive thread. Frames handed to the receive
+// handler start at the flow header, as RxRing delivers them.
+class Transport {
+public:
+    // As RxRing::FrameHandler: the frame is only valid during the call and
+    // received_at is in packet_timestamp_now() units
+    using FrameHandler = std::function<void(const uint8_t* frame, size_t length, uint64_t received_at)>;
+
+    virtual ~Transport() = default;
+
+    // Queue one frame for transmission; false if it cannot be sent
+    virtual bool send(const RawPacket& packet) = 0;
+
+    // Hand every queued frame on now
+    virtual void flush() = 0;
+
+    // False for a transmit-only transport; poll() is then never called
+    virtual bool can_receive() const = 0;
+
+    // Wait up to timeout_ms for frames and dispatch them. Returns the number
+    // delivered.
+    virtual size_t poll(int timeout_ms, const FrameHandler& handler) = 0;
+
+    // Frames lost on the receive side before they reached poll()
+    virtual uint64_t receive_drops() { return 0; }
+    
+    // Frames send() accepted that the kernel then refused
+    virtual uint64_t transmit_drops() { return 0; }
+    
+    // Largest frame, flow header and payload, that goes out without being
+    // fragmented; frames packed to fill one (heartbeats, NACKs) size to it
+    virtual size_t max_frame() const { return ETHERNET_MTU; }
+    
+    // CPU the receive thread should run on: where the queue's interrupts
+    // land, or -1 for anywhere
+    int receive_cpu() const { return receive_cpu_; }
+    void set_receive_cpu(int cpu) { receive_cpu_ = cpu; }
+
+private:
+    int receive_cpu_ = -1;
+};
+
+// Backends selectable for a real interface
+enum class TransportKind {
+    PACKET,          // AF_PACKET raw frames; the fallback, works on any Linux NIC
+    XDP,             // AF_XDP on one NIC queue, zero-copy where the driver allows
+    UDP_MULTICAST    // Flow frames as UDP datagrams to a multicast group, routable
+};
+
+// How an interface's frames are split between its AF_PACKET queues
+enum class FanoutMode {
+    HASH,     // By flow ID, so each flow stays on one queue; any NIC
+    CPU,      // By the CPU that took the frame in, following RSS and RPS
+    QUEUE     // By NIC receive queue, for NICs that steer flow frames themselves
+};
+
+// Most queues one interface is split into, and one past the highest NIC
+// queue an XDP socket may bind
+constexpr uint32_t MAX_QUEUES = 256;
+
+struct TransportConfig {
+    TransportKind kind;
+    std::string multicast_group;   // "address:port"; empty for the default group
+    uint32_t multicast_ttl;
+    uint32_t xdp_queue;            // First NIC receive queue the XDP sockets bind to
+    uint32_t queues;               // Per interface; 0 for one per NIC receive queue
+    FanoutMode fanout;
+    bool hardware_timestamps;      // AF_PACKET receive stamps from the NIC's PTP clock
+
+    TransportConfig()
+        : kind(TransportKind::PACKET), multicast_ttl(16), xdp_queue(0), queues(1), fanout(FanoutMode::HASH),
+          hardware_timestamps(false) {}
+};
+
+bool parse_transport_kind(const std::string& name, TransportKind& kind);
+const char* transport_kind_name(TransportKind kind);
+bool parse_fanout_mode(const std::string& name, FanoutMode& mode);
+
+// Open the configured backend on interface, one transport per queue, each
+// with its receive CPU set. An XDP transport that cannot be set up falls
+// back to AF_PACKET; UDP multicast always uses one queue. Empty if nothing
+// could be opened.
+std::vector<std::unique_ptr<Transport>> open_transports(const std::string& interface, const TransportConfig& config,
+                                                        const TxQueueConfig& tx_config);
+
+// FlushTimer - bounds how long a batching transport holds a queued frame
+//
+// arm() when the first frame of a batch is queued; flush runs on the timer's
+// own thread max_latency_us later, with none of the caller's locks held. A
+// transport that flushes sooner need not disarm: a late flush finds less to
+// send.
+class FlushTimer {
+public:
+    FlushTimer(uint32_t max_latency_us, std::function<void()> flush);
+    ~FlushTimer();
+
+    FlushTimer(const FlushTimer&) = delete;
+    FlushTimer& operator=(const FlushTimer&) = delete;
+
+    void arm();
+
+private:
+    void worker();
+
+    uint32_t max_latency_us_;
+    std::function<void()> flush_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool armed_;
+    bool running_;
+    std::chrono::steady_clock::time_point deadline_;
+    std::thread thread_;
+};
+
+} // namespace nerd
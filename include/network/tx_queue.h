@@ -0,0 +1,96 @@
+#pragma once
+
+#include "network/packet.h"
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <sys/socket.h>
+
+namespace nerd {
+
+// Transmit batching parameters
+struct TxQueueConfig {
+    uint32_t frame_size;        // Bytes per transmit slot (Ethernet header included)
+    uint32_t frame_count;       // Number of transmit slots
+    uint32_t flush_threshold;   // Flush as soon as this many frames are queued
+    uint32_t max_latency_us;    // Longest a queued frame may wait for a flush
+    bool use_tx_ring;           // Try PACKET_TX_RING before falling back to sendmmsg
+
+    TxQueueConfig() : frame_size(2048), frame_count(256), flush_threshold(32),
+                      max_latency_us(1000), use_tx_ring(true) {}
+};
+
+// TxQueue - batched frame transmission for a packet socket
+//
+// Frames are serialized in place directly into a mmap'd PACKET_TX_RING
+// slot. Without a ring, only the headers are written to a staging slot and
+// the payload is sent straight from its pool slab with one sendmmsg().
+// A flush happens when flush_threshold frames are pending or the oldest
+// pending frame has waited max_latency_us.
+class TxQueue {
+public:
+    TxQueue();
+    ~TxQueue();
+
+    TxQueue(const TxQueue&) = delete;
+    TxQueue& operator=(const TxQueue&) = delete;
+
+    // Takes over transmission on an already bound AF_PACKET socket
+    bool open(int socket, const TxQueueConfig& config = TxQueueConfig());
+    void close();
+    bool is_open() const { return socket_ >= 0; }
+    bool uses_tx_ring() const { return ring_ != nullptr; }
+
+    // Queue one frame; returns false if it does not fit a slot
+    bool enqueue(const RawPacket& packet);
+
+    // Hand every pending frame to the kernel now
+    void flush();
+
+    // Stamped into every frame's Ethernet source; all zeroes until set
+    void set_source_address(const uint8_t* mac);
+
+    uint64_t frames_sent() const { return frames_sent_.load(std::memory_order_relaxed); }
+    uint64_t frames_dropped() const { return frames_dropped_.load(std::memory_order_relaxed); }  // Refused by sendmmsg
+    uint64_t flush_count() const { return flush_count_.load(std::memory_order_relaxed); }
+
+private:
+    bool setup_tx_ring();
+    uint8_t* acquire_slot();
+    size_t write_link_header(uint8_t* slot) const;
+    void flush_locked();
+    void flush_worker();
+
+    int socket_;
+    TxQueueConfig config_;
+    uint8_t source_[6];
+
+    // PACKET_TX_RING mode
+    uint8_t* ring_;
+    size_t ring_size_;
+    uint32_t ring_head_;
+
+    // sendmmsg mode: headers in staging_, payloads referenced in their pool slabs
+    std::vector<uint8_t> staging_;
+    std::vector<struct mmsghdr> messages_;
+    std::vector<struct iovec> iovecs_;
+    std::vector<PacketRef> pending_payloads_;
+
+    uint32_t pending_;
+    std::chrono::steady_clock::time_point oldest_pending_;
+
+    std::mutex mutex_;
+    std::condition_variable flush_cv_;
+    std::thread flush_thread_;
+    bool running_;
+
+    std::atomic<uint64_t> frames_sent_;
+    std::atomic<uint64_t> frames_dropped_;
+    std::atomic<uint64_t> flush_count_;
+};
+
+} // namespace nerd
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "network/transport.h"
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace nerd {
+
+// UdpMulticastTransport - flow frames as UDP datagrams to a multicast group
+//
+// Each frame (flow header and payload, no Ethernet header) is one datagram,
+// so flows cross routers wherever the group is routed and no privileges are
+// needed. Sends are batched: consecutive frames of one size go out as a
+// single UDP_SEGMENT (GSO) super-datagram and the batches share one
+// sendmmsg(). The receive socket asks for UDP_GRO, so the kernel may hand
+// several datagrams over as one buffer, and for SO_RXQ_OVFL, which reports
+// datagrams dropped with the socket buffer full. Nodes join the group on one
+// interface; a node's own datagrams, looped back so nodes on one host see
+// each other, are recognised by source address and skipped.
+class UdpMulticastTransport : public Transport {
+public:
+    static constexpr const char* DEFAULT_GROUP = "239.78.69.82:47820";
+    
+    // An Ethernet MTU less the IPv4 and UDP headers, so no datagram fragments
+    // and every one is a valid GSO segment
+    static constexpr size_t MAX_DATAGRAM = ETHERNET_MTU - 20 - 8;
+
+    UdpMulticastTransport();
+    ~UdpMulticastTransport() override;
+
+    UdpMulticastTransport(const UdpMulticastTransport&) = delete;
+    UdpMulticastTransport& operator=(const UdpMulticastTransport&) = delete;
+
+    // group is "address:port"; empty means DEFAULT_GROUP
+    bool open(const std::string& interface, const std::string& group, uint32_t ttl);
+    void close();
+    bool segmentation_offload() const { return gso_; }
+
+    bool send(const RawPacket& packet) override;
+    void flush() override;
+    bool can_receive() const override { return receive_socket_ >= 0; }
+    size_t poll(int timeout_ms, const FrameHandler& handler) override;
+    uint64_t receive_drops() override { return drops_.load(std::memory_order_relaxed); }
+    size_t max_frame() const override { return MAX_DATAGRAM; }
+
+private:
+    // Consecutive queued frames sent as one GSO datagram: all segment bytes
+    // long except possibly the last
+    struct Batch {
+        size_t offset;
+        size_t length;
+        uint16_t segment;
+        uint16_t segments;
+        bool closed;      // A shorter segment ended it
+    };
+
+    bool open_sender(const std::string& interface, int ifindex, uint32_t ttl);
+    bool open_receiver(int ifindex);
+    void flush_locked();
+
+    int send_socket_;
+    int receive_socket_;
+    struct sockaddr_in group_;
+    struct sockaddr_in self_;     // Source address of datagrams this node sends
+    bool gso_;
+
+    // Transmit batching
+    std::mutex mutex_;
+    std::vector<uint8_t> pending_;
+    std::vector<Batch> batches_;
+    std::unique_ptr<FlushTimer> flush_timer_;
+
+    // Receive buffers, one GRO-sized buffer per message; receive thread only
+    std::vector<uint8_t> receive_buffers_;
+    std::vector<uint8_t> receive_control_;
+    std::vector<struct mmsghdr> receive_messages_;
+    std::vector<struct iovec> receive_iovecs_;
+    std::vector<struct sockaddr_in> receive_sources_;
+    std::atomic<uint64_t> drops_;
+};
+
+} // namespace nerd
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "network/transport.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace nerd {
+
+// XdpProgram - the XDP program and XSKMAP behind an interface's AF_XDP sockets
+//
+// Redirects FLOW_ETHERTYPE frames carrying FLOW_MAGIC to the socket
+// registered for the queue they arrived on and passes everything else, and
+// frames on queues without a socket, up the stack. Attached through a bpf
+// link, so it is detached when the last XdpTransport using it closes.
+class XdpProgram {
+public:
+    XdpProgram();
+    ~XdpProgram();
+
+    XdpProgram(const XdpProgram&) = delete;
+    XdpProgram& operator=(const XdpProgram&) = delete;
+
+    // Room for sockets on queues 0 to queue_count - 1
+    bool attach(int ifindex, uint32_t queue_count);
+    bool add_socket(uint32_t queue_id, int socket);
+
+private:
+    int map_fd_;
+    int program_fd_;
+    int link_fd_;
+};
+
+// XdpTransport - flow frames through an AF_XDP socket on one NIC queue
+//
+// An XdpProgram, shared by every socket on the interface, hands the queue's
+// flow frames to the socket, so they skip the kernel network stack
+// entirely. The frames live in a UMEM shared with the kernel: the lower half
+// circulates through the fill and RX rings, the upper half is the transmit
+// pool, reclaimed from the completion ring. The socket binds zero-copy where
+// the driver supports it and in copy mode otherwise. Only the bound queue is
+// served: steer the flow ethertype to the queues in use (ethtool -N ...
+// action <queue>) or open one transport per queue. Needs CAP_NET_ADMIN and
+// CAP_BPF (or root) and a 5.9+ kernel for bpf links.
+class XdpTransport : public Transport {
+public:
+    XdpTransport();
+    ~XdpTransport() override;
+
+    XdpTransport(const XdpTransport&) = delete;
+    XdpTransport& operator=(const XdpTransport&) = delete;
+
+    // Without a program, attaches one of its own for just this queue
+    bool open(const std::string& interface, uint32_t queue_id, std::shared_ptr<XdpProgram> program = nullptr);
+    void close();
+    bool zero_copy() const { return zero_copy_; }
+
+    bool send(const RawPacket& packet) override;
+    void flush() override;
+    bool can_receive() const override { return socket_ >= 0; }
+    size_t poll(int timeout_ms, const FrameHandler& handler) override;
+    uint64_t receive_drops() override;
+
+private:
+    // One mmapped ring shared with the kernel; entries are uint64_t frame
+    // addresses (fill, completion) or xdp_desc (RX, TX)
+    struct Ring {
+        uint32_t* producer;
+        uint32_t* consumer;
+        uint32_t* flags;
+        void* entries;
+        uint32_t mask;
+        void* map;
+        size_t map_size;
+    };
+
+    bool open_socket(int ifindex, uint32_t queue_id);
+    bool map_ring(Ring& ring, uint64_t offset, const void* offsets, size_t entry_size, uint32_t size);
+    void reclaim_completed();
+    void flush_locked();
+
+    int socket_;
+    std::shared_ptr<XdpProgram> program_;
+    bool zero_copy_;
+    uint8_t source_[6];
+
+    uint8_t* umem_;
+    Ring fill_;
+    Ring completion_;
+    Ring rx_;
+    Ring tx_;
+
+    // Transmit side: pool, ring and completion ring are under mutex_
+    std::mutex mutex_;
+    std::vector<uint64_t> free_frames_;
+    uint32_t tx_pending_;
+    std::unique_ptr<FlushTimer> flush_timer_;
+};
+
+} // namespace nerd
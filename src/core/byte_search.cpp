@@ -0,0 +1,106 @@
+#include "core/byte_search.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NERD_SEARCH_X86 1
+#endif
+
+namespace nerd {
+
+namespace {
+
+// Needles of two bytes or more; the vector kernels finish their tail here
+const char* search_scalar(const char* haystack, size_t length, const char* needle, size_t needle_length) {
+    return static_cast<const char*>(memmem(haystack, length, needle, needle_length));
+}
+
+#ifdef NERD_SEARCH_X86
+__attribute__((target("sse2")))
+const char* search_sse2(const char* haystack, size_t length, const char* needle, size_t needle_length) {
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[needle_length - 1]);
+    size_t i = 0;
+    for (; i + needle_length - 1 + 16 <= length; i += 16) {
+        __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack + i));
+        __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack + i + needle_length - 1));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last))));
+        while (mask) {
+            size_t at = i + __builtin_ctz(mask);
+            if (std::memcmp(haystack + at + 1, needle + 1, needle_length - 2) == 0) {
+                return haystack + at;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return search_scalar(haystack + i, length - i, needle, needle_length);
+}
+
+__attribute__((target("avx2")))
+const char* search_avx2(const char* haystack, size_t length, const char* needle, size_t needle_length) {
+    __m256i first = _mm256_set1_epi8(needle[0]);
+    __m256i last = _mm256_set1_epi8(needle[needle_length - 1]);
+    size_t i = 0;
+    for (; i + needle_length - 1 + 32 <= length; i += 32) {
+        __m256i head = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(haystack + i));
+        __m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(haystack + i + needle_length - 1));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, last))));
+        while (mask) {
+            size_t at = i + __builtin_ctz(mask);
+            if (std::memcmp(haystack + at + 1, needle + 1, needle_length - 2) == 0) {
+                return haystack + at;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return search_scalar(haystack + i, length - i, needle, needle_length);
+}
+#endif
+
+using SearchKernel = const char* (*)(const char*, size_t, const char*, size_t);
+
+struct Kernel {
+    SearchKernel fn;
+    const char* name;
+
+    Kernel() : fn(search_scalar), name("scalar") {
+#ifdef NERD_SEARCH_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            fn = search_avx2;
+            name = "avx2";
+        } else if (__builtin_cpu_supports("sse2")) {
+            fn = search_sse2;
+            name = "sse2";
+        }
+#endif
+    }
+};
+
+const Kernel& kernel() {
+    static const Kernel instance;
+    return instance;
+}
+
+} // namespace
+
+const char* find_bytes(const char* haystack, size_t length, const char* needle, size_t needle_length) {
+    if (needle_length == 0) {
+        return haystack;
+    }
+    if (needle_length > length) {
+        return nullptr;
+    }
+    if (needle_length == 1) {
+        return static_cast<const char*>(std::memchr(haystack, needle[0], length));
+    }
+    return kernel().fn(haystack, length, needle, needle_length);
+}
+
+const char* byte_search_kernel_name() {
+    return kernel().name;
+}
+
+} // namespace nerd
@@ -0,0 +1,210 @@
+#include "core/chunk_codec.h"
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#ifdef NERD_HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef NERD_HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+namespace nerd {
+
+namespace {
+
+#ifdef NERD_HAVE_ZSTD
+// Chunks are small and latency matters more than the last few percent
+const int ZSTD_LEVEL = 3;
+
+struct Dictionary {
+    ZSTD_CDict* compress;
+    ZSTD_DDict* decompress;
+
+    Dictionary(const std::vector<uint8_t>& bytes)
+        : compress(ZSTD_createCDict(bytes.data(), bytes.size(), ZSTD_LEVEL)),
+          decompress(ZSTD_createDDict(bytes.data(), bytes.size())) {}
+    ~Dictionary() {
+        ZSTD_freeCDict(compress);
+        ZSTD_freeDDict(decompress);
+    }
+    Dictionary(const Dictionary&) = delete;
+    Dictionary& operator=(const Dictionary&) = delete;
+};
+
+// Dictionaries are looked up per chunk but registered rarely; a lookup
+// holds the lock only long enough to copy out the shared pointer
+std::mutex dictionaries_mutex;
+std::map<uint16_t, std::shared_ptr<Dictionary>> dictionaries;
+
+std::shared_ptr<Dictionary> find_dictionary(uint16_t id) {
+    std::lock_guard<std::mutex> lock(dictionaries_mutex);
+    auto it = dictionaries.find(id);
+    return it != dictionaries.end() ? it->second : nullptr;
+}
+
+// One context per thread, reused across chunks
+struct Contexts {
+    ZSTD_CCtx* compress;
+    ZSTD_DCtx* decompress;
+
+    Contexts() : compress(ZSTD_createCCtx()), decompress(ZSTD_createDCtx()) {}
+    ~Contexts() {
+        ZSTD_freeCCtx(compress);
+        ZSTD_freeDCtx(decompress);
+    }
+};
+
+Contexts& contexts() {
+    thread_local Contexts instance;
+    return instance;
+}
+#endif
+
+} // namespace
+
+bool codec_available(ChunkCodec codec) {
+    switch (codec) {
+        case CODEC_NONE:
+            return true;
+#ifdef NERD_HAVE_LZ4
+        case CODEC_LZ4:
+            return true;
+#endif
+#ifdef NERD_HAVE_ZSTD
+        case CODEC_ZSTD:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+const char* codec_name(ChunkCodec codec) {
+    switch (codec) {
+        case CODEC_NONE: return "none";
+        case CODEC_LZ4: return "lz4";
+        case CODEC_ZSTD: return "zstd";
+        default: return "unknown";
+    }
+}
+
+size_t compress_chunk(ChunkCodec codec, [[maybe_unused]] uint16_t dictionary, [[maybe_unused]] const uint8_t* src,
+                      size_t length, [[maybe_unused]] uint8_t* dest, size_t capacity) {
+    size_t limit = std::min(capacity, length > 0 ? length - 1 : 0);
+    if (limit == 0) {
+        return 0;
+    }
+    switch (codec) {
+#ifdef NERD_HAVE_LZ4
+        case CODEC_LZ4: {
+            int size = LZ4_compress_default(reinterpret_cast<const char*>(src), reinterpret_cast<char*>(dest),
+                                            static_cast<int>(length), static_cast<int>(limit));
+            return size > 0 ? static_cast<size_t>(size) : 0;
+        }
+#endif
+#ifdef NERD_HAVE_ZSTD
+        case CODEC_ZSTD: {
+            size_t size;
+            std::shared_ptr<Dictionary> shared = dictionary ? find_dictionary(dictionary) : nullptr;
+            if (dictionary && !shared) {
+                return 0;  // Peers could not decode it either
+            }
+            if (shared) {
+                size = ZSTD_compress_usingCDict(contexts().compress, dest, limit, src, length, shared->compress);
+            } else {
+                size = ZSTD_compressCCtx(contexts().compress, dest, limit, src, length, ZSTD_LEVEL);
+            }
+            return ZSTD_isError(size) ? 0 : size;
+        }
+#endif
+        default:
+            return 0;
+    }
+}
+
+bool decompress_chunk(ChunkCodec codec, [[maybe_unused]] uint16_t dictionary, [[maybe_unused]] const uint8_t* src,
+                      [[maybe_unused]] size_t length, [[maybe_unused]] uint8_t* dest, [[maybe_unused]] size_t expected) {
+    switch (codec) {
+#ifdef NERD_HAVE_LZ4
+        case CODEC_LZ4: {
+            int size = LZ4_decompress_safe(reinterpret_cast<const char*>(src), reinterpret_cast<char*>(dest),
+                                           static_cast<int>(length), static_cast<int>(expected));
+            return size >= 0 && static_cast<size_t>(size) == expected;
+        }
+#endif
+#ifdef NERD_HAVE_ZSTD
+        case CODEC_ZSTD: {
+            size_t size;
+            if (dictionary) {
+                std::shared_ptr<Dictionary> shared = find_dictionary(dictionary);
+                if (!shared) {
+                    return false;
+                }
+                size = ZSTD_decompress_usingDDict(contexts().decompress, dest, expected, src, length, shared->decompress);
+            } else {
+                size = ZSTD_decompressDCtx(contexts().decompress, dest, expected, src, length);
+            }
+            return !ZSTD_isError(size) && size == expected;
+        }
+#endif
+        default:
+            return false;
+    }
+}
+
+bool register_dictionary(uint16_t id, const std::vector<uint8_t>& dictionary) {
+#ifdef NERD_HAVE_ZSTD
+    if (id == 0 || dictionary.empty()) {
+        return false;
+    }
+    auto shared = std::make_shared<Dictionary>(dictionary);
+    if (!shared->compress || !shared->decompress) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(dictionaries_mutex);
+    dictionaries[id] = shared;
+    return true;
+#else
+    (void)id;
+    (void)dictionary;
+    return false;
+#endif
+}
+
+bool has_dictionary(uint16_t id) {
+#ifdef NERD_HAVE_ZSTD
+    return id != 0 && find_dictionary(id) != nullptr;
+#else
+    (void)id;
+    return false;
+#endif
+}
+
+std::vector<uint8_t> train_dictionary(const std::vector<std::string>& samples, size_t capacity) {
+#ifdef NERD_HAVE_ZSTD
+    std::string joined;
+    std::vector<size_t> sizes;
+    for (const auto& sample : samples) {
+        joined += sample;
+        sizes.push_back(sample.size());
+    }
+    std::vector<uint8_t> dictionary(capacity);
+    size_t size = ZDICT_trainFromBuffer(dictionary.data(), capacity, joined.data(), sizes.data(),
+                                        static_cast<unsigned>(sizes.size()));
+    if (ZDICT_isError(size)) {
+        return std::vector<uint8_t>();
+    }
+    dictionary.resize(size);
+    return dictionary;
+#else
+    (void)samples;
+    (void)capacity;
+    return std::vector<uint8_t>();
+#endif
+}
+
+} // namespace nerd
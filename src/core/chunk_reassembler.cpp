@@ -0,0 +1,308 @@
+#include "core/chunk_reassembler.h"
+#include "core/fec.h"
+#include "core/chunk_codec.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace nerd {
+
+namespace {
+
+uint32_t chunks_for(size_t length) {
+    return static_cast<uint32_t>((length + FLOW_CHUNK_SIZE - 1) / FLOW_CHUNK_SIZE);
+}
+
+// Expected payload of chunk index in content of the given length
+size_t chunk_length(uint32_t index, size_t length) {
+    size_t offset = static_cast<size_t>(index) * FLOW_CHUNK_SIZE;
+    return offset < length ? std::min(FLOW_CHUNK_SIZE, length - offset) : 0;
+}
+
+} // namespace
+
+ChunkReassembler::ChunkReassembler()
+    : version_(0), chunk_count_(0), received_(0), max_length_(DEFAULT_MAX_FLOW_LENGTH), fec_data_chunks_(0),
+      recovered_(0) {}
+
+bool ChunkReassembler::accept(const RawPacket& packet) {
+    if (packet.payload_size() < sizeof(FlowChunkHeader)) {
+        return false;
+    }
+
+    FlowChunkHeader header;
+    std::memcpy(&header, packet.payload(), sizeof(header));
+    const uint8_t* chunk = packet.payload() + sizeof(header);
+    size_t length = packet.payload_size() - sizeof(header);
+    uint32_t index = packet.header().sequence;
+
+    if (!adopt_version(header.version, header.total_length) || index >= chunk_count_) {
+        return false;
+    }
+    if (has(index) && chunk_versions_[index] > header.version) {
+        return false;  // A newer copy of this chunk is already in place
+    }
+
+    size_t expected = chunk_length(index, data_.size());
+    uint8_t* dest = data_.data() + static_cast<size_t>(index) * FLOW_CHUNK_SIZE;
+    if (packet.header().flags & PACKET_COMPRESSED) {
+        // Decoded straight to its final offset; a failed decode may have
+        // clobbered the old copy, so the chunk is wanted again
+        if (!decompress_chunk(static_cast<ChunkCodec>(packet.header().codec), packet.header().dictionary,
+                              chunk, length, dest, expected)) {
+            unmark(index);
+            return false;
+        }
+    } else {
+        if (length != expected) {
+            return false;
+        }
+        std::memcpy(dest, chunk, length);
+    }
+    mark(index, header.version);
+    
+    if (fec_data_chunks_ != 0) {
+        try_recover(index / fec_data_chunks_);
+    }
+    return true;
+}
+
+bool ChunkReassembler::accept_parity(const RawPacket& packet) {
+    if (packet.payload_size() != sizeof(FlowParityHeader) + FLOW_CHUNK_SIZE) {
+        return false;
+    }
+    
+    FlowParityHeader header;
+    std::memcpy(&header, packet.payload(), sizeof(header));
+    if (header.data_chunks == 0 || header.data_chunks > FEC_MAX_DATA ||
+        header.group_chunks == 0 || header.group_chunks > header.data_chunks ||
+        header.parity_chunks == 0 || header.parity_chunks > FEC_MAX_PARITY || header.row >= header.parity_chunks) {
+        return false;
+    }
+    
+    if (!adopt_version(header.version, header.total_length) ||
+        static_cast<uint64_t>(header.group) * header.data_chunks >= chunk_count_) {
+        return false;
+    }
+    
+    // Parity of a newer emission replaces whatever the group had collected
+    ParityGroup& group = parity_[header.group];
+    size_t block_bytes = static_cast<size_t>(header.parity_chunks) * FLOW_CHUNK_SIZE;
+    if (group.blocks.empty() || header.version > group.version) {
+        group.version = header.version;
+        group.data_chunks = header.data_chunks;
+        group.group_chunks = header.group_chunks;
+        group.rows = 0;
+        group.blocks.assign(block_bytes, 0);
+    } else if (header.version < group.version || group.blocks.size() != block_bytes ||
+               group.data_chunks != header.data_chunks || group.group_chunks != header.group_chunks) {
+        return false;
+    }
+    
+    uint64_t bit = uint64_t(1) << header.row;
+    if (!(group.rows & bit)) {
+        std::memcpy(group.blocks.data() + static_cast<size_t>(header.row) * FLOW_CHUNK_SIZE,
+                    packet.payload() + sizeof(header), FLOW_CHUNK_SIZE);
+        group.rows |= bit;
+    }
+    
+    fec_data_chunks_ = header.data_chunks;
+    try_recover(header.group);
+    return true;
+}
+
+void ChunkReassembler::reset() {
+    // Storage is released, not just emptied: a reset copy may be large
+    std::vector<uint8_t>().swap(data_);
+    std::vector<uint64_t>().swap(present_);
+    std::vector<uint64_t>().swap(chunk_versions_);
+    parity_.clear();
+    version_ = 0;
+    chunk_count_ = 0;
+    received_ = 0;
+    fec_data_chunks_ = 0;
+}
+
+void ChunkReassembler::restore(const uint8_t* data, size_t total_length, uint64_t version, const uint64_t* present) {
+    reset();
+    version_ = version;
+    resize(total_length);
+    std::memcpy(data_.data(), data, total_length);
+    for (uint32_t index = 0; index < chunk_count_; ++index) {
+        if ((present[index >> 6] >> (index & 63)) & 1) {
+            mark(index, version);
+        }
+    }
+}
+
+bool ChunkReassembler::adopt_version(uint64_t version, uint64_t total_length) {
+    // The newest version seen decides the content length; the length is the
+    // peer's word, so one that is too large or too many chunks is refused
+    // before anything is allocated for it
+    if (version > version_ || !started()) {
+        if (total_length > max_length_ ||
+            total_length > uint64_t(std::numeric_limits<uint32_t>::max()) * FLOW_CHUNK_SIZE) {
+            return false;
+        }
+        version_ = version;
+        resize(total_length);
+    }
+    return true;
+}
+
+void ChunkReassembler::mark(uint32_t index, uint64_t version) {
+    if (!has(index)) {
+        present_[index >> 6] |= uint64_t(1) << (index & 63);
+        ++received_;
+    }
+    chunk_versions_[index] = version;
+}
+
+void ChunkReassembler::unmark(uint32_t index) {
+    if (has(index)) {
+        present_[index >> 6] &= ~(uint64_t(1) << (index & 63));
+        --received_;
+    }
+}
+
+void ChunkReassembler::try_recover(uint32_t group_index) {
+    auto it = parity_.find(group_index);
+    if (it == parity_.end()) {
+        return;
+    }
+    ParityGroup& group = it->second;
+    
+    uint32_t first = group_index * group.data_chunks;
+    if (first >= chunk_count_) {
+        parity_.erase(it);
+        return;
+    }
+    uint32_t count = std::min<uint32_t>(group.data_chunks, chunk_count_ - first);
+    if (count != group.group_chunks) {
+        return;  // Content length moved since this parity was made
+    }
+    
+    // Chunks older than the parity may be stale, so they count as lost too;
+    // a newer one means the parity itself is stale
+    std::vector<uint32_t> erased;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t index = first + i;
+        if (!has(index) || chunk_versions_[index] < group.version) {
+            erased.push_back(i);
+        } else if (chunk_versions_[index] > group.version) {
+            parity_.erase(it);
+            return;
+        }
+    }
+    if (erased.empty()) {
+        parity_.erase(it);
+        return;
+    }
+    if (erased.size() > static_cast<size_t>(__builtin_popcountll(group.rows))) {
+        return;  // Wait for more parity or for the chunks themselves
+    }
+    
+    // Surviving chunks are read in place; only a short last chunk is padded
+    std::vector<uint8_t> padded(FLOW_CHUNK_SIZE, 0);
+    std::vector<const uint8_t*> data(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t index = first + i;
+        size_t length = chunk_length(index, data_.size());
+        data[i] = data_.data() + static_cast<size_t>(index) * FLOW_CHUNK_SIZE;
+        if (length < FLOW_CHUNK_SIZE && has(index)) {
+            std::memcpy(padded.data(), data[i], length);
+            data[i] = padded.data();
+        }
+    }
+    
+    std::vector<const uint8_t*> parity;
+    std::vector<uint32_t> rows;
+    for (uint32_t row = 0; row < 64 && rows.size() < erased.size(); ++row) {
+        if (group.rows & (uint64_t(1) << row)) {
+            parity.push_back(group.blocks.data() + static_cast<size_t>(row) * FLOW_CHUNK_SIZE);
+            rows.push_back(row);
+        }
+    }
+    
+    std::vector<uint8_t> output(erased.size() * FLOW_CHUNK_SIZE);
+    std::vector<uint8_t*> recovered(erased.size());
+    for (size_t k = 0; k < erased.size(); ++k) {
+        recovered[k] = output.data() + k * FLOW_CHUNK_SIZE;
+    }
+    if (!fec_recover(data.data(), count, erased, parity.data(), rows.data(), recovered.data(), FLOW_CHUNK_SIZE)) {
+        return;
+    }
+    
+    uint64_t version = group.version;
+    parity_.erase(it);
+    for (size_t k = 0; k < erased.size(); ++k) {
+        uint32_t index = first + erased[k];
+        std::memcpy(data_.data() + static_cast<size_t>(index) * FLOW_CHUNK_SIZE, recovered[k],
+                    chunk_length(index, data_.size()));
+        mark(index, version);
+        ++recovered_;
+    }
+}
+
+void ChunkReassembler::resize(size_t total_length) {
+    size_t old_length = data_.size();
+    uint32_t old_count = chunk_count_;
+    uint32_t count = chunks_for(total_length);
+
+    data_.resize(total_length);
+    present_.resize((count + 63) / 64, 0);
+    chunk_versions_.resize(count, 0);
+    chunk_count_ = count;
+
+    // Drop bits past the new end, and any chunk whose extent the resize changed
+    if (count < old_count) {
+        if (count & 63) {
+            present_[count >> 6] &= (uint64_t(1) << (count & 63)) - 1;
+        }
+    }
+    uint32_t edges[2] = {old_count ? old_count - 1 : 0, count ? count - 1 : 0};
+    for (uint32_t edge : edges) {
+        if (edge < count && has(edge) && chunk_length(edge, old_length) != chunk_length(edge, total_length)) {
+            present_[edge >> 6] &= ~(uint64_t(1) << (edge & 63));
+        }
+    }
+
+    received_ = 0;
+    for (uint64_t word : present_) {
+        received_ += __builtin_popcountll(word);
+    }
+    
+    for (auto it = parity_.begin(); it != parity_.end();) {
+        if (static_cast<uint64_t>(it->first) * it->second.data_chunks >= count) {
+            it = parity_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+size_t ChunkReassembler::contiguous_bytes() const {
+    for (size_t word = 0; word < present_.size(); ++word) {
+        if (~present_[word] != 0) {
+            uint32_t index = static_cast<uint32_t>(word * 64 + __builtin_ctzll(~present_[word]));
+            return std::min(data_.size(), static_cast<size_t>(index) * FLOW_CHUNK_SIZE);
+        }
+    }
+    return data_.size();
+}
+
+std::vector<uint32_t> ChunkReassembler::missing(size_t max) const {
+    std::vector<uint32_t> gaps;
+    for (uint32_t index = 0; index < chunk_count_ && gaps.size() < max; ++index) {
+        if ((index & 63) == 0 && present_[index >> 6] == ~uint64_t(0)) {
+            index += 63;  // Whole word present
+            continue;
+        }
+        if (!has(index)) {
+            gaps.push_back(index);
+        }
+    }
+    return gaps;
+}
+
+} // namespace nerd
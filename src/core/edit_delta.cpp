@@ -0,0 +1,146 @@
+#include "core/edit_delta.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+namespace nerd {
+
+namespace {
+
+void append_bytes(std::vector<uint8_t>& out, const void* data, size_t length) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    out.insert(out.end(), bytes, bytes + length);
+}
+
+// Close the payload under construction by patching in its splice count
+void finish_payload(std::vector<std::vector<uint8_t>>& payloads, std::vector<uint8_t>& payload,
+                    uint32_t splice_count) {
+    if (splice_count == 0) {
+        return;
+    }
+    std::memcpy(payload.data() + offsetof(EditDeltaHeader, splice_count), &splice_count, sizeof(splice_count));
+    payloads.push_back(std::move(payload));
+    payload.clear();
+}
+
+} // namespace
+
+std::vector<std::vector<uint8_t>> encode_edit_deltas(const std::vector<ContentSplice>& splices,
+                                                     uint64_t base_version, size_t max_payload) {
+    std::vector<std::vector<uint8_t>> payloads;
+    const size_t overhead = sizeof(EditDeltaHeader) + sizeof(SpliceRecord);
+    if (max_payload <= overhead) {
+        return payloads;
+    }
+    
+    std::vector<uint8_t> payload;
+    uint32_t splice_count = 0;
+    
+    for (const auto& splice : splices) {
+        uint32_t offset = splice.offset;
+        uint32_t erase_length = splice.erase_length;
+        size_t position = 0;
+        
+        // Runs at least once so pure deletions are emitted too
+        for (;;) {
+            if (payload.empty()) {
+                EditDeltaHeader header;
+                header.base_version = base_version + payloads.size();
+                header.splice_count = 0;
+                append_bytes(payload, &header, sizeof(header));
+            }
+            
+            size_t room = max_payload - payload.size();
+            size_t remaining = splice.insert.size() - position;
+            if (room < sizeof(SpliceRecord) + (remaining ? 1 : 0)) {
+                finish_payload(payloads, payload, splice_count);
+                splice_count = 0;
+                continue;
+            }
+            
+            size_t take = std::min(remaining, room - sizeof(SpliceRecord));
+            SpliceRecord record;
+            record.offset = offset;
+            record.erase_length = erase_length;
+            record.insert_length = static_cast<uint32_t>(take);
+            append_bytes(payload, &record, sizeof(record));
+            append_bytes(payload, splice.insert.data() + position, take);
+            ++splice_count;
+            
+            // The rest of the insert continues right after this piece
+            position += take;
+            offset += static_cast<uint32_t>(take);
+            erase_length = 0;
+            if (position == splice.insert.size()) {
+                break;
+            }
+        }
+    }
+    
+    finish_payload(payloads, payload, splice_count);
+    return payloads;
+}
+
+bool decode_edit_delta(const uint8_t* data, size_t length, uint64_t& base_version,
+                       std::vector<ContentSplice>& splices) {
+    if (length < sizeof(EditDeltaHeader)) {
+        return false;
+    }
+    
+    EditDeltaHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    size_t position = sizeof(header);
+    
+    // The count is the peer's word: one the payload cannot hold is refused
+    // before anything is reserved for it
+    if (header.splice_count > (length - position) / sizeof(SpliceRecord)) {
+        return false;
+    }
+    
+    splices.clear();
+    splices.reserve(header.splice_count);
+    for (uint32_t i = 0; i < header.splice_count; ++i) {
+        if (length - position < sizeof(SpliceRecord)) {
+            return false;
+        }
+        SpliceRecord record;
+        std::memcpy(&record, data + position, sizeof(record));
+        position += sizeof(record);
+        
+        if (length - position < record.insert_length) {
+            return false;
+        }
+        uint32_t offset = record.offset;
+        uint32_t erase_length = record.erase_length;
+        splices.emplace_back(offset, erase_length,
+                             std::string(reinterpret_cast<const char*>(data + position), record.insert_length));
+        position += record.insert_length;
+    }
+    
+    base_version = header.base_version;
+    return position == length;
+}
+
+bool splices_in_range(size_t size, const std::vector<ContentSplice>& splices) {
+    for (const auto& splice : splices) {
+        if (splice.offset > size || splice.erase_length > size - splice.offset) {
+            return false;
+        }
+        size = size - splice.erase_length + splice.insert.size();
+    }
+    return true;
+}
+
+bool apply_splices(TextBuffer& content, const std::vector<ContentSplice>& splices) {
+    // Validate against the running length first so a bad delta changes nothing
+    if (!splices_in_range(content.size(), splices)) {
+        return false;
+    }
+    
+    for (const auto& splice : splices) {
+        content.replace(splice.offset, splice.erase_length, splice.insert);
+    }
+    return true;
+}
+
+} // namespace nerd
@@ -0,0 +1,115 @@
+#include "core/fec.h"
+#include "core/gf256.h"
+#include <cstring>
+#include <utility>
+
+namespace nerd {
+
+namespace {
+
+// Cauchy points: x_j = j for parity rows, y_i = 128 + i for data columns
+uint8_t cauchy(uint32_t row, uint32_t column) {
+    return gf_inv(static_cast<uint8_t>(row ^ (FEC_MAX_DATA + column)));
+}
+
+} // namespace
+
+uint8_t fec_coefficient(uint32_t parity_row, uint32_t data_column) {
+    // Dividing each column by its row-0 entry keeps every square submatrix
+    // invertible and turns the first parity block into XOR parity
+    return gf_div(cauchy(parity_row, data_column), cauchy(0, data_column));
+}
+
+void fec_encode(const uint8_t* const* data, size_t data_count,
+                uint8_t* const* parity, size_t parity_count, size_t block_size) {
+    for (size_t j = 0; j < parity_count; ++j) {
+        std::memset(parity[j], 0, block_size);
+        for (size_t i = 0; i < data_count; ++i) {
+            gf_mul_add(parity[j], data[i], fec_coefficient(static_cast<uint32_t>(j), static_cast<uint32_t>(i)), block_size);
+        }
+    }
+}
+
+bool fec_recover(const uint8_t* const* data, size_t data_count, const std::vector<uint32_t>& erased,
+                 const uint8_t* const* parity, const uint32_t* parity_rows,
+                 uint8_t* const* recovered, size_t block_size) {
+    size_t e = erased.size();
+    if (e == 0) {
+        return true;
+    }
+    if (data_count > FEC_MAX_DATA || e > data_count || e > FEC_MAX_PARITY) {
+        return false;
+    }
+    
+    // Syndromes: each parity block with the surviving data folded back out
+    std::vector<bool> lost(data_count, false);
+    for (uint32_t column : erased) {
+        if (column >= data_count || lost[column]) {
+            return false;
+        }
+        lost[column] = true;
+    }
+    std::vector<std::vector<uint8_t>> syndrome(e, std::vector<uint8_t>(block_size));
+    for (size_t r = 0; r < e; ++r) {
+        if (parity_rows[r] >= FEC_MAX_PARITY) {
+            return false;
+        }
+        std::memcpy(syndrome[r].data(), parity[r], block_size);
+        for (size_t i = 0; i < data_count; ++i) {
+            if (!lost[i]) {
+                gf_mul_add(syndrome[r].data(), data[i], fec_coefficient(parity_rows[r], static_cast<uint32_t>(i)), block_size);
+            }
+        }
+    }
+    
+    // Invert the e x e submatrix (parity rows by erased columns) with
+    // Gauss-Jordan elimination; Cauchy submatrices are never singular, but a
+    // repeated parity row would make it so
+    std::vector<uint8_t> matrix(e * e), inverse(e * e, 0);
+    for (size_t r = 0; r < e; ++r) {
+        for (size_t c = 0; c < e; ++c) {
+            matrix[r * e + c] = fec_coefficient(parity_rows[r], erased[c]);
+        }
+        inverse[r * e + r] = 1;
+    }
+    for (size_t col = 0; col < e; ++col) {
+        size_t pivot = col;
+        while (pivot < e && matrix[pivot * e + col] == 0) {
+            ++pivot;
+        }
+        if (pivot == e) {
+            return false;
+        }
+        if (pivot != col) {
+            for (size_t c = 0; c < e; ++c) {
+                std::swap(matrix[pivot * e + c], matrix[col * e + c]);
+                std::swap(inverse[pivot * e + c], inverse[col * e + c]);
+            }
+        }
+        uint8_t scale = gf_inv(matrix[col * e + col]);
+        for (size_t c = 0; c < e; ++c) {
+            matrix[col * e + c] = gf_mul(matrix[col * e + c], scale);
+            inverse[col * e + c] = gf_mul(inverse[col * e + c], scale);
+        }
+        for (size_t r = 0; r < e; ++r) {
+            uint8_t factor = matrix[r * e + col];
+            if (r == col || factor == 0) {
+                continue;
+            }
+            for (size_t c = 0; c < e; ++c) {
+                matrix[r * e + c] ^= gf_mul(factor, matrix[col * e + c]);
+                inverse[r * e + c] ^= gf_mul(factor, inverse[col * e + c]);
+            }
+        }
+    }
+    
+    for (size_t k = 0; k < e; ++k) {
+        std::memset(recovered[k], 0, block_size);
+        for (size_t r = 0; r < e; ++r) {
+            gf_mul_add(recovered[k], syndrome[r].data(), inverse[k * e + r], block_size);
+        }
+    }
+    return true;
+}
+
+} // namespace nerd
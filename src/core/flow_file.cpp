@@ -1,27 +1,121 @@
 #include "core/flow_file.h"
-#include <sstream>
+#include "core/fec.h"
+#include "core/chunk_codec.h"
+#include "core/spill_file.h"
+#include "core/log.h"
+#include "network/crc32c.h"
 #include <algorithm>
-#include <iostream>
+#include <iterator>
+#include <cstring>
+#include <chrono>
 
 namespace nerd {
 
+namespace {
+
+// Payload bytes per edit delta; data chunks carry FLOW_CHUNK_SIZE content bytes
+const size_t MAX_PACKET_SIZE = 1400;
+
+// Chunks are clean until an edit touches them
+const size_t CLEAN = std::string::npos;
+
+// In-place rewrites tracked apart before they are re-emitted as one range
+const size_t MAX_DIRTY_RANGES = 64;
+
+// Out-of-order deltas held while waiting for the gap to fill
+const size_t MAX_PENDING_EDITS = 1024;
+
+// Substitution matches this close together share one splice: the bytes
+// between them cost less to resend than a splice record and a notification
+const size_t SUBSTITUTE_MERGE_GAP = 64;
+
+// Gap requests: at most one per interval, and the tail is only asked for
+// once chunks have stopped arriving for the settle time
+const uint64_t NACK_INTERVAL_US = 100000;
+const uint64_t NACK_SETTLE_US = 50000;
+const size_t MAX_NACK_CHUNKS = 4096;
+
+// Copies adopted from peers or snapshots at least this large live in the
+// spill file, with only the leaves being viewed or edited resident
+const size_t STREAMING_BYTES = size_t(16) << 20;
+
+// FLOW_DATA and FLOW_PARITY payloads both lead with the content version
+uint64_t payload_version(const RawPacket& packet) {
+    uint64_t version = 0;
+    if (packet.payload_size() >= sizeof(version)) {
+        std::memcpy(&version, packet.payload(), sizeof(version));
+    }
+    return version;
+}
+
+// Deltas remembered by the version they produced, for telling a duplicate
+// from a concurrent edit
+void remember_delta(std::map<uint64_t, uint32_t>& history, uint64_t version, uint32_t crc) {
+    history[version] = crc;
+    while (history.size() > MAX_PENDING_EDITS) {
+        history.erase(history.begin());
+    }
+}
+
+uint32_t chunks_for(size_t length) {
+    return static_cast<uint32_t>((length + FLOW_CHUNK_SIZE - 1) / FLOW_CHUNK_SIZE);
+}
+
+uint64_t monotonic_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
 FlowFile::FlowFile(FlowID id, const std::string& name) 
-    : identifier_(id), name_(name), is_modified_(false) {
+    : identifier_(id), name_(name), is_modified_(false), version_(0), in_transaction_(false), dirty_offset_(CLEAN),
+      paged_bytes_(0), chunk_frontier_(0), last_chunk_us_(0), last_nack_us_(0),
+      awaiting_content_(false), resyncing_(false), restored_(false), catch_up_version_(0), chunks_patched_(false), snapshot_saved_(false),
+      saved_version_(0), saved_chunks_(0), network_flow_(nullptr), next_listener_id_(1) {
     pattern_.id = id;
     pattern_.name = name;
 }
 
-FlowFile::~FlowFile() = default;
+FlowFile::~FlowFile() {
+    // The network may be building one of our chunks; wait it out
+    if (chunk_source_) {
+        std::lock_guard<std::mutex> lock(chunk_source_->mutex);
+        chunk_source_->materialize = nullptr;
+    }
+}
+
+void FlowFile::attach_network(NetworkFlow* network_flow) {
+    std::lock_guard<std::recursive_mutex> content_lock(content_mutex_);
+    network_flow_ = network_flow;
+    if (network_flow_ && !chunk_source_) {
+        serve_chunks();
+    }
+}
 
 void FlowFile::maintain_flow() {
-    // Encode current content into network packets
-    encode_content_in_packets();
-    
-    // Update circulation pattern if needed
-    if (is_modified_) {
-        broadcast_existence();
+    // Chunks are built under the content lock and paced out once it is
+    // dropped, so waiting on the transmit budget holds up neither edits nor
+    // the network serving the flow's other chunks
+    std::vector<RawPacket> packets;
+    {
+        std::lock_guard<std::recursive_mutex> content_lock(content_mutex_);
+        // Re-emit only the chunks local edits touched; clean chunks keep circulating
+        if (dirty_offset_ != CLEAN || !dirty_ranges_.empty()) {
+            encode_content_in_packets(packets);
+        }
+        
+        // Pattern changes need no broadcast of their own: FlowManager's
+        // discovery summary already announces the flow
         is_modified_ = false;
     }
+    
+    if (network_flow_ && !packets.empty()) {
+        for (const auto& packet : packets) {
+            network_flow_->broadcast_packet(packet);
+        }
+        network_flow_->flush_transmit();
+    }
 }
 
 void FlowFile::modify_pattern(const EditCommand& cmd) {
@@ -44,63 +138,539 @@ void FlowFile::modify_pattern(const EditCommand& cmd) {
     }
 }
 
-std::string FlowFile::read_from_flow() {
-    // In a real implementation, this would read from the circulating packets
-    // For now, return the current content
-    return content_;
+size_t FlowFile::apply_commands(const std::vector<EditCommand>& commands) {
+    std::lock_guard<std::recursive_mutex> content_lock(content_mutex_);
+    size_t old_size = content_.size();
+    size_t old_newlines = content_.newlines_before(old_size);
+    
+    in_transaction_ = true;
+    for (const auto& cmd : commands) {
+        modify_pattern(cmd);
+    }
+    in_transaction_ = false;
+    if (outgoing_.empty()) {
+        return 0;
+    }
+    
+    // The splices all fall between the shortest unchanged prefix and the
+    // shortest unchanged suffix any of them left, so one change covers them
+    size_t prefix = old_size;
+    size_t suffix = old_size;
+    size_t length = old_size;
+    for (const auto& splice : outgoing_) {
+        prefix = std::min<size_t>(prefix, splice.offset);
+        suffix = std::min<size_t>(suffix, length - splice.offset - splice.erase_length);
+        length = length - splice.erase_length + splice.insert.size();
+    }
+    
+    size_t changed_end = content_.size() - suffix;
+    int first_line = static_cast<int>(content_.newlines_before(prefix));
+    int suffix_lines = static_cast<int>(content_.newlines_before(content_.size()) - content_.newlines_before(changed_end));
+    std::string inserted = content_.substr(prefix, changed_end - prefix);
+    
+    ContentChange change;
+    change.offset = prefix;
+    change.erased_bytes = old_size - suffix - prefix;
+    change.inserted = inserted;
+    change.first_line = first_line;
+    change.erased_lines = static_cast<int>(old_newlines) - first_line - suffix_lines;
+    change.inserted_lines = static_cast<int>(content_.newlines_before(changed_end)) - first_line;
+    
+    size_t splices = outgoing_.size();
+    transmit_edits();
+    change.version = version_;
+    for (const auto& entry : change_listeners_) {
+        entry.second(change);
+    }
+    outgoing_.clear();
+    outgoing_changes_.clear();
+    is_modified_ = true;
+    return splices;
 }
 
 void FlowFile::write_to_flow(const std::string& data) {
-    content_ = data;
-    is_modified_ = true;
-    notify_content_change();
+    std::lock_guard<std::recursive_mutex> content_lock(content_mutex_);
+    splice_content(ContentSplice(0, static_cast<uint32_t>(content_.size()), data));
+    publish_edits();
 }
 
 void FlowFile::append_content(const std::string& line) {
+    std::lock_guard<std::recursive_mutex> content_lock(content_mutex_);
+    std::string text = line;
     if (!content_.empty() && content_.back() != '\n') {
-        content_ += '\n';
+        text.insert(text.begin(), '\n');
     }
-    content_ += line;
-    is_modified_ = true;
-    notify_content_change();
+    splice_content(ContentSplice(static_cast<uint32_t>(content_.size()), 0, text));
+    publish_edits();
 }
 
 void FlowFile::delete_content(int start_line, int end_line) {
-    std::vector<std::string> lines = split_into_lines(content_);
+    std::lock_guard<std::recursive_mutex> content_lock(content_mutex_);
+    int lines = content_.line_count();
     
-    if (start_line >= 0 && start_line < static_cast<int>(lines.size()) &&
-        end_line >= start_line && end_line < static_cast<int>(lines.size())) {
+    if (start_line >= 0 && start_line < lines && end_line >= start_line && end_line < lines) {
+        size_t begin = content_.line_offset(start_line);
+        size_t end = content_.line_offset(end_line + 1);
         
-        lines.erase(lines.begin() + start_line, lines.begin() + end_line + 1);
-        content_ = join_lines(lines);
-        is_modified_ = true;
-        notify_content_change();
+        // Dropping the last line also drops the newline that separated it
+        if (end_line + 1 == lines && begin > 0) {
+            --begin;
+        }
+        
+        splice_content(ContentSplice(static_cast<uint32_t>(begin), static_cast<uint32_t>(end - begin), ""));
+        publish_edits();
     }
 }
 
 void FlowFile::substitute_content(const std::string& pattern, const std::string& replacement) {
-    size_t pos = 0;
-    while ((pos = content_.find(pattern, pos)) != std::string::npos) {
-        content_.replace(pos, pattern.length(), replacement);
-        pos += replacement.length();
+    std::lock_guard<std::recursive_mutex> content_lock(content_mutex_);
+    if (pattern.empty()) {
+        return;
     }
-    is_modified_ = true;
-    notify_content_change();
+    
+    // One scan finds every match; the replacement text for each run of
+    // nearby matches is built once, and all of it before the content moves
+    std::vector<size_t> matches = content_.find_all(pattern);
+    std::vector<ContentSplice> splices;
+    long shift = 0;  // Earlier splices' growth, since each applies to the content after them
+    for (size_t first = 0; first < matches.size();) {
+        size_t last = first;
+        while (last + 1 < matches.size() && matches[last + 1] - (matches[last] + pattern.size()) <= SUBSTITUTE_MERGE_GAP) {
+            ++last;
+        }
+        
+        size_t begin = matches[first];
+        size_t end = matches[last] + pattern.size();
+        ContentSplice splice;
+        splice.offset = static_cast<uint32_t>(begin + shift);
+        splice.erase_length = static_cast<uint32_t>(end - begin);
+        splice.insert.reserve(end - begin + (last - first + 1) * replacement.size());
+        for (size_t i = first; i <= last; ++i) {
+            splice.insert += replacement;
+            if (i < last) {
+                size_t gap_begin = matches[i] + pattern.size();
+                size_t at = splice.insert.size();
+                splice.insert.resize(at + matches[i + 1] - gap_begin);
+                content_.copy(gap_begin, matches[i + 1] - gap_begin, &splice.insert[at]);
+            }
+        }
+        shift += static_cast<long>(splice.insert.size()) - static_cast<long>(splice.erase_length);
+        splices.push_back(std::move(splice));
+        first = last + 1;
+    }
+    
+    for (const auto& splice : splices) {
+        splice_content(splice);
+    }
+    publish_edits();
 }
 
 void FlowFile::insert_content(int line, const std::string& content) {
-    std::vector<std::string> lines = split_into_lines(content_);
+    std::lock_guard<std::recursive_mutex> content_lock(content_mutex_);
+    int lines = content_.line_count();
     
-    if (line >= 0 && line <= static_cast<int>(lines.size())) {
-        std::vector<std::string> insert_lines = split_into_lines(content);
-        lines.insert(lines.begin() + line, insert_lines.begin(), insert_lines.end());
-        this->content_ = join_lines(lines);
+    if (line >= 0 && line <= lines) {
+        std::string text = content;
+        if (!text.empty() && text.back() == '\n') {
+            text.pop_back();
+        }
+        if (text.empty() && content.empty()) {
+            return;
+        }
+        
+        size_t offset;
+        if (line < lines) {
+            offset = content_.line_offset(line);
+            text += '\n';
+        } else {
+            offset = content_.size();
+            if (!content_.empty() && content_.back() != '\n') {
+                text.insert(text.begin(), '\n');
+            }
+        }
+        
+        splice_content(ContentSplice(static_cast<uint32_t>(offset), 0, text));
+        publish_edits();
+    }
+}
+
+void FlowFile::receive_edit(const RawPacket& packet) {
+    std::lock_guard<std::mutex> lock(inbox_mutex_);
+    inbox_.push_back(packet);
+}
+
+size_t FlowFile::apply_received_edits() {
+    std::lock_guard<std::mutex> lock(chunk_mutex_);
+    std::lock_guard<std::recursive_mutex> content_lock(content_mutex_);
+    std::vector<RawPacket> packets;
+    {
+        std::lock_guard<std::mutex> inbox_lock(inbox_mutex_);
+        packets.swap(inbox_);
+    }
+    
+    // Two deltas made against the same version: the one with the larger CRC
+    // wins on every holder, and a holder that applied the other refetches
+    bool diverged = false;
+    for (const auto& packet : packets) {
+        uint64_t base_version;
+        PendingEdit edit;
+        if (!decode_edit_delta(packet.payload(), packet.payload_size(), base_version, edit.splices)) {
+            continue;
+        }
+        edit.crc = crc32c(0, packet.payload(), packet.payload_size());
+        if (base_version < version_) {
+            // A duplicate, one too old to tell, or a concurrent edit
+            auto held = delta_history_.find(base_version + 1);
+            if (held != delta_history_.end() && held->second < edit.crc) {
+                diverged = true;
+            }
+            continue;
+        }
+        auto pending = pending_edits_.find(base_version);
+        if (pending == pending_edits_.end() || pending->second.crc < edit.crc) {
+            pending_edits_[base_version] = std::move(edit);
+        }
+    }
+    pending_edits_.erase(pending_edits_.begin(), pending_edits_.lower_bound(version_));
+    
+    // Apply every delta that continues from the current version; one that
+    // does not fit the content means this copy is not what the version says
+    size_t applied = 0;
+    auto it = pending_edits_.find(version_);
+    while (!diverged && !resyncing_ && it != pending_edits_.end()) {
+        if (!splices_in_range(content_.size(), it->second.splices)) {
+            pending_edits_.erase(it);
+            diverged = true;
+            break;
+        }
+        std::vector<ContentChange> changes;
+        ++version_;
+        remember_delta(delta_history_, version_, it->second.crc);
+        for (const auto& splice : it->second.splices) {
+            apply_splice(splice, changes, true);
+        }
+        notify_changes(changes, it->second.splices, true);
+        ++applied;
+        pending_edits_.erase(it);
+        it = pending_edits_.find(version_);
+    }
+    
+    // A gap that never fills must not grow without bound: forget the farthest deltas
+    while (pending_edits_.size() > MAX_PENDING_EDITS) {
+        pending_edits_.erase(std::prev(pending_edits_.end()));
+    }
+    
+    if (applied > 0) {
         is_modified_ = true;
-        notify_content_change();
+        advertise_version();
+    }
+    if (diverged && !resyncing_) {
+        resync();
+    }
+    return applied;
+}
+
+void FlowFile::resync() {
+    static LogSite resync_log(1);
+    log_message(LogLevel::WARN, resync_log, "Flow ", identifier_, " diverged from its peers at version ", version_.load(),
+                "; fetching a holder's copy");
+    
+    // Stop serving this copy and ask the holders for theirs at the next
+    // heartbeat, as a joiner does; its version is not advanced meanwhile
+    reassembler_.reset();
+    paged_bytes_ = 0;
+    restored_ = false;
+    chunks_patched_ = false;
+    awaiting_content_ = true;
+    resyncing_ = true;
+    last_nack_us_ = 0;
+    dirty_offset_ = CLEAN;
+    dirty_ranges_.clear();
+    delta_history_.clear();
+    chunk_stamps_.clear();
+    advertise_version();
+}
+
+void FlowFile::receive_chunk(const RawPacket& packet) {
+    std::lock_guard<std::mutex> lock(chunk_mutex_);
+    
+    // Chunks of a version we already hold, such as peers refreshing ours,
+    // would only rebuild a second full copy here
+    if (!reassembler_.started() && !awaiting_content_ && payload_version(packet) <= version_.load()) {
+        return;
+    }
+    if (packet.header().packet_type == FLOW_PARITY) {
+        reassembler_.accept_parity(packet);
+        return;
+    }
+    uint32_t index = packet.header().sequence;
+    uint64_t held = reassembler_.chunk_version(index);
+    if (!reassembler_.accept(packet)) {
+        return;
+    }
+    if (restored_ && reassembler_.chunk_version(index) > held) {
+        chunks_patched_ = true;
+    }
+    awaiting_content_ = false;
+    // accept() refused any index at or past the 32-bit chunk count, so one
+    // past it never wraps to 0
+    chunk_frontier_ = std::max(chunk_frontier_, index + 1);
+    last_chunk_us_ = monotonic_us();
+    request_missing_chunks(last_chunk_us_);
+}
+
+void FlowFile::await_remote_content() {
+    std::lock_guard<std::mutex> lock(chunk_mutex_);
+    awaiting_content_ = true;
+}
+
+void FlowFile::receive_heartbeat(const HeartbeatRecord& beat) {
+    std::lock_guard<std::mutex> lock(chunk_mutex_);
+    uint64_t now = monotonic_us();
+    
+    // A restored copy asks a holder that moved past it for every chunk
+    // newer than the snapshot; gaps and stragglers are asked for in between
+    uint32_t advertised = beat.sequence;
+    uint64_t held = reassembler_.complete() ? version_.load() : reassembler_.version();
+    if (restored_ && beat.version > held && advertised > 0 && network_flow_ &&
+        now - last_nack_us_ >= NACK_INTERVAL_US) {
+        std::vector<uint32_t> all(std::min<size_t>(advertised, MAX_NACK_CHUNKS));
+        for (uint32_t i = 0; i < all.size(); ++i) {
+            all[i] = i;
+        }
+        last_nack_us_ = now;
+        network_flow_->request_retransmit(identifier_, all, catch_up_version_);
+        return;
+    }
+    
+    // A joiner that has no chunk yet learns the stream's extent from the
+    // holder's heartbeat and asks for all of it
+    if (awaiting_content_ && !reassembler_.started() && advertised > 0 && network_flow_ &&
+        now - last_nack_us_ >= NACK_INTERVAL_US) {
+        std::vector<uint32_t> all(std::min<size_t>(advertised, MAX_NACK_CHUNKS));
+        for (uint32_t i = 0; i < all.size(); ++i) {
+            all[i] = i;
+        }
+        last_nack_us_ = now;
+        network_flow_->request_retransmit(identifier_, all);
+        return;
+    }
+    request_missing_chunks(now);
+}
+
+void FlowFile::request_missing_chunks(uint64_t now) {
+    if (!network_flow_ || !reassembler_.started() || reassembler_.complete() || now - last_nack_us_ < NACK_INTERVAL_US) {
+        return;
+    }
+    
+    std::vector<uint32_t> missing = reassembler_.missing(MAX_NACK_CHUNKS);
+    
+    // Holes below the frontier were skipped over; chunks past it may still be
+    // in flight until the stream has been quiet for a while
+    if (now - last_chunk_us_ < NACK_SETTLE_US) {
+        missing.erase(std::lower_bound(missing.begin(), missing.end(), chunk_frontier_), missing.end());
+    }
+    if (missing.empty()) {
+        return;
+    }
+    
+    last_nack_us_ = now;
+    network_flow_->request_retransmit(identifier_, missing);
+}
+
+size_t FlowFile::apply_received_chunks() {
+    std::lock_guard<std::mutex> lock(chunk_mutex_);
+    std::lock_guard<std::recursive_mutex> content_lock(content_mutex_);
+    bool patched = chunks_patched_ && reassembler_.complete() && reassembler_.version() >= version_;
+    if (!reassembler_.started() || (reassembler_.version() <= version_ && !patched && !resyncing_)) {
+        return 0;  // Nothing newer than what we hold
+    }
+    
+    const char* data = reinterpret_cast<const char*>(reassembler_.data());
+    size_t offset = 0;
+    size_t paged;
+    
+    if (reassembler_.complete()) {
+        // Adopt the whole copy: chunks already paged in may have been replaced since
+        paged = reassembler_.total_length();
+    } else {
+        paged = reassembler_.contiguous_bytes();
+        if (paged <= paged_bytes_) {
+            return 0;
+        }
+        // Early parts become readable while the tail is still in flight
+        offset = paged_bytes_;
+    }
+    
+    // The changed bytes are handed to listeners straight from the reassembler
+    ContentChange change;
+    change.offset = offset;
+    change.erased_bytes = content_.size() - offset;
+    change.first_line = static_cast<int>(content_.newlines_before(offset));
+    change.erased_lines = static_cast<int>(content_.newlines_before(content_.size())) - change.first_line;
+    change.inserted = std::string_view(data + offset, paged - offset);
+    change.inserted_lines = static_cast<int>(std::count(change.inserted.begin(), change.inserted.end(), '\n'));
+    replace_tail(offset, data + offset, paged - offset);
+    
+    // Adopted chunks are served with the headers they arrived with; only
+    // whole chunks count while the tail is still in flight
+    uint32_t stamped = reassembler_.complete() ? chunks_for(paged) : static_cast<uint32_t>(paged / FLOW_CHUNK_SIZE);
+    chunk_stamps_.resize(stamped);
+    FlowChunkHeader stamp;
+    stamp.total_length = reassembler_.total_length();
+    for (uint32_t sequence = static_cast<uint32_t>(offset / FLOW_CHUNK_SIZE); sequence < stamped; ++sequence) {
+        stamp.version = reassembler_.chunk_version(sequence);
+        chunk_stamps_[sequence] = stamp;
+    }
+    
+    if (reassembler_.complete()) {
+        // Which deltas led to the adopted version is not known here
+        version_ = reassembler_.version();
+        paged_bytes_ = 0;
+        chunks_patched_ = false;
+        resyncing_ = false;
+        delta_history_.clear();
+        advertise_version();
+    } else {
+        paged_bytes_ = paged;
+    }
+    notify_change(change, true);
+    
+    // A large copy now lives in the spill file; keeping the reassembled one
+    // would hold the flow in memory twice. Only a restored copy keeps it, to
+    // be patched by the chunks that changed while this node was down.
+    if (reassembler_.complete() && paged >= STREAMING_BYTES && !restored_) {
+        reassembler_.reset();
     }
+    is_modified_ = true;
+    return paged;
+}
+
+void FlowFile::replace_tail(size_t offset, const char* data, size_t length) {
+    content_.erase(offset, content_.size() - offset);
+    if (offset + length < STREAMING_BYTES) {
+        content_.insert(offset, std::string(data, length));
+    } else {
+        // Nothing left views an old copy once the rope holds none of it
+        if (!spill_) {
+            spill_ = std::make_unique<SpillFile>();
+        } else if (content_.spilled_bytes() == 0) {
+            spill_->reset();
+        }
+        content_.insert_spilled(offset, data, length, *spill_);
+    }
+    
+    // Local edits to what was replaced are gone, so nothing of them is re-emitted
+    if (dirty_offset_ != CLEAN && dirty_offset_ >= offset) {
+        dirty_offset_ = CLEAN;
+    }
+    dirty_ranges_.erase(std::remove_if(dirty_ranges_.begin(), dirty_ranges_.end(),
+                                       [offset](const std::pair<size_t, size_t>& range) {
+                                           return range.first >= offset;
+                                       }),
+                        dirty_ranges_.end());
+    for (auto& range : dirty_ranges_) {
+        range.second = std::min(range.second, offset);
+    }
+}
+
+bool FlowFile::save_snapshot(const std::string& path, uint64_t name_key) {
+    std::lock_guard<std::mutex> lock(chunk_mutex_);
+    std::lock_guard<std::recursive_mutex> content_lock(content_mutex_);
+    bool partial = reassembler_.started() && !reassembler_.complete() && (content_.empty() || paged_bytes_ != 0);
+    if (resyncing_ && !partial) {
+        return true;  // The last snapshot saved stays the better copy
+    }
+    uint64_t version = partial ? reassembler_.version() : version_.load();
+    uint32_t chunks = partial ? reassembler_.received()
+                              : static_cast<uint32_t>((content_.size() + FLOW_CHUNK_SIZE - 1) / FLOW_CHUNK_SIZE);
+    if (snapshot_saved_ && version == saved_version_ && chunks == saved_chunks_) {
+        return true;
+    }
+    
+    SnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.name_key = name_key;
+    header.version = version;
+    snapshot_pattern(pattern_, header);
+    
+    std::vector<uint64_t> bitmap;
+    if (partial) {
+        header.total_length = reassembler_.total_length();
+        header.chunk_count = reassembler_.chunk_count();
+        bitmap = reassembler_.bitmap();
+    } else {
+        header.total_length = content_.size();
+        header.chunk_count = chunks;
+        bitmap.assign((chunks + 63) / 64, ~uint64_t(0));
+        if (chunks & 63) {
+            bitmap.back() = (uint64_t(1) << (chunks & 63)) - 1;
+        }
+    }
+    
+    // The rope is written leaf by leaf, never flattened
+    SnapshotWriter writer(path);
+    if (!writer.begin(header, name_, bitmap)) {
+        return false;
+    }
+    if (partial) {
+        writer.append(reassembler_.data(), reassembler_.total_length());
+    } else {
+        content_.for_each_chunk([&writer](const char* data, size_t length) { writer.append(data, length); });
+    }
+    if (!writer.commit()) {
+        return false;
+    }
+    
+    snapshot_saved_ = true;
+    saved_version_ = version;
+    saved_chunks_ = chunks;
+    return true;
+}
+
+void FlowFile::restore_snapshot(const FlowSnapshot& snapshot) {
+    const SnapshotHeader& header = snapshot.header();
+    std::lock_guard<std::mutex> lock(chunk_mutex_);
+    std::lock_guard<std::recursive_mutex> content_lock(content_mutex_);
+    reassembler_.restore(snapshot.content(), header.total_length, header.version, snapshot.bitmap());
+    chunk_frontier_ = header.chunk_count;
+    restored_ = true;
+    catch_up_version_ = header.version;
+    
+    if (snapshot.complete()) {
+        // Built straight from the mapped pages and served from them as
+        // saved; holders that moved on are asked for what changed
+        replace_tail(0, reinterpret_cast<const char*>(snapshot.content()), header.total_length);
+        version_ = header.version;
+        chunk_stamps_.clear();
+        stamp_chunks(0, header.chunk_count, header.version);
+        advertise_version();
+    }
+    // A partial copy pages in its prefix like any joiner; missing chunks are
+    // asked for at the first heartbeat
+    
+    snapshot_saved_ = true;
+    saved_version_ = header.version;
+    saved_chunks_ = snapshot.complete() ? header.chunk_count : reassembler_.received();
+}
+
+std::vector<uint32_t> FlowFile::missing_chunks(size_t max) {
+    std::lock_guard<std::mutex> lock(chunk_mutex_);
+    return reassembler_.missing(max);
+}
+
+void FlowFile::set_max_length(size_t max_length) {
+    std::lock_guard<std::mutex> lock(chunk_mutex_);
+    reassembler_.set_max_length(max_length);
 }
 
 void FlowFile::update_circulation_pattern(const CirculationPattern& pattern) {
+    std::lock_guard<std::recursive_mutex> content_lock(content_mutex_);
+    // Circulating chunks were grouped and compressed under the old settings
+    if (pattern.fec_data_chunks != pattern_.fec_data_chunks || pattern.fec_parity_chunks != pattern_.fec_parity_chunks ||
+        pattern.codec != pattern_.codec || pattern.dictionary != pattern_.dictionary) {
+        dirty_offset_ = 0;
+    }
     pattern_ = pattern;
     is_modified_ = true;
 }
@@ -122,119 +692,371 @@ void FlowFile::remove_circulation_node(const std::string& address) {
 }
 
 std::vector<uint8_t> FlowFile::serialize_content() const {
-    std::vector<uint8_t> serialized;
-    serialized.reserve(content_.size());
-    
-    for (char c : content_) {
-        serialized.push_back(static_cast<uint8_t>(c));
-    }
-    
+    std::vector<uint8_t> serialized(content_.size());
+    content_.copy(0, serialized.size(), reinterpret_cast<char*>(serialized.data()));
     return serialized;
 }
 
 bool FlowFile::deserialize_content(const std::vector<uint8_t>& data) {
-    content_.clear();
-    content_.reserve(data.size());
+    std::lock_guard<std::recursive_mutex> content_lock(content_mutex_);
+    // Rebuilt from circulating data: subscribers see one whole-content
+    // change, but nothing is sent back out as a delta
+    std::vector<ContentSplice> splices(1, ContentSplice(0, static_cast<uint32_t>(content_.size()),
+                                                        std::string(data.begin(), data.end())));
+    std::vector<ContentChange> changes;
+    apply_splice(splices[0], changes, true);
+    notify_changes(changes, splices, true);
+    is_modified_ = true;
+    return true;
+}
+
+size_t FlowFile::add_change_listener(ContentChangeListener listener) {
+    size_t id = next_listener_id_++;
+    change_listeners_.emplace_back(id, std::move(listener));
+    return id;
+}
+
+void FlowFile::remove_change_listener(size_t id) {
+    change_listeners_.erase(
+        std::remove_if(change_listeners_.begin(), change_listeners_.end(),
+                       [id](const std::pair<size_t, ContentChangeListener>& entry) {
+                           return entry.first == id;
+                       }),
+        change_listeners_.end());
+}
+
+void FlowFile::apply_splice(const ContentSplice& splice, std::vector<ContentChange>& changes, bool remote) {
+    // Line positions are taken before the content moves under them
+    ContentChange change;
+    change.offset = splice.offset;
+    change.erased_bytes = splice.erase_length;
+    change.first_line = static_cast<int>(content_.newlines_before(splice.offset));
+    change.erased_lines = static_cast<int>(content_.newlines_before(splice.offset + splice.erase_length)) - change.first_line;
+    change.inserted_lines = static_cast<int>(std::count(splice.insert.begin(), splice.insert.end(), '\n'));
+    changes.push_back(change);
+    
+    content_.replace(splice.offset, splice.erase_length, splice.insert);
     
-    for (uint8_t byte : data) {
-        content_.push_back(static_cast<char>(byte));
+    // Only the originator re-emits what an edit changed. A peer's delta has
+    // reached the other holders itself, so its chunks are just restamped.
+    if (!remote) {
+        mark_dirty(splice);
+        return;
+    }
+    shift_dirty(splice);
+    uint32_t first = static_cast<uint32_t>(splice.offset / FLOW_CHUNK_SIZE);
+    if (splice.erase_length != splice.insert.size()) {
+        stamp_chunks(first, chunks_for(content_.size()), version_);
+    } else if (!splice.insert.empty()) {
+        stamp_chunks(first, chunks_for(static_cast<size_t>(splice.offset) + splice.insert.size()), version_);
+    }
+}
+
+void FlowFile::mark_dirty(const ContentSplice& splice) {
+    // A length change moves every byte after it; a same-length rewrite
+    // changes only its own bytes
+    size_t offset = splice.offset;
+    if (splice.erase_length != splice.insert.size()) {
+        dirty_offset_ = std::min(dirty_offset_, offset);
+        size_t tail = dirty_offset_;
+        dirty_ranges_.erase(std::remove_if(dirty_ranges_.begin(), dirty_ranges_.end(),
+                                           [tail](const std::pair<size_t, size_t>& range) {
+                                               return range.first >= tail;
+                                           }),
+                            dirty_ranges_.end());
+    } else if (!splice.insert.empty() && offset < dirty_offset_) {
+        dirty_ranges_.emplace_back(offset, offset + splice.insert.size());
+        if (dirty_ranges_.size() > MAX_DIRTY_RANGES) {
+            std::pair<size_t, size_t> merged = dirty_ranges_.front();
+            for (const auto& range : dirty_ranges_) {
+                merged.first = std::min(merged.first, range.first);
+                merged.second = std::max(merged.second, range.second);
+            }
+            dirty_ranges_.assign(1, merged);
+        }
+    }
+}
+
+void FlowFile::shift_dirty(const ContentSplice& splice) {
+    // Local edits still to be re-emitted move with a peer's splice; those it
+    // overlaps also cover what it inserted
+    size_t offset = splice.offset;
+    size_t erased_end = offset + splice.erase_length;
+    size_t inserted_end = offset + splice.insert.size();
+    if (dirty_offset_ != CLEAN && dirty_offset_ > offset) {
+        dirty_offset_ = dirty_offset_ >= erased_end ? dirty_offset_ - splice.erase_length + splice.insert.size() : offset;
+    }
+    for (auto& range : dirty_ranges_) {
+        if (range.first >= erased_end) {
+            range.first = range.first - splice.erase_length + splice.insert.size();
+            range.second = range.second - splice.erase_length + splice.insert.size();
+        } else if (range.second > offset) {
+            range.first = std::min(range.first, offset);
+            range.second = range.second >= erased_end ? range.second - splice.erase_length + splice.insert.size()
+                                                      : std::max(range.second, inserted_end);
+        }
+    }
+}
+
+bool FlowFile::chunk_dirty(uint32_t sequence) const {
+    size_t begin = static_cast<size_t>(sequence) * FLOW_CHUNK_SIZE;
+    size_t end = begin + FLOW_CHUNK_SIZE;
+    if (dirty_offset_ != CLEAN && end > dirty_offset_) {
+        return true;
+    }
+    for (const auto& range : dirty_ranges_) {
+        if (range.first < end && range.second > begin) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<std::pair<uint32_t, uint32_t>> FlowFile::dirty_chunks(uint32_t chunk_count, uint32_t group_size) const {
+    // Runs of chunks to re-emit, sorted and disjoint; with FEC each run
+    // covers whole groups
+    std::vector<std::pair<uint32_t, uint32_t>> runs;
+    auto add = [&runs, chunk_count, group_size](size_t begin, uint32_t end) {
+        uint32_t first = static_cast<uint32_t>(std::min<size_t>(begin / FLOW_CHUNK_SIZE, chunk_count));
+        end = std::min(end, chunk_count);
+        if (group_size != 0) {
+            first -= first % group_size;
+            end = std::min<uint32_t>(chunk_count, (end + group_size - 1) / group_size * group_size);
+        }
+        if (first < end) {
+            runs.emplace_back(first, end);
+        }
+    };
+    for (const auto& range : dirty_ranges_) {
+        add(range.first, chunks_for(range.second));
+    }
+    if (dirty_offset_ != CLEAN) {
+        add(dirty_offset_, chunk_count);
     }
     
-    is_modified_ = true;
-    notify_content_change();
-    return true;
+    std::sort(runs.begin(), runs.end());
+    std::vector<std::pair<uint32_t, uint32_t>> merged;
+    for (const auto& run : runs) {
+        if (!merged.empty() && run.first <= merged.back().second) {
+            merged.back().second = std::max(merged.back().second, run.second);
+        } else {
+            merged.push_back(run);
+        }
+    }
+    return merged;
 }
 
-bool FlowFile::discover_existing_flow() {
-    // In a real implementation, this would send discovery packets
-    // and wait for responses from existing flows
-    std::cout << "Discovering existing flow: " << name_ << std::endl;
-    return false; // Assume no existing flow for now
+void FlowFile::stamp_chunks(uint32_t first, uint32_t end, uint64_t version) {
+    chunk_stamps_.resize(chunks_for(content_.size()));
+    FlowChunkHeader stamp;
+    stamp.version = version;
+    stamp.total_length = content_.size();
+    for (uint32_t sequence = first; sequence < std::min<size_t>(end, chunk_stamps_.size()); ++sequence) {
+        chunk_stamps_[sequence] = stamp;
+    }
 }
 
-void FlowFile::broadcast_existence() {
-    // In a real implementation, this would broadcast the flow's existence
-    // to other nodes in the network
-    std::cout << "Broadcasting flow existence: " << name_ << " (ID: " << identifier_ << ")" << std::endl;
+void FlowFile::notify_changes(std::vector<ContentChange>& changes, const std::vector<ContentSplice>& splices,
+                              bool remote) {
+    for (size_t i = 0; i < changes.size(); ++i) {
+        changes[i].inserted = splices[i].insert;
+        notify_change(changes[i], remote);
+    }
 }
 
-void FlowFile::notify_content_change() {
-    if (content_change_callback_) {
-        content_change_callback_(content_);
+void FlowFile::notify_change(ContentChange& change, bool remote) {
+    change.version = version_;
+    change.remote = remote;
+    for (const auto& entry : change_listeners_) {
+        entry.second(change);
     }
 }
 
-void FlowFile::encode_content_in_packets() {
-    // In a real implementation, this would encode the content into
-    // a series of packets that circulate through the network
-    std::vector<uint8_t> content_data = serialize_content();
+void FlowFile::splice_content(const ContentSplice& splice) {
+    apply_splice(splice, outgoing_changes_, false);
+    outgoing_.push_back(splice);
+}
+
+void FlowFile::publish_edits() {
+    if (in_transaction_ || outgoing_.empty()) {
+        return;
+    }
     
-    // Split content into packet-sized chunks
-    const size_t MAX_PACKET_SIZE = 1400; // Leave room for headers
-    size_t offset = 0;
-    uint32_t sequence = 0;
+    transmit_edits();
+    notify_changes(outgoing_changes_, outgoing_, false);
+    outgoing_.clear();
+    outgoing_changes_.clear();
+    is_modified_ = true;
+}
+
+void FlowFile::transmit_edits() {
+    // Circulation cost scales with the edit, not the file
+    std::vector<std::vector<uint8_t>> deltas = encode_edit_deltas(outgoing_, version_, MAX_PACKET_SIZE);
+    for (const auto& delta : deltas) {
+        RawPacket packet(identifier_, FLOW_EDIT, delta);
+        packet.set_sequence(static_cast<uint32_t>(++version_));
+        remember_delta(delta_history_, version_, crc32c(0, delta.data(), delta.size()));
+        if (network_flow_) {
+            network_flow_->transmit_packet(packet);
+        }
+    }
     
-    while (offset < content_data.size()) {
-        size_t chunk_size = std::min(MAX_PACKET_SIZE, content_data.size() - offset);
-        std::vector<uint8_t> chunk(content_data.begin() + offset, 
-                                  content_data.begin() + offset + chunk_size);
-        
-        // Create data packet
-        RawPacket packet(identifier_, FLOW_DATA, chunk);
-        packet.set_sequence(sequence++);
-        
-        // In a real implementation, this packet would be injected into the network
-        // For now, just log it
-        std::cout << "Encoded packet " << sequence - 1 << " for flow " << identifier_ 
-                  << " with " << chunk_size << " bytes" << std::endl;
-        
-        offset += chunk_size;
+    if (network_flow_ && !deltas.empty()) {
+        network_flow_->flush_transmit();
+    }
+    advertise_version();
+}
+
+void FlowFile::advertise_version() {
+    if (network_flow_) {
+        network_flow_->set_flow_version(identifier_, version_, static_cast<uint32_t>(chunk_stamps_.size()));
     }
 }
 
-void FlowFile::decode_content_from_packets(const std::vector<RawPacket>& packets) {
-    std::vector<uint8_t> content_data;
+void FlowFile::encode_content_in_packets(std::vector<RawPacket>& packets) {
+    // Only the chunks local edits changed are re-emitted; the rest keep
+    // circulating as they are
+    uint32_t chunk_count = chunks_for(content_.size());
+    
+    // With FEC a touched group is re-emitted whole, so all chunks of a group
+    // share the version its parity was computed at
+    uint32_t group_size = pattern_.has_fec() ? std::min<uint32_t>(pattern_.fec_data_chunks, FEC_MAX_DATA) : 0;
+    std::vector<uint8_t> group_blocks(static_cast<size_t>(group_size) * FLOW_CHUNK_SIZE);
+    std::vector<std::pair<uint32_t, uint32_t>> runs = dirty_chunks(chunk_count, group_size);
+    
+    // Every chunk says which version and length of the content it belongs to
+    uint8_t chunk[sizeof(FlowChunkHeader) + FLOW_CHUNK_SIZE];
+    FlowChunkHeader header;
+    header.version = version_;
+    header.total_length = content_.size();
+    chunk_stamps_.resize(chunk_count);
+    size_t wire_bytes = 0;
+    uint32_t encoded = 0;
+    
+    for (const auto& run : runs) {
+        for (uint32_t sequence = run.first; sequence < run.second; ++sequence) {
+            RawPacket packet;
+            size_t chunk_size = build_chunk(sequence, header, chunk, packet);
+            chunk_stamps_[sequence] = header;
+            wire_bytes += packet.payload_size();
+            ++encoded;
+            
+            // Sent, not stored: circulation rebuilds the chunk from content_
+            if (network_flow_) {
+                packets.push_back(std::move(packet));
+            }
+            
+            if (group_size != 0) {
+                uint32_t slot = sequence % group_size;
+                uint8_t* block = group_blocks.data() + static_cast<size_t>(slot) * FLOW_CHUNK_SIZE;
+                std::memcpy(block, chunk + sizeof(header), chunk_size);
+                std::memset(block + chunk_size, 0, FLOW_CHUNK_SIZE - chunk_size);
+                if (slot + 1 == group_size || sequence + 1 == chunk_count) {
+                    emit_parity(sequence / group_size, slot + 1, group_blocks.data(), packets);
+                }
+            }
+        }
+    }
     
-    // Sort packets by sequence number
-    std::vector<RawPacket> sorted_packets = packets;
-    std::sort(sorted_packets.begin(), sorted_packets.end(),
-              [](const RawPacket& a, const RawPacket& b) {
-                  return a.header().sequence < b.header().sequence;
-              });
+    static LogSite encode_log;
+    log_message(LogLevel::INFO, encode_log, "Encoded ", encoded, " of ", chunk_count, " packets for flow ", identifier_,
+                " (", content_.size(), " bytes, ", wire_bytes, " sent)");
     
-    // Combine packet payloads
-    for (const auto& packet : sorted_packets) {
-        const auto& data = packet.data();
-        content_data.insert(content_data.end(), data.begin(), data.end());
+    // Content that shrank stops serving the chunks past its new end
+    dirty_offset_ = CLEAN;
+    dirty_ranges_.clear();
+    advertise_version();
+}
+
+void FlowFile::serve_chunks() {
+    // Nothing is re-emitted: refreshes and NACK answers serve the chunks
+    // held so far, and the ones that arrive later, as they are stamped
+    chunk_source_ = std::make_shared<ChunkSource>();
+    chunk_source_->materialize = [this](uint32_t sequence, uint64_t since_version, RawPacket& packet) {
+        return materialize_chunk(sequence, since_version, packet);
+    };
+    network_flow_->set_chunk_source(identifier_, chunk_source_);
+    advertise_version();
+}
+
+bool FlowFile::materialize_chunk(uint32_t sequence, uint64_t since_version, RawPacket& packet) {
+    // Runs on the network's threads, which must not wait on an edit or an
+    // encode; a chunk edited since it was emitted waits for its re-emission
+    std::unique_lock<std::recursive_mutex> content_lock(content_mutex_, std::try_to_lock);
+    if (!content_lock.owns_lock() || sequence >= chunk_stamps_.size() || chunk_dirty(sequence)) {
+        return false;
+    }
+    const FlowChunkHeader& header = chunk_stamps_[sequence];
+    if (since_version != 0 && header.version <= since_version) {
+        return false;
     }
     
-    // Deserialize content
-    deserialize_content(content_data);
+    uint8_t chunk[sizeof(FlowChunkHeader) + FLOW_CHUNK_SIZE];
+    build_chunk(sequence, header, chunk, packet);
+    return true;
 }
 
-std::vector<std::string> FlowFile::split_into_lines(const std::string& content) const {
-    std::vector<std::string> lines;
-    std::istringstream stream(content);
-    std::string line;
+size_t FlowFile::build_chunk(uint32_t sequence, const FlowChunkHeader& header, uint8_t* chunk, RawPacket& packet) const {
+    std::memcpy(chunk, &header, sizeof(header));
+    size_t offset = static_cast<size_t>(sequence) * FLOW_CHUNK_SIZE;
+    size_t chunk_size = content_.copy(offset, FLOW_CHUNK_SIZE, reinterpret_cast<char*>(chunk + sizeof(header)));
     
-    while (std::getline(stream, line)) {
-        lines.push_back(line);
+    // Chunks are compressed one by one so each stays independently decodable;
+    // a chunk that does not shrink goes out raw
+    ChunkCodec codec = static_cast<ChunkCodec>(pattern_.codec);
+    uint8_t compressed[sizeof(FlowChunkHeader) + FLOW_CHUNK_SIZE];
+    size_t packed = 0;
+    if (codec != CODEC_NONE && codec_available(codec)) {
+        std::memcpy(compressed, &header, sizeof(header));
+        packed = compress_chunk(codec, pattern_.dictionary, chunk + sizeof(header), chunk_size,
+                                compressed + sizeof(header), FLOW_CHUNK_SIZE);
     }
     
-    return lines;
+    packet = packed ? RawPacket(identifier_, FLOW_DATA, compressed, sizeof(header) + packed)
+                    : RawPacket(identifier_, FLOW_DATA, chunk, sizeof(header) + chunk_size);
+    packet.set_sequence(sequence);
+    if (packed) {
+        packet.set_compression(codec, pattern_.dictionary);
+    }
+    return chunk_size;
 }
 
-std::string FlowFile::join_lines(const std::vector<std::string>& lines) const {
-    std::ostringstream stream;
+void FlowFile::emit_parity(uint32_t group, uint32_t group_chunks, const uint8_t* blocks,
+                           std::vector<RawPacket>& packets) {
+    if (!network_flow_) {
+        return;
+    }
     
-    for (size_t i = 0; i < lines.size(); ++i) {
-        if (i > 0) {
-            stream << '\n';
-        }
-        stream << lines[i];
+    // Parity is computed straight into the payloads of the parity packets
+    uint32_t parity_count = std::min<uint32_t>(pattern_.fec_parity_chunks, FEC_MAX_PARITY);
+    size_t stride = sizeof(FlowParityHeader) + FLOW_CHUNK_SIZE;
+    std::vector<uint8_t> payloads(parity_count * stride);
+    std::vector<const uint8_t*> data(group_chunks);
+    std::vector<uint8_t*> parity(parity_count);
+    for (uint32_t i = 0; i < group_chunks; ++i) {
+        data[i] = blocks + static_cast<size_t>(i) * FLOW_CHUNK_SIZE;
     }
+    for (uint32_t j = 0; j < parity_count; ++j) {
+        parity[j] = payloads.data() + j * stride + sizeof(FlowParityHeader);
+    }
+    fec_encode(data.data(), group_chunks, parity.data(), parity_count, FLOW_CHUNK_SIZE);
     
-    return stream.str();
+    FlowParityHeader header;
+    header.version = version_;
+    header.total_length = content_.size();
+    header.group = group;
+    header.data_chunks = static_cast<uint8_t>(std::min<uint32_t>(pattern_.fec_data_chunks, FEC_MAX_DATA));
+    header.group_chunks = static_cast<uint8_t>(group_chunks);
+    header.parity_chunks = static_cast<uint8_t>(parity_count);
+    for (uint32_t j = 0; j < parity_count; ++j) {
+        header.row = static_cast<uint8_t>(j);
+        std::memcpy(payloads.data() + j * stride, &header, sizeof(header));
+        
+        // Parity is sent with each emission but not kept circulating
+        RawPacket packet(identifier_, FLOW_PARITY, payloads.data() + j * stride, stride);
+        packet.set_sequence(group);
+        packets.push_back(std::move(packet));
+    }
 }
 
 } // namespace nerd
\ No newline at end of file
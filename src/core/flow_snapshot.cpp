@@ -0,0 +1,217 @@
+#include "core/flow_snapshot.h"
+#include "core/chunk_reassembler.h"
+#include "network/crc32c.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+namespace nerd {
+
+namespace {
+
+uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+}
+
+size_t bitmap_words(uint32_t chunk_count) {
+    return (static_cast<size_t>(chunk_count) + 63) / 64;
+}
+
+uint32_t header_checksum(const SnapshotHeader& header) {
+    return crc32c(0, &header, offsetof(SnapshotHeader, checksum));
+}
+
+} // namespace
+
+void snapshot_pattern(const CirculationPattern& pattern, SnapshotHeader& header) {
+    header.circulation_rate = pattern.circulation_rate;
+    header.max_packet_age = pattern.max_packet_age;
+    header.auto_sustain = pattern.auto_sustain ? 1 : 0;
+    header.fec_data_chunks = pattern.fec_data_chunks;
+    header.fec_parity_chunks = pattern.fec_parity_chunks;
+    header.codec = pattern.codec;
+    header.dictionary = pattern.dictionary;
+}
+
+FlowSnapshot::FlowSnapshot() : base_(nullptr), size_(0) {}
+
+FlowSnapshot::~FlowSnapshot() {
+    close();
+}
+
+bool FlowSnapshot::open(const std::string& path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SnapshotHeader)) {
+        ::close(fd);
+        return false;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void* base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    base_ = static_cast<const uint8_t*>(base);
+    size_ = size;
+
+    // Every section must lie inside the file before any of it is read
+    const SnapshotHeader& h = header();
+    bool valid = h.magic == SNAPSHOT_MAGIC && h.format == SNAPSHOT_FORMAT && h.checksum == header_checksum(h) &&
+                 h.chunk_count == (h.total_length + FLOW_CHUNK_SIZE - 1) / FLOW_CHUNK_SIZE &&
+                 h.name_offset + h.name_length <= size &&
+                 h.bitmap_offset + bitmap_words(h.chunk_count) * sizeof(uint64_t) <= size &&
+                 h.content_offset <= size && h.total_length <= size - h.content_offset;
+    if (!valid) {
+        close();
+        return false;
+    }
+
+    // Read front to back once, by the checksum and then by whoever adopts it
+    madvise(const_cast<uint8_t*>(base_), size_, MADV_SEQUENTIAL);
+    if (crc32c(0, content(), h.total_length) != h.content_checksum) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void FlowSnapshot::close() {
+    if (base_) {
+        munmap(const_cast<uint8_t*>(base_), size_);
+        base_ = nullptr;
+        size_ = 0;
+    }
+}
+
+std::string FlowSnapshot::name() const {
+    return std::string(reinterpret_cast<const char*>(base_ + header().name_offset), header().name_length);
+}
+
+CirculationPattern FlowSnapshot::pattern() const {
+    const SnapshotHeader& h = header();
+    CirculationPattern pattern;
+    pattern.name = name();
+    pattern.circulation_rate = h.circulation_rate;
+    pattern.max_packet_age = h.max_packet_age;
+    pattern.auto_sustain = h.auto_sustain != 0;
+    pattern.fec_data_chunks = h.fec_data_chunks;
+    pattern.fec_parity_chunks = h.fec_parity_chunks;
+    pattern.codec = h.codec;
+    pattern.dictionary = h.dictionary;
+    return pattern;
+}
+
+bool FlowSnapshot::has_chunk(uint32_t index) const {
+    if (index >= header().chunk_count) {
+        return false;
+    }
+    return (bitmap()[index >> 6] >> (index & 63)) & 1;
+}
+
+bool FlowSnapshot::complete() const {
+    uint32_t count = header().chunk_count;
+    for (size_t i = 0; i < bitmap_words(count); ++i) {
+        uint64_t expected = (i + 1 < bitmap_words(count) || (count & 63) == 0) ? ~uint64_t(0)
+                                                                              : (uint64_t(1) << (count & 63)) - 1;
+        if (bitmap()[i] != expected) {
+            return false;
+        }
+    }
+    return true;
+}
+
+SnapshotWriter::SnapshotWriter(const std::string& path)
+    : path_(path), temp_path_(path + ".tmp"), fd_(-1), written_(0), failed_(false) {
+    std::memset(&header_, 0, sizeof(header_));
+}
+
+SnapshotWriter::~SnapshotWriter() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        unlink(temp_path_.c_str());
+    }
+}
+
+bool SnapshotWriter::begin(const SnapshotHeader& header, const std::string& name, const std::vector<uint64_t>& bitmap) {
+    fd_ = ::open(temp_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0 || name.size() > UINT16_MAX || bitmap.size() != bitmap_words(header.chunk_count)) {
+        failed_ = true;
+        return false;
+    }
+
+    header_ = header;
+    header_.magic = SNAPSHOT_MAGIC;
+    header_.format = SNAPSHOT_FORMAT;
+    header_.name_length = static_cast<uint16_t>(name.size());
+    header_.name_offset = sizeof(SnapshotHeader);
+    header_.bitmap_offset = align8(header_.name_offset + name.size());
+    header_.content_offset = align8(header_.bitmap_offset + bitmap.size() * sizeof(uint64_t));
+    header_.content_checksum = 0;
+
+    // The header goes in last, once the content checksum is known
+    write_at(header_.name_offset, name.data(), name.size());
+    write_at(header_.bitmap_offset, bitmap.data(), bitmap.size() * sizeof(uint64_t));
+    return !failed_;
+}
+
+bool SnapshotWriter::append(const void* data, size_t length) {
+    if (failed_ || fd_ < 0) {
+        return false;
+    }
+    header_.content_checksum = crc32c(header_.content_checksum, data, length);
+    write_at(header_.content_offset + written_, data, length);
+    written_ += length;
+    return !failed_;
+}
+
+bool SnapshotWriter::commit() {
+    if (failed_ || fd_ < 0 || written_ != header_.total_length) {
+        return false;
+    }
+    header_.checksum = header_checksum(header_);
+    write_at(0, &header_, sizeof(header_));
+    if (!failed_ && ftruncate(fd_, static_cast<off_t>(header_.content_offset + written_)) != 0) {
+        failed_ = true;  // Sized explicitly: padding before empty content is never written
+    }
+
+    // Synced before the rename, so the name never points at unwritten blocks
+    bool ok = !failed_ && fdatasync(fd_) == 0;
+    ok = ::close(fd_) == 0 && ok;
+    fd_ = -1;
+    if (!ok || rename(temp_path_.c_str(), path_.c_str()) != 0) {
+        unlink(temp_path_.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool SnapshotWriter::write_at(uint64_t offset, const void* data, size_t length) {
+    const char* bytes = static_cast<const char*>(data);
+    while (!failed_ && length > 0) {
+        ssize_t n = pwrite(fd_, bytes, length, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            failed_ = true;
+            break;
+        }
+        bytes += n;
+        offset += static_cast<uint64_t>(n);
+        length -= static_cast<size_t>(n);
+    }
+    return !failed_;
+}
+
+} // namespace nerd
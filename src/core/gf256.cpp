@@ -0,0 +1,167 @@
+#include "core/gf256.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NERD_GF_X86 1
+#endif
+
+namespace nerd {
+
+namespace {
+
+struct Tables {
+    uint8_t exp[512];   // Doubled so exp[log a + log b] needs no modulo
+    uint8_t log[256];
+
+    Tables() {
+        unsigned x = 1;
+        for (int i = 0; i < 255; ++i) {
+            exp[i] = static_cast<uint8_t>(x);
+            log[x] = static_cast<uint8_t>(i);
+            x <<= 1;
+            if (x & 0x100) {
+                x ^= 0x11d;
+            }
+        }
+        for (int i = 255; i < 512; ++i) {
+            exp[i] = exp[i - 255];
+        }
+        log[0] = 0;
+    }
+};
+
+const Tables& tables() {
+    static const Tables instance;
+    return instance;
+}
+
+// Products of the coefficient with every low nibble, then every high nibble:
+// c * x == low[x & 15] ^ high[x >> 4]
+void nibble_tables(uint8_t coefficient, uint8_t* low, uint8_t* high) {
+    for (int i = 0; i < 16; ++i) {
+        low[i] = gf_mul(coefficient, static_cast<uint8_t>(i));
+        high[i] = gf_mul(coefficient, static_cast<uint8_t>(i << 4));
+    }
+}
+
+void mul_add_scalar(uint8_t* dst, const uint8_t* src, const uint8_t* low, const uint8_t* high, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        dst[i] ^= low[src[i] & 15] ^ high[src[i] >> 4];
+    }
+}
+
+#ifdef NERD_GF_X86
+__attribute__((target("ssse3")))
+void mul_add_ssse3(uint8_t* dst, const uint8_t* src, const uint8_t* low, const uint8_t* high, size_t length) {
+    __m128i low_table = _mm_loadu_si128(reinterpret_cast<const __m128i*>(low));
+    __m128i high_table = _mm_loadu_si128(reinterpret_cast<const __m128i*>(high));
+    __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i lo = _mm_shuffle_epi8(low_table, _mm_and_si128(in, mask));
+        __m128i hi = _mm_shuffle_epi8(high_table, _mm_and_si128(_mm_srli_epi64(in, 4), mask));
+        __m128i out = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(out, _mm_xor_si128(lo, hi)));
+    }
+    mul_add_scalar(dst + i, src + i, low, high, length - i);
+}
+
+__attribute__((target("avx2")))
+void mul_add_avx2(uint8_t* dst, const uint8_t* src, const uint8_t* low, const uint8_t* high, size_t length) {
+    __m256i low_table = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(low)));
+    __m256i high_table = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(high)));
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i lo = _mm256_shuffle_epi8(low_table, _mm256_and_si256(in, mask));
+        __m256i hi = _mm256_shuffle_epi8(high_table, _mm256_and_si256(_mm256_srli_epi64(in, 4), mask));
+        __m256i out = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(out, _mm256_xor_si256(lo, hi)));
+    }
+    mul_add_scalar(dst + i, src + i, low, high, length - i);
+}
+#endif
+
+using RegionKernel = void (*)(uint8_t*, const uint8_t*, const uint8_t*, const uint8_t*, size_t);
+
+struct Kernel {
+    RegionKernel fn;
+    const char* name;
+
+    Kernel() : fn(mul_add_scalar), name("scalar") {
+#ifdef NERD_GF_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            fn = mul_add_avx2;
+            name = "avx2";
+        } else if (__builtin_cpu_supports("ssse3")) {
+            fn = mul_add_ssse3;
+            name = "ssse3";
+        }
+#endif
+    }
+};
+
+const Kernel& kernel() {
+    static const Kernel instance;
+    return instance;
+}
+
+void xor_region(uint8_t* dst, const uint8_t* src, size_t length) {
+    // Word at a time; the compiler vectorizes this loop on its own
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t a, b;
+        std::memcpy(&a, dst + i, 8);
+        std::memcpy(&b, src + i, 8);
+        a ^= b;
+        std::memcpy(dst + i, &a, 8);
+    }
+    for (; i < length; ++i) {
+        dst[i] ^= src[i];
+    }
+}
+
+} // namespace
+
+uint8_t gf_mul(uint8_t a, uint8_t b) {
+    if (a == 0 || b == 0) {
+        return 0;
+    }
+    const Tables& t = tables();
+    return t.exp[t.log[a] + t.log[b]];
+}
+
+uint8_t gf_div(uint8_t a, uint8_t b) {
+    if (a == 0) {
+        return 0;
+    }
+    const Tables& t = tables();
+    return t.exp[t.log[a] + 255 - t.log[b]];
+}
+
+uint8_t gf_inv(uint8_t a) {
+    return gf_div(1, a);
+}
+
+void gf_mul_add(uint8_t* dst, const uint8_t* src, uint8_t coefficient, size_t length) {
+    if (coefficient == 0) {
+        return;
+    }
+    if (coefficient == 1) {
+        xor_region(dst, src, length);
+        return;
+    }
+    uint8_t low[16], high[16];
+    nibble_tables(coefficient, low, high);
+    kernel().fn(dst, src, low, high, length);
+}
+
+const char* gf_kernel_name() {
+    return kernel().name;
+}
+
+} // namespace nerd
@@ -0,0 +1,169 @@
+#include "core/log.h"
+#include "network/mpsc_queue.h"
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+namespace nerd {
+
+namespace {
+
+const size_t LOG_QUEUE_CAPACITY = 1024;
+
+struct LogLine {
+    LogLevel level;
+    std::string text;
+
+    LogLine() : level(LogLevel::INFO) {}
+};
+
+uint64_t log_second() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// One writer thread drains the queue, so producers only ever pay for
+// formatting and a push; iostream locking stays off their path
+class Logger {
+public:
+    Logger() : queue_(LOG_QUEUE_CAPACITY), idle_(false), running_(true), written_(0) {
+        writer_ = std::thread(&Logger::writer, this);
+    }
+
+    ~Logger() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = false;
+        }
+        cv_.notify_one();
+        writer_.join();
+    }
+
+    void push(LogLevel level, std::string text) {
+        LogLine line;
+        line.level = level;
+        line.text = std::move(text);
+        if (!queue_.try_push(line)) {
+            return;
+        }
+
+        // Same handshake as the shard workers: either we see the writer
+        // idle or it sees the line before it sleeps
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (idle_.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cv_.notify_one();
+        }
+    }
+
+    void flush() {
+        uint64_t target = queue_.enqueued();
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.notify_one();
+        flushed_cv_.wait(lock, [this, target] { return written_ >= target || !running_; });
+    }
+
+private:
+    void writer() {
+        for (;;) {
+            uint64_t drained = 0;
+            while (!queue_.empty()) {
+                drained += queue_.drain(64, [](const LogLine& line) {
+                    std::ostream& out = line.level >= LogLevel::WARN ? std::cerr : std::cout;
+                    out << line.text << '\n';
+                });
+            }
+            std::cout.flush();
+            std::cerr.flush();
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            written_ += drained;
+            flushed_cv_.notify_all();
+            if (!running_ && queue_.empty()) {
+                return;
+            }
+            idle_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            cv_.wait(lock, [this] { return !running_ || !queue_.empty(); });
+            idle_.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    MpscQueue<LogLine> queue_;
+    std::atomic<bool> idle_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::condition_variable flushed_cv_;
+    bool running_;
+    uint64_t written_;
+    std::thread writer_;
+};
+
+Logger& logger() {
+    static Logger instance;
+    return instance;
+}
+
+std::atomic<uint8_t> threshold(static_cast<uint8_t>(LogLevel::INFO));
+
+} // namespace
+
+void set_log_level(LogLevel level) {
+    threshold.store(static_cast<uint8_t>(level), std::memory_order_relaxed);
+}
+
+LogLevel log_level() {
+    return static_cast<LogLevel>(threshold.load(std::memory_order_relaxed));
+}
+
+bool parse_log_level(const std::string& name, LogLevel& level) {
+    if (name == "debug") {
+        level = LogLevel::DEBUG;
+    } else if (name == "info") {
+        level = LogLevel::INFO;
+    } else if (name == "warn") {
+        level = LogLevel::WARN;
+    } else if (name == "error") {
+        level = LogLevel::ERROR;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool log_admit(LogLevel level, LogSite& site, uint64_t& suppressed) {
+    if (static_cast<uint8_t>(level) < threshold.load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    // The first message of a new second resets the budget and reports
+    // what the last one held back
+    uint64_t now = log_second();
+    uint64_t window = site.window.load(std::memory_order_relaxed);
+    if (window != now && site.window.compare_exchange_strong(window, now, std::memory_order_relaxed)) {
+        site.count.store(1, std::memory_order_relaxed);
+        suppressed = site.suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+    if (site.count.fetch_add(1, std::memory_order_relaxed) < site.per_second) {
+        suppressed = 0;
+        return true;
+    }
+    site.suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void log_write(LogLevel level, std::string message, uint64_t suppressed) {
+    if (suppressed != 0) {
+        message += " (" + std::to_string(suppressed) + " similar suppressed)";
+    }
+    logger().push(level, std::move(message));
+}
+
+void log_flush() {
+    logger().flush();
+}
+
+} // namespace nerd
@@ -0,0 +1,175 @@
+#include "core/spill_file.h"
+#include "core/log.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace nerd {
+
+namespace {
+
+// Address space reserved up front so the arena never moves, and the step
+// the file mapping is extended by
+const size_t RESERVE = size_t(1) << 36;
+const size_t MAP_STEP = size_t(64) << 20;
+
+const size_t NO_GROUP = static_cast<size_t>(-1);
+
+int open_backing_file(const std::string& directory) {
+    std::string dir = directory;
+    if (dir.empty()) {
+        const char* tmp = std::getenv("TMPDIR");
+        dir = tmp && *tmp ? tmp : "/tmp";
+    }
+    int fd = open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0) {
+        return fd;
+    }
+
+    // No O_TMPFILE on this filesystem: a named file, unlinked at once
+    std::string path = dir + "/nerd-spill-XXXXXX";
+    fd = mkostemp(&path[0], O_CLOEXEC);
+    if (fd >= 0) {
+        unlink(path.c_str());
+    }
+    return fd;
+}
+
+} // namespace
+
+SpillFile::SpillFile(size_t resident_budget, const std::string& directory)
+    : fd_(open_backing_file(directory)), base_(nullptr), mapped_(0), size_(0),
+      budget_groups_(std::max<size_t>(resident_budget / RESIDENT_GROUP, 1)), last_group_(NO_GROUP) {
+    if (fd_ < 0) {
+        static LogSite create_log(1);
+        log_message(LogLevel::WARN, create_log, "Failed to create spill file: ", strerror(errno));
+        return;
+    }
+    void* reserved = mmap(nullptr, RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED) {
+        static LogSite reserve_log(1);
+        log_message(LogLevel::WARN, reserve_log, "Failed to reserve spill address space: ", strerror(errno));
+        return;
+    }
+    base_ = static_cast<char*>(reserved);
+}
+
+SpillFile::~SpillFile() {
+    if (base_) {
+        munmap(base_, RESERVE);
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+const char* SpillFile::append(const char* data, size_t length) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t offset = size_.load(std::memory_order_relaxed);
+    if (!base_ || length > RESERVE - offset) {
+        return nullptr;
+    }
+
+    // Written through the file, not the mapping, so appending never faults
+    // the new pages in; they are read back only as they are touched
+    size_t written = 0;
+    while (written < length) {
+        ssize_t n = pwrite(fd_, data + written, length - written, static_cast<off_t>(offset + written));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return nullptr;
+        }
+        written += static_cast<size_t>(n);
+    }
+    if (!map_through(offset + length)) {
+        return nullptr;
+    }
+    size_.store(offset + length, std::memory_order_relaxed);
+    return base_ + offset;
+}
+
+void SpillFile::reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!base_) {
+        return;
+    }
+    // Back to an inaccessible reservation and an empty file
+    if (mapped_ != 0) {
+        mmap(base_, mapped_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    }
+    if (ftruncate(fd_, 0) != 0) {
+        static LogSite truncate_log(1);
+        log_message(LogLevel::WARN, truncate_log, "Failed to truncate spill file: ", strerror(errno));
+    }
+    mapped_ = 0;
+    size_.store(0, std::memory_order_relaxed);
+    lru_.clear();
+    resident_.clear();
+    last_group_.store(NO_GROUP, std::memory_order_relaxed);
+}
+
+void SpillFile::touch(const char* data, size_t length) {
+    size_t first = static_cast<size_t>(data - base_) / RESIDENT_GROUP;
+    size_t last = (static_cast<size_t>(data - base_) + std::max<size_t>(length, 1) - 1) / RESIDENT_GROUP;
+    if (first == last && last_group_.load(std::memory_order_relaxed) == first) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t group = first; group <= last; ++group) {
+        auto it = resident_.find(group);
+        if (it != resident_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second);
+        } else {
+            lru_.push_front(group);
+            resident_[group] = lru_.begin();
+        }
+    }
+    last_group_.store(last, std::memory_order_relaxed);
+    evict_over_budget();
+}
+
+size_t SpillFile::resident_groups() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return resident_.size();
+}
+
+bool SpillFile::map_through(size_t end) {
+    if (end <= mapped_) {
+        return true;
+    }
+    size_t target = std::min(RESERVE, (end + MAP_STEP - 1) / MAP_STEP * MAP_STEP);
+
+    // Pages past the end of the file are mapped but never read
+    void* mapped = mmap(base_ + mapped_, target - mapped_, PROT_READ, MAP_SHARED | MAP_FIXED, fd_,
+                        static_cast<off_t>(mapped_));
+    if (mapped == MAP_FAILED) {
+        static LogSite map_log(1);
+        log_message(LogLevel::WARN, map_log, "Failed to map spill file: ", strerror(errno));
+        return false;
+    }
+    mapped_ = target;
+    return true;
+}
+
+void SpillFile::evict_over_budget() {
+    // The file keeps the bytes; dropping the pages only gives up residency
+    while (resident_.size() > budget_groups_) {
+        size_t group = lru_.back();
+        lru_.pop_back();
+        resident_.erase(group);
+        size_t offset = group * RESIDENT_GROUP;
+        madvise(base_ + offset, std::min(RESIDENT_GROUP, mapped_ - offset), MADV_DONTNEED);
+        if (last_group_.load(std::memory_order_relaxed) == group) {
+            last_group_.store(NO_GROUP, std::memory_order_relaxed);
+        }
+    }
+}
+
+} // namespace nerd
@@ -0,0 +1,494 @@
+#include "core/text_buffer.h"
+#include "core/byte_search.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <string_view>
+
+namespace nerd {
+
+namespace {
+
+// Leaves are built around LEAF_TARGET bytes and grow in place up to LEAF_MAX
+const size_t LEAF_TARGET = 2048;
+const size_t LEAF_MAX = 4096;
+
+size_t count_newlines(const char* data, size_t length) {
+    return static_cast<size_t>(std::count(data, data + length, '\n'));
+}
+
+} // namespace
+
+TextBuffer::TextBuffer() : seed_(0x9e3779b97f4a7c15ULL) {}
+
+TextBuffer::TextBuffer(const std::string& text) : TextBuffer() {
+    assign(text);
+}
+
+TextBuffer::~TextBuffer() = default;
+
+void TextBuffer::assign(const std::string& text) {
+    root_ = build(text.data(), text.size());
+}
+
+void TextBuffer::assign(const char* data, size_t length) {
+    root_ = build(data, length);
+}
+
+void TextBuffer::insert_spilled(size_t offset, const char* data, size_t length, SpillFile& spill) {
+    const char* spilled = length ? spill.append(data, length) : nullptr;
+    if (!spilled) {
+        insert(offset, std::string(data, length));
+        return;
+    }
+    NodePtr left;
+    NodePtr right;
+    split(std::move(root_), std::min(offset, size()), left, right);
+    // Leaves are cut and counted from data, so the spilled pages are not read back
+    root_ = merge(merge(std::move(left), build(data, length, &spill, spilled)), std::move(right));
+}
+
+size_t TextBuffer::spilled_bytes() const {
+    return spilled_bytes(root_.get());
+}
+
+size_t TextBuffer::spilled_bytes(const Node* node) {
+    if (!node) {
+        return 0;
+    }
+    return (node->spill ? node->length : 0) + spilled_bytes(node->left.get()) + spilled_bytes(node->right.get());
+}
+
+void TextBuffer::clear() {
+    root_.reset();
+}
+
+std::string TextBuffer::to_string() const {
+    std::string text;
+    text.reserve(size());
+    for_each_chunk([&text](const char* data, size_t length) {
+        text.append(data, length);
+    });
+    return text;
+}
+
+void TextBuffer::insert(size_t offset, const std::string& text) {
+    if (text.empty()) {
+        return;
+    }
+    offset = std::min(offset, size());
+
+    // Small edits land in an existing leaf without reshaping the tree
+    if (root_ && insert_in_leaf(root_.get(), offset, text)) {
+        return;
+    }
+
+    NodePtr left, right;
+    split(std::move(root_), offset, left, right);
+    root_ = merge(merge(std::move(left), build(text.data(), text.size())), std::move(right));
+}
+
+void TextBuffer::erase(size_t offset, size_t length) {
+    size_t total = size();
+    if (offset >= total || length == 0) {
+        return;
+    }
+    length = std::min(length, total - offset);
+
+    NodePtr left, middle, right;
+    split(std::move(root_), offset, left, right);
+    split(std::move(right), length, middle, right);
+    root_ = merge(std::move(left), std::move(right));
+}
+
+void TextBuffer::replace(size_t offset, size_t length, const std::string& text) {
+    erase(offset, length);
+    insert(offset, text);
+}
+
+size_t TextBuffer::size() const {
+    return root_ ? root_->bytes : 0;
+}
+
+char TextBuffer::at(size_t offset) const {
+    const Node* leaf = locate(offset);
+    if (!leaf) {
+        return '\0';
+    }
+    if (leaf->spill) {
+        leaf->spill->touch(leaf->data + offset, 1);
+    }
+    return leaf->data[offset];
+}
+
+std::string TextBuffer::substr(size_t offset, size_t length) const {
+    size_t total = size();
+    if (offset >= total) {
+        return std::string();
+    }
+    std::string text(std::min(length, total - offset), '\0');
+    copy(offset, text.size(), &text[0]);
+    return text;
+}
+
+size_t TextBuffer::copy(size_t offset, size_t length, char* dest) const {
+    size_t copied = 0;
+    visit_range(root_.get(), offset, offset + length, [dest, &copied](const char* data, size_t count) {
+        std::memcpy(dest + copied, data, count);
+        copied += count;
+        return true;
+    });
+    return copied;
+}
+
+template <typename Fn>
+void TextBuffer::scan(const std::string& pattern, size_t from, Fn&& fn) const {
+    // Each leaf is searched in place; only a match straddling two leaves is
+    // looked for in a seam built from the last pattern.size() - 1 bytes
+    // before the leaf and as many at its start
+    const size_t keep = pattern.size() - 1;
+    std::string seam;
+    size_t base = from;      // Offset of the current leaf's first byte
+    size_t next = from;      // Earliest offset the next match may start at
+    visit_range(root_.get(), from, size(), [&](const char* data, size_t count) {
+        if (!seam.empty() && next < base) {
+            size_t seam_start = base - seam.size();
+            size_t head = seam.size();
+            seam.append(data, std::min(count, keep));
+            const char* cursor = seam.data() + (std::max(next, seam_start) - seam_start);
+            const char* end = seam.data() + seam.size();
+            while (cursor < seam.data() + head) {
+                const char* hit = find_bytes(cursor, end - cursor, pattern.data(), pattern.size());
+                if (!hit || hit >= seam.data() + head) {
+                    break;
+                }
+                size_t offset = seam_start + (hit - seam.data());
+                next = offset + pattern.size();
+                if (!fn(offset)) {
+                    return false;
+                }
+                cursor = hit + pattern.size();
+            }
+            seam.resize(head);
+        }
+        
+        const char* cursor = data + (std::max(next, base) - base);
+        const char* end = data + count;
+        while (cursor < end) {
+            const char* hit = find_bytes(cursor, end - cursor, pattern.data(), pattern.size());
+            if (!hit) {
+                break;
+            }
+            size_t offset = base + (hit - data);
+            next = offset + pattern.size();
+            if (!fn(offset)) {
+                return false;
+            }
+            cursor = hit + pattern.size();
+        }
+        
+        // Carry the tail forward for the next seam
+        if (count >= keep) {
+            seam.assign(end - keep, keep);
+        } else {
+            seam.append(data, count);
+            seam.erase(0, seam.size() - std::min(seam.size(), keep));
+        }
+        base += count;
+        return true;
+    });
+}
+
+size_t TextBuffer::find(const std::string& pattern, size_t from) const {
+    size_t total = size();
+    if (pattern.empty() || from >= total) {
+        return pattern.empty() && from <= total ? from : npos;
+    }
+
+    size_t found = npos;
+    scan(pattern, from, [&found](size_t offset) {
+        found = offset;
+        return false;
+    });
+    return found;
+}
+
+std::vector<size_t> TextBuffer::find_all(const std::string& pattern, size_t from) const {
+    std::vector<size_t> matches;
+    if (pattern.empty() || from >= size()) {
+        return matches;
+    }
+    scan(pattern, from, [&matches](size_t offset) {
+        matches.push_back(offset);
+        return true;
+    });
+    return matches;
+}
+
+int TextBuffer::line_count() const {
+    if (!root_) {
+        return 0;
+    }
+    int lines = static_cast<int>(root_->newlines);
+    return back() == '\n' ? lines : lines + 1;
+}
+
+size_t TextBuffer::line_offset(int line) const {
+    if (line <= 0 || !root_) {
+        return 0;
+    }
+    if (static_cast<size_t>(line) > root_->newlines) {
+        return size();
+    }
+    return offset_after_newline(root_.get(), static_cast<size_t>(line));
+}
+
+size_t TextBuffer::newlines_before(size_t offset) const {
+    size_t newlines = 0;
+    const Node* node = root_.get();
+    while (node) {
+        size_t left_bytes = node->left ? node->left->bytes : 0;
+        if (offset < left_bytes) {
+            node = node->left.get();
+            continue;
+        }
+        if (node->left) {
+            newlines += node->left->newlines;
+        }
+        offset -= left_bytes;
+        if (offset < node->length) {
+            if (node->spill) {
+                node->spill->touch(node->data, offset);
+            }
+            return newlines + count_newlines(node->data, offset);
+        }
+        newlines += node->text_newlines;
+        offset -= node->length;
+        node = node->right.get();
+    }
+    return newlines;
+}
+
+std::string TextBuffer::line(int index) const {
+    size_t begin = line_offset(index);
+    size_t end = line_offset(index + 1);
+    if (end > begin && at(end - 1) == '\n') {
+        --end;
+    }
+    return substr(begin, end - begin);
+}
+
+std::string_view TextBuffer::line_view(int index, std::string& scratch) const {
+    size_t begin = line_offset(index);
+    size_t end = line_offset(index + 1);
+    if (end > begin && at(end - 1) == '\n') {
+        --end;
+    }
+    if (begin == end) {
+        return std::string_view();
+    }
+
+    size_t local = begin;
+    const Node* leaf = locate(local);
+    if (leaf && local + (end - begin) <= leaf->length) {
+        if (leaf->spill) {
+            leaf->spill->touch(leaf->data + local, end - begin);
+        }
+        return std::string_view(leaf->data + local, end - begin);
+    }
+
+    scratch = substr(begin, end - begin);
+    return std::string_view(scratch);
+}
+
+const TextBuffer::Node* TextBuffer::locate(size_t& offset) const {
+    // Leaf holding offset; offset becomes relative to that leaf
+    const Node* node = root_.get();
+    while (node) {
+        size_t left_bytes = node->left ? node->left->bytes : 0;
+        if (offset < left_bytes) {
+            node = node->left.get();
+        } else if (offset < left_bytes + node->length) {
+            offset -= left_bytes;
+            return node;
+        } else {
+            offset -= left_bytes + node->length;
+            node = node->right.get();
+        }
+    }
+    return nullptr;
+}
+
+uint32_t TextBuffer::next_priority() {
+    // xorshift64: treap priorities only need to be well spread
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 7;
+    seed_ ^= seed_ << 17;
+    return static_cast<uint32_t>(seed_ >> 32);
+}
+
+TextBuffer::NodePtr TextBuffer::make_leaf(const char* data, size_t length, SpillFile* spill, const char* spilled) {
+    NodePtr node(new Node());
+    if (spill) {
+        node->data = spilled;
+    } else {
+        node->text.assign(data, length);
+        node->data = node->text.data();
+    }
+    node->length = length;
+    node->spill = spill;
+    node->text_newlines = count_newlines(data, length);
+    node->priority = next_priority();
+    update(node.get());
+    return node;
+}
+
+TextBuffer::NodePtr TextBuffer::build(const char* data, size_t length, SpillFile* spill, const char* spilled) {
+    NodePtr root;
+    size_t offset = 0;
+    while (offset < length) {
+        size_t cut = std::min(LEAF_TARGET, length - offset);
+        if (offset + cut < length) {
+            // End the leaf after the last newline in its second half, if any
+            const char* begin = data + offset + cut / 2;
+            const char* end = data + offset + cut;
+            const char* newline = std::find(std::make_reverse_iterator(end), std::make_reverse_iterator(begin), '\n').base();
+            if (newline != begin) {
+                cut = static_cast<size_t>(newline - (data + offset));
+            }
+        }
+        root = merge(std::move(root), make_leaf(data + offset, cut, spill, spilled ? spilled + offset : nullptr));
+        offset += cut;
+    }
+    return root;
+}
+
+void TextBuffer::update(Node* node) {
+    node->bytes = node->length;
+    node->newlines = node->text_newlines;
+    if (node->left) {
+        node->bytes += node->left->bytes;
+        node->newlines += node->left->newlines;
+    }
+    if (node->right) {
+        node->bytes += node->right->bytes;
+        node->newlines += node->right->newlines;
+    }
+}
+
+TextBuffer::NodePtr TextBuffer::merge(NodePtr left, NodePtr right) {
+    if (!left) {
+        return right;
+    }
+    if (!right) {
+        return left;
+    }
+    if (left->priority > right->priority) {
+        left->right = merge(std::move(left->right), std::move(right));
+        update(left.get());
+        return left;
+    }
+    right->left = merge(std::move(left), std::move(right->left));
+    update(right.get());
+    return right;
+}
+
+void TextBuffer::split(NodePtr node, size_t offset, NodePtr& left, NodePtr& right) {
+    if (!node) {
+        left.reset();
+        right.reset();
+        return;
+    }
+
+    size_t left_bytes = node->left ? node->left->bytes : 0;
+    size_t text_end = left_bytes + node->length;
+
+    if (offset <= left_bytes) {
+        split(std::move(node->left), offset, left, node->left);
+        update(node.get());
+        right = std::move(node);
+    } else if (offset >= text_end) {
+        split(std::move(node->right), offset - text_end, node->right, right);
+        update(node.get());
+        left = std::move(node);
+    } else {
+        // Cut inside this leaf: the tail becomes a leaf of its own, a
+        // spilled one just a shorter view
+        size_t local = offset - left_bytes;
+        NodePtr tail = make_leaf(node->data + local, node->length - local, node->spill, node->data + local);
+        if (!node->spill) {
+            node->text.resize(local);
+            node->data = node->text.data();
+        }
+        node->length = local;
+        node->text_newlines -= tail->text_newlines;
+        NodePtr rest = std::move(node->right);
+        update(node.get());
+        left = std::move(node);
+        right = merge(std::move(tail), std::move(rest));
+    }
+}
+
+bool TextBuffer::insert_in_leaf(Node* node, size_t offset, const std::string& text) {
+    size_t left_bytes = node->left ? node->left->bytes : 0;
+    bool inserted;
+
+    if (node->left && offset < left_bytes) {
+        inserted = insert_in_leaf(node->left.get(), offset, text);
+    } else if (offset - left_bytes <= node->length) {
+        if (node->length + text.size() > LEAF_MAX) {
+            return false;
+        }
+        // An edited leaf comes back to the heap
+        if (node->spill) {
+            node->text.assign(node->data, node->length);
+            node->spill = nullptr;
+        }
+        node->text.insert(offset - left_bytes, text);
+        node->data = node->text.data();
+        node->length = node->text.size();
+        node->text_newlines += count_newlines(text.data(), text.size());
+        inserted = true;
+    } else if (node->right) {
+        inserted = insert_in_leaf(node->right.get(), offset - left_bytes - node->length, text);
+    } else {
+        return false;
+    }
+
+    if (inserted) {
+        update(node);
+    }
+    return inserted;
+}
+
+size_t TextBuffer::offset_after_newline(const Node* node, size_t newline) {
+    size_t base = 0;
+    while (node) {
+        size_t left_newlines = node->left ? node->left->newlines : 0;
+        size_t left_bytes = node->left ? node->left->bytes : 0;
+        if (newline <= left_newlines) {
+            node = node->left.get();
+            continue;
+        }
+        newline -= left_newlines;
+        if (newline <= node->text_newlines) {
+            if (node->spill) {
+                node->spill->touch(node->data, node->length);
+            }
+            std::string_view text(node->data, node->length);
+            size_t pos = 0;
+            for (;;) {
+                pos = text.find('\n', pos) + 1;
+                if (--newline == 0) {
+                    return base + left_bytes + pos;
+                }
+            }
+        }
+        newline -= node->text_newlines;
+        base += left_bytes + node->length;
+        node = node->right.get();
+    }
+    return base;
+}
+
+} // namespace nerd
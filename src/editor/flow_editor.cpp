@@ -1,13 +1,25 @@
 #include "editor/flow_editor.h"
+#include "core/log.h"
+#include "core/fec.h"
+#include "core/chunk_codec.h"
 #include <iostream>
 #include <sstream>
+#include <fstream>
+#include <iterator>
 #include <regex>
 #include <algorithm>
 
 namespace nerd {
 
-FlowEditor::FlowEditor() {
-    flow_manager_ = std::make_unique<FlowManager>();
+namespace {
+
+// Trained dictionaries are sized like zstd's own default
+const size_t DICTIONARY_BYTES = 110 * 1024;
+
+} // namespace
+
+FlowEditor::FlowEditor(const std::string& flow_namespace) : change_listener_(0) {
+    flow_manager_ = std::make_unique<FlowManager>(flow_namespace);
 }
 
 FlowEditor::~FlowEditor() = default;
@@ -28,9 +40,9 @@ bool FlowEditor::open_flow(const std::string& flow_name) {
     state_.current_line = 0;
     state_.is_modified = false;
     
-    // Set up content change callback
-    flow->set_content_change_callback([this](const std::string& new_content) {
-        this->handle_content_change(new_content);
+    // Follow content changes as they land
+    change_listener_ = flow->add_change_listener([this](const ContentChange& change) {
+        this->handle_content_change(change);
     });
     
     clear_error();
@@ -41,6 +53,7 @@ bool FlowEditor::open_flow(const std::string& flow_name) {
 void FlowEditor::close_flow() {
     if (state_.current_flow) {
         std::string flow_name = state_.current_flow->name();
+        state_.current_flow->remove_change_listener(change_listener_);
         flow_manager_->close_flow(flow_name);
         state_.current_flow = nullptr;
         state_.current_line = 0;
@@ -74,9 +87,108 @@ void FlowEditor::run_command(const std::string& command) {
         return;
     }
     
+    // Catch up with peers' data and edits before acting on line numbers
+    if (state_.current_flow) {
+        state_.current_flow->apply_received_chunks();
+        state_.current_flow->apply_received_edits();
+    }
+    
     if (!execute_command(command)) {
         set_error("Invalid command: " + command);
     }
+    
+    // Engine messages the command produced land before its result is reported
+    log_flush();
+}
+
+bool FlowEditor::run_script(std::istream& input) {
+    std::vector<EditCommand> pending;
+    int pending_from = 0;     // Script line of the transaction's first edit
+    int lines = 0;            // Line count once the queued edits have applied
+    std::string line;
+    int number = 0;
+    bool ok = true;
+    
+    // A failed transaction is reported at the line that began it
+    auto commit = [this, &pending, &pending_from, &ok]() {
+        apply_transaction(pending);
+        if (!state_.last_error.empty()) {
+            std::cerr << "Error: line " << pending_from << ": " << state_.last_error << std::endl;
+            clear_error();
+            ok = false;
+        }
+    };
+    
+    while (ok && std::getline(input, line)) {
+        ++number;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        
+        EditCommand edit;
+        if (parse_edit_command(line, edit)) {
+            // Line numbers are checked as queued, against the content the
+            // earlier edits of the transaction will have left
+            if (pending.empty()) {
+                if (state_.current_flow) {
+                    state_.current_flow->apply_received_chunks();
+                    state_.current_flow->apply_received_edits();
+                }
+                pending_from = number;
+                lines = state_.current_flow ? state_.current_flow->line_count() : 0;
+            }
+            // One invalid edit fails the whole transaction: none of it applies
+            if (state_.current_flow && !project_edit(edit, lines)) {
+                pending.clear();
+                std::cerr << "Error: line " << number << ": Invalid line range" << std::endl;
+                ok = false;
+                break;
+            }
+            pending.push_back(edit);
+            continue;
+        }
+        
+        // Anything else ends the running transaction and runs on its own
+        commit();
+        if (!ok || line == "quit" || line == "q") {
+            break;
+        }
+        run_command(line);
+        if (!state_.last_error.empty()) {
+            std::cerr << "Error: line " << number << ": " << state_.last_error << std::endl;
+            clear_error();
+            ok = false;
+        }
+    }
+    
+    if (ok) {
+        commit();
+    }
+    
+    // A failed script leaves the flow unwritten
+    if (ok && state_.current_flow && state_.is_modified) {
+        write_flow();
+    }
+    return ok;
+}
+
+void FlowEditor::apply_transaction(std::vector<EditCommand>& edits) {
+    if (edits.empty()) {
+        return;
+    }
+    if (!state_.current_flow) {
+        set_error("No flow open");
+        edits.clear();
+        return;
+    }
+    
+    size_t splices = state_.current_flow->apply_commands(edits);
+    if (splices > 0) {
+        state_.is_modified = true;
+    }
+    update_current_line();
+    std::cout << "Applied " << edits.size() << " commands (" << splices << " splices)" << std::endl;
+    edits.clear();
 }
 
 void FlowEditor::append_line(const std::string& line) {
@@ -122,6 +234,11 @@ void FlowEditor::insert_line(int line, const std::string& content) {
         return;
     }
     
+    if (line < 0 || line > state_.current_flow->line_count()) {
+        set_error("Invalid line range");
+        return;
+    }
+    
     state_.current_flow->insert_content(line, content);
     state_.is_modified = true;
     update_current_line();
@@ -133,9 +250,9 @@ void FlowEditor::print_current_line() {
         return;
     }
     
-    std::vector<std::string> lines = split_lines(state_.current_flow->content());
-    if (state_.current_line >= 0 && state_.current_line < static_cast<int>(lines.size())) {
-        std::cout << (state_.current_line + 1) << "\t" << lines[state_.current_line] << std::endl;
+    if (state_.current_line >= 0 && state_.current_line < state_.current_flow->line_count()) {
+        std::string scratch;
+        std::cout << (state_.current_line + 1) << "\t" << state_.current_flow->line(state_.current_line, scratch) << std::endl;
     }
 }
 
@@ -145,8 +262,7 @@ void FlowEditor::print_all_lines() {
         return;
     }
     
-    std::vector<std::string> lines = split_lines(state_.current_flow->content());
-    print_lines(lines, 0, lines.size() - 1);
+    print_lines(0, state_.current_flow->line_count() - 1);
 }
 
 void FlowEditor::print_line_range(int start, int end) {
@@ -160,8 +276,7 @@ void FlowEditor::print_line_range(int start, int end) {
         return;
     }
     
-    std::vector<std::string> lines = split_lines(state_.current_flow->content());
-    print_lines(lines, start, end);
+    print_lines(start, end);
 }
 
 void FlowEditor::write_flow() {
@@ -182,20 +297,52 @@ void FlowEditor::quit_editor() {
     close_flow();
 }
 
-bool FlowEditor::initialize_network(const std::string& interface) {
+bool FlowEditor::initialize_network(const std::vector<std::string>& interfaces) {
     if (!flow_manager_) {
         set_error("Flow manager not initialized");
         return false;
     }
     
-    bool success = flow_manager_->initialize_network(interface);
+    bool success = flow_manager_->initialize_network(interfaces);
     if (!success) {
-        set_error("Failed to initialize network on interface: " + interface);
+        std::string names;
+        for (const auto& interface : interfaces) {
+            names += (names.empty() ? "" : ",") + interface;
+        }
+        set_error("Failed to initialize network on interface: " + names);
     }
     
     return success;
 }
 
+void FlowEditor::set_transmit_limits(const TransmitLimits& limits) {
+    if (flow_manager_ && flow_manager_->network_flow()) {
+        flow_manager_->network_flow()->set_transmit_limits(limits);
+    }
+}
+
+void FlowEditor::set_transport_config(const TransportConfig& config) {
+    if (flow_manager_ && flow_manager_->network_flow()) {
+        flow_manager_->network_flow()->set_transport_config(config);
+    }
+}
+
+size_t FlowEditor::enable_snapshots(const std::string& directory) {
+    return flow_manager_ ? flow_manager_->enable_snapshots(directory) : 0;
+}
+
+void FlowEditor::set_metrics_file(const std::string& path) {
+    if (flow_manager_) {
+        flow_manager_->set_metrics_file(path);
+    }
+}
+
+void FlowEditor::set_max_flow_length(size_t max_length) {
+    if (flow_manager_) {
+        flow_manager_->set_max_flow_length(max_length);
+    }
+}
+
 void FlowEditor::discover_flows() {
     if (flow_manager_) {
         flow_manager_->discover_existing_flows();
@@ -214,6 +361,81 @@ std::string FlowEditor::parse_command(const std::string& input) {
     return input;
 }
 
+bool FlowEditor::parse_edit_command(const std::string& command, EditCommand& edit) const {
+    std::istringstream iss(command);
+    std::string cmd;
+    iss >> cmd;
+    
+    if (cmd == "append" || cmd == "a") {
+        std::string text;
+        std::getline(iss, text);
+        if (!text.empty() && text[0] == ' ') {
+            text = text.substr(1);
+        }
+        edit.type = EditCommand::APPEND;
+        edit.data = text;
+        return true;
+    }
+    
+    if (cmd == "insert" || cmd == "i") {
+        int line;
+        if (!(iss >> line)) {
+            return false;
+        }
+        std::string text;
+        std::getline(iss, text);
+        if (!text.empty() && text[0] == ' ') {
+            text = text.substr(1);
+        }
+        edit.type = EditCommand::INSERT;
+        edit.start_line = line - 1;
+        edit.data = text;
+        return true;
+    }
+    
+    if (cmd == "delete" || cmd == "d") {
+        int start, end;
+        if (!(iss >> start >> end)) {
+            return false;
+        }
+        edit.type = EditCommand::DELETE;
+        edit.start_line = start - 1; // Convert to 0-based
+        edit.end_line = end - 1;
+        return true;
+    }
+    
+    if (cmd == "substitute" || cmd == "s") {
+        std::string pattern, replacement;
+        if (!(iss >> pattern)) {
+            return false;
+        }
+        iss >> replacement;
+        edit.type = EditCommand::SUBSTITUTE;
+        edit.pattern = pattern;
+        edit.replacement = replacement;
+        return true;
+    }
+    
+    return false;
+}
+
+void FlowEditor::apply_edit(const EditCommand& edit) {
+    switch (edit.type) {
+        case EditCommand::APPEND:
+            append_line(edit.data);
+            break;
+        case EditCommand::INSERT:
+            insert_line(edit.start_line, edit.data);
+            break;
+        case EditCommand::DELETE:
+            delete_lines(edit.start_line, edit.end_line);
+            break;
+        case EditCommand::SUBSTITUTE:
+            substitute_text(edit.pattern, edit.replacement);
+            break;
+    }
+}
+
 bool FlowEditor::execute_command(const std::string& command) {
     std::istringstream iss(command);
     std::string cmd;
@@ -232,6 +454,11 @@ bool FlowEditor::execute_command(const std::string& command) {
         std::cout << "  discover          - Discover existing flows" << std::endl;
         std::cout << "  list              - List active flows" << std::endl;
         std::cout << "  status            - Show current flow status" << std::endl;
+        std::cout << "  stats [prometheus] - Show engine counters and latencies" << std::endl;
+        std::cout << "  pattern fec <data> <parity> | off - Send parity with each group of data chunks" << std::endl;
+        std::cout << "  pattern codec <none|lz4|zstd> [dictionary] - Compress data chunks" << std::endl;
+        std::cout << "  dictionary load <id> <file> - Register a zstd dictionary shared with peers" << std::endl;
+        std::cout << "  dictionary train <id> <file> - Train one from this flow and save it for peers" << std::endl;
         std::cout << "  write             - Write flow to circulation" << std::endl;
         std::cout << "  quit              - Quit editor" << std::endl;
         return true;
@@ -248,39 +475,9 @@ bool FlowEditor::execute_command(const std::string& command) {
         return true;
     }
     
-    if (cmd == "append" || cmd == "a") {
-        std::string text;
-        std::getline(iss, text);
-        if (!text.empty() && text[0] == ' ') {
-            text = text.substr(1);
-        }
-        append_line(text);
-        return true;
-    }
-    
-    if (cmd == "insert" || cmd == "i") {
-        int line;
-        iss >> line;
-        std::string text;
-        std::getline(iss, text);
-        if (!text.empty() && text[0] == ' ') {
-            text = text.substr(1);
-        }
-        insert_line(line - 1, text);
-        return true;
-    }
-    
-    if (cmd == "delete" || cmd == "d") {
-        int start, end;
-        iss >> start >> end;
-        delete_lines(start - 1, end - 1); // Convert to 0-based
-        return true;
-    }
-    
-    if (cmd == "substitute" || cmd == "s") {
-        std::string pattern, replacement;
-        iss >> pattern >> replacement;
-        substitute_text(pattern, replacement);
+    EditCommand edit;
+    if (parse_edit_command(command, edit)) {
+        apply_edit(edit);
         return true;
     }
     
@@ -329,6 +526,24 @@ bool FlowEditor::execute_command(const std::string& command) {
         return true;
     }
     
+    if (cmd == "stats") {
+        std::string format;
+        iss >> format;
+        if (!format.empty() && format != "prometheus") {
+            return false;
+        }
+        print_stats(!format.empty());
+        return true;
+    }
+    
+    if (cmd == "pattern") {
+        return configure_pattern(iss);
+    }
+    
+    if (cmd == "dictionary") {
+        return manage_dictionary(iss);
+    }
+    
     if (cmd == "write" || cmd == "w") {
         write_flow();
         return true;
@@ -364,35 +579,191 @@ void FlowEditor::print_flow_state() {
     std::cout << "Current line: " << (state_.current_line + 1) << std::endl;
     std::cout << "Modified: " << (state_.is_modified ? "yes" : "no") << std::endl;
     
-    std::vector<std::string> lines = split_lines(state_.current_flow->content());
-    std::cout << "Total lines: " << lines.size() << std::endl;
+    std::cout << "Total lines: " << state_.current_flow->line_count() << std::endl;
+    
+    const CirculationPattern& pattern = state_.current_flow->pattern();
+    if (pattern.has_fec()) {
+        std::cout << "FEC: " << static_cast<int>(pattern.fec_parity_chunks) << " parity per "
+                  << static_cast<int>(pattern.fec_data_chunks) << " data chunks" << std::endl;
+    } else {
+        std::cout << "FEC: off" << std::endl;
+    }
+    std::cout << "Codec: " << codec_name(static_cast<ChunkCodec>(pattern.codec));
+    if (pattern.dictionary != 0) {
+        std::cout << " (dictionary " << pattern.dictionary << ")";
+    }
+    std::cout << std::endl;
 }
 
-void FlowEditor::write_pattern_changes() {
+bool FlowEditor::manage_dictionary(std::istream& args) {
+    std::string action;
+    unsigned long id = 0;
+    std::string path;
+    if (!(args >> action >> id >> path) || (action != "load" && action != "train")) {
+        return false;
+    }
+    if (id == 0 || id > UINT16_MAX) {
+        set_error("Dictionary ids run from 1 to " + std::to_string(UINT16_MAX));
+        return true;
+    }
+    
+    std::vector<uint8_t> dictionary;
+    if (action == "load") {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            set_error("Cannot read dictionary file: " + path);
+            return true;
+        }
+        dictionary.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    } else {
+        // Lines are the samples: content of one flow family shares its phrasing
+        if (!state_.current_flow) {
+            set_error("No flow open");
+            return true;
+        }
+        std::vector<std::string> samples;
+        state_.current_flow->for_each_line(0, state_.current_flow->line_count(), [&samples](int, std::string_view line) {
+            samples.emplace_back(line);
+        });
+        dictionary = train_dictionary(samples, DICTIONARY_BYTES);
+        if (dictionary.empty()) {
+            set_error("Could not train a dictionary from this flow");
+            return true;
+        }
+        std::ofstream file(path, std::ios::binary);
+        if (!file.write(reinterpret_cast<const char*>(dictionary.data()), dictionary.size())) {
+            set_error("Cannot write dictionary file: " + path);
+            return true;
+        }
+    }
+    
+    if (!register_dictionary(static_cast<uint16_t>(id), dictionary)) {
+        set_error("Could not register dictionary " + std::to_string(id));
+        return true;
+    }
+    std::cout << "Dictionary " << id << ": " << dictionary.size() << " bytes" << std::endl;
+    return true;
+}
+
+bool FlowEditor::configure_pattern(std::istream& args) {
     if (!state_.current_flow) {
-        return;
+        set_error("No flow open");
+        return true;
     }
     
-    // In a real implementation, this would write the changes to the circulation pattern
-    state_.current_flow->maintain_flow();
+    // Takes effect at the next write, which re-sends every chunk
+    CirculationPattern pattern = state_.current_flow->pattern();
+    std::string setting;
+    args >> setting;
+    if (setting == "fec") {
+        std::string data;
+        args >> data;
+        if (data == "off") {
+            pattern.fec_data_chunks = 0;
+            pattern.fec_parity_chunks = 0;
+        } else {
+            int data_chunks = 0;
+            int parity_chunks = 0;
+            std::istringstream(data) >> data_chunks;
+            if (!(args >> parity_chunks) || data_chunks < 1 || data_chunks > static_cast<int>(FEC_MAX_DATA) ||
+                parity_chunks < 1 || parity_chunks > static_cast<int>(FEC_MAX_PARITY)) {
+                set_error("Expected pattern fec <1-" + std::to_string(FEC_MAX_DATA) + "> <1-" +
+                          std::to_string(FEC_MAX_PARITY) + "> or pattern fec off");
+                return true;
+            }
+            pattern.fec_data_chunks = static_cast<uint8_t>(data_chunks);
+            pattern.fec_parity_chunks = static_cast<uint8_t>(parity_chunks);
+        }
+    } else if (setting == "codec") {
+        std::string name;
+        args >> name;
+        ChunkCodec codec = CODEC_NONE;
+        while (codec <= CODEC_ZSTD && name != codec_name(codec)) {
+            codec = static_cast<ChunkCodec>(codec + 1);
+        }
+        if (codec > CODEC_ZSTD) {
+            set_error("Expected pattern codec <none|lz4|zstd> [dictionary]");
+            return true;
+        }
+        if (!codec_available(codec)) {
+            set_error(std::string("Codec not available in this build: ") + name);
+            return true;
+        }
+        
+        // Peers decode with the same dictionary, so it must be registered first
+        unsigned long dictionary = 0;
+        if (args >> dictionary && (codec != CODEC_ZSTD || dictionary > UINT16_MAX ||
+                                   !has_dictionary(static_cast<uint16_t>(dictionary)))) {
+            set_error("No zstd dictionary registered as " + std::to_string(dictionary));
+            return true;
+        }
+        pattern.codec = codec;
+        pattern.dictionary = static_cast<uint16_t>(dictionary);
+    } else {
+        return false;
+    }
+    
+    state_.current_flow->update_circulation_pattern(pattern);
+    state_.is_modified = true;
+    return true;
 }
 
-std::vector<std::string> FlowEditor::split_lines(const std::string& content) {
-    std::vector<std::string> lines;
-    std::istringstream stream(content);
-    std::string line;
+void FlowEditor::print_stats(bool prometheus) {
+    if (!flow_manager_) {
+        return;
+    }
+    if (prometheus) {
+        std::cout << flow_manager_->render_metrics() << std::flush;
+        return;
+    }
     
-    while (std::getline(stream, line)) {
-        lines.push_back(line);
+    const NetworkFlow& network = *flow_manager_->network_flow();
+    NetworkFlow::TrafficStats traffic = network.traffic_stats();
+    NetworkFlow::IngressStats ingress = network.ingress_stats();
+    NetworkFlow::RetransmitStats retransmit = network.retransmit_stats();
+    NetworkFlow::CirculationStats circulation = network.circulation_stats();
+    
+    std::cout << "Received: " << traffic.rx_packets << " packets, " << traffic.rx_bytes << " bytes ("
+              << traffic.rx_dropped << " dropped before delivery, " << ingress.corrupt << " corrupt)" << std::endl;
+    std::cout << "Sent: " << traffic.tx_packets << " packets, " << traffic.tx_bytes << " bytes ("
+              << traffic.tx_dropped << " dropped)" << std::endl;
+    std::cout << "Shard queues: " << ingress.enqueued << " enqueued, " << ingress.dropped << " dropped, "
+              << ingress.fallbacks << " stored directly" << std::endl;
+    std::cout << "Retransmission: " << retransmit.nacks_received << " requests, " << retransmit.packets_resent
+              << " resent, " << retransmit.packets_throttled << " throttled" << std::endl;
+    std::cout << "Circulation: " << circulation.heartbeats << " heartbeats in " << circulation.heartbeat_frames
+              << " frames, " << circulation.refreshes << " refreshes, " << circulation.deferred << " deferred" << std::endl;
+    
+    // Bucket upper bounds, so each figure is within a factor of two
+    auto print_latency = [](const char* label, const HistogramSnapshot& histogram, const char* unit) {
+        std::cout << label << ": p50 <= " << histogram.quantile(0.5) << unit << ", p99 <= " << histogram.quantile(0.99)
+                  << unit << ", max <= " << histogram.quantile(1.0) << unit << " (" << histogram.count << " samples)"
+                  << std::endl;
+    };
+    print_latency("Circulation tick", network.tick_histogram(), " ns");
+    print_latency("Shard lock wait", network.lock_wait_histogram(), " ns");
+    print_latency("Reorder depth", network.reorder_histogram(), " packets");
+}
+
+void FlowEditor::write_pattern_changes() {
+    if (!state_.current_flow) {
+        return;
     }
     
-    return lines;
+    // In a real implementation, this would write the changes to the circulation pattern
+    state_.current_flow->maintain_flow();
 }
 
-void FlowEditor::print_lines(const std::vector<std::string>& lines, int start, int end) {
-    for (int i = start; i <= end && i < static_cast<int>(lines.size()); ++i) {
-        std::cout << (i + 1) << "\t" << lines[i] << std::endl;
+void FlowEditor::print_lines(int start, int end) {
+    if (end < start) {
+        return;
     }
+    
+    // Streamed from the line index; nothing is copied per line
+    state_.current_flow->for_each_line(start, end - start + 1, [](int index, std::string_view line) {
+        std::cout << (index + 1) << "\t" << line << "\n";
+    });
+    std::cout << std::flush;
 }
 
 bool FlowEditor::validate_line_range(int start, int end) {
@@ -400,13 +771,43 @@ bool FlowEditor::validate_line_range(int start, int end) {
         return false;
     }
     
-    std::vector<std::string> lines = split_lines(state_.current_flow->content());
-    return start >= 0 && start < static_cast<int>(lines.size()) &&
-           end >= start && end < static_cast<int>(lines.size());
+    int lines = state_.current_flow->line_count();
+    return start >= 0 && start < lines && end >= start && end < lines;
 }
 
-void FlowEditor::handle_content_change(const std::string& new_content) {
+bool FlowEditor::project_edit(const EditCommand& edit, int& lines) const {
+    // The edit commands' text never holds a newline, so each adds or removes whole lines
+    switch (edit.type) {
+        case EditCommand::APPEND:
+            lines += edit.data.empty() ? 0 : 1;
+            return true;
+        case EditCommand::INSERT:
+            if (edit.start_line < 0 || edit.start_line > lines) {
+                return false;
+            }
+            lines += edit.data.empty() ? 0 : 1;
+            return true;
+        case EditCommand::DELETE:
+            if (edit.start_line < 0 || edit.start_line >= lines || edit.end_line < edit.start_line ||
+                edit.end_line >= lines) {
+                return false;
+            }
+            lines -= edit.end_line - edit.start_line + 1;
+            return true;
+        case EditCommand::SUBSTITUTE:
+            return true;
+    }
+    return true;
+}
+
+void FlowEditor::handle_content_change(const ContentChange& change) {
     state_.is_modified = true;
+    
+    // Keep the cursor on the same text when lines above it come or go
+    if (change.first_line < state_.current_line) {
+        int shift = change.inserted_lines - change.erased_lines;
+        state_.current_line = std::max(change.first_line, state_.current_line + shift);
+    }
     update_current_line();
 }
 
@@ -415,9 +816,9 @@ void FlowEditor::update_current_line() {
         return;
     }
     
-    std::vector<std::string> lines = split_lines(state_.current_flow->content());
-    if (state_.current_line >= static_cast<int>(lines.size())) {
-        state_.current_line = std::max(0, static_cast<int>(lines.size()) - 1);
+    int lines = state_.current_flow->line_count();
+    if (state_.current_line >= lines) {
+        state_.current_line = std::max(0, lines - 1);
     }
 }
 
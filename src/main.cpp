@@ -1,7 +1,16 @@
 #include "editor/flow_editor.h"
+#include "core/log.h"
 #include <iostream>
 #include <string>
 #include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cstdint>
+#include <limits>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <unistd.h>
 
 void print_usage(const char* program_name) {
     std::cout << "NERD: Network-Flow Editor" << std::endl;
@@ -10,7 +19,22 @@ void print_usage(const char* program_name) {
     std::cout << "Usage: " << program_name << " [OPTIONS] [FLOW_NAME]" << std::endl;
     std::cout << std::endl;
     std::cout << "Options:" << std::endl;
-    std::cout << "  -i, --interface <interface>  Network interface to use (default: eth0)" << std::endl;
+    std::cout << "  -i, --interface <interface>  Network interfaces, comma-separated or repeated (default: eth0)" << std::endl;
+    std::cout << "  --queues <count>             Queues per interface up to 256, or auto for one per NIC queue (default: 1)" << std::endl;
+    std::cout << "  --fanout <mode>              Split queues by hash (flow ID), cpu or NIC queue (default: hash)" << std::endl;
+    std::cout << "  -t, --transport <kind>       packet, xdp or udp (default: packet)" << std::endl;
+    std::cout << "  --multicast-group <group>    addr:port for the udp transport (default: 239.78.69.82:47820)" << std::endl;
+    std::cout << "  --multicast-ttl <hops>       Multicast TTL for the udp transport (default: 16)" << std::endl;
+    std::cout << "  --xdp-queue <queue>          NIC queue the xdp transport binds, below 256 (default: 0)" << std::endl;
+    std::cout << "  --hw-timestamps              Stamp receipt with the NIC clock (needs phc2sys on it)" << std::endl;
+    std::cout << "  -n, --namespace <name>       Flow namespace shared with peers (default: none)" << std::endl;
+    std::cout << "  --max-pps <packets>          Cap packets per second sent on the interface" << std::endl;
+    std::cout << "  --max-bandwidth <bytes>      Cap bytes per second sent on the interface" << std::endl;
+    std::cout << "  -s, --script <file>          Apply the commands in file as a batch, then exit" << std::endl;
+    std::cout << "  --snapshot-dir <dir>         Save flows to dir and restore them at startup" << std::endl;
+    std::cout << "  --metrics-file <file>        Keep Prometheus-format metrics in file" << std::endl;
+    std::cout << "  --max-flow-size <bytes>      Refuse peers' copies larger than this (default: 268435456)" << std::endl;
+    std::cout << "  --log-level <level>          debug, info, warn or error (default: info)" << std::endl;
     std::cout << "  -h, --help                   Show this help message" << std::endl;
     std::cout << "  -v, --version                Show version information" << std::endl;
     std::cout << std::endl;
@@ -18,6 +42,9 @@ void print_usage(const char* program_name) {
     std::cout << "  " << program_name << "                    # Start interactive mode" << std::endl;
     std::cout << "  " << program_name << " myflow            # Open flow 'myflow'" << std::endl;
     std::cout << "  " << program_name << " -i lo0 myflow     # Use loopback interface" << std::endl;
+    std::cout << "  " << program_name << " -i eth0,eth1 --queues auto myflow  # Every queue of two NICs" << std::endl;
+    std::cout << "  " << program_name << " -s edits.ed myflow # Apply a script to 'myflow'" << std::endl;
+    std::cout << "  cat edits.ed | " << program_name << " myflow  # Same, from piped stdin" << std::endl;
     std::cout << std::endl;
     std::cout << "Flow Commands:" << std::endl;
     std::cout << "  open <flow_name>             Open a flow" << std::endl;
@@ -29,18 +56,39 @@ void print_usage(const char* program_name) {
     std::cout << "  discover                     Discover existing flows" << std::endl;
     std::cout << "  list                         List active flows" << std::endl;
     std::cout << "  status                       Show current flow status" << std::endl;
+    std::cout << "  stats [prometheus]           Show engine counters and latencies" << std::endl;
+    std::cout << "  pattern fec <data> <parity>  Send parity with each group of data chunks (or: fec off)" << std::endl;
+    std::cout << "  pattern codec <codec> [dict] Compress data chunks with none, lz4 or zstd" << std::endl;
+    std::cout << "  dictionary load <id> <file>  Register a zstd dictionary shared with peers" << std::endl;
+    std::cout << "  dictionary train <id> <file> Train one from the open flow and save it" << std::endl;
     std::cout << "  write                        Write changes to circulation" << std::endl;
     std::cout << "  quit                         Exit editor" << std::endl;
 }
 
+// A decimal count within [min, max]. strtoull wraps a leading '-' and
+// saturates on overflow, so both are refused here rather than left to it.
+bool parse_count(const char* text, unsigned long long min, unsigned long long max, unsigned long long& value) {
+    char* end = nullptr;
+    errno = 0;
+    value = std::strtoull(text, &end, 10);
+    return end != text && *end == '\0' && !std::strchr(text, '-') && errno != ERANGE && value >= min && value <= max;
+}
+
 void print_version() {
     std::cout << "NERD: Network-Flow Editor v0.1.0" << std::endl;
     std::cout << "Revolutionary file editing for living network processes" << std::endl;
 }
 
 int main(int argc, char* argv[]) {
-    std::string interface = "eth0";
+    std::vector<std::string> interfaces;
     std::string flow_name;
+    std::string flow_namespace;
+    std::string script;
+    std::string snapshot_dir;
+    std::string metrics_file;
+    size_t max_flow_length = nerd::DEFAULT_MAX_FLOW_LENGTH;
+    nerd::TransmitLimits limits;
+    nerd::TransportConfig transport;
     
     // Parse command line arguments
     for (int i = 1; i < argc; ++i) {
@@ -57,10 +105,140 @@ int main(int argc, char* argv[]) {
         }
         
         if (arg == "-i" || arg == "--interface") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing interface name after " << arg << std::endl;
+                return 1;
+            }
+            std::stringstream names(argv[++i]);
+            for (std::string name; std::getline(names, name, ',');) {
+                if (!name.empty()) {
+                    interfaces.push_back(name);
+                }
+            }
+        }
+        else if (arg == "--queues") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value after " << arg << std::endl;
+                return 1;
+            }
+            std::string value = argv[++i];
+            unsigned long long count = 0;
+            if (value != "auto" && !parse_count(value.c_str(), 1, nerd::MAX_QUEUES, count)) {
+                std::cerr << "Error: Expected a queue count up to " << nerd::MAX_QUEUES << " or auto after " << arg
+                          << std::endl;
+                return 1;
+            }
+            transport.queues = static_cast<uint32_t>(count);
+        }
+        else if (arg == "--fanout") {
+            if (i + 1 >= argc || !nerd::parse_fanout_mode(argv[++i], transport.fanout)) {
+                std::cerr << "Error: Expected hash, cpu or queue after " << arg << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "-t" || arg == "--transport") {
+            if (i + 1 >= argc || !nerd::parse_transport_kind(argv[++i], transport.kind)) {
+                std::cerr << "Error: Expected packet, xdp or udp after " << arg << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--multicast-group") {
             if (i + 1 < argc) {
-                interface = argv[++i];
+                transport.multicast_group = argv[++i];
             } else {
-                std::cerr << "Error: Missing interface name after " << arg << std::endl;
+                std::cerr << "Error: Missing group after " << arg << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--multicast-ttl" || arg == "--xdp-queue") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value after " << arg << std::endl;
+                return 1;
+            }
+            // A TTL is one byte; an XDP socket binds one of the NIC's queues
+            unsigned long long value;
+            if (!parse_count(argv[++i], 0, arg == "--multicast-ttl" ? 255 : nerd::MAX_QUEUES - 1, value)) {
+                std::cerr << "Error: Invalid value for " << arg << ": " << argv[i] << std::endl;
+                return 1;
+            }
+            if (arg == "--multicast-ttl") {
+                transport.multicast_ttl = static_cast<uint32_t>(value);
+            } else {
+                transport.xdp_queue = static_cast<uint32_t>(value);
+            }
+        }
+        else if (arg == "--hw-timestamps") {
+            transport.hardware_timestamps = true;
+        }
+        else if (arg == "--max-pps" || arg == "--max-bandwidth") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value after " << arg << std::endl;
+                return 1;
+            }
+            // The packet rate must also fit the limiter's 32-bit field
+            const char* text = argv[++i];
+            unsigned long long value;
+            unsigned long long max = arg == "--max-pps" ? std::numeric_limits<uint32_t>::max()
+                                                        : std::numeric_limits<uint64_t>::max();
+            if (!parse_count(text, 0, max, value)) {
+                std::cerr << "Error: Invalid value for " << arg << ": " << text << std::endl;
+                return 1;
+            }
+            if (arg == "--max-pps") {
+                limits.max_packets_per_second = static_cast<uint32_t>(value);
+            } else {
+                limits.max_bytes_per_second = value;
+            }
+        }
+        else if (arg == "-s" || arg == "--script") {
+            if (i + 1 < argc) {
+                script = argv[++i];
+            } else {
+                std::cerr << "Error: Missing script file after " << arg << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--snapshot-dir") {
+            if (i + 1 < argc) {
+                snapshot_dir = argv[++i];
+            } else {
+                std::cerr << "Error: Missing directory after " << arg << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--metrics-file") {
+            if (i + 1 < argc) {
+                metrics_file = argv[++i];
+            } else {
+                std::cerr << "Error: Missing file after " << arg << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--max-flow-size") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value after " << arg << std::endl;
+                return 1;
+            }
+            unsigned long long value;
+            if (!parse_count(argv[++i], 1, std::numeric_limits<size_t>::max(), value)) {
+                std::cerr << "Error: Invalid value for " << arg << ": " << argv[i] << std::endl;
+                return 1;
+            }
+            max_flow_length = static_cast<size_t>(value);
+        }
+        else if (arg == "--log-level") {
+            nerd::LogLevel level;
+            if (i + 1 >= argc || !nerd::parse_log_level(argv[++i], level)) {
+                std::cerr << "Error: Expected debug, info, warn or error after " << arg << std::endl;
+                return 1;
+            }
+            nerd::set_log_level(level);
+        }
+        else if (arg == "-n" || arg == "--namespace") {
+            if (i + 1 < argc) {
+                flow_namespace = argv[++i];
+            } else {
+                std::cerr << "Error: Missing namespace after " << arg << std::endl;
                 return 1;
             }
         }
@@ -82,11 +260,27 @@ int main(int argc, char* argv[]) {
     
     try {
         // Create the flow editor
-        nerd::FlowEditor editor;
+        nerd::FlowEditor editor(flow_namespace);
+        editor.set_transmit_limits(limits);
+        editor.set_transport_config(transport);
+        editor.set_max_flow_length(max_flow_length);
+        if (!metrics_file.empty()) {
+            editor.set_metrics_file(metrics_file);
+        }
         
-        // Initialize network interface
-        std::cout << "Initializing network interface: " << interface << std::endl;
-        if (!editor.initialize_network(interface)) {
+        // Saved flows are readable before the network is even up
+        if (!snapshot_dir.empty()) {
+            editor.enable_snapshots(snapshot_dir);
+        }
+        
+        // Initialize network interfaces
+        if (interfaces.empty()) {
+            interfaces.push_back("eth0");
+        }
+        for (const auto& interface : interfaces) {
+            std::cout << "Initializing network interface: " << interface << std::endl;
+        }
+        if (!editor.initialize_network(interfaces)) {
             std::cerr << "Warning: Failed to initialize network interface. Running in simulation mode." << std::endl;
             std::cerr << "Note: Raw socket access requires root privileges." << std::endl;
         }
@@ -100,6 +294,19 @@ int main(int argc, char* argv[]) {
             }
         }
         
+        // A script, or commands piped in, run as a batch; a terminal gets the prompt
+        if (!script.empty()) {
+            std::ifstream input(script);
+            if (!input) {
+                std::cerr << "Error: Cannot read script '" << script << "'" << std::endl;
+                return 1;
+            }
+            return editor.run_script(input) ? 0 : 1;
+        }
+        if (!isatty(STDIN_FILENO)) {
+            return editor.run_script(std::cin) ? 0 : 1;
+        }
+        
         // Start interactive mode
         editor.run_interactive();
         
@@ -0,0 +1,141 @@
+#include "network/crc32c.h"
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define NERD_CRC_X86 1
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define NERD_CRC_ARM 1
+#endif
+
+namespace nerd {
+
+namespace {
+
+// Reflected Castagnoli polynomial
+const uint32_t POLY = 0x82f63b78;
+
+struct Table {
+    uint32_t entries[8][256];   // Slicing-by-8
+
+    Table() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1) ^ (POLY & (0u - (crc & 1)));
+            }
+            entries[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int slice = 1; slice < 8; ++slice) {
+                uint32_t previous = entries[slice - 1][i];
+                entries[slice][i] = (previous >> 8) ^ entries[0][previous & 0xff];
+            }
+        }
+    }
+};
+
+const Table& table() {
+    static const Table instance;
+    return instance;
+}
+
+uint32_t crc_table(uint32_t crc, const uint8_t* data, size_t length) {
+    const Table& t = table();
+    while (length >= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        word ^= crc;
+        crc = t.entries[7][word & 0xff] ^ t.entries[6][(word >> 8) & 0xff] ^
+              t.entries[5][(word >> 16) & 0xff] ^ t.entries[4][(word >> 24) & 0xff] ^
+              t.entries[3][(word >> 32) & 0xff] ^ t.entries[2][(word >> 40) & 0xff] ^
+              t.entries[1][(word >> 48) & 0xff] ^ t.entries[0][word >> 56];
+        data += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = (crc >> 8) ^ t.entries[0][(crc ^ *data++) & 0xff];
+    }
+    return crc;
+}
+
+#ifdef NERD_CRC_X86
+__attribute__((target("sse4.2")))
+uint32_t crc_hardware(uint32_t crc, const uint8_t* data, size_t length) {
+    uint64_t value = crc;
+    while (length >= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        value = _mm_crc32_u64(value, word);
+        data += 8;
+        length -= 8;
+    }
+    crc = static_cast<uint32_t>(value);
+    while (length--) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+#endif
+
+#ifdef NERD_CRC_ARM
+__attribute__((target("+crc")))
+uint32_t crc_hardware(uint32_t crc, const uint8_t* data, size_t length) {
+    while (length >= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        crc = __crc32cd(crc, word);
+        data += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = __crc32cb(crc, *data++);
+    }
+    return crc;
+}
+#endif
+
+using CrcKernel = uint32_t (*)(uint32_t, const uint8_t*, size_t);
+
+struct Kernel {
+    CrcKernel fn;
+    const char* name;
+
+    Kernel() : fn(crc_table), name("table") {
+#if defined(NERD_CRC_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.2")) {
+            fn = crc_hardware;
+            name = "sse4.2";
+        }
+#elif defined(NERD_CRC_ARM)
+        if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+            fn = crc_hardware;
+            name = "armv8";
+        }
+#endif
+    }
+};
+
+const Kernel& kernel() {
+    static const Kernel instance;
+    return instance;
+}
+
+} // namespace
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t length) {
+    return ~kernel().fn(~crc, static_cast<const uint8_t*>(data), length);
+}
+
+const char* crc32c_kernel_name() {
+    return kernel().name;
+}
+
+} // namespace nerd
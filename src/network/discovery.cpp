@@ -0,0 +1,154 @@
+#include "network/discovery.h"
+#include "network/flow_table.h"
+#include <algorithm>
+#include <cstring>
+
+namespace nerd {
+
+namespace {
+
+const size_t BITS_PER_KEY = 10;   // About 1% false positives with 7 hashes
+const uint8_t HASH_COUNT = 7;
+const size_t MAX_FILTER_BITS = (DISCOVERY_MAX_PAYLOAD - sizeof(DiscoveryHeader) - sizeof(AnnounceRecord)) * 8 / 64 * 64;
+
+void write_header(std::vector<uint8_t>& payload, DiscoveryKind kind, uint64_t node_id) {
+    DiscoveryHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.kind = kind;
+    header.node_id = node_id;
+    payload.resize(sizeof(header));
+    std::memcpy(payload.data(), &header, sizeof(header));
+}
+
+} // namespace
+
+BloomFilter::BloomFilter(uint32_t bits, uint8_t hash_count)
+    : words_(std::max<uint32_t>(bits, 64) / 64, 0), hash_count_(hash_count) {}
+
+BloomFilter BloomFilter::for_keys(size_t count, size_t bits_per_key, size_t max_bits) {
+    size_t bits = std::min(std::max<size_t>(count * bits_per_key, 64), max_bits);
+    return BloomFilter(static_cast<uint32_t>(bits), HASH_COUNT);
+}
+
+void BloomFilter::insert(uint64_t key) {
+    uint64_t bits = bit_count();
+    uint64_t h1 = key, h2 = flow_hash(key) | 1;
+    for (uint8_t i = 0; i < hash_count_; ++i) {
+        uint64_t bit = (h1 + i * h2) % bits;
+        words_[bit >> 6] |= uint64_t(1) << (bit & 63);
+    }
+}
+
+bool BloomFilter::may_contain(uint64_t key) const {
+    if (words_.empty()) {
+        return false;
+    }
+    uint64_t bits = bit_count();
+    uint64_t h1 = key, h2 = flow_hash(key) | 1;
+    for (uint8_t i = 0; i < hash_count_; ++i) {
+        uint64_t bit = (h1 + i * h2) % bits;
+        if (!((words_[bit >> 6] >> (bit & 63)) & 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void BloomFilter::assign(const uint8_t* data, uint32_t bits, uint8_t hash_count) {
+    words_.assign(bits / 64, 0);
+    std::memcpy(words_.data(), data, bits / 8);
+    hash_count_ = hash_count;
+}
+
+std::vector<std::vector<uint8_t>> encode_announce(uint64_t node_id, uint64_t generation,
+                                                  const std::vector<uint64_t>& keys) {
+    // Enough partitions that each filter keeps its target density in one frame
+    size_t max_bits = MAX_FILTER_BITS;
+    size_t keys_per_partition = max_bits / BITS_PER_KEY;
+    size_t partitions = std::max<size_t>(1, (keys.size() + keys_per_partition - 1) / keys_per_partition);
+    
+    std::vector<std::vector<uint64_t>> split(partitions);
+    for (uint64_t key : keys) {
+        split[(key >> 32) % partitions].push_back(key);
+    }
+    
+    std::vector<std::vector<uint8_t>> payloads;
+    for (size_t p = 0; p < partitions; ++p) {
+        BloomFilter filter = BloomFilter::for_keys(split[p].size(), BITS_PER_KEY, max_bits);
+        for (uint64_t key : split[p]) {
+            filter.insert(key);
+        }
+        
+        AnnounceRecord record;
+        std::memset(&record, 0, sizeof(record));
+        record.generation = generation;
+        record.flow_count = static_cast<uint32_t>(split[p].size());
+        record.partition = static_cast<uint16_t>(p);
+        record.partition_count = static_cast<uint16_t>(partitions);
+        record.filter_bits = filter.bit_count();
+        record.hash_count = filter.hash_count();
+        
+        std::vector<uint8_t> payload;
+        write_header(payload, DISCOVERY_ANNOUNCE, node_id);
+        size_t offset = payload.size();
+        payload.resize(offset + sizeof(record) + record.filter_bits / 8);
+        std::memcpy(payload.data() + offset, &record, sizeof(record));
+        std::memcpy(payload.data() + offset + sizeof(record), filter.words().data(), record.filter_bits / 8);
+        payloads.push_back(std::move(payload));
+    }
+    return payloads;
+}
+
+std::vector<uint8_t> encode_flow_name(DiscoveryKind kind, uint64_t node_id, uint64_t name_key,
+                                      const std::string& name, FlowID flow_id) {
+    FlowNameRecord record;
+    record.name_key = name_key;
+    record.flow_id = flow_id;
+    record.name_length = static_cast<uint16_t>(name.size());
+    
+    std::vector<uint8_t> payload;
+    write_header(payload, kind, node_id);
+    size_t offset = payload.size();
+    payload.resize(offset + sizeof(record) + record.name_length);
+    std::memcpy(payload.data() + offset, &record, sizeof(record));
+    std::memcpy(payload.data() + offset + sizeof(record), name.data(), record.name_length);
+    return payload;
+}
+
+bool decode_discovery_header(const RawPacket& packet, DiscoveryHeader& header) {
+    if (packet.payload_size() < sizeof(header)) {
+        return false;
+    }
+    std::memcpy(&header, packet.payload(), sizeof(header));
+    return true;
+}
+
+bool decode_announce(const RawPacket& packet, AnnounceRecord& record, BloomFilter& filter) {
+    const size_t offset = sizeof(DiscoveryHeader);
+    if (packet.payload_size() < offset + sizeof(record)) {
+        return false;
+    }
+    std::memcpy(&record, packet.payload() + offset, sizeof(record));
+    if (record.filter_bits == 0 || record.filter_bits % 64 != 0 || record.hash_count == 0 ||
+        record.partition_count == 0 || record.partition >= record.partition_count ||
+        packet.payload_size() != offset + sizeof(record) + record.filter_bits / 8) {
+        return false;
+    }
+    filter.assign(packet.payload() + offset + sizeof(record), record.filter_bits, record.hash_count);
+    return true;
+}
+
+bool decode_flow_name(const RawPacket& packet, FlowNameRecord& record, std::string& name) {
+    const size_t offset = sizeof(DiscoveryHeader);
+    if (packet.payload_size() < offset + sizeof(record)) {
+        return false;
+    }
+    std::memcpy(&record, packet.payload() + offset, sizeof(record));
+    if (packet.payload_size() != offset + sizeof(record) + record.name_length) {
+        return false;
+    }
+    name.assign(reinterpret_cast<const char*>(packet.payload() + offset + sizeof(record)), record.name_length);
+    return true;
+}
+
+} // namespace nerd
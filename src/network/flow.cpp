@@ -1,19 +1,112 @@
 #include "network/flow.h"
-#include <sys/socket.h>
-#include <linux/if_packet.h>
+#include "network/packet_codec.h"
 #include <net/ethernet.h>
-#include <net/if.h>
-#include <sys/ioctl.h>
-#include <arpa/inet.h>
-#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
 #include <cstring>
 #include <iostream>
 #include <chrono>
+#include <thread>
 #include <algorithm>
+#include <random>
 
 namespace nerd {
 
-NetworkFlow::NetworkFlow() : running_(false), raw_socket_(-1) {}
+namespace {
+
+// Wheel time base; unaffected by wall-clock steps and shared with packet
+// receipt times
+uint64_t monotonic_us() {
+    return packet_timestamp_now();
+}
+
+// Finer base for lock waits and tick durations, which are mostly sub-microsecond
+uint64_t monotonic_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::string shard_label(size_t index) {
+    return "shard=\"" + std::to_string(index) + "\"";
+}
+
+std::string queue_label(size_t index) {
+    return "queue=\"" + std::to_string(index) + "\"";
+}
+
+std::string flow_label(FlowID id) {
+    return "flow=\"" + std::to_string(id) + "\"";
+}
+
+// Upper bound on how long the circulation worker sleeps between checks
+const uint64_t MAX_IDLE_US = 100000;
+
+// Circulation sends a heartbeat at least this often; the rest of a flow's
+// ticks refresh its stored packets
+const uint64_t HEARTBEAT_INTERVAL_US = 1000000;
+
+// Budget a circulation tick asks for before it knows which packet it sends
+const size_t CIRCULATION_FRAME_BYTES = sizeof(struct ether_header) + sizeof(FlowPacketHeader) + 1500;
+
+// An unsustained flow's expiry sweep runs at most this many times per
+// max_packet_age
+const uint64_t EXPIRY_SWEEPS = 8;
+
+// Holders answer a NACK after a random delay below this and skip what
+// another holder resent first, so usually one of them answers each chunk
+const uint64_t NACK_SUPPRESS_US = 20000;
+
+uint64_t nack_delay_us() {
+    thread_local std::minstd_rand random(std::random_device{}());
+    return std::uniform_int_distribution<uint64_t>(0, NACK_SUPPRESS_US - 1)(random);
+}
+
+uint64_t circulation_period_us(uint32_t circulation_rate) {
+    return 1000000 / std::max<uint32_t>(circulation_rate, 1);
+}
+
+size_t frame_bytes(const RawPacket& packet) {
+    return sizeof(struct ether_header) + sizeof(FlowPacketHeader) + packet.payload_size();
+}
+
+// Content version a stored FLOW_DATA chunk was emitted at: its payload
+// leads with the FlowChunkHeader, whose first field is the version
+uint64_t chunk_version(const RawPacket& packet) {
+    uint64_t version = 0;
+    if (packet.header().packet_type == FLOW_DATA && packet.payload_size() >= sizeof(version)) {
+        std::memcpy(&version, packet.payload(), sizeof(version));
+    }
+    return version;
+}
+
+// Keep a shard's worker on one core so its flows stay cache-resident, and a
+// receive thread next to its queue's interrupts
+void pin_to_core(std::thread& thread, unsigned core) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    int err = pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+    if (err != 0) {
+        std::cerr << "Failed to pin thread to core " << core << ": " << strerror(err) << std::endl;
+    }
+}
+
+} // namespace
+
+NetworkFlow::NetworkFlow(size_t shard_count)
+    : running_(false), heartbeat_records_(PacketCodec<FLOW_HEARTBEAT>::MAX_RECORDS),
+      nack_ranges_(PacketCodec<FLOW_NACK>::MAX_RECORDS), corrupt_frames_(0), nacks_received_(0), packets_resent_(0),
+      packets_throttled_(0), heartbeats_sent_(0), heartbeat_frames_(0), refreshes_sent_(0) {
+    if (shard_count == 0) {
+        shard_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    
+    uint64_t now = monotonic_us();
+    for (size_t i = 0; i < shard_count; ++i) {
+        shards_.push_back(std::make_unique<Shard>());
+        shards_.back()->timers.reset(now);
+    }
+}
 
 NetworkFlow::~NetworkFlow() {
     stop_circulation();
@@ -21,265 +114,1159 @@ NetworkFlow::~NetworkFlow() {
 }
 
 void NetworkFlow::inject_packet(const RawPacket& packet) {
-    std::lock_guard<std::mutex> lock(streams_mutex_);
+    // Local data must not be lost to backpressure: store it directly when
+    // no worker is running or the shard's queue is full
+    if (!running_ || !enqueue_packet(packet)) {
+        if (running_) {
+            shard_for(packet.header().flow_id).fallbacks.fetch_add(1, std::memory_order_relaxed);
+        }
+        store_packet(packet);
+    }
+    broadcast_packet(packet);
+}
+
+void NetworkFlow::broadcast_packet(const RawPacket& packet) {
+    // Bulk encodes run on the editor and maintenance threads, which wait out
+    // the budget here rather than queue a whole re-emission behind it
+    if (queues_.empty()) {
+        return;
+    }
+    uint64_t wait = tx_limiter_.reserve(frame_bytes(packet), monotonic_us());
+    if (wait != 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(wait));
+    }
+    transmit_now(packet);
+}
+
+NetworkFlow::Shard& NetworkFlow::shard_for(FlowID flow_id) const {
+    // High hash bits: the shard's FlowTable already indexes with the low ones
+    return *shards_[(flow_hash(flow_id) >> 32) % shards_.size()];
+}
+
+std::unique_lock<std::mutex> NetworkFlow::lock_shard(Shard& shard) const {
+    // Uncontended acquisitions cost no clock reads; only real waits are timed
+    std::unique_lock<std::mutex> lock(shard.mutex, std::try_to_lock);
+    if (lock.owns_lock()) {
+        shard.lock_wait_ns.record(0);
+        return lock;
+    }
+    uint64_t start = monotonic_ns();
+    lock.lock();
+    shard.lock_wait_ns.record(monotonic_ns() - start);
+    return lock;
+}
+
+void NetworkFlow::transmit_packet(const RawPacket& packet) {
+    // Transient packets (edit deltas) are sent but not kept in circulation
+    send_raw_packet(packet);
+}
+
+void NetworkFlow::request_retransmit(FlowID flow_id, const std::vector<uint32_t>& missing, uint64_t since_version) {
+    std::vector<NackRange> ranges = ranges_from_sequences(missing, nack_ranges_);
+    if (ranges.empty()) {
+        return;
+    }
     
-    // Find or create stream for this flow
+    NackHeader header = {};
+    header.since_version = since_version;
+    RawPacket nack = encode_packet<FLOW_NACK>(flow_id, header, ranges.data(), ranges.size());
+    send_raw_packet(nack);
+    flush_transmit();
+}
+
+void NetworkFlow::store_packet(const RawPacket& packet) {
+    Shard& shard = shard_for(packet.header().flow_id);
+    auto lock = lock_shard(shard);
+    apply_packet(shard, packet);
+}
+
+bool NetworkFlow::enqueue_packet(const RawPacket& packet) {
+    Shard& shard = shard_for(packet.header().flow_id);
+    if (!shard.ingress.try_push(packet)) {
+        return false;
+    }
+    
+    // Pairs with the fence in circulation_worker: either we see it idle or
+    // it sees the packet before going to sleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (shard.idle.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(shard.timers_mutex);
+        shard.cv.notify_one();
+    }
+    return true;
+}
+
+void NetworkFlow::drain_ingress(Shard& shard) {
+    while (!shard.ingress.empty()) {
+        // One lock acquisition per batch rather than per packet
+        auto lock = lock_shard(shard);
+        shard.ingress.drain(INGRESS_BATCH, [this, &shard](const RawPacket& packet) {
+            apply_packet(shard, packet);
+        });
+    }
+}
+
+void NetworkFlow::apply_packet(Shard& shard, const RawPacket& packet) {
     FlowID flow_id = packet.header().flow_id;
-    PacketStream* stream = get_stream(flow_id);
     
-    if (!stream) {
-        add_stream(flow_id);
-        stream = get_stream(flow_id);
+    // Find or create stream for this flow
+    FlowRecord& record = shard.flows.find_or_insert(flow_id);
+    if (!record.stream) {
+        record.stream = std::make_unique<PacketStream>(flow_id);
     }
     
-    if (stream) {
-        stream->add_packet(packet);
+    // A holder with an older copy, such as one warm-started from a snapshot,
+    // must not displace a newer chunk from the stream. A chunk source stores
+    // nothing; its copy is as new as the version it advertises.
+    uint32_t sequence = packet.header().sequence;
+    const RawPacket* held = record.stream->find(sequence);
+    uint64_t held_version = record.source ? record.version : held ? chunk_version(*held) : 0;
+    if (held_version > chunk_version(packet)) {
+        return;
     }
     
-    // Send packet to network
-    send_raw_packet(packet);
+    // Another holder answered a NACK this one was waiting to answer
+    if (!record.nack_pending.empty() && packet.received_at() != 0) {
+        auto pending = std::lower_bound(record.nack_pending.begin(), record.nack_pending.end(), sequence);
+        if (pending != record.nack_pending.end() && *pending == sequence) {
+            record.nack_pending.erase(pending);
+        }
+    }
+    if (record.source) {
+        return;
+    }
+    
+    // Received packets that arrive behind the newest one show how far the
+    // network reorders them; refreshes of packets already held do not count
+    if (!held && packet.received_at() != 0 && !record.stream->empty()) {
+        uint32_t end = record.stream->window_end();
+        shard.reorder_depth.record(static_cast<int32_t>(end - sequence) > 0 ? end - sequence - 1 : 0);
+    }
+    bool duplicate = held && chunk_version(*held) == chunk_version(packet);
+    
+    record.stream->add_packet(packet);
+    if (!record.stream->find(sequence)) {
+        return;  // Fell outside the stream window
+    }
+    
+    // Only packets the stream took count as ingress; a copy of one already
+    // held re-stamps it but brings nothing new
+    if (!duplicate) {
+        record.packets_in++;
+        record.bytes_in += packet.payload_size();
+    }
+    
+    // A stored packet is stamped with its local arrival, never the sender's
+    // clock, so skew between peers and time spent queued for the worker do
+    // not shift expiry. Sustained flows never expire and have no timers;
+    // the rest share one sweep per flow.
+    uint64_t now = monotonic_us();
+    uint64_t arrived = packet.received_at() != 0 ? std::min(packet.received_at(), now) : now;
+    record.stream->find(sequence)->set_timestamp(arrived);
+    if (!(record.has_pattern() && record.pattern.auto_sustain)) {
+        arm_expiry(shard, record, arrived + record.pattern.max_packet_age);
+    }
 }
 
 void NetworkFlow::modify_flow_pattern(FlowID id, const CirculationPattern& new_pattern) {
-    std::lock_guard<std::mutex> lock(patterns_mutex_);
-    flow_patterns_[id] = new_pattern;
+    CirculationPattern pattern = new_pattern;
+    pattern.id = id;
+    add_circulation_pattern(pattern);
 }
 
 void NetworkFlow::sustain_circulation() {
-    std::lock_guard<std::mutex> lock(streams_mutex_);
+    for (auto& shard : shards_) {
+        sustain_shard(*shard);
+    }
+}
+
+void NetworkFlow::sustain_shard(Shard& shard) {
+    uint64_t start = monotonic_ns();
+    uint64_t now = monotonic_us();
+    std::vector<TimerEvent> due;
     
-    for (auto& stream : active_streams_) {
-        if (stream) {
-            stream->maintain_circulation();
-            stream->cleanup_old_packets();
+    {
+        std::lock_guard<std::mutex> lock(shard.timers_mutex);
+        shard.timers.advance(now, due);
+    }
+    
+    // Handled outside the wheel lock so handlers can reschedule
+    std::vector<HeartbeatRecord> heartbeats;
+    for (const auto& event : due) {
+        handle_timer_event(shard, event, now, heartbeats);
+    }
+    queue_heartbeats(shard, heartbeats, now);
+    
+    // Idle passes would drown the ticks that did something
+    if (!due.empty()) {
+        shard.tick_ns.record(monotonic_ns() - start);
+    }
+}
+
+void NetworkFlow::queue_heartbeats(Shard& shard, const std::vector<HeartbeatRecord>& heartbeats, uint64_t now) {
+    // Ticks are spread across the interval, so heartbeats are held briefly
+    // to fill frames; a full frame or the deadline sends them
+    std::vector<HeartbeatRecord> ready;
+    {
+        std::lock_guard<std::mutex> lock(shard.heartbeat_mutex);
+        if (shard.heartbeats.empty() && !heartbeats.empty()) {
+            shard.heartbeat_flush_us = now + HEARTBEAT_COALESCE_US;
+        }
+        shard.heartbeats.insert(shard.heartbeats.end(), heartbeats.begin(), heartbeats.end());
+        if (shard.heartbeats.empty()) {
+            return;
+        }
+        if (now >= shard.heartbeat_flush_us || !running_) {
+            ready.swap(shard.heartbeats);
+        } else {
+            size_t full = shard.heartbeats.size() / heartbeat_records_ * heartbeat_records_;
+            ready.assign(shard.heartbeats.begin(), shard.heartbeats.begin() + full);
+            shard.heartbeats.erase(shard.heartbeats.begin(), shard.heartbeats.begin() + full);
         }
     }
+    send_heartbeats(ready);
 }
 
 void NetworkFlow::add_stream(FlowID flow_id) {
-    active_streams_.push_back(std::make_unique<PacketStream>(flow_id));
+    Shard& shard = shard_for(flow_id);
+    auto lock = lock_shard(shard);
+    FlowRecord& record = shard.flows.find_or_insert(flow_id);
+    if (!record.stream) {
+        record.stream = std::make_unique<PacketStream>(flow_id);
+    }
 }
 
 void NetworkFlow::remove_stream(FlowID flow_id) {
-    active_streams_.erase(
-        std::remove_if(active_streams_.begin(), active_streams_.end(),
-                      [flow_id](const std::unique_ptr<PacketStream>& stream) {
-                          return stream && stream->flow_id() == flow_id;
-                      }),
-        active_streams_.end()
-    );
-}
-
-PacketStream* NetworkFlow::get_stream(FlowID flow_id) {
-    for (auto& stream : active_streams_) {
-        if (stream && stream->flow_id() == flow_id) {
-            return stream.get();
+    Shard& shard = shard_for(flow_id);
+    auto lock = lock_shard(shard);
+    FlowRecord* record = shard.flows.find(flow_id);
+    if (record) {
+        record->stream.reset();
+        record->source.reset();
+        record->source_chunks = 0;
+        release_if_unused(shard, *record);
+    }
+}
+
+void NetworkFlow::set_chunk_source(FlowID flow_id, std::shared_ptr<ChunkSource> source) {
+    Shard& shard = shard_for(flow_id);
+    auto lock = lock_shard(shard);
+    FlowRecord& record = shard.flows.find_or_insert(flow_id);
+    
+    // Whatever the stream held is served by the holder from now on
+    record.stream = std::make_unique<PacketStream>(flow_id);
+    record.source = std::move(source);
+    record.source_chunks = 0;
+}
+
+void NetworkFlow::set_flow_version(FlowID flow_id, uint64_t version, uint32_t chunks) {
+    Shard& shard = shard_for(flow_id);
+    auto lock = lock_shard(shard);
+    FlowRecord* record = shard.flows.find(flow_id);
+    if (record) {
+        record->version = version;
+        if (record->source) {
+            record->source_chunks = chunks;
         }
     }
-    return nullptr;
+}
+
+bool NetworkFlow::flow_liveness(FlowID flow_id, FlowLiveness& liveness) const {
+    Shard& shard = shard_for(flow_id);
+    auto lock = lock_shard(shard);
+    const FlowRecord* record = shard.flows.find(flow_id);
+    if (!record || record->heard_us == 0) {
+        return false;
+    }
+    liveness.last_heard_us = record->heard_us;
+    liveness.sequence = record->heard_sequence;
+    liveness.version = record->heard_version;
+    return true;
 }
 
 void NetworkFlow::add_circulation_pattern(const CirculationPattern& pattern) {
-    std::lock_guard<std::mutex> lock(patterns_mutex_);
-    flow_patterns_[pattern.id] = pattern;
+    Shard& shard = shard_for(pattern.id);
+    auto lock = lock_shard(shard);
+    FlowRecord& record = shard.flows.find_or_insert(pattern.id);
+    bool was_sustained = record.has_pattern() && record.pattern.auto_sustain;
+    record.pattern = pattern;
+    
+    // A new generation retires the maintenance chain of any previous pattern
+    record.pattern_generation = ++shard.next_generation;
+    if (pattern.auto_sustain) {
+        // Phase within the first period by hash, so patterns added together
+        // do not tick together
+        uint64_t period = circulation_period_us(pattern.circulation_rate);
+        uint64_t phase = flow_hash(pattern.id ^ record.pattern_generation) % period;
+        schedule_maintenance(shard, pattern.id, record.pattern_generation, monotonic_us() + phase);
+    } else {
+        stop_sustaining(shard, record, was_sustained);
+    }
 }
 
 void NetworkFlow::remove_circulation_pattern(FlowID id) {
-    std::lock_guard<std::mutex> lock(patterns_mutex_);
-    flow_patterns_.erase(id);
+    Shard& shard = shard_for(id);
+    auto lock = lock_shard(shard);
+    FlowRecord* record = shard.flows.find(id);
+    if (record) {
+        bool was_sustained = record->has_pattern() && record->pattern.auto_sustain;
+        record->pattern = CirculationPattern();
+        record->pattern_generation = 0;
+        stop_sustaining(shard, *record, was_sustained);
+        release_if_unused(shard, *record);
+    }
+}
+
+void NetworkFlow::stop_sustaining(Shard& shard, FlowRecord& record, bool was_sustained) {
+    if (!record.stream || record.stream->empty()) {
+        return;
+    }
+    
+    // Ages restart when sustain stops; otherwise a shorter max age may
+    // already be due, and the sweep works that out
+    uint64_t now = monotonic_us();
+    if (was_sustained) {
+        record.sustain_end_us = now;
+        arm_expiry(shard, record, now + record.pattern.max_packet_age);
+    } else {
+        arm_expiry(shard, record, now);
+    }
 }
 
-CirculationPattern* NetworkFlow::get_pattern(FlowID id) {
-    std::lock_guard<std::mutex> lock(patterns_mutex_);
-    auto it = flow_patterns_.find(id);
-    return (it != flow_patterns_.end()) ? &it->second : nullptr;
+void NetworkFlow::release_if_unused(Shard& shard, FlowRecord& record) {
+    if (!record.stream && !record.has_pattern()) {
+        shard.flows.erase(record.id);
+    }
 }
 
 bool NetworkFlow::initialize_interface(const std::string& interface) {
-    interface_name_ = interface;
-    
-    // Create raw socket
-    raw_socket_ = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
-    if (raw_socket_ < 0) {
-        std::cerr << "Failed to create raw socket: " << strerror(errno) << std::endl;
+    auto transports = open_transports(interface, transport_config_, tx_config_);
+    if (transports.empty()) {
         return false;
     }
-    
-    // Get interface index
-    struct ifreq ifr;
-    std::memset(&ifr, 0, sizeof(ifr));
-    std::strncpy(ifr.ifr_name, interface.c_str(), IFNAMSIZ - 1);
-    
-    if (ioctl(raw_socket_, SIOCGIFINDEX, &ifr) < 0) {
-        std::cerr << "Failed to get interface index: " << strerror(errno) << std::endl;
-        close(raw_socket_);
-        raw_socket_ = -1;
-        return false;
-    }
-    
-    // Bind socket to interface
-    struct sockaddr_ll addr;
-    std::memset(&addr, 0, sizeof(addr));
-    addr.sll_family = AF_PACKET;
-    addr.sll_protocol = htons(ETH_P_ALL);
-    addr.sll_ifindex = ifr.ifr_ifindex;
-    
-    if (bind(raw_socket_, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        std::cerr << "Failed to bind socket: " << strerror(errno) << std::endl;
-        close(raw_socket_);
-        raw_socket_ = -1;
-        return false;
+    for (auto& transport : transports) {
+        attach_transport(std::move(transport));
     }
     
     std::cout << "Initialized interface: " << interface << std::endl;
     return true;
 }
 
+void NetworkFlow::attach_transport(std::unique_ptr<Transport> transport) {
+    size_t payload = transport->max_frame() - sizeof(FlowPacketHeader);
+    heartbeat_records_ = std::min(heartbeat_records_, PacketCodec<FLOW_HEARTBEAT>::capacity(payload));
+    nack_ranges_ = std::min(nack_ranges_, PacketCodec<FLOW_NACK>::capacity(payload));
+    queues_.push_back(std::make_unique<Queue>(std::move(transport)));
+}
+
 void NetworkFlow::close_interface() {
-    if (raw_socket_ >= 0) {
-        close(raw_socket_);
-        raw_socket_ = -1;
+    queues_.clear();
+    heartbeat_records_ = PacketCodec<FLOW_HEARTBEAT>::MAX_RECORDS;
+    nack_ranges_ = PacketCodec<FLOW_NACK>::MAX_RECORDS;
+}
+
+void NetworkFlow::set_transmit_limits(const TransmitLimits& limits) {
+    tx_limiter_.configure(limits, monotonic_us());
+}
+
+void NetworkFlow::flush_transmit() {
+    for (auto& queue : queues_) {
+        queue->transport->flush();
     }
 }
 
 void NetworkFlow::start_circulation() {
     if (!running_) {
         running_ = true;
-        circulation_thread_ = std::thread(&NetworkFlow::circulation_worker, this);
-        std::cout << "Started circulation worker thread" << std::endl;
+        unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            Shard& shard = *shards_[i];
+            shard.worker = std::thread(&NetworkFlow::circulation_worker, this, std::ref(shard));
+            pin_to_core(shard.worker, static_cast<unsigned>(i % cores));
+        }
+        for (auto& queue : queues_) {
+            if (queue->transport->can_receive()) {
+                queue->receive_thread = std::thread(&NetworkFlow::receive_worker, this, std::ref(*queue));
+                if (queue->transport->receive_cpu() >= 0) {
+                    pin_to_core(queue->receive_thread, static_cast<unsigned>(queue->transport->receive_cpu()));
+                }
+            }
+        }
+        std::cout << "Started " << shards_.size() << " circulation worker threads" << std::endl;
     }
 }
 
 void NetworkFlow::stop_circulation() {
     if (running_) {
         running_ = false;
-        circulation_cv_.notify_all();
         
-        if (circulation_thread_.joinable()) {
-            circulation_thread_.join();
+        // Receive first, so the workers' final drain sees everything it queued
+        for (auto& queue : queues_) {
+            if (queue->receive_thread.joinable()) {
+                queue->receive_thread.join();
+            }
         }
         
-        std::cout << "Stopped circulation worker thread" << std::endl;
+        for (auto& shard : shards_) {
+            // Taken so no worker misses the wakeup between its check and its wait
+            { std::lock_guard<std::mutex> lock(shard->timers_mutex); }
+            shard->cv.notify_all();
+        }
+        
+        for (auto& shard : shards_) {
+            if (shard->worker.joinable()) {
+                shard->worker.join();
+            }
+        }
+        std::cout << "Stopped circulation worker threads" << std::endl;
     }
 }
 
-void NetworkFlow::discover_flows() {
-    // Send discovery packets to find existing flows
-    RawPacket discovery_packet(0, FLOW_DISCOVERY, {});
-    send_raw_packet(discovery_packet);
-}
-
 std::vector<FlowID> NetworkFlow::get_active_flows() const {
     std::vector<FlowID> flows;
-    std::lock_guard<std::mutex> lock(streams_mutex_);
     
-    for (const auto& stream : active_streams_) {
-        if (stream) {
-            flows.push_back(stream->flow_id());
-        }
+    for (const auto& shard : shards_) {
+        auto lock = lock_shard(*shard);
+        shard->flows.for_each([&flows](const FlowRecord& record) {
+            if (record.stream) {
+                flows.push_back(record.id);
+            }
+        });
     }
     
     return flows;
 }
 
-void NetworkFlow::circulation_worker() {
+NetworkFlow::IngressStats NetworkFlow::ingress_stats() const {
+    IngressStats stats = {0, 0, 0, corrupt_frames_.load(std::memory_order_relaxed)};
+    for (const auto& shard : shards_) {
+        stats.enqueued += shard->ingress.enqueued();
+        stats.dropped += shard->dropped.load(std::memory_order_relaxed);
+        stats.fallbacks += shard->fallbacks.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+NetworkFlow::RetransmitStats NetworkFlow::retransmit_stats() const {
+    RetransmitStats stats;
+    stats.nacks_received = nacks_received_.load(std::memory_order_relaxed);
+    stats.packets_resent = packets_resent_.load(std::memory_order_relaxed);
+    stats.packets_throttled = packets_throttled_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+NetworkFlow::CirculationStats NetworkFlow::circulation_stats() const {
+    CirculationStats stats;
+    stats.heartbeats = heartbeats_sent_.load(std::memory_order_relaxed);
+    stats.heartbeat_frames = heartbeat_frames_.load(std::memory_order_relaxed);
+    stats.refreshes = refreshes_sent_.load(std::memory_order_relaxed);
+    stats.deferred = tx_limiter_.deferred();
+    return stats;
+}
+
+NetworkFlow::TrafficStats NetworkFlow::traffic_stats() const {
+    TrafficStats stats;
+    stats.rx_packets = rx_packets_.value();
+    stats.rx_bytes = rx_bytes_.value();
+    stats.rx_dropped = 0;
+    for (const auto& queue : queues_) {
+        stats.rx_dropped += queue->transport->receive_drops();
+    }
+    stats.tx_packets = tx_packets_.value();
+    stats.tx_bytes = tx_bytes_.value();
+    stats.tx_dropped = tx_dropped_.value();
+    for (const auto& queue : queues_) {
+        stats.tx_dropped += queue->transport->transmit_drops();
+    }
+    return stats;
+}
+
+HistogramSnapshot NetworkFlow::tick_histogram() const {
+    HistogramSnapshot merged;
+    for (const auto& shard : shards_) {
+        merged.merge(shard->tick_ns.snapshot());
+    }
+    return merged;
+}
+
+HistogramSnapshot NetworkFlow::lock_wait_histogram() const {
+    HistogramSnapshot merged;
+    for (const auto& shard : shards_) {
+        merged.merge(shard->lock_wait_ns.snapshot());
+    }
+    return merged;
+}
+
+HistogramSnapshot NetworkFlow::reorder_histogram() const {
+    HistogramSnapshot merged;
+    for (const auto& shard : shards_) {
+        merged.merge(shard->reorder_depth.snapshot());
+    }
+    return merged;
+}
+
+void NetworkFlow::render_metrics(MetricsText& out) const {
+    TrafficStats traffic = traffic_stats();
+    out.family("nerd_rx_packets_total", "counter", "Flow frames received");
+    out.sample("nerd_rx_packets_total", traffic.rx_packets);
+    out.family("nerd_rx_bytes_total", "counter", "Flow frame bytes received");
+    out.sample("nerd_rx_bytes_total", traffic.rx_bytes);
+    out.family("nerd_rx_dropped_total", "counter", "Frames the transport dropped before delivery");
+    out.sample("nerd_rx_dropped_total", traffic.rx_dropped);
+    out.family("nerd_rx_corrupt_total", "counter", "Frames dropped for a bad header or checksum");
+    out.sample("nerd_rx_corrupt_total", corrupt_frames_.load(std::memory_order_relaxed));
+    out.family("nerd_tx_packets_total", "counter", "Frames queued for transmission");
+    out.sample("nerd_tx_packets_total", traffic.tx_packets);
+    out.family("nerd_tx_bytes_total", "counter", "Frame bytes queued for transmission");
+    out.sample("nerd_tx_bytes_total", traffic.tx_bytes);
+    out.family("nerd_tx_dropped_total", "counter", "Frames too large for a transmit slot or refused by the kernel");
+    out.sample("nerd_tx_dropped_total", traffic.tx_dropped);
+    out.family("nerd_queue_rx_packets_total", "counter", "Flow frames received, by transport queue");
+    for (size_t i = 0; i < queues_.size(); ++i) {
+        out.sample("nerd_queue_rx_packets_total", queues_[i]->rx_packets.load(std::memory_order_relaxed), queue_label(i));
+    }
+    out.family("nerd_queue_rx_dropped_total", "counter", "Frames dropped before delivery, by transport queue");
+    for (size_t i = 0; i < queues_.size(); ++i) {
+        out.sample("nerd_queue_rx_dropped_total", queues_[i]->transport->receive_drops(), queue_label(i));
+    }
+    
+    RetransmitStats retransmit = retransmit_stats();
+    out.family("nerd_nacks_received_total", "counter", "Retransmission requests received");
+    out.sample("nerd_nacks_received_total", retransmit.nacks_received);
+    out.family("nerd_packets_resent_total", "counter", "Stored packets resent on request");
+    out.sample("nerd_packets_resent_total", retransmit.packets_resent);
+    out.family("nerd_packets_throttled_total", "counter", "Requested resends refused by the flow's budget");
+    out.sample("nerd_packets_throttled_total", retransmit.packets_throttled);
+    
+    CirculationStats circulation = circulation_stats();
+    out.family("nerd_heartbeats_total", "counter", "Flow heartbeats sent");
+    out.sample("nerd_heartbeats_total", circulation.heartbeats);
+    out.family("nerd_heartbeat_frames_total", "counter", "Aggregated heartbeat frames sent");
+    out.sample("nerd_heartbeat_frames_total", circulation.heartbeat_frames);
+    out.family("nerd_refreshes_total", "counter", "Stored packets re-sent in rotation");
+    out.sample("nerd_refreshes_total", circulation.refreshes);
+    out.family("nerd_circulation_deferred_total", "counter", "Circulation ticks pushed back by the transmit budget");
+    out.sample("nerd_circulation_deferred_total", circulation.deferred);
+    
+    // Per shard: queue, tick and lock figures, taken without the shard lock
+    out.family("nerd_shard_ingress_enqueued_total", "counter", "Packets handed to the shard worker");
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        out.sample("nerd_shard_ingress_enqueued_total", shards_[i]->ingress.enqueued(), shard_label(i));
+    }
+    out.family("nerd_shard_ingress_dropped_total", "counter", "Received packets rejected by a full shard queue");
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        out.sample("nerd_shard_ingress_dropped_total", shards_[i]->dropped.load(std::memory_order_relaxed), shard_label(i));
+    }
+    out.family("nerd_shard_ingress_fallbacks_total", "counter", "Local packets stored directly instead of queued");
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        out.sample("nerd_shard_ingress_fallbacks_total", shards_[i]->fallbacks.load(std::memory_order_relaxed), shard_label(i));
+    }
+    out.family("nerd_circulation_tick_nanoseconds", "histogram", "Wall time of circulation ticks that had work");
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        out.histogram("nerd_circulation_tick_nanoseconds", shards_[i]->tick_ns.snapshot(), shard_label(i));
+    }
+    out.family("nerd_shard_lock_wait_nanoseconds", "histogram", "Time spent waiting for the shard lock");
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        out.histogram("nerd_shard_lock_wait_nanoseconds", shards_[i]->lock_wait_ns.snapshot(), shard_label(i));
+    }
+    out.family("nerd_reorder_depth_packets", "histogram", "How far behind the newest sequence a received packet landed");
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        out.histogram("nerd_reorder_depth_packets", shards_[i]->reorder_depth.snapshot(), shard_label(i));
+    }
+    
+    // Per flow, copied out under each shard lock in turn
+    struct FlowSample {
+        FlowID id;
+        size_t stored;
+        uint64_t packets_in;
+        uint64_t bytes_in;
+        uint64_t packets_resent;
+    };
+    std::vector<FlowSample> flows;
+    for (const auto& shard : shards_) {
+        auto lock = lock_shard(*shard);
+        shard->flows.for_each([&flows](const FlowRecord& record) {
+            if (record.stream) {
+                flows.push_back({record.id, record.stream->size(), record.packets_in, record.bytes_in, record.packets_resent});
+            }
+        });
+    }
+    out.family("nerd_flow_packets_stored", "gauge", "Packets held in the flow's stream");
+    for (const auto& flow : flows) {
+        out.sample("nerd_flow_packets_stored", flow.stored, flow_label(flow.id));
+    }
+    out.family("nerd_flow_packets_in_total", "counter", "New packets stored into the flow's stream");
+    for (const auto& flow : flows) {
+        out.sample("nerd_flow_packets_in_total", flow.packets_in, flow_label(flow.id));
+    }
+    out.family("nerd_flow_bytes_in_total", "counter", "Payload bytes of new packets stored into the flow's stream");
+    for (const auto& flow : flows) {
+        out.sample("nerd_flow_bytes_in_total", flow.bytes_in, flow_label(flow.id));
+    }
+    out.family("nerd_flow_packets_resent_total", "counter", "The flow's packets resent on request");
+    for (const auto& flow : flows) {
+        out.sample("nerd_flow_packets_resent_total", flow.packets_resent, flow_label(flow.id));
+    }
+}
+
+void NetworkFlow::circulation_worker(Shard& shard) {
     while (running_) {
-        // Sustain all active flows
-        sustain_circulation();
+        // Apply queued packets, then every expiry, refresh and maintenance event that is due
+        drain_ingress(shard);
+        sustain_shard(shard);
+        send_paced(shard, false);
         
-        // Maintain flow patterns
+        // Sleep until the wheel has something to do, a deferred frame comes
+        // due or a packet arrives
+        std::unique_lock<std::mutex> lock(shard.timers_mutex);
+        shard.idle.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t wakeup = shard.timers.next_wakeup(monotonic_us() + MAX_IDLE_US);
+        shard.paced_wakeup = false;
+        if (!shard.paced.empty()) {
+            wakeup = std::min(wakeup, shard.paced.front().first);
+        }
         {
-            std::lock_guard<std::mutex> lock(patterns_mutex_);
-            for (const auto& pair : flow_patterns_) {
-                if (pair.second.auto_sustain) {
-                    maintain_flow_pattern(pair.first);
-                }
+            std::lock_guard<std::mutex> heartbeat_lock(shard.heartbeat_mutex);
+            if (!shard.heartbeats.empty()) {
+                wakeup = std::min(wakeup, shard.heartbeat_flush_us);
             }
         }
-        
-        // Sleep for a short interval
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        auto deadline = std::chrono::steady_clock::time_point(std::chrono::microseconds(wakeup));
+        shard.cv.wait_until(lock, deadline, [this, &shard] {
+            return !running_ || !shard.ingress.empty() || shard.paced_wakeup;
+        });
+        shard.idle.store(false, std::memory_order_relaxed);
     }
+    
+    // Nothing queued is lost across a stop
+    drain_ingress(shard);
+    send_paced(shard, true);
 }
 
 bool NetworkFlow::send_raw_packet(const RawPacket& packet) {
-    if (raw_socket_ < 0) {
+    if (queues_.empty()) {
+        return false;
+    }
+    
+    // Without workers nothing would send a deferred frame, so it goes now;
+    // its credit is still spent and later frames wait for it
+    uint64_t now = monotonic_us();
+    uint64_t wait = tx_limiter_.reserve(frame_bytes(packet), now);
+    if (wait != 0 && running_) {
+        defer_packet(packet, now + wait);
+        return true;
+    }
+    return transmit_now(packet);
+}
+
+bool NetworkFlow::transmit_now(const RawPacket& packet) {
+    if (queues_.empty()) {
+        return false;
+    }
+    Transport& transport = *queues_[packet.header().flow_id % queues_.size()]->transport;
+    if (!transport.send(packet)) {
+        tx_dropped_.add();
+        return false;
+    }
+    tx_packets_.add();
+    tx_bytes_.add(frame_bytes(packet));
+    return true;
+}
+
+void NetworkFlow::defer_packet(const RawPacket& packet, uint64_t due) {
+    // Senders reserve credit before taking the lock, so a frame can arrive
+    // after one due later than it; inserting by due time keeps the queue
+    // sorted, and frames due together keep their arrival order
+    Shard& shard = shard_for(packet.header().flow_id);
+    std::lock_guard<std::mutex> lock(shard.timers_mutex);
+    auto position = std::upper_bound(shard.paced.begin(), shard.paced.end(), due,
+                                     [](uint64_t time, const std::pair<uint64_t, RawPacket>& entry) {
+                                         return time < entry.first;
+                                     });
+    shard.paced.emplace(position, due, packet);
+    shard.paced_wakeup = true;
+    shard.cv.notify_one();
+}
+
+void NetworkFlow::send_paced(Shard& shard, bool all) {
+    std::vector<RawPacket> due;
+    {
+        std::lock_guard<std::mutex> lock(shard.timers_mutex);
+        uint64_t now = monotonic_us();
+        while (!shard.paced.empty() && (all || shard.paced.front().first <= now)) {
+            due.push_back(std::move(shard.paced.front().second));
+            shard.paced.pop_front();
+        }
+    }
+    for (const auto& packet : due) {
+        transmit_now(packet);
+    }
+    if (!due.empty()) {
+        flush_transmit();
+    }
+}
+
+template <PacketType Type>
+void NetworkFlow::receive_frame(const uint8_t*, uint64_t, RawPacket&) {
+    // Control frames and unknown types have no receiver
+}
+
+// Received packets are stored, not re-broadcast: echoing them back onto the
+// segment would loop between every pair of nodes.
+template <>
+void NetworkFlow::receive_frame<FLOW_DATA>(const uint8_t* frame, uint64_t received_at, RawPacket& scratch) {
+    // The packet is queued to the shard that owns its flow; a full shard
+    // queue drops it and counts it
+    scratch.assign_frame(frame);
+    scratch.set_received_at(received_at);
+    if (!enqueue_packet(scratch)) {
+        shard_for(scratch.header().flow_id).dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (data_handler_) {
+        data_handler_(scratch);
+    }
+}
+
+template <>
+void NetworkFlow::receive_frame<FLOW_PARITY>(const uint8_t* frame, uint64_t received_at, RawPacket& scratch) {
+    // Parity is consumed by the receiver's reassembler, not circulated
+    if (data_handler_) {
+        scratch.assign_frame(frame);
+        scratch.set_received_at(received_at);
+        data_handler_(scratch);
+    }
+}
+
+template <>
+void NetworkFlow::receive_frame<FLOW_EDIT>(const uint8_t* frame, uint64_t received_at, RawPacket& scratch) {
+    // Edit deltas are applied by the flow's owner, not circulated
+    if (edit_handler_) {
+        scratch.assign_frame(frame);
+        scratch.set_received_at(received_at);
+        edit_handler_(scratch);
+    }
+}
+
+template <>
+void NetworkFlow::receive_frame<FLOW_DISCOVERY>(const uint8_t* frame, uint64_t received_at, RawPacket& scratch) {
+    // Summaries and queries belong to the flow directory above us; nothing
+    // here answers them, so they cannot bounce between nodes
+    if (discovery_handler_) {
+        scratch.assign_frame(frame);
+        scratch.set_received_at(received_at);
+        discovery_handler_(scratch);
+    }
+}
+
+template <>
+void NetworkFlow::receive_frame<FLOW_HEARTBEAT>(const uint8_t* frame, uint64_t received_at, RawPacket&) {
+    // Liveness state, not stream content: read where it lies in the slot
+    using Codec = PacketCodec<FLOW_HEARTBEAT>;
+    const uint8_t* payload = frame + sizeof(FlowPacketHeader);
+    HeartbeatHeader header;
+    size_t count;
+    if (!Codec::parse(payload, frame_header(frame).data_length, header, count)) {
+        return;
+    }
+    
+    // Grouped by shard so each shard's lock is taken once per frame, not
+    // once per record
+    std::vector<std::pair<Shard*, HeartbeatRecord>> beats;
+    beats.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        HeartbeatRecord beat = Codec::record(payload, i);
+        beats.emplace_back(&shard_for(beat.flow_id), beat);
+    }
+    std::stable_sort(beats.begin(), beats.end(),
+                     [](const std::pair<Shard*, HeartbeatRecord>& a,
+                        const std::pair<Shard*, HeartbeatRecord>& b) { return a.first < b.first; });
+    
+    // Only flows held here keep liveness; the rest cost nothing
+    uint64_t heard = received_at != 0 ? received_at : monotonic_us();
+    size_t held = 0;
+    for (size_t i = 0; i < beats.size();) {
+        Shard& shard = *beats[i].first;
+        auto lock = lock_shard(shard);
+        for (; i < beats.size() && beats[i].first == &shard; ++i) {
+            const HeartbeatRecord& beat = beats[i].second;
+            FlowRecord* record = shard.flows.find(beat.flow_id);
+            if (!record) {
+                continue;
+            }
+            record->heard_us = heard;
+            record->heard_sequence = beat.sequence;
+            record->heard_version = beat.version;
+            beats[held++].second = beat;
+        }
+    }
+    
+    if (heartbeat_handler_) {
+        for (size_t i = 0; i < held; ++i) {
+            heartbeat_handler_(beats[i].second);
+        }
+    }
+}
+
+template <>
+void NetworkFlow::receive_frame<FLOW_NACK>(const uint8_t* frame, uint64_t, RawPacket&) {
+    using Codec = PacketCodec<FLOW_NACK>;
+    FlowPacketHeader flow_header = frame_header(frame);
+    const uint8_t* payload = frame + sizeof(FlowPacketHeader);
+    NackHeader header;
+    size_t count;
+    if (!Codec::parse(payload, flow_header.data_length, header, count)) {
+        return;
+    }
+    nacks_received_.fetch_add(1, std::memory_order_relaxed);
+    
+    Shard& shard = shard_for(flow_header.flow_id);
+    auto lock = lock_shard(shard);
+    FlowRecord* record = shard.flows.find(flow_header.flow_id);
+    if (!record || !record->stream) {
+        return;  // Not a holder of this flow
+    }
+    
+    // Ranges come from the peer: clip them to the stream's window, or the
+    // source's chunks, and bound the walk, so no NACK can hold the shard
+    // lock for long. A source's chunks are filtered when they are built.
+    std::vector<uint32_t>& pending = record->nack_pending;
+    size_t before = pending.size();
+    uint32_t base = record->source ? 0 : record->stream->window_base();
+    uint32_t end = record->source ? record->source_chunks : record->stream->window_end();
+    uint32_t visits = RESEND_BURST;
+    for (size_t i = 0; i < count && visits > 0; ++i) {
+        NackRange range = Codec::record(payload, i);
+        uint64_t first = std::max<uint64_t>(range.first, base);
+        uint64_t last = std::min<uint64_t>(static_cast<uint64_t>(range.first) + range.count, end);
+        for (uint64_t seq = first; seq < last && visits > 0; ++seq) {
+            --visits;
+            if (!record->source) {
+                const RawPacket* stored = record->stream->find(static_cast<uint32_t>(seq));
+                if (!stored || (header.since_version != 0 && chunk_version(*stored) <= header.since_version)) {
+                    continue;
+                }
+            }
+            pending.push_back(static_cast<uint32_t>(seq));
+        }
+    }
+    if (pending.size() == before) {
+        return;
+    }
+    record->nack_since = before == 0 ? header.since_version : std::min(record->nack_since, header.since_version);
+    
+    // Merge with what earlier NACKs asked for; one answer covers them all
+    std::sort(pending.begin() + before, pending.end());
+    std::inplace_merge(pending.begin(), pending.begin() + before, pending.end());
+    pending.erase(std::unique(pending.begin(), pending.end()), pending.end());
+    if (pending.size() > RESEND_BURST) {
+        packets_throttled_.fetch_add(pending.size() - RESEND_BURST, std::memory_order_relaxed);
+        pending.resize(RESEND_BURST);
+    }
+    
+    if (record->nack_due_us == 0) {
+        TimerEvent event;
+        event.kind = TimerEvent::NACK_ANSWER;
+        event.flow_id = flow_header.flow_id;
+        event.deadline = monotonic_us() + nack_delay_us();
+        event.stamp = event.deadline;
+        record->nack_due_us = event.deadline;
+        schedule_event(shard, event);
+    }
+}
+
+constexpr std::array<NetworkFlow::FrameReceiver, 256> NetworkFlow::make_receive_table() {
+    std::array<FrameReceiver, 256> table{};
+    for (auto& entry : table) {
+        entry = &NetworkFlow::receive_frame<FLOW_CONTROL>;
+    }
+    table[FLOW_DATA] = &NetworkFlow::receive_frame<FLOW_DATA>;
+    table[FLOW_HEARTBEAT] = &NetworkFlow::receive_frame<FLOW_HEARTBEAT>;
+    table[FLOW_EDIT] = &NetworkFlow::receive_frame<FLOW_EDIT>;
+    table[FLOW_DISCOVERY] = &NetworkFlow::receive_frame<FLOW_DISCOVERY>;
+    table[FLOW_NACK] = &NetworkFlow::receive_frame<FLOW_NACK>;
+    table[FLOW_PARITY] = &NetworkFlow::receive_frame<FLOW_PARITY>;
+    return table;
+}
+
+void NetworkFlow::receive_worker(Queue& queue) {
+    static constexpr std::array<FrameReceiver, 256> RECEIVERS = make_receive_table();
+    RawPacket packet;
+    auto dispatch = [this, &queue, &packet](const uint8_t* frame, size_t length, uint64_t received_at) {
+        // Handled straight out of the ring slot, checked once; only the types
+        // whose handlers keep a packet copy it into the pool. The filter only
+        // passes flow frames, so one that fails validation is corrupt.
+        if (!validate_frame(frame, length)) {
+            corrupt_frames_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        rx_packets_.add();
+        rx_bytes_.add(length);
+        queue.rx_packets.fetch_add(1, std::memory_order_relaxed);
+        (this->*RECEIVERS[frame[offsetof(FlowPacketHeader, packet_type)]])(frame, received_at, packet);
+    };
+    
+    while (running_) {
+        // Short timeout so stop_circulation() is honoured promptly
+        queue.transport->poll(100, dispatch);
+    }
+}
+
+bool NetworkFlow::next_refresh_packet(FlowRecord& record, RawPacket& packet, std::shared_ptr<ChunkSource>& source) {
+    // A source's chunks are built once the shard lock is dropped; packet
+    // only carries the sequence until then
+    if (record.source) {
+        if (record.source_chunks == 0) {
+            return false;
+        }
+        uint32_t sequence = record.refresh_cursor < record.source_chunks ? record.refresh_cursor : 0;
+        record.refresh_cursor = sequence + 1;
+        packet.set_sequence(sequence);
+        source = record.source;
+        return true;
+    }
+    
+    PacketStream* stream = record.stream.get();
+    if (!stream || stream->empty()) {
         return false;
     }
     
-    std::vector<uint8_t> serialized = packet.serialize();
-    
-    // Create Ethernet frame
-    struct ethernet_header {
-        uint8_t dest[6];
-        uint8_t source[6];
-        uint16_t type;
-    } __attribute__((packed));
-    
-    // For simplicity, use broadcast address
-    struct ethernet_header eth;
-    std::memset(eth.dest, 0xFF, 6);  // Broadcast
-    std::memset(eth.source, 0x00, 6); // Placeholder
-    eth.type = htons(0x1234);  // Custom protocol type
-    
-    // Combine Ethernet header with packet data
-    std::vector<uint8_t> frame;
-    frame.reserve(sizeof(ethernet_header) + serialized.size());
-    
-    const uint8_t* eth_ptr = reinterpret_cast<const uint8_t*>(&eth);
-    frame.insert(frame.end(), eth_ptr, eth_ptr + sizeof(ethernet_header));
-    frame.insert(frame.end(), serialized.begin(), serialized.end());
-    
-    // Send frame
-    ssize_t sent = send(raw_socket_, frame.data(), frame.size(), 0);
-    return sent == static_cast<ssize_t>(frame.size());
-}
-
-void NetworkFlow::handle_incoming_packet(const RawPacket& packet) {
-    // Handle different packet types
-    switch (static_cast<PacketType>(packet.header().packet_type)) {
-        case FLOW_DATA:
-            inject_packet(packet);
-            break;
-            
-        case FLOW_DISCOVERY:
-            // Respond with our active flows
-            discover_flows();
-            break;
-            
-        case FLOW_HEARTBEAT:
-            // Update flow timestamp
-            inject_packet(packet);
-            break;
-            
-        case FLOW_EDIT:
-            // Handle edit commands
-            inject_packet(packet);
-            break;
-            
-        default:
-            break;
-    }
-}
-
-void NetworkFlow::maintain_flow_pattern(FlowID flow_id) {
-    CirculationPattern* pattern = get_pattern(flow_id);
-    if (!pattern) {
+    // Stored packets in rotation, so every peer's copy keeps being refreshed
+    uint32_t sequence = stream->next_present(std::max(record.refresh_cursor, stream->window_base()), stream->window_end());
+    if (sequence == stream->window_end()) {
+        sequence = stream->next_present(stream->window_base(), stream->window_end());
+    }
+    packet = *stream->find(sequence);
+    packet.set_timestamp(packet_timestamp_now());
+    record.refresh_cursor = sequence + 1;
+    return true;
+}
+
+bool NetworkFlow::materialize(ChunkSource& source, uint32_t sequence, uint64_t since_version, RawPacket& packet) {
+    std::lock_guard<std::mutex> lock(source.mutex);
+    if (!source.materialize || !source.materialize(sequence, since_version, packet)) {
+        return false;
+    }
+    packet.set_timestamp(packet_timestamp_now());
+    return true;
+}
+
+void NetworkFlow::send_heartbeats(const std::vector<HeartbeatRecord>& heartbeats) {
+    const size_t capacity = heartbeat_records_;
+    for (size_t i = 0; i < heartbeats.size(); i += capacity) {
+        size_t count = std::min(capacity, heartbeats.size() - i);
+        RawPacket frame = encode_packet<FLOW_HEARTBEAT>(0, HeartbeatHeader(), heartbeats.data() + i, count);
+        send_raw_packet(frame);
+        heartbeat_frames_.fetch_add(1, std::memory_order_relaxed);
+    }
+    heartbeats_sent_.fetch_add(heartbeats.size(), std::memory_order_relaxed);
+}
+
+void NetworkFlow::schedule_event(Shard& shard, const TimerEvent& event) {
+    std::lock_guard<std::mutex> lock(shard.timers_mutex);
+    shard.timers.schedule(event);
+}
+
+void NetworkFlow::schedule_maintenance(Shard& shard, FlowID flow_id, uint64_t generation, uint64_t deadline) {
+    TimerEvent event;
+    event.kind = TimerEvent::FLOW_MAINTAIN;
+    event.flow_id = flow_id;
+    event.stamp = generation;
+    event.deadline = deadline;
+    event.tick = deadline;
+    schedule_event(shard, event);
+}
+
+void NetworkFlow::handle_timer_event(Shard& shard, const TimerEvent& event, uint64_t now,
+                                     std::vector<HeartbeatRecord>& heartbeats) {
+    if (event.kind == TimerEvent::NACK_ANSWER) {
+        answer_nack(shard, event, now);
+        return;
+    }
+    if (event.kind == TimerEvent::PACKET_EXPIRE) {
+        expire_packets(shard, event, now);
         return;
     }
     
-    PacketStream* stream = get_stream(flow_id);
-    if (!stream) {
+    // A tick takes its credit before it knows which frame it sends, and one
+    // that has to wait keeps it, so flows deferred together go one by one.
+    // The retry is a copy with a later deadline but the same tick.
+    if (event.deadline == event.tick) {
+        uint64_t wait = tx_limiter_.reserve(CIRCULATION_FRAME_BYTES, now);
+        if (wait != 0) {
+            TimerEvent retry = event;
+            retry.deadline = now + wait;
+            schedule_event(shard, retry);
+            return;
+        }
+    }
+    
+    uint64_t period;
+    RawPacket packet;
+    std::shared_ptr<ChunkSource> source;
+    bool send;
+    {
+        auto lock = lock_shard(shard);
+        FlowRecord* record = shard.flows.find(event.flow_id);
+        if (!record || record->pattern_generation != event.stamp || !record->pattern.auto_sustain) {
+            tx_limiter_.refund(1, CIRCULATION_FRAME_BYTES);
+            return;  // Pattern removed or replaced since this was armed
+        }
+        period = circulation_period_us(record->pattern.circulation_rate);
+        
+        // A heartbeat once a second, so receivers notice a lost tail; the
+        // other ticks refresh stored packets
+        send = false;
+        if (record->stream) {
+            if (now - record->last_heartbeat_us >= HEARTBEAT_INTERVAL_US) {
+                HeartbeatRecord beat;
+                beat.flow_id = record->id;
+                beat.sequence = record->source ? record->source_chunks : record->stream->window_end();
+                beat.version = record->version;
+                heartbeats.push_back(beat);
+                record->last_heartbeat_us = now;
+            } else {
+                send = next_refresh_packet(*record, packet, source);
+            }
+        }
+    }
+    if (source) {
+        send = materialize(*source, packet.header().sequence, 0, packet);
+    }
+    // Heartbeats reserve their own frames when the shard sends them
+    if (send) {
+        tx_limiter_.refund(0, CIRCULATION_FRAME_BYTES - std::min(CIRCULATION_FRAME_BYTES, frame_bytes(packet)));
+        transmit_now(packet);
+        refreshes_sent_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        tx_limiter_.refund(1, CIRCULATION_FRAME_BYTES);
+    }
+    
+    // The next tick keeps the flow's phase, deferred or not; ticks missed
+    // while the worker was busy are skipped rather than sent back to back
+    uint64_t next = event.tick + period;
+    if (next <= now) {
+        next += (now - next) / period * period + period;
+    }
+    schedule_maintenance(shard, event.flow_id, event.stamp, next);
+}
+
+void NetworkFlow::arm_expiry(Shard& shard, FlowRecord& record, uint64_t deadline) {
+    // Packets arrive in time order, so one sweep is usually armed already
+    if (record.expire_due_us != 0 && record.expire_due_us <= deadline) {
         return;
     }
+    record.expire_due_us = deadline;
+    
+    TimerEvent event;
+    event.kind = TimerEvent::PACKET_EXPIRE;
+    event.flow_id = record.id;
+    event.deadline = deadline;
+    event.stamp = deadline;
+    schedule_event(shard, event);
+}
+
+void NetworkFlow::expire_packets(Shard& shard, const TimerEvent& event, uint64_t now) {
+    auto lock = lock_shard(shard);
+    FlowRecord* record = shard.flows.find(event.flow_id);
+    if (!record || record->expire_due_us != event.stamp) {
+        return;  // Superseded by an earlier sweep
+    }
+    record->expire_due_us = 0;
+    if (!record->stream || (record->has_pattern() && record->pattern.auto_sustain)) {
+        return;  // Sustained again; nothing ages
+    }
+    
+    PacketStream& stream = *record->stream;
+    uint64_t max_age = record->pattern.max_packet_age;
+    uint64_t oldest = UINT64_MAX;
+    for (uint32_t seq = stream.next_present(stream.window_base(), stream.window_end()); seq < stream.window_end();
+         seq = stream.next_present(seq + 1, stream.window_end())) {
+        uint64_t aged_from = std::max(stream.find(seq)->header().timestamp, record->sustain_end_us);
+        if (aged_from + max_age <= now) {
+            stream.remove_packet(seq);
+        } else {
+            oldest = std::min(oldest, aged_from);
+        }
+    }
     
-    // Send heartbeat packets to maintain circulation
-    std::vector<uint8_t> heartbeat_data = {'H', 'B'};
-    RawPacket heartbeat(flow_id, FLOW_HEARTBEAT, heartbeat_data);
-    heartbeat.set_sequence(stream->next_sequence());
+    // A flow whose packets trickle in is swept a few times per max age, not
+    // once per packet, so a packet may outlive its age by up to a fraction
+    if (oldest != UINT64_MAX) {
+        arm_expiry(shard, *record, std::max(oldest + max_age, now + max_age / EXPIRY_SWEEPS));
+    }
+}
+
+void NetworkFlow::answer_nack(Shard& shard, const TimerEvent& event, uint64_t now) {
+    // Copies share the slabs; they are sent once the shard lock is dropped.
+    // A chunk source's answers are built then too, from what was asked.
+    std::vector<RawPacket> resend;
+    std::vector<uint32_t> build;
+    std::shared_ptr<ChunkSource> source;
+    uint64_t since = 0;
+    uint64_t throttled = 0;
+    {
+        auto lock = lock_shard(shard);
+        FlowRecord* record = shard.flows.find(event.flow_id);
+        if (!record || record->nack_due_us != event.stamp) {
+            return;  // Flow gone, or already answered
+        }
+        record->nack_due_us = 0;
+        source = record->source;
+        since = record->nack_since;
+        
+        // Refill the flow's budget so a burst of NACKs cannot flood the link
+        uint64_t refill = (now - record->resend_refill_us) * RESEND_RATE / 1000000;
+        if (refill > 0) {
+            record->resend_tokens = static_cast<uint32_t>(std::min<uint64_t>(RESEND_BURST, record->resend_tokens + refill));
+            record->resend_refill_us = now;
+        }
+        
+        // Only chunks still held count against the budget when it runs out
+        for (uint32_t sequence : record->nack_pending) {
+            const RawPacket* stored = record->stream ? record->stream->find(sequence) : nullptr;
+            if (!source && !stored) {
+                continue;
+            }
+            if (record->resend_tokens == 0) {
+                ++throttled;
+                continue;
+            }
+            --record->resend_tokens;
+            if (source) {
+                build.push_back(sequence);
+                continue;
+            }
+            ++record->packets_resent;
+            resend.push_back(*stored);
+            resend.back().set_timestamp(now);
+        }
+        record->nack_pending.clear();
+    }
+    
+    if (source) {
+        RawPacket packet;
+        for (uint32_t sequence : build) {
+            if (materialize(*source, sequence, since, packet)) {
+                resend.push_back(packet);
+            }
+        }
+        if (!resend.empty()) {
+            auto lock = lock_shard(shard);
+            if (FlowRecord* record = shard.flows.find(event.flow_id)) {
+                record->packets_resent += resend.size();
+            }
+        }
+    }
     
-    send_raw_packet(heartbeat);
-    stream->add_packet(heartbeat);
+    for (const auto& stored : resend) {
+        send_raw_packet(stored);
+    }
+    if (!resend.empty()) {
+        flush_transmit();
+    }
+    packets_resent_.fetch_add(resend.size(), std::memory_order_relaxed);
+    packets_throttled_.fetch_add(throttled, std::memory_order_relaxed);
 }
 
-} // namespace nerd
\ No newline at end of file
+} // namespace nerd
@@ -0,0 +1,82 @@
+#include "network/flow_cache.h"
+#include "network/flow_id.h"
+#include "network/flow_table.h"
+
+namespace nerd {
+
+FlowCache::NameStripe& FlowCache::name_stripe(const std::string& name) const {
+    return names_[hash_bytes(name.data(), name.size(), 0) % STRIPES];
+}
+
+FlowCache::IdStripe& FlowCache::id_stripe(FlowID id) const {
+    return ids_[flow_hash(id) % STRIPES];
+}
+
+bool FlowCache::insert(const std::string& name, uint64_t key, std::unique_ptr<FlowFile> file) {
+    NameStripe& by_name = name_stripe(name);
+    IdStripe& by_id = id_stripe(file->identifier());
+    
+    std::lock_guard<std::mutex> name_lock(by_name.mutex);
+    if (by_name.flows.count(name)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> id_lock(by_id.mutex);
+    if (!by_id.flows.emplace(file->identifier(), file.get()).second) {
+        return false;
+    }
+    
+    Slot& slot = by_name.flows[name];
+    slot.id = file->identifier();
+    slot.key = key;
+    slot.file = std::move(file);
+    size_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+std::unique_ptr<FlowFile> FlowCache::erase(const std::string& name) {
+    NameStripe& by_name = name_stripe(name);
+    std::lock_guard<std::mutex> name_lock(by_name.mutex);
+    auto it = by_name.flows.find(name);
+    if (it == by_name.flows.end()) {
+        return nullptr;
+    }
+    
+    // Once the ID entry is gone the receive thread cannot reach the file
+    IdStripe& by_id = id_stripe(it->second.id);
+    {
+        std::lock_guard<std::mutex> id_lock(by_id.mutex);
+        by_id.flows.erase(it->second.id);
+    }
+    std::unique_ptr<FlowFile> file = std::move(it->second.file);
+    by_name.flows.erase(it);
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    return file;
+}
+
+FlowFile* FlowCache::find(const std::string& name) const {
+    const NameStripe& stripe = name_stripe(name);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto it = stripe.flows.find(name);
+    return it != stripe.flows.end() ? it->second.file.get() : nullptr;
+}
+
+bool FlowCache::lookup(const std::string& name, Entry& entry) const {
+    const NameStripe& stripe = name_stripe(name);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto it = stripe.flows.find(name);
+    if (it == stripe.flows.end()) {
+        return false;
+    }
+    entry.id = it->second.id;
+    entry.key = it->second.key;
+    entry.file = it->second.file.get();
+    return true;
+}
+
+bool FlowCache::contains_id(FlowID id) const {
+    const IdStripe& stripe = id_stripe(id);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    return stripe.flows.count(id) != 0;
+}
+
+} // namespace nerd
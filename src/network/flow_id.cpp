@@ -0,0 +1,56 @@
+#include "network/flow_id.h"
+#include "network/flow_table.h"
+#include <cstring>
+
+namespace nerd {
+
+namespace {
+
+const uint64_t K0 = 0xa0761d6478bd642fULL;
+const uint64_t K1 = 0xe7037ed1a0b428dbULL;
+const uint64_t K2 = 0x8ebc6af09c88c6e3ULL;
+
+inline uint64_t mix(uint64_t a, uint64_t b) {
+    __uint128_t product = static_cast<__uint128_t>(a) * b;
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+}
+
+// Little-endian, so hosts agree on IDs; packet.h asserts that is host order
+inline uint64_t load64(const uint8_t* bytes) {
+    uint64_t value;
+    std::memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+} // namespace
+
+uint64_t hash_bytes(const void* data, size_t length, uint64_t seed) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = seed ^ K0;
+    
+    size_t remaining = length;
+    while (remaining >= 16) {
+        hash = mix(load64(bytes) ^ K1, load64(bytes + 8) ^ hash);
+        bytes += 16;
+        remaining -= 16;
+    }
+    
+    // Zero-padded tail; the length below keeps padded inputs apart
+    uint8_t tail[16] = {0};
+    std::memcpy(tail, bytes, remaining);
+    hash = mix(load64(tail) ^ K1, load64(tail + 8) ^ hash);
+    return mix(hash ^ K2, static_cast<uint64_t>(length) ^ K1);
+}
+
+uint64_t flow_name_key(const std::string& flow_namespace, const std::string& name) {
+    // The namespace hash seeds the name hash, so ("ab", "c") and ("a", "bc") differ
+    uint64_t scope = hash_bytes(flow_namespace.data(), flow_namespace.size(), 0);
+    return hash_bytes(name.data(), name.size(), scope);
+}
+
+FlowID derive_flow_id(uint64_t name_key, uint32_t attempt) {
+    FlowID id = attempt == 0 ? name_key : flow_hash(name_key + attempt * K2);
+    return id != 0 ? id : K0;
+}
+
+} // namespace nerd
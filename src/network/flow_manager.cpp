@@ -1,21 +1,70 @@
 #include "network/flow_manager.h"
+#include "core/log.h"
+#include <sys/stat.h>
+#include <dirent.h>
+#include <cerrno>
+#include <cstring>
 #include <iostream>
 #include <algorithm>
 #include <chrono>
+#include <iomanip>
+#include <random>
+#include <sstream>
 
 namespace nerd {
 
-FlowManager::FlowManager() : running_(false), next_flow_id_(1) {
+namespace {
+
+// Summaries go out every interval, jittered by up to a quarter either way;
+// a peer that misses PEER_TIMEOUT_INTERVALS of them is forgotten
+const std::chrono::milliseconds ANNOUNCE_INTERVAL(5000);
+const uint64_t PEER_TIMEOUT_INTERVALS = 3;
+
+// Flows are re-emitted every SUSTAIN_INTERVALS announce rounds
+const uint64_t SUSTAIN_INTERVALS = 6;
+
+// Snapshots of changed flows are written every SNAPSHOT_INTERVALS announce rounds
+const uint64_t SNAPSHOT_INTERVALS = 6;
+
+// How long connect_to_flow() waits for a holder to answer a query
+const std::chrono::milliseconds QUERY_TIMEOUT(300);
+
+uint64_t directory_now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+FlowManager::FlowManager(const std::string& flow_namespace)
+    : namespace_(flow_namespace), announce_generation_(1), max_flow_length_(DEFAULT_MAX_FLOW_LENGTH), running_(false),
+      announce_requested_(false) {
+    std::random_device seed;
+    node_id_ = (static_cast<uint64_t>(seed()) << 32) | seed();
+    
     network_flow_ = std::make_unique<NetworkFlow>();
+    network_flow_->set_edit_handler([this](const RawPacket& packet) { route_packet(packet); });
+    network_flow_->set_data_handler([this](const RawPacket& packet) { route_packet(packet); });
+    network_flow_->set_discovery_handler([this](const RawPacket& packet) { handle_discovery_packet(packet); });
+    network_flow_->set_heartbeat_handler([this](const HeartbeatRecord& beat) {
+        flows_.with_flow(beat.flow_id, [&beat](FlowFile& flow) { flow.receive_heartbeat(beat); });
+    });
 }
 
 FlowManager::~FlowManager() {
     if (running_) {
-        running_ = false;
+        {
+            std::lock_guard<std::mutex> lock(worker_mutex_);
+            running_ = false;
+        }
+        worker_cv_.notify_all();
         if (discovery_thread_.joinable()) {
             discovery_thread_.join();
         }
     }
+    
+    // Whatever changed since the last round survives the restart
+    save_snapshots();
 }
 
 FlowFile* FlowManager::open_flow(const std::string& flow_name) {
@@ -25,9 +74,8 @@ FlowFile* FlowManager::open_flow(const std::string& flow_name) {
     }
     
     // Check if flow already exists
-    auto it = active_files_.find(flow_name);
-    if (it != active_files_.end()) {
-        return it->second.get();
+    if (FlowFile* existing = flows_.find(flow_name)) {
+        return existing;
     }
     
     // Try to discover existing flow
@@ -36,35 +84,159 @@ FlowFile* FlowManager::open_flow(const std::string& flow_name) {
     }
     
     // Create new flow
-    FlowID flow_id = generate_flow_id();
+    FlowFile* result = register_flow(flow_id_for(flow_name), flow_name);
+    if (!result) {
+        return nullptr;
+    }
+    std::cout << "Created new flow: " << flow_name << " (ID: " << result->identifier() << ")" << std::endl;
+    return result;
+}
+
+FlowID FlowManager::flow_id_for(const std::string& flow_name) {
+    uint64_t key = flow_name_key(namespace_, flow_name);
+    
+    // Every node probes the same sequence, so a collision resolves the same
+    // way wherever the names involved are known
+    for (uint32_t attempt = 0;; ++attempt) {
+        FlowID candidate = derive_flow_id(key, attempt);
+        if (flows_.contains_id(candidate)) {
+            continue;
+        }
+        
+        std::lock_guard<std::mutex> lock(directory_mutex_);
+        bool taken = false;
+        for (const auto& remote : remote_flows_) {
+            if (remote.second.flow_id == candidate && remote.first != flow_name) {
+                taken = true;
+                break;
+            }
+        }
+        if (!taken) {
+            return candidate;
+        }
+    }
+}
+
+FlowFile* FlowManager::register_flow(FlowID flow_id, const std::string& flow_name, const FlowSnapshot* snapshot) {
     auto flow_file = std::make_unique<FlowFile>(flow_id, flow_name);
+    flow_file->set_max_length(max_flow_length_);
     
-    // Set up circulation pattern
+    // Set up circulation pattern; a restored flow keeps the one it was saved with
     CirculationPattern pattern;
+    if (snapshot) {
+        pattern = snapshot->pattern();
+    } else {
+        pattern.circulation_rate = 10; // 10 packets per second
+        pattern.auto_sustain = true;
+    }
     pattern.id = flow_id;
     pattern.name = flow_name;
-    pattern.circulation_rate = 10; // 10 packets per second
-    pattern.auto_sustain = true;
     
     flow_file->update_circulation_pattern(pattern);
     
+    // Store the flow; a joined ID may already be held by another local name
+    FlowFile* result = flow_file.get();
+    if (!flows_.insert(flow_name, flow_name_key(namespace_, flow_name), std::move(flow_file))) {
+        std::cerr << "Flow ID " << flow_id << " already in use; cannot open " << flow_name << std::endl;
+        return nullptr;
+    }
+    
+    // Only once the ID is ours: the network takes the flow's chunks from it
+    result->attach_network(network_flow_.get());
+    
     // Add to network flow
     if (network_flow_) {
         network_flow_->add_circulation_pattern(pattern);
     }
     
-    // Store the flow
-    FlowFile* result = flow_file.get();
-    active_files_[flow_name] = std::move(flow_file);
+    // Restored once the network holds the flow, so its version is advertised
+    if (snapshot) {
+        result->restore_snapshot(*snapshot);
+    }
     
-    std::cout << "Created new flow: " << flow_name << " (ID: " << flow_id << ")" << std::endl;
+    ++announce_generation_;
+    request_announce();
     return result;
 }
 
+size_t FlowManager::enable_snapshots(const std::string& directory) {
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Cannot create snapshot directory " << directory << ": " << strerror(errno) << std::endl;
+        return 0;
+    }
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) {
+        std::cerr << "Cannot read snapshot directory " << directory << ": " << strerror(errno) << std::endl;
+        return 0;
+    }
+    snapshot_dir_ = directory;
+    
+    size_t restored = 0;
+    while (struct dirent* entry = readdir(dir)) {
+        std::string file = entry->d_name;
+        if (file.size() <= 5 || file.compare(file.size() - 5, 5, ".snap") != 0) {
+            continue;
+        }
+        FlowSnapshot snapshot;
+        if (!snapshot.open(directory + "/" + file)) {
+            std::cerr << "Ignoring unreadable snapshot " << file << std::endl;
+            continue;
+        }
+        
+        // Other namespaces may share the directory; their keys do not match
+        std::string name = snapshot.name();
+        if (!validate_flow_name(name) || snapshot.header().name_key != flow_name_key(namespace_, name) ||
+            flows_.find(name)) {
+            continue;
+        }
+        if (FlowFile* flow = register_flow(flow_id_for(name), name, &snapshot)) {
+            ++restored;
+            std::cout << "Restored flow: " << name << " (version " << snapshot.header().version << ", "
+                      << flow->text().size() << " bytes)" << std::endl;
+        }
+    }
+    closedir(dir);
+    return restored;
+}
+
+void FlowManager::save_snapshots() {
+    if (snapshot_dir_.empty()) {
+        return;
+    }
+    
+    // Written outside the cache stripes: a sync must not stall packet routing
+    std::lock_guard<std::mutex> lock(snapshot_mutex_);
+    std::vector<FlowCache::Entry> flows;
+    flows_.for_each([&flows](const std::string&, const FlowCache::Entry& flow) {
+        flows.push_back(flow);
+    });
+    for (const auto& flow : flows) {
+        if (!flow.file->save_snapshot(snapshot_path(flow.key), flow.key)) {
+            static LogSite save_log(1);
+            log_message(LogLevel::WARN, save_log, "Failed to save snapshot of flow ", flow.file->name());
+        }
+    }
+}
+
+std::string FlowManager::snapshot_path(uint64_t name_key) const {
+    std::ostringstream path;
+    path << snapshot_dir_ << '/' << std::hex << std::setw(16) << std::setfill('0') << name_key << ".snap";
+    return path.str();
+}
+
 void FlowManager::close_flow(const std::string& flow_name) {
-    auto it = active_files_.find(flow_name);
-    if (it != active_files_.end()) {
-        FlowID flow_id = it->second->identifier();
+    // Out of the cache first, so nothing is routed to it any more
+    std::unique_lock<std::mutex> snapshot_lock(snapshot_mutex_);
+    std::unique_ptr<FlowFile> flow_file = flows_.erase(flow_name);
+    snapshot_lock.unlock();
+    if (flow_file) {
+        FlowID flow_id = flow_file->identifier();
+        
+        // Kept on disk, so the flow comes back with the next warm start
+        if (!snapshot_dir_.empty()) {
+            uint64_t key = flow_name_key(namespace_, flow_name);
+            flow_file->save_snapshot(snapshot_path(key), key);
+        }
         
         // Remove from network flow
         if (network_flow_) {
@@ -72,8 +244,8 @@ void FlowManager::close_flow(const std::string& flow_name) {
             network_flow_->remove_stream(flow_id);
         }
         
-        // Remove from active files
-        active_files_.erase(it);
+        ++announce_generation_;
+        request_announce();
         
         std::cout << "Closed flow: " << flow_name << std::endl;
     }
@@ -82,7 +254,7 @@ void FlowManager::close_flow(const std::string& flow_name) {
 void FlowManager::create_circulation_pattern(const std::string& name) {
     // This would create a new circulation pattern without a file
     CirculationPattern pattern;
-    pattern.id = generate_flow_id();
+    pattern.id = flow_id_for(name);
     pattern.name = name;
     pattern.circulation_rate = 5;
     pattern.auto_sustain = true;
@@ -95,9 +267,16 @@ void FlowManager::create_circulation_pattern(const std::string& name) {
 }
 
 void FlowManager::sustain_all_flows() {
-    for (auto& pair : active_files_) {
-        if (pair.second) {
-            pair.second->maintain_flow();
+    // Maintained outside the cache stripes: re-emission waits out the
+    // transmit budget, which must not stall opens and packet routing
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex_);
+        std::vector<FlowCache::Entry> flows;
+        flows_.for_each([&flows](const std::string&, const FlowCache::Entry& flow) {
+            flows.push_back(flow);
+        });
+        for (const auto& flow : flows) {
+            flow.file->maintain_flow();
         }
     }
     
@@ -106,24 +285,31 @@ void FlowManager::sustain_all_flows() {
     }
 }
 
-bool FlowManager::initialize_network(const std::string& interface) {
+bool FlowManager::initialize_network(const std::vector<std::string>& interfaces) {
     if (!network_flow_) {
         return false;
     }
     
-    bool success = network_flow_->initialize_interface(interface);
+    // An interface that fails is left out; the others still carry the flows
+    for (const auto& interface : interfaces) {
+        if (network_flow_->initialize_interface(interface)) {
+            topology_.interfaces.push_back(interface);
+        } else {
+            std::cerr << "Skipping interface " << interface << std::endl;
+        }
+    }
+    bool success = !topology_.interfaces.empty();
     if (success) {
-        // Add interface to topology
-        topology_.interfaces.push_back(interface);
-        
         // Start network flow
         network_flow_->start_circulation();
         
-        // Start discovery thread
+        // Start discovery thread; the first announce goes out right away
         running_ = true;
         discovery_thread_ = std::thread(&FlowManager::discovery_worker, this);
         
-        std::cout << "Initialized network on interface: " << interface << std::endl;
+        for (const auto& interface : topology_.interfaces) {
+            std::cout << "Initialized network on interface: " << interface << std::endl;
+        }
     }
     
     return success;
@@ -134,33 +320,27 @@ void FlowManager::handle_topology_change() {
     discover_network_topology();
     
     // Adapt circulation patterns to new topology
-    for (auto& pair : active_files_) {
-        if (pair.second) {
-            // Update circulation paths based on new topology
-            CirculationPattern pattern = pair.second->pattern();
-            // In a real implementation, this would update the pattern
-            // based on available network paths
-            pair.second->update_circulation_pattern(pattern);
-        }
-    }
+    flows_.for_each([](const std::string&, const FlowCache::Entry& flow) {
+        // Update circulation paths based on new topology
+        CirculationPattern pattern = flow.file->pattern();
+        // In a real implementation, this would update the pattern
+        // based on available network paths
+        flow.file->update_circulation_pattern(pattern);
+    });
 }
 
 void FlowManager::discover_network_topology() {
-    // In a real implementation, this would:
-    // 1. Send discovery packets to find other nodes
-    // 2. Build routing table based on responses
-    // 3. Update topology information
-    
-    std::cout << "Discovering network topology..." << std::endl;
-    
-    // For now, just simulate discovery
+    // Nodes are whoever announced recently; every node reaches every other
+    // over the shared segment
+    std::lock_guard<std::mutex> lock(directory_mutex_);
     topology_.discovered_nodes.clear();
     topology_.routing_table.clear();
     
-    // Simulate finding some nodes
-    topology_.discovered_nodes = {"192.168.1.100", "192.168.1.101", "192.168.1.102"};
-    
-    // Build simple routing table
+    for (const auto& peer : peers_) {
+        std::ostringstream name;
+        name << std::hex << std::setw(16) << std::setfill('0') << peer.first;
+        topology_.discovered_nodes.push_back(name.str());
+    }
     for (const auto& node : topology_.discovered_nodes) {
         topology_.routing_table[node] = topology_.discovered_nodes;
     }
@@ -169,19 +349,19 @@ void FlowManager::discover_network_topology() {
 std::vector<std::string> FlowManager::discover_existing_flows() {
     std::vector<std::string> discovered_flows;
     
-    if (network_flow_) {
-        network_flow_->discover_flows();
-    }
-    
     // Include locally active flows
-    for (const auto& pair : active_files_) {
-        discovered_flows.push_back(pair.first);
+    discovered_flows = get_active_flow_names();
+    
+    // And every remote flow a holder has named in answer to a query
+    {
+        std::lock_guard<std::mutex> lock(directory_mutex_);
+        for (const auto& remote : remote_flows_) {
+            if (peers_.count(remote.second.node_id)) {
+                discovered_flows.push_back(remote.first);
+            }
+        }
     }
     
-    // Simulated remote flows for demonstration
-    static const std::vector<std::string> simulated_flows = {"document1", "logfile", "config"};
-    discovered_flows.insert(discovered_flows.end(), simulated_flows.begin(), simulated_flows.end());
-    
     // Deduplicate and sort
     std::sort(discovered_flows.begin(), discovered_flows.end());
     discovered_flows.erase(std::unique(discovered_flows.begin(), discovered_flows.end()), discovered_flows.end());
@@ -190,78 +370,263 @@ std::vector<std::string> FlowManager::discover_existing_flows() {
 }
 
 bool FlowManager::connect_to_flow(const std::string& flow_name) {
-    // Try to discover and connect to existing flow
-    std::cout << "Attempting to connect to existing flow: " << flow_name << std::endl;
+    if (!running_) {
+        return false;  // No network to find it on
+    }
+    
+    // Skip the round trip when peers have announced and none may hold it
+    uint64_t key = flow_name_key(namespace_, flow_name);
+    {
+        std::lock_guard<std::mutex> lock(directory_mutex_);
+        bool candidate = peers_.empty();
+        for (const auto& peer : peers_) {
+            const PeerSummary& summary = peer.second;
+            if (!summary.partitions.empty() &&
+                summary.partitions[(key >> 32) % summary.partitions.size()].may_contain(key)) {
+                candidate = true;
+                break;
+            }
+        }
+        if (!candidate) {
+            return false;
+        }
+    }
     
-    // In a real implementation, this would:
-    // 1. Send discovery packets for this specific flow
-    // 2. Wait for responses
-    // 3. Create FlowFile from discovered flow data
+    std::cout << "Attempting to connect to existing flow: " << flow_name << std::endl;
+    uint64_t asked = directory_now_us();
+    send_discovery(encode_flow_name(DISCOVERY_QUERY, node_id_, key, flow_name, 0));
+    
+    RemoteFlow remote;
+    {
+        std::unique_lock<std::mutex> lock(directory_mutex_);
+        bool answered = directory_cv_.wait_for(lock, QUERY_TIMEOUT, [&] {
+            auto it = remote_flows_.find(flow_name);
+            return it != remote_flows_.end() && it->second.seen_us >= asked;
+        });
+        if (!answered) {
+            return false;
+        }
+        remote = remote_flows_[flow_name];
+    }
     
-    // For now, assume no existing flow
-    return false;
+    // Join under the holder's ID; its chunks arrive through circulation and
+    // NACKs fill whatever is missing
+    FlowFile* joined = register_flow(remote.flow_id, flow_name);
+    if (!joined) {
+        return false;
+    }
+    joined->await_remote_content();
+    std::cout << "Joined flow: " << flow_name << " (ID: " << remote.flow_id << ")" << std::endl;
+    return true;
 }
 
 std::vector<std::string> FlowManager::get_active_flow_names() const {
     std::vector<std::string> names;
-    names.reserve(active_files_.size());
+    names.reserve(flows_.size());
     
-    for (const auto& pair : active_files_) {
-        names.push_back(pair.first);
-    }
+    flows_.for_each([&names](const std::string& name, const FlowCache::Entry&) {
+        names.push_back(name);
+    });
+    std::sort(names.begin(), names.end());
     
     return names;
 }
 
+std::string FlowManager::render_metrics() {
+    MetricsText out;
+    out.family("nerd_flows_open", "gauge", "Flows open on this node");
+    out.sample("nerd_flows_open", flows_.size());
+    {
+        std::lock_guard<std::mutex> lock(directory_mutex_);
+        out.family("nerd_peers", "gauge", "Peers heard from within the timeout");
+        out.sample("nerd_peers", peers_.size());
+        out.family("nerd_remote_flows", "gauge", "Remote flows named by their holders");
+        out.sample("nerd_remote_flows", remote_flows_.size());
+    }
+    network_flow_->render_metrics(out);
+    return out.str();
+}
+
 FlowFile* FlowManager::get_flow(const std::string& name) {
-    auto it = active_files_.find(name);
-    return (it != active_files_.end()) ? it->second.get() : nullptr;
+    return flows_.find(name);
 }
 
 void FlowManager::discovery_worker() {
-    while (running_) {
-        // Periodically discover network topology
+    std::mt19937_64 jitter(node_id_);
+    std::uniform_int_distribution<int64_t> spread(-ANNOUNCE_INTERVAL.count() / 4, ANNOUNCE_INTERVAL.count() / 4);
+    
+    for (uint64_t round = 0; running_; ++round) {
+        // One summary per node per interval, however many flows it holds
+        announce_flows();
+        expire_peers();
         discover_network_topology();
         
-        // Maintain flow circulation
-        maintain_flow_circulation();
+        if (round % SUSTAIN_INTERVALS == 0) {
+            maintain_flow_circulation();
+        }
+        if (round % SNAPSHOT_INTERVALS == 0) {
+            save_snapshots();
+        }
+        if (!metrics_file_.empty() && !write_metrics_file(metrics_file_, render_metrics())) {
+            static LogSite metrics_log(1);
+            log_message(LogLevel::WARN, metrics_log, "Failed to write metrics to ", metrics_file_);
+        }
         
-        // Sleep for discovery interval
-        std::this_thread::sleep_for(std::chrono::seconds(30));
+        // Jittered so nodes started together do not announce in lockstep
+        auto deadline = std::chrono::steady_clock::now() + ANNOUNCE_INTERVAL + std::chrono::milliseconds(spread(jitter));
+        std::unique_lock<std::mutex> lock(worker_mutex_);
+        while (worker_cv_.wait_until(lock, deadline, [this] { return !running_ || announce_requested_; })) {
+            if (!running_) {
+                return;
+            }
+            // The flow set changed: refresh the summary without waiting out the interval
+            announce_requested_ = false;
+            lock.unlock();
+            announce_flows();
+            lock.lock();
+        }
+    }
+}
+
+void FlowManager::request_announce() {
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex_);
+        announce_requested_ = true;
     }
+    worker_cv_.notify_all();
 }
 
 void FlowManager::maintain_flow_circulation() {
     // Sustain all active flows
     sustain_all_flows();
-    
-    // Broadcast existence of our flows
-    for (const auto& pair : active_files_) {
-        if (pair.second) {
-            broadcast_flow_existence(pair.first);
+}
+
+void FlowManager::announce_flows() {
+    // Read the generation first: a flow set change racing the walk bumps it
+    // again and triggers another announce
+    uint64_t generation = announce_generation_.load();
+    std::vector<uint64_t> keys;
+    keys.reserve(flows_.size());
+    flows_.for_each([&keys](const std::string&, const FlowCache::Entry& flow) {
+        keys.push_back(flow.key);
+    });
+    
+    for (const auto& payload : encode_announce(node_id_, generation, keys)) {
+        send_discovery(payload);
+    }
+}
+
+void FlowManager::expire_peers() {
+    uint64_t cutoff = PEER_TIMEOUT_INTERVALS * ANNOUNCE_INTERVAL.count() * 1000;
+    uint64_t now = directory_now_us();
+    
+    std::lock_guard<std::mutex> lock(directory_mutex_);
+    for (auto it = peers_.begin(); it != peers_.end();) {
+        if (now - it->second.last_seen_us > cutoff) {
+            it = peers_.erase(it);
+        } else {
+            ++it;
         }
     }
 }
 
-void FlowManager::handle_flow_discovery_response(const RawPacket& packet) {
-    // Handle discovery response packets
-    // In a real implementation, this would parse the response
-    // and update flow information accordingly
+void FlowManager::send_discovery(const std::vector<uint8_t>& payload) {
+    RawPacket packet(0, FLOW_DISCOVERY, payload);
+    network_flow_->transmit_packet(packet);
+    network_flow_->flush_transmit();
+}
+
+void FlowManager::handle_discovery_packet(const RawPacket& packet) {
+    // Runs on the receive thread
+    DiscoveryHeader header;
+    if (!decode_discovery_header(packet, header) || header.node_id == node_id_) {
+        return;
+    }
+    
+    switch (header.kind) {
+        case DISCOVERY_ANNOUNCE:
+            handle_announce(header, packet);
+            break;
+        case DISCOVERY_QUERY:
+            answer_query(packet);
+            break;
+        case DISCOVERY_FOUND:
+            record_found(header, packet);
+            break;
+        default:
+            break;
+    }
+}
+
+void FlowManager::handle_announce(const DiscoveryHeader& header, const RawPacket& packet) {
+    AnnounceRecord record;
+    BloomFilter filter;
+    if (!decode_announce(packet, record, filter)) {
+        return;
+    }
+    
+    std::lock_guard<std::mutex> lock(directory_mutex_);
+    PeerSummary& peer = peers_[header.node_id];
+    peer.last_seen_us = directory_now_us();
     
-    std::cout << "Received flow discovery response" << std::endl;
+    // A new generation or partition layout replaces the whole summary
+    if (peer.generation != record.generation || peer.partitions.size() != record.partition_count) {
+        peer.generation = record.generation;
+        peer.partitions.assign(record.partition_count, BloomFilter());
+    }
+    peer.partitions[record.partition] = std::move(filter);
 }
 
-void FlowManager::broadcast_flow_existence(const std::string& flow_name) {
-    // Broadcast that this flow exists
-    // In a real implementation, this would send broadcast packets
-    // to announce the flow's existence
+void FlowManager::answer_query(const RawPacket& packet) {
+    FlowNameRecord record;
+    std::string name;
+    if (!decode_flow_name(packet, record, name)) {
+        return;
+    }
     
-    std::cout << "Broadcasting existence of flow: " << flow_name << std::endl;
+    // The key check drops queries from other namespaces
+    FlowCache::Entry flow;
+    if (!flows_.lookup(name, flow) || flow.key != record.name_key) {
+        return;
+    }
+    send_discovery(encode_flow_name(DISCOVERY_FOUND, node_id_, flow.key, name, flow.id));
+}
+
+void FlowManager::record_found(const DiscoveryHeader& header, const RawPacket& packet) {
+    FlowNameRecord record;
+    std::string name;
+    if (!decode_flow_name(packet, record, name) || record.flow_id == 0 ||
+        record.name_key != flow_name_key(namespace_, name)) {
+        return;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(directory_mutex_);
+        RemoteFlow& remote = remote_flows_[name];
+        remote.flow_id = record.flow_id;
+        remote.node_id = header.node_id;
+        remote.seen_us = directory_now_us();
+    }
+    directory_cv_.notify_all();
+}
+
+void FlowManager::route_packet(const RawPacket& packet) {
+    // Runs on the receive thread; the flow applies it on the editor thread
+    flows_.with_flow(packet.header().flow_id, [&packet](FlowFile& flow) {
+        switch (packet.header().packet_type) {
+            case FLOW_EDIT:
+                flow.receive_edit(packet);
+                break;
+            default:
+                flow.receive_chunk(packet);
+                break;
+        }
+    });
 }
 
 bool FlowManager::validate_flow_name(const std::string& name) const {
     // Basic validation - no empty names, no special characters
-    if (name.empty()) {
+    if (name.empty() || name.size() > 255) {
         return false;
     }
     
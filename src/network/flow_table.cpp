@@ -0,0 +1,92 @@
+#include "network/flow_table.h"
+
+namespace nerd {
+
+FlowTable::FlowTable(size_t initial_capacity) : size_(0) {
+    size_t capacity = 16;
+    while (capacity < initial_capacity) {
+        capacity <<= 1;
+    }
+    slots_.resize(capacity);
+    mask_ = capacity - 1;
+}
+
+size_t FlowTable::probe(FlowID id) const {
+    size_t index = hash(id) & mask_;
+    while (slots_[index].used && slots_[index].record.id != id) {
+        index = (index + 1) & mask_;
+    }
+    return index;
+}
+
+FlowRecord* FlowTable::find(FlowID id) {
+    size_t index = probe(id);
+    return slots_[index].used ? &slots_[index].record : nullptr;
+}
+
+const FlowRecord* FlowTable::find(FlowID id) const {
+    size_t index = probe(id);
+    return slots_[index].used ? &slots_[index].record : nullptr;
+}
+
+FlowRecord& FlowTable::find_or_insert(FlowID id) {
+    size_t index = probe(id);
+    if (slots_[index].used) {
+        return slots_[index].record;
+    }
+
+    // Keep the load factor at or below 3/4
+    if ((size_ + 1) * 4 > slots_.size() * 3) {
+        grow();
+        index = probe(id);
+    }
+
+    Slot& slot = slots_[index];
+    slot.used = true;
+    slot.record = FlowRecord();
+    slot.record.id = id;
+    ++size_;
+    return slot.record;
+}
+
+bool FlowTable::erase(FlowID id) {
+    size_t hole = probe(id);
+    if (!slots_[hole].used) {
+        return false;
+    }
+
+    // Backward-shift deletion: pull later members of the probe run into the hole
+    size_t next = (hole + 1) & mask_;
+    while (slots_[next].used) {
+        size_t home = hash(slots_[next].record.id) & mask_;
+        // Move unless the entry's home lies cyclically in (hole, next]
+        bool stays = (hole <= next) ? (home > hole && home <= next) : (home > hole || home <= next);
+        if (!stays) {
+            slots_[hole].record = std::move(slots_[next].record);
+            hole = next;
+        }
+        next = (next + 1) & mask_;
+    }
+
+    slots_[hole].used = false;
+    slots_[hole].record = FlowRecord();
+    --size_;
+    return true;
+}
+
+void FlowTable::grow() {
+    std::vector<Slot> old;
+    old.swap(slots_);
+    slots_.resize(old.size() * 2);
+    mask_ = slots_.size() - 1;
+
+    for (auto& slot : old) {
+        if (slot.used) {
+            size_t index = probe(slot.record.id);
+            slots_[index].used = true;
+            slots_[index].record = std::move(slot.record);
+        }
+    }
+}
+
+} // namespace nerd
\ No newline at end of file
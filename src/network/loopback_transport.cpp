@@ -0,0 +1,120 @@
+#include "network/loopback_transport.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace nerd {
+
+namespace {
+
+// Frames copied out per lock acquisition on the receive side
+const size_t POLL_BATCH = 64;
+
+std::chrono::steady_clock::time_point steady_at(uint64_t us) {
+    return std::chrono::steady_clock::time_point(std::chrono::microseconds(us));
+}
+
+} // namespace
+
+LoopbackHub::LoopbackHub(const LoopbackConfig& config) : config_(config) {}
+
+std::unique_ptr<LoopbackTransport> LoopbackHub::attach() {
+    std::unique_ptr<LoopbackTransport> port(new LoopbackTransport(*this));
+    std::unique_lock<std::shared_mutex> lock(ports_mutex_);
+    ports_.push_back(port.get());
+    return port;
+}
+
+void LoopbackHub::detach(LoopbackTransport* port) {
+    std::unique_lock<std::shared_mutex> lock(ports_mutex_);
+    ports_.erase(std::remove(ports_.begin(), ports_.end(), port), ports_.end());
+}
+
+bool LoopbackHub::broadcast(const LoopbackTransport* sender, const RawPacket& packet) {
+    // Serialized once, as the wire would carry it, and copied to each port
+    thread_local std::vector<uint8_t> frame;
+    frame.resize(config_.frame_size);
+    size_t length = packet.serialize_into(frame.data(), frame.size());
+    if (length == 0) {
+        return false;
+    }
+
+    uint64_t deliver_at = packet_timestamp_now() + config_.latency_us;
+    std::shared_lock<std::shared_mutex> lock(ports_mutex_);
+    for (LoopbackTransport* port : ports_) {
+        if (port != sender) {
+            port->deliver(frame.data(), length, deliver_at);
+        }
+    }
+    return true;
+}
+
+LoopbackTransport::LoopbackTransport(LoopbackHub& hub)
+    : hub_(hub), slot_size_(hub.config().frame_size),
+      slots_(static_cast<size_t>(hub.config().queue_frames) * hub.config().frame_size),
+      deliver_at_(hub.config().queue_frames), lengths_(hub.config().queue_frames), head_(0), count_(0),
+      batch_(POLL_BATCH * hub.config().frame_size), drops_(0) {}
+
+LoopbackTransport::~LoopbackTransport() {
+    hub_.detach(this);
+}
+
+bool LoopbackTransport::send(const RawPacket& packet) {
+    return hub_.broadcast(this, packet);
+}
+
+void LoopbackTransport::deliver(const uint8_t* frame, size_t length, uint64_t deliver_at) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (count_ == lengths_.size()) {
+        drops_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    size_t slot = (head_ + count_) % lengths_.size();
+    std::memcpy(slots_.data() + slot * slot_size_, frame, length);
+    deliver_at_[slot] = deliver_at;
+    lengths_[slot] = static_cast<uint32_t>(length);
+    if (count_++ == 0) {
+        cv_.notify_one();
+    }
+}
+
+size_t LoopbackTransport::poll(int timeout_ms, const FrameHandler& handler) {
+    uint32_t lengths[POLL_BATCH];
+    uint64_t stamps[POLL_BATCH];
+    size_t taken = 0;
+    {
+        // Every sender shares one latency, so frames come due in ring order
+        uint64_t limit = packet_timestamp_now() + static_cast<uint64_t>(timeout_ms) * 1000;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            uint64_t now = packet_timestamp_now();
+            if (count_ != 0 && deliver_at_[head_] <= now) {
+                break;
+            }
+            if (now >= limit) {
+                return 0;
+            }
+            uint64_t wake = count_ != 0 ? std::min(limit, deliver_at_[head_]) : limit;
+            cv_.wait_until(lock, steady_at(wake));
+        }
+
+        // Copied out so the handler runs unlocked: it may send, and the
+        // ports it sends to may be sending to this one
+        uint64_t now = packet_timestamp_now();
+        while (taken < POLL_BATCH && count_ != 0 && deliver_at_[head_] <= now) {
+            std::memcpy(batch_.data() + taken * slot_size_, slots_.data() + head_ * slot_size_, lengths_[head_]);
+            lengths[taken] = lengths_[head_];
+            stamps[taken] = deliver_at_[head_];
+            head_ = (head_ + 1) % lengths_.size();
+            --count_;
+            ++taken;
+        }
+    }
+
+    for (size_t i = 0; i < taken; ++i) {
+        handler(batch_.data() + i * slot_size_, lengths[i], stamps[i]);
+    }
+    return taken;
+}
+
+} // namespace nerd
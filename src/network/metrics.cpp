@@ -0,0 +1,159 @@
+#include "network/metrics.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+
+namespace nerd {
+
+namespace {
+
+std::atomic<size_t> next_stripe(0);
+
+size_t bucket_for(uint64_t value) {
+    if (value == 0) {
+        return 0;
+    }
+    size_t bucket = 64 - static_cast<size_t>(__builtin_clzll(value));
+    return bucket < HistogramSnapshot::BUCKETS ? bucket : HistogramSnapshot::BUCKETS - 1;
+}
+
+} // namespace
+
+size_t metric_stripe() {
+    thread_local size_t stripe = next_stripe.fetch_add(1, std::memory_order_relaxed) % METRIC_STRIPES;
+    return stripe;
+}
+
+Counter::Counter() {
+    for (auto& stripe : stripes_) {
+        stripe.value.store(0, std::memory_order_relaxed);
+    }
+}
+
+uint64_t Counter::value() const {
+    uint64_t total = 0;
+    for (const auto& stripe : stripes_) {
+        total += stripe.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void HistogramSnapshot::merge(const HistogramSnapshot& other) {
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        buckets[i] += other.buckets[i];
+    }
+    count += other.count;
+    sum += other.sum;
+}
+
+uint64_t HistogramSnapshot::upper_bound(size_t bucket) {
+    return bucket == 0 ? 0 : (uint64_t(1) << bucket) - 1;
+}
+
+uint64_t HistogramSnapshot::quantile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(count - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return upper_bound(i);
+        }
+    }
+    return upper_bound(BUCKETS - 1);
+}
+
+Histogram::Histogram() {
+    for (auto& stripe : stripes_) {
+        for (auto& bucket : stripe.buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        stripe.sum.store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::record(uint64_t value) {
+    Stripe& stripe = stripes_[metric_stripe()];
+    stripe.buckets[bucket_for(value)].fetch_add(1, std::memory_order_relaxed);
+    stripe.sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+HistogramSnapshot Histogram::snapshot() const {
+    // Stripes are read one by one, so a snapshot taken under load may be a
+    // few samples behind in places; count always matches the buckets
+    HistogramSnapshot snapshot;
+    for (const auto& stripe : stripes_) {
+        for (size_t i = 0; i < HistogramSnapshot::BUCKETS; ++i) {
+            uint64_t n = stripe.buckets[i].load(std::memory_order_relaxed);
+            snapshot.buckets[i] += n;
+            snapshot.count += n;
+        }
+        snapshot.sum += stripe.sum.load(std::memory_order_relaxed);
+    }
+    return snapshot;
+}
+
+void MetricsText::family(const std::string& name, const char* type, const char* help) {
+    text_ += "# HELP " + name + " " + help + "\n";
+    text_ += "# TYPE " + name + " " + type + "\n";
+}
+
+void MetricsText::sample(const std::string& name, uint64_t value, const std::string& labels) {
+    text_ += name;
+    if (!labels.empty()) {
+        text_ += "{" + labels + "}";
+    }
+    text_ += " " + std::to_string(value) + "\n";
+}
+
+void MetricsText::histogram(const std::string& name, const HistogramSnapshot& histogram, const std::string& labels) {
+    // Cumulative buckets up to the highest one in use, then +Inf
+    std::string prefix = labels.empty() ? std::string() : labels + ",";
+    size_t last = 0;
+    for (size_t i = 0; i < HistogramSnapshot::BUCKETS; ++i) {
+        if (histogram.buckets[i] != 0) {
+            last = i;
+        }
+    }
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i <= last && i + 1 < HistogramSnapshot::BUCKETS; ++i) {
+        cumulative += histogram.buckets[i];
+        sample(name + "_bucket", cumulative, prefix + "le=\"" + std::to_string(HistogramSnapshot::upper_bound(i)) + "\"");
+    }
+    sample(name + "_bucket", histogram.count, prefix + "le=\"+Inf\"");
+    sample(name + "_sum", histogram.sum, labels);
+    sample(name + "_count", histogram.count, labels);
+}
+
+bool write_metrics_file(const std::string& path, const std::string& text) {
+    std::string temp_path = path + ".tmp";
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    size_t written = 0;
+    while (written < text.size()) {
+        ssize_t n = write(fd, text.data() + written, text.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        written += static_cast<size_t>(n);
+    }
+
+    // Renamed into place so a scrape never sees a partial file
+    bool ok = close(fd) == 0 && written == text.size();
+    if (!ok || rename(temp_path.c_str(), path.c_str()) != 0) {
+        unlink(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace nerd
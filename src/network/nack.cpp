@@ -0,0 +1,23 @@
+#include "network/nack.h"
+
+namespace nerd {
+
+std::vector<NackRange> ranges_from_sequences(const std::vector<uint32_t>& sequences, size_t max_ranges) {
+    std::vector<NackRange> ranges;
+    for (uint32_t sequence : sequences) {
+        if (!ranges.empty() && ranges.back().first + ranges.back().count == sequence) {
+            ++ranges.back().count;
+            continue;
+        }
+        if (ranges.size() == max_ranges) {
+            break;
+        }
+        NackRange range;
+        range.first = sequence;
+        range.count = 1;
+        ranges.push_back(range);
+    }
+    return ranges;
+}
+
+} // namespace nerd
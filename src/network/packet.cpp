@@ -1,32 +1,120 @@
 #include "network/packet.h"
+#include "network/crc32c.h"
+#include <cstddef>
 #include <cstring>
 #include <chrono>
 #include <algorithm>
+#include <limits>
 
 namespace nerd {
 
-// Magic number for flow packet identification
-static const uint32_t FLOW_MAGIC = 0x4E455244; // "NERD" in ASCII
+namespace {
 
-RawPacket::RawPacket() {
+// Header bytes covered by the checksum: everything before the checksum itself
+const size_t CHECKED_HEADER_BYTES = offsetof(FlowPacketHeader, checksum);
+
+// Fields of the frame header, which static_assert in packet.h keeps in host order
+uint32_t load_le32(const uint8_t* data) {
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+void store_le32(uint8_t* data, uint32_t value) {
+    std::memcpy(data, &value, sizeof(value));
+}
+
+uint16_t load_le16(const uint8_t* data) {
+    uint16_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+} // namespace
+
+uint64_t packet_timestamp_now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool validate_frame(const uint8_t* frame, size_t length) {
+    if (length < sizeof(FlowPacketHeader)) {
+        return false;
+    }
+    
+    uint32_t magic = load_le32(frame + offsetof(FlowPacketHeader, magic));
+    uint8_t version = frame[offsetof(FlowPacketHeader, version)];
+    size_t data_length = load_le16(frame + offsetof(FlowPacketHeader, data_length));
+    uint32_t checksum = load_le32(frame + offsetof(FlowPacketHeader, checksum));
+    
+    // Checksum what is there, then decide everything in one branch
+    size_t available = length - sizeof(FlowPacketHeader);
+    uint32_t crc = crc32c(0, frame, CHECKED_HEADER_BYTES);
+    crc = crc32c(crc, frame + sizeof(FlowPacketHeader), std::min(data_length, available));
+    return (magic == FLOW_MAGIC) & (version == FLOW_WIRE_VERSION) & (data_length <= available) & (crc == checksum);
+}
+
+FlowPacketHeader frame_header(const uint8_t* frame) {
+    FlowPacketHeader header;
+    std::memcpy(&header, frame, sizeof(FlowPacketHeader));
+    return header;
+}
+
+// Empty packets are placeholders and scratch (cleared ring slots, receive
+// workers), always overwritten before use, so they skip the clock read
+RawPacket::RawPacket() : payload_length_(0), received_at_(0) {
     header_.magic = FLOW_MAGIC;
+    header_.version = FLOW_WIRE_VERSION;
     header_.flow_id = 0;
     header_.sequence = 0;
     header_.packet_type = FLOW_DATA;
     header_.data_length = 0;
-    header_.timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
-        std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+    header_.timestamp = 0;
+    header_.flags = 0;
+    header_.codec = 0;
+    header_.dictionary = 0;
+    header_.checksum = 0;
 }
 
-RawPacket::RawPacket(FlowID flow_id, PacketType type, const std::vector<uint8_t>& payload) 
-    : data_(payload) {
+RawPacket::RawPacket(FlowID flow_id, PacketType type, const std::vector<uint8_t>& payload)
+    : RawPacket(flow_id, type, payload.data(), payload.size()) {}
+
+RawPacket::RawPacket(FlowID flow_id, PacketType type, const uint8_t* payload, size_t length)
+    : payload_length_(0), received_at_(0) {
     header_.magic = FLOW_MAGIC;
+    header_.version = FLOW_WIRE_VERSION;
     header_.flow_id = flow_id;
     header_.sequence = 0;
-    header_.packet_type = static_cast<uint32_t>(type);
-    header_.data_length = payload.size();
-    header_.timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
-        std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+    header_.packet_type = static_cast<uint8_t>(type);
+    header_.data_length = static_cast<uint16_t>(length);
+    header_.timestamp = packet_timestamp_now();
+    header_.flags = 0;
+    header_.codec = 0;
+    header_.dictionary = 0;
+    header_.checksum = 0;
+    assign_payload(payload, length);
+}
+
+RawPacket RawPacket::allocate(FlowID flow_id, PacketType type, size_t length) {
+    RawPacket packet(flow_id, type, nullptr, 0);
+    packet.payload_length_ = length;
+    packet.header_.data_length = static_cast<uint16_t>(length);
+    if (length > 0) {
+        packet.buffer_ = PacketPool::instance().allocate(PACKET_HEADROOM + length);
+    }
+    return packet;
+}
+
+void RawPacket::assign_payload(const uint8_t* payload, size_t length) {
+    payload_length_ = length;
+    if (length == 0) {
+        buffer_.reset();
+        return;
+    }
+    
+    // The only copy the payload sees on its way into the pool
+    buffer_ = PacketPool::instance().allocate(PACKET_HEADROOM + length);
+    std::memcpy(buffer_.data() + PACKET_HEADROOM, payload, length);
 }
 
 void RawPacket::set_header(const FlowPacketHeader& header) {
@@ -34,8 +122,12 @@ void RawPacket::set_header(const FlowPacketHeader& header) {
 }
 
 void RawPacket::set_payload(const std::vector<uint8_t>& payload) {
-    data_ = payload;
-    header_.data_length = payload.size();
+    set_payload(payload.data(), payload.size());
+}
+
+void RawPacket::set_payload(const uint8_t* payload, size_t length) {
+    assign_payload(payload, length);
+    header_.data_length = static_cast<uint16_t>(length);
 }
 
 void RawPacket::set_flow_id(FlowID flow_id) {
@@ -43,52 +135,82 @@ void RawPacket::set_flow_id(FlowID flow_id) {
 }
 
 void RawPacket::set_packet_type(PacketType type) {
-    header_.packet_type = static_cast<uint32_t>(type);
+    header_.packet_type = static_cast<uint8_t>(type);
 }
 
 void RawPacket::set_sequence(uint32_t seq) {
     header_.sequence = seq;
 }
 
+void RawPacket::set_timestamp(uint64_t timestamp) {
+    header_.timestamp = timestamp;
+}
+
+void RawPacket::set_compression(uint8_t codec, uint16_t dictionary) {
+    header_.codec = codec;
+    header_.dictionary = dictionary;
+    if (codec != 0) {
+        header_.flags |= PACKET_COMPRESSED;
+    } else {
+        header_.flags &= ~PACKET_COMPRESSED;
+    }
+}
+
 std::vector<uint8_t> RawPacket::serialize() const {
-    std::vector<uint8_t> serialized;
-    serialized.reserve(sizeof(FlowPacketHeader) + data_.size());
-    
-    // Serialize header
-    const uint8_t* header_ptr = reinterpret_cast<const uint8_t*>(&header_);
-    serialized.insert(serialized.end(), header_ptr, header_ptr + sizeof(FlowPacketHeader));
-    
-    // Serialize payload
-    serialized.insert(serialized.end(), data_.begin(), data_.end());
-    
+    std::vector<uint8_t> serialized(sizeof(FlowPacketHeader) + payload_length_);
+    serialize_into(serialized.data(), serialized.size());
     return serialized;
 }
 
-bool RawPacket::deserialize(const std::vector<uint8_t>& raw_data) {
-    if (raw_data.size() < sizeof(FlowPacketHeader)) {
-        return false;
+size_t RawPacket::serialize_into(uint8_t* buffer, size_t capacity) const {
+    size_t header_size = serialize_header_into(buffer, capacity);
+    if (header_size == 0 || capacity - header_size < payload_length_) {
+        return 0;
     }
     
-    // Deserialize header
-    std::memcpy(&header_, raw_data.data(), sizeof(FlowPacketHeader));
+    if (payload_length_ > 0) {
+        std::memcpy(buffer + header_size, payload(), payload_length_);
+    }
     
-    // Validate magic number
-    if (header_.magic != FLOW_MAGIC) {
-        return false;
+    return header_size + payload_length_;
+}
+
+size_t RawPacket::serialize_header_into(uint8_t* buffer, size_t capacity) const {
+    // The payload length must survive the 16-bit length field
+    if (capacity < sizeof(FlowPacketHeader) || payload_length_ != header_.data_length) {
+        return 0;
     }
     
-    // Deserialize payload
-    if (raw_data.size() >= sizeof(FlowPacketHeader) + header_.data_length) {
-        data_.assign(raw_data.begin() + sizeof(FlowPacketHeader), 
-                    raw_data.begin() + sizeof(FlowPacketHeader) + header_.data_length);
+    std::memcpy(buffer, &header_, sizeof(FlowPacketHeader));
+    
+    uint32_t crc = crc32c(0, buffer, CHECKED_HEADER_BYTES);
+    crc = crc32c(crc, payload(), payload_length_);
+    store_le32(buffer + CHECKED_HEADER_BYTES, crc);
+    return sizeof(FlowPacketHeader);
+}
+
+bool RawPacket::deserialize(const std::vector<uint8_t>& raw_data) {
+    return deserialize(raw_data.data(), raw_data.size());
+}
+
+bool RawPacket::deserialize(const uint8_t* raw_data, size_t length) {
+    // Corrupt, truncated and foreign-version frames never reach the pool
+    if (!validate_frame(raw_data, length)) {
+        return false;
     }
     
+    assign_frame(raw_data);
     return true;
 }
 
+void RawPacket::assign_frame(const uint8_t* frame) {
+    header_ = frame_header(frame);
+    assign_payload(frame + sizeof(FlowPacketHeader), header_.data_length);
+}
+
 bool RawPacket::is_valid() const {
     return header_.magic == FLOW_MAGIC && 
-           header_.data_length == data_.size();
+           header_.data_length == payload_length_;
 }
 
 bool RawPacket::is_flow_packet() const {
@@ -96,67 +218,203 @@ bool RawPacket::is_flow_packet() const {
 }
 
 // PacketStream implementation
-PacketStream::PacketStream(FlowID flow_id) : flow_id_(flow_id), next_sequence_(0) {}
+PacketStream::PacketStream(FlowID flow_id, uint32_t max_capacity)
+    : flow_id_(flow_id), slots_(MIN_CAPACITY), present_(MIN_CAPACITY / 64, 0),
+      mask_(MIN_CAPACITY - 1), base_(0), end_(0), count_(0),
+      max_capacity_(MIN_CAPACITY), dropped_(0), next_sequence_(0) {
+    // Keep the limit a power of two so grow() never overshoots it
+    while (max_capacity_ < max_capacity && max_capacity_ < (1u << 31)) {
+        max_capacity_ <<= 1;
+    }
+}
 
 void PacketStream::add_packet(const RawPacket& packet) {
-    if (packet.header().flow_id == flow_id_) {
-        packets_.push_back(packet);
-        
-        // Maintain packet order by sequence number
-        std::sort(packets_.begin(), packets_.end(), 
-                 [](const RawPacket& a, const RawPacket& b) {
-                     return a.header().sequence < b.header().sequence;
-                 });
+    if (packet.header().flow_id != flow_id_) {
+        return;
+    }
+    
+    // The window is [base_, end_), so the last sequence has no end to give it;
+    // accepting it would wrap end_ and strand the flow's later packets
+    uint32_t sequence = packet.header().sequence;
+    if (sequence == std::numeric_limits<uint32_t>::max()) {
+        ++dropped_;
+        return;
+    }
+    if (count_ == 0) {
+        base_ = sequence;
+        end_ = sequence;
     }
+    
+    uint32_t first = std::min(base_, sequence);
+    uint32_t last = std::max(end_, sequence + 1);
+    if (!reserve_span(first, last)) {
+        // Older than anything the window can still hold
+        ++dropped_;
+        return;
+    }
+    
+    base_ = std::min(base_, sequence);
+    end_ = std::max(end_, sequence + 1);
+    
+    // A re-encoded chunk simply replaces the copy already in the slot
+    if (!test(sequence)) {
+        set_bit(sequence);
+        ++count_;
+    }
+    slots_[sequence & mask_] = packet;
 }
 
 void PacketStream::remove_packet(uint32_t sequence) {
-    packets_.erase(
-        std::remove_if(packets_.begin(), packets_.end(),
-                      [sequence](const RawPacket& packet) {
-                          return packet.header().sequence == sequence;
-                      }),
-        packets_.end()
-    );
-}
-
-void PacketStream::maintain_circulation() {
-    // Update timestamps for all packets to keep them "alive"
-    auto now = std::chrono::high_resolution_clock::now();
-    uint64_t timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
-        now.time_since_epoch()).count();
-    
-    for (auto& packet : packets_) {
-        // Create a new packet with updated timestamp
-        RawPacket new_packet;
-        new_packet.set_header(packet.header());
-        new_packet.set_payload(packet.data());
-        new_packet.set_sequence(packet.header().sequence);
+    if (sequence < base_ || sequence >= end_ || !test(sequence)) {
+        return;
+    }
+    
+    clear_bit(sequence);
+    slots_[sequence & mask_] = RawPacket();
+    if (--count_ == 0) {
+        base_ = end_ = 0;
+        return;
+    }
+    
+    // Shrink the window to the packets that remain
+    if (sequence == base_) {
+        base_ = next_present(base_, end_);
+    }
+    while (end_ > base_ && !test(end_ - 1)) {
+        --end_;
+    }
+}
+
+const RawPacket* PacketStream::find(uint32_t sequence) const {
+    if (sequence < base_ || sequence >= end_ || !test(sequence)) {
+        return nullptr;
+    }
+    return &slots_[sequence & mask_];
+}
+
+RawPacket* PacketStream::find(uint32_t sequence) {
+    if (sequence < base_ || sequence >= end_ || !test(sequence)) {
+        return nullptr;
+    }
+    return &slots_[sequence & mask_];
+}
+
+uint32_t PacketStream::next_present(uint32_t from, uint32_t limit) const {
+    from = std::max(from, base_);
+    limit = std::min(limit, end_);
+    
+    while (from < limit) {
+        uint32_t index = from & mask_;
+        uint32_t bit = index & 63;
+        uint64_t word = present_[index >> 6] >> bit;
+        uint32_t span = std::min<uint32_t>(64 - bit, limit - from);
+        
+        if (word != 0) {
+            uint32_t offset = __builtin_ctzll(word);
+            if (offset < span) {
+                return from + offset;
+            }
+        }
+        from += span;
+    }
+    
+    return limit;
+}
+
+uint32_t PacketStream::next_missing(uint32_t from, uint32_t limit) const {
+    while (from < limit) {
+        if (from < base_ || from >= end_) {
+            return from;
+        }
         
-        // Update timestamp in header
-        FlowPacketHeader header = new_packet.header();
-        header.timestamp = timestamp;
-        new_packet.set_header(header);
+        uint32_t index = from & mask_;
+        uint32_t bit = index & 63;
+        uint64_t word = ~present_[index >> 6] >> bit;
+        uint32_t span = std::min<uint32_t>(64 - bit, limit - from);
         
-        packet = new_packet;
+        if (word != 0) {
+            uint32_t offset = __builtin_ctzll(word);
+            if (offset < span) {
+                return from + offset;
+            }
+        }
+        from += span;
+    }
+    
+    return limit;
+}
+
+uint32_t PacketStream::contiguous_from(uint32_t sequence) const {
+    if (sequence < base_ || sequence >= end_) {
+        return 0;
+    }
+    return next_missing(sequence, end_) - sequence;
+}
+
+bool PacketStream::reserve_span(uint32_t first, uint32_t last) {
+    uint32_t span = last - first;
+    if (span <= capacity()) {
+        return true;
+    }
+    
+    if (span <= max_capacity_) {
+        grow(span);
+        return true;
+    }
+    
+    // The window is at its limit: only forward progress may slide it
+    if (first < base_) {
+        return false;
+    }
+    
+    evict_below(last - max_capacity_);
+    if (count_ == 0) {
+        base_ = end_ = last - 1;
     }
+    grow(last - base_);
+    return true;
 }
 
-void PacketStream::cleanup_old_packets() {
-    auto now = std::chrono::high_resolution_clock::now();
-    uint64_t current_time = std::chrono::duration_cast<std::chrono::microseconds>(
-        now.time_since_epoch()).count();
+void PacketStream::grow(uint32_t span) {
+    uint32_t new_capacity = capacity();
+    while (new_capacity < span) {
+        new_capacity <<= 1;
+    }
+    if (new_capacity == capacity()) {
+        return;
+    }
     
-    // Remove packets older than 30 seconds
-    const uint64_t MAX_AGE_MICROSECONDS = 30000000;
+    std::vector<RawPacket> slots(new_capacity);
+    std::vector<uint64_t> present(new_capacity / 64, 0);
+    uint32_t new_mask = new_capacity - 1;
     
-    packets_.erase(
-        std::remove_if(packets_.begin(), packets_.end(),
-                      [current_time](const RawPacket& packet) {
-                          return (current_time - packet.header().timestamp) > MAX_AGE_MICROSECONDS;
-                      }),
-        packets_.end()
-    );
+    for_each_run([&](uint32_t first, uint32_t count) {
+        for (uint32_t seq = first; seq < first + count; ++seq) {
+            uint32_t index = seq & new_mask;
+            slots[index] = std::move(slots_[seq & mask_]);
+            present[index >> 6] |= uint64_t(1) << (index & 63);
+        }
+    });
+    
+    slots_.swap(slots);
+    present_.swap(present);
+    mask_ = new_mask;
+}
+
+void PacketStream::evict_below(uint32_t sequence) {
+    uint32_t stop = std::min(sequence, end_);
+    for (uint32_t seq = next_present(base_, stop); seq < stop; seq = next_present(seq + 1, stop)) {
+        clear_bit(seq);
+        slots_[seq & mask_] = RawPacket();
+        --count_;
+        ++dropped_;
+    }
+    
+    if (count_ == 0) {
+        base_ = end_ = sequence;
+    } else {
+        base_ = next_present(stop, end_);
+    }
 }
 
 } // namespace nerd
\ No newline at end of file
@@ -0,0 +1,234 @@
+#include "network/packet_buffer.h"
+#include <algorithm>
+#include <new>
+
+namespace nerd {
+
+// A block of slabs_per_arena slabs, released once every one of them is free
+struct PacketArena {
+    uint8_t* memory;
+    size_t free_slabs;          // Slabs of this arena on the shared free list
+    bool releasing;             // Picked by the trim in progress
+};
+
+namespace {
+
+const size_t SLAB_STRIDE = sizeof(PacketBuffer) + PACKET_BUFFER_SIZE;
+
+static_assert(SLAB_STRIDE % PACKET_BUFFER_ALIGN == 0, "slabs must stay cache aligned");
+
+// A thread's cache is refilled and drained this many slabs at a time, and
+// holds at most THREAD_CACHE_SLABS before handing a batch back
+const size_t CACHE_BATCH = 32;
+const size_t THREAD_CACHE_SLABS = 2 * CACHE_BATCH;
+
+// Arenas' worth of free slabs the shared list may hold before wholly free
+// arenas are released, and how many wholly free ones a trim keeps
+const size_t TRIM_HIGH_ARENAS = 8;
+const size_t TRIM_LOW_ARENAS = 2;
+
+} // namespace
+
+// Free slabs owned by one thread, all from the same pool
+struct PacketPool::ThreadCache {
+    PacketPool* pool;
+    PacketBuffer* head;
+    size_t count;
+
+    ThreadCache() : pool(nullptr), head(nullptr), count(0) {}
+    ~ThreadCache() {
+        if (pool && count != 0) {
+            pool->give_back(*this, count);
+        }
+    }
+};
+
+PacketPool::PacketPool(size_t slabs_per_arena)
+    : free_list_(nullptr), slabs_per_arena_(slabs_per_arena ? slabs_per_arena : 1),
+      total_slabs_(0), free_slabs_(0), empty_arenas_(0) {}
+
+PacketPool::~PacketPool() {
+    for (PacketArena* arena : arenas_) {
+        ::operator delete(arena->memory, std::align_val_t(PACKET_BUFFER_ALIGN));
+        delete arena;
+    }
+}
+
+PacketPool& PacketPool::instance() {
+    // Never destroyed: packets may still be released during static teardown
+    static PacketPool* pool = new PacketPool();
+    return *pool;
+}
+
+PacketPool::ThreadCache& PacketPool::thread_cache() {
+    thread_local ThreadCache cache;
+    return cache;
+}
+
+PacketRef PacketPool::allocate(size_t capacity) {
+    if (capacity > PACKET_BUFFER_SIZE) {
+        void* memory = ::operator new(sizeof(PacketBuffer) + capacity, std::align_val_t(PACKET_BUFFER_ALIGN));
+        PacketBuffer* buffer = new (memory) PacketBuffer();
+        buffer->refs.store(1, std::memory_order_relaxed);
+        buffer->capacity = static_cast<uint32_t>(capacity);
+        buffer->pool = nullptr;
+        buffer->arena = nullptr;
+        buffer->next_free = nullptr;
+        return PacketRef(buffer);
+    }
+
+    // An empty cache binds to whichever pool the thread uses next; a thread
+    // touching a second pool takes that pool's slabs one at a time
+    ThreadCache& cache = thread_cache();
+    if (cache.count == 0) {
+        cache.pool = this;
+        refill(cache);
+    }
+
+    PacketBuffer* buffer;
+    if (cache.pool == this) {
+        buffer = cache.head;
+        cache.head = buffer->next_free;
+        --cache.count;
+    } else {
+        std::lock_guard<std::mutex> lock(mutex_);
+        buffer = take_locked();
+    }
+
+    buffer->refs.store(1, std::memory_order_relaxed);
+    buffer->next_free = nullptr;
+    return PacketRef(buffer);
+}
+
+void PacketPool::recycle(PacketBuffer* buffer) {
+    ThreadCache& cache = thread_cache();
+    if (cache.count == 0) {
+        cache.pool = this;
+    }
+    if (cache.pool != this) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        put_locked(buffer);
+        return;
+    }
+
+    buffer->next_free = cache.head;
+    cache.head = buffer;
+    if (++cache.count > THREAD_CACHE_SLABS) {
+        give_back(cache, CACHE_BATCH);
+    }
+}
+
+size_t PacketPool::total_slabs() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return total_slabs_;
+}
+
+size_t PacketPool::free_slabs() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return free_slabs_;
+}
+
+PacketBuffer* PacketPool::take_locked() {
+    if (!free_list_) {
+        grow_locked();
+    }
+    PacketBuffer* buffer = free_list_;
+    free_list_ = buffer->next_free;
+    if (buffer->arena->free_slabs-- == slabs_per_arena_) {
+        --empty_arenas_;
+    }
+    --free_slabs_;
+    return buffer;
+}
+
+void PacketPool::put_locked(PacketBuffer* buffer) {
+    buffer->next_free = free_list_;
+    free_list_ = buffer;
+    if (++buffer->arena->free_slabs == slabs_per_arena_) {
+        ++empty_arenas_;
+    }
+    ++free_slabs_;
+}
+
+void PacketPool::refill(ThreadCache& cache) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (cache.count < CACHE_BATCH) {
+        PacketBuffer* buffer = take_locked();
+        buffer->next_free = cache.head;
+        cache.head = buffer;
+        ++cache.count;
+    }
+}
+
+void PacketPool::give_back(ThreadCache& cache, size_t count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < count && cache.head; ++i) {
+        PacketBuffer* buffer = cache.head;
+        cache.head = buffer->next_free;
+        --cache.count;
+        put_locked(buffer);
+    }
+    if (free_slabs_ > TRIM_HIGH_ARENAS * slabs_per_arena_ && empty_arenas_ > TRIM_LOW_ARENAS) {
+        trim_locked();
+    }
+}
+
+void PacketPool::grow_locked() {
+    uint8_t* memory = static_cast<uint8_t*>(
+        ::operator new(SLAB_STRIDE * slabs_per_arena_, std::align_val_t(PACKET_BUFFER_ALIGN)));
+    PacketArena* arena = new PacketArena{memory, slabs_per_arena_, false};
+    arenas_.push_back(arena);
+
+    for (size_t i = 0; i < slabs_per_arena_; ++i) {
+        PacketBuffer* buffer = new (memory + i * SLAB_STRIDE) PacketBuffer();
+        buffer->refs.store(0, std::memory_order_relaxed);
+        buffer->capacity = PACKET_BUFFER_SIZE;
+        buffer->pool = this;
+        buffer->arena = arena;
+        buffer->next_free = free_list_;
+        free_list_ = buffer;
+    }
+
+    total_slabs_ += slabs_per_arena_;
+    free_slabs_ += slabs_per_arena_;
+    ++empty_arenas_;
+}
+
+void PacketPool::trim_locked() {
+    // Only arenas with every slab back on the shared list can go, and only
+    // down to the low-water mark, so a burst that just ended is not refetched
+    size_t releasing = 0;
+    for (PacketArena* arena : arenas_) {
+        if (empty_arenas_ - releasing <= TRIM_LOW_ARENAS) {
+            break;
+        }
+        if (arena->free_slabs == slabs_per_arena_) {
+            arena->releasing = true;
+            ++releasing;
+        }
+    }
+
+    PacketBuffer** link = &free_list_;
+    while (*link) {
+        if ((*link)->arena->releasing) {
+            *link = (*link)->next_free;
+        } else {
+            link = &(*link)->next_free;
+        }
+    }
+
+    auto kept = std::remove_if(arenas_.begin(), arenas_.end(), [](PacketArena* arena) {
+        if (!arena->releasing) {
+            return false;
+        }
+        ::operator delete(arena->memory, std::align_val_t(PACKET_BUFFER_ALIGN));
+        delete arena;
+        return true;
+    });
+    arenas_.erase(kept, arenas_.end());
+    total_slabs_ -= releasing * slabs_per_arena_;
+    free_slabs_ -= releasing * slabs_per_arena_;
+    empty_arenas_ -= releasing;
+}
+
+} // namespace nerd
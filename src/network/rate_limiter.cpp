@@ -0,0 +1,72 @@
+#include "network/rate_limiter.h"
+#include <algorithm>
+#include <cmath>
+
+namespace nerd {
+
+RateLimiter::RateLimiter()
+    : packet_tokens_(0), byte_tokens_(0), refilled_us_(0), enabled_(false), deferred_(0) {}
+
+void RateLimiter::configure(const TransmitLimits& limits, uint64_t now_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    limits_ = limits;
+    packet_tokens_ = limits.max_packets_per_second * (BURST_US / 1e6);
+    byte_tokens_ = limits.max_bytes_per_second * (BURST_US / 1e6);
+    refilled_us_ = now_us;
+    enabled_.store(limits.max_packets_per_second != 0 || limits.max_bytes_per_second != 0,
+                   std::memory_order_relaxed);
+}
+
+TransmitLimits RateLimiter::limits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return limits_;
+}
+
+void RateLimiter::refill(uint64_t now_us) {
+    if (now_us <= refilled_us_) {
+        return;
+    }
+    double elapsed = (now_us - refilled_us_) / 1e6;
+    refilled_us_ = now_us;
+    
+    // At least one frame of credit, so a cap below the burst still lets frames through
+    double packet_cap = std::max(1.0, limits_.max_packets_per_second * (BURST_US / 1e6));
+    double byte_cap = std::max(2048.0, limits_.max_bytes_per_second * (BURST_US / 1e6));
+    packet_tokens_ = std::min(packet_cap, packet_tokens_ + elapsed * limits_.max_packets_per_second);
+    byte_tokens_ = std::min(byte_cap, byte_tokens_ + elapsed * limits_.max_bytes_per_second);
+}
+
+uint64_t RateLimiter::reserve(size_t bytes, uint64_t now_us) {
+    if (!limited()) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    refill(now_us);
+    packet_tokens_ -= 1;
+    byte_tokens_ -= static_cast<double>(bytes);
+    
+    // The frame may go once the buckets are back out of the debt it left
+    double wait = 0;
+    if (limits_.max_packets_per_second != 0 && packet_tokens_ < 0) {
+        wait = std::max(wait, -packet_tokens_ / limits_.max_packets_per_second);
+    }
+    if (limits_.max_bytes_per_second != 0 && byte_tokens_ < 0) {
+        wait = std::max(wait, -byte_tokens_ / limits_.max_bytes_per_second);
+    }
+    if (wait <= 0) {
+        return 0;
+    }
+    deferred_.fetch_add(1, std::memory_order_relaxed);
+    return std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(wait * 1e6)));
+}
+
+void RateLimiter::refund(uint32_t packets, size_t bytes) {
+    if (!limited()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    packet_tokens_ += packets;
+    byte_tokens_ += static_cast<double>(bytes);
+}
+
+} // namespace nerd
@@ -0,0 +1,312 @@
+#include "network/rx_ring.h"
+#include "network/packet.h"
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <linux/filter.h>
+#include <net/ethernet.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+namespace nerd {
+
+namespace {
+
+// Receive stamps further in the past than this are treated as clock
+// disagreement, not queueing, so a stepped clock cannot age a block of frames
+const uint64_t MAX_RECEIVE_DELAY_US = 1000000;
+
+uint64_t realtime_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+}
+
+} // namespace
+
+RxRing::RxRing() : socket_(-1), ring_(nullptr), ring_size_(0), current_block_(0), hardware_timestamps_(false),
+      restore_hwtstamp_(false), hwtstamp_ifindex_(0), saved_hwtstamp_(), fanout_group_(0), kernel_drops_(0) {}
+
+RxRing::~RxRing() {
+    close();
+}
+
+bool RxRing::open(int ifindex, const RxRingConfig& config) {
+    close();
+    config_ = config;
+
+    socket_ = socket(AF_PACKET, SOCK_RAW, htons(FLOW_ETHERTYPE));
+    if (socket_ < 0) {
+        std::cerr << "Failed to create receive socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Filter before the ring is mapped so no foreign frame is ever queued
+    if (!attach_filter()) {
+        close();
+        return false;
+    }
+
+    if (config_.hardware_timestamps) {
+        enable_timestamps(ifindex);
+    }
+
+    int version = TPACKET_V3;
+    if (setsockopt(socket_, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        std::cerr << "Failed to select TPACKET_V3: " << strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+
+    struct tpacket_req3 req;
+    std::memset(&req, 0, sizeof(req));
+    req.tp_block_size = config_.block_size;
+    req.tp_block_nr = config_.block_count;
+    req.tp_frame_size = config_.frame_size;
+    req.tp_frame_nr = (config_.block_size / config_.frame_size) * config_.block_count;
+    req.tp_retire_blk_tov = config_.retire_timeout_ms;
+
+    if (setsockopt(socket_, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        std::cerr << "Failed to allocate receive ring: " << strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+
+    ring_size_ = static_cast<size_t>(config_.block_size) * config_.block_count;
+    void* map = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, socket_, 0);
+    if (map == MAP_FAILED) {
+        // MAP_LOCKED needs RLIMIT_MEMLOCK headroom; fall back to pageable memory
+        map = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED, socket_, 0);
+    }
+    if (map == MAP_FAILED) {
+        std::cerr << "Failed to map receive ring: " << strerror(errno) << std::endl;
+        ring_size_ = 0;
+        close();
+        return false;
+    }
+    ring_ = static_cast<uint8_t*>(map);
+    current_block_ = 0;
+
+    struct sockaddr_ll addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(FLOW_ETHERTYPE);
+    addr.sll_ifindex = ifindex;
+
+    if (bind(socket_, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        std::cerr << "Failed to bind receive socket: " << strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+
+    if (config_.fanout && !join_fanout()) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void RxRing::close() {
+    if (ring_) {
+        munmap(ring_, ring_size_);
+        ring_ = nullptr;
+        ring_size_ = 0;
+    }
+    if (socket_ >= 0) {
+        if (restore_hwtstamp_) {
+            struct ifreq ifr;
+            std::memset(&ifr, 0, sizeof(ifr));
+            if (if_indextoname(hwtstamp_ifindex_, ifr.ifr_name)) {
+                ifr.ifr_data = reinterpret_cast<char*>(&saved_hwtstamp_);
+                ioctl(socket_, SIOCSHWTSTAMP, &ifr);
+            }
+            restore_hwtstamp_ = false;
+        }
+        ::close(socket_);
+        socket_ = -1;
+    }
+    hardware_timestamps_ = false;
+    fanout_group_ = 0;
+}
+
+uint64_t RxRing::kernel_drops() {
+    struct tpacket_stats_v3 stats;
+    socklen_t length = sizeof(stats);
+    if (socket_ >= 0 && getsockopt(socket_, SOL_PACKET, PACKET_STATISTICS, &stats, &length) == 0) {
+        kernel_drops_.fetch_add(stats.tp_drops, std::memory_order_relaxed);
+    }
+    return kernel_drops_.load(std::memory_order_relaxed);
+}
+
+size_t RxRing::poll(int timeout_ms, const FrameHandler& handler) {
+    if (!ring_) {
+        return 0;
+    }
+
+    tpacket_block_desc* block = block_at(current_block_);
+    if (!(block->hdr.bh1.block_status & TP_STATUS_USER)) {
+        struct pollfd pfd;
+        pfd.fd = socket_;
+        pfd.events = POLLIN | POLLERR;
+        pfd.revents = 0;
+        if (::poll(&pfd, 1, timeout_ms) <= 0) {
+            return 0;
+        }
+    }
+
+    // Drain every block the kernel has retired so far
+    size_t delivered = 0;
+    for (uint32_t i = 0; i < config_.block_count; ++i) {
+        block = block_at(current_block_);
+        if (!(block->hdr.bh1.block_status & TP_STATUS_USER)) {
+            break;
+        }
+
+        delivered += process_block(block, handler);
+
+        // Return the block to the kernel
+        __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        current_block_ = (current_block_ + 1) % config_.block_count;
+    }
+
+    return delivered;
+}
+
+size_t RxRing::process_block(tpacket_block_desc* block, const FrameHandler& handler) {
+    uint8_t* base = reinterpret_cast<uint8_t*>(block);
+    uint32_t count = block->hdr.bh1.num_pkts;
+    auto* frame = reinterpret_cast<tpacket3_hdr*>(base + block->hdr.bh1.offset_to_first_pkt);
+    size_t delivered = 0;
+    
+    // Both clocks are read once per block
+    uint64_t wall_ns = realtime_ns();
+    uint64_t local_us = packet_timestamp_now();
+
+    for (uint32_t i = 0; i < count; ++i) {
+        auto* sll = reinterpret_cast<const sockaddr_ll*>(
+            reinterpret_cast<uint8_t*>(frame) + TPACKET_ALIGN(sizeof(tpacket3_hdr)));
+
+        // Our own transmissions are looped back to packet sockets; skip them
+        if (sll->sll_pkttype != PACKET_OUTGOING && frame->tp_snaplen > sizeof(struct ether_header)) {
+            const uint8_t* mac = reinterpret_cast<const uint8_t*>(frame) + frame->tp_mac;
+            uint64_t stamp_ns = static_cast<uint64_t>(frame->tp_sec) * 1000000000ULL + frame->tp_nsec;
+            uint64_t delay_us = stamp_ns < wall_ns ? std::min((wall_ns - stamp_ns) / 1000, MAX_RECEIVE_DELAY_US) : 0;
+            handler(mac + sizeof(struct ether_header), frame->tp_snaplen - sizeof(struct ether_header), local_us - delay_us);
+            ++delivered;
+        }
+
+        frame = reinterpret_cast<tpacket3_hdr*>(reinterpret_cast<uint8_t*>(frame) + frame->tp_next_offset);
+    }
+
+    return delivered;
+}
+
+tpacket_block_desc* RxRing::block_at(uint32_t index) const {
+    return reinterpret_cast<tpacket_block_desc*>(ring_ + static_cast<size_t>(index) * config_.block_size);
+}
+
+void RxRing::enable_timestamps(int ifindex) {
+    // The NIC's stamping is interface-wide and may belong to a PTP daemon:
+    // whatever filter it already runs is kept, and only a NIC stamping
+    // nothing is widened to every frame. Drivers without support (or a
+    // caller without CAP_NET_ADMIN) leave the kernel's software stamp.
+    struct ifreq ifr;
+    std::memset(&ifr, 0, sizeof(ifr));
+    if (!if_indextoname(ifindex, ifr.ifr_name)) {
+        return;
+    }
+    struct hwtstamp_config current;
+    std::memset(&current, 0, sizeof(current));
+    ifr.ifr_data = reinterpret_cast<char*>(&current);
+    if (ioctl(socket_, SIOCGHWTSTAMP, &ifr) < 0) {
+        return;
+    }
+    if (current.rx_filter == HWTSTAMP_FILTER_NONE) {
+        struct hwtstamp_config widened = current;
+        widened.rx_filter = HWTSTAMP_FILTER_ALL;
+        ifr.ifr_data = reinterpret_cast<char*>(&widened);
+        if (ioctl(socket_, SIOCSHWTSTAMP, &ifr) < 0 || widened.rx_filter == HWTSTAMP_FILTER_NONE) {
+            return;
+        }
+        saved_hwtstamp_ = current;
+        hwtstamp_ifindex_ = ifindex;
+        restore_hwtstamp_ = true;
+    }
+
+    int flags = SOF_TIMESTAMPING_RAW_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE |
+                SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE;
+    hardware_timestamps_ = setsockopt(socket_, SOL_PACKET, PACKET_TIMESTAMP, &flags, sizeof(flags)) == 0;
+}
+
+bool RxRing::attach_filter() {
+    // Classic BPF loads words in network byte order, while the flow header is
+    // little-endian on the wire, so compare against the byte-swapped magic.
+    const uint32_t magic_on_wire = __builtin_bswap32(FLOW_MAGIC);
+
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),                              // ethertype
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, FLOW_ETHERTYPE, 0, 3),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, sizeof(struct ether_header)),    // FlowPacketHeader::magic
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, magic_on_wire, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0xFFFF),                                  // accept whole frame
+        BPF_STMT(BPF_RET | BPF_K, 0),                                       // drop
+    };
+
+    struct sock_fprog program;
+    program.len = sizeof(code) / sizeof(code[0]);
+    program.filter = code;
+
+    if (setsockopt(socket_, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) < 0) {
+        std::cerr << "Failed to attach flow filter: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool RxRing::join_fanout() {
+    // The first ring has the kernel pick an id no other process is using, so
+    // two nodes on one host never split each other's frames
+    uint32_t flags = config_.fanout_group == 0 ? PACKET_FANOUT_FLAG_UNIQUEID : 0;
+    int arg = static_cast<int>(config_.fanout_group | ((config_.fanout_type | flags) << 16));
+    if (setsockopt(socket_, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0) {
+        std::cerr << "Failed to join fanout group: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    socklen_t length = sizeof(arg);
+    if (getsockopt(socket_, SOL_PACKET, PACKET_FANOUT, &arg, &length) < 0) {
+        std::cerr << "Failed to read fanout group: " << strerror(errno) << std::endl;
+        return false;
+    }
+    fanout_group_ = static_cast<uint16_t>(arg & 0xFFFF);
+
+    // The group's program returns the low word of the flow ID; the kernel
+    // takes it modulo the ring count, so a flow stays on one ring
+    if (config_.fanout_type == PACKET_FANOUT_CBPF && flags) {
+        struct sock_filter code[] = {
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, sizeof(struct ether_header) + offsetof(FlowPacketHeader, flow_id)),
+            BPF_STMT(BPF_RET | BPF_A, 0),
+        };
+        struct sock_fprog program;
+        program.len = sizeof(code) / sizeof(code[0]);
+        program.filter = code;
+        if (setsockopt(socket_, SOL_PACKET, PACKET_FANOUT_DATA, &program, sizeof(program)) < 0) {
+            std::cerr << "Failed to attach fanout program: " << strerror(errno) << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace nerd
\ No newline at end of file
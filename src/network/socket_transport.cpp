@@ -0,0 +1,93 @@
+#include "network/socket_transport.h"
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+namespace nerd {
+
+PacketSocketTransport::PacketSocketTransport()
+    : socket_(-1), rx_ring_(std::make_unique<RxRing>()), tx_queue_(std::make_unique<TxQueue>()) {}
+
+PacketSocketTransport::~PacketSocketTransport() {
+    close();
+}
+
+bool PacketSocketTransport::open(const std::string& interface, const TxQueueConfig& config,
+                                 const RxRingConfig& rx_config) {
+    // Create raw socket; protocol 0 keeps it transmit-only, receive goes through rx_ring_
+    socket_ = socket(AF_PACKET, SOCK_RAW, 0);
+    if (socket_ < 0) {
+        std::cerr << "Failed to create raw socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Get interface index
+    struct ifreq ifr;
+    std::memset(&ifr, 0, sizeof(ifr));
+    std::strncpy(ifr.ifr_name, interface.c_str(), IFNAMSIZ - 1);
+
+    if (ioctl(socket_, SIOCGIFINDEX, &ifr) < 0) {
+        std::cerr << "Failed to get interface index: " << strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+
+    // Bind socket to interface
+    struct sockaddr_ll addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = 0;
+    addr.sll_ifindex = ifr.ifr_ifindex;
+
+    if (bind(socket_, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        std::cerr << "Failed to bind socket: " << strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+
+    // Batch transmissions on socket_, sent from the interface's own address
+    // so each frame can be traced to its node
+    int ifindex = ifr.ifr_ifindex;
+    tx_queue_->open(socket_, config);
+    if (ioctl(socket_, SIOCGIFHWADDR, &ifr) == 0) {
+        tx_queue_->set_source_address(reinterpret_cast<const uint8_t*>(ifr.ifr_hwaddr.sa_data));
+    }
+
+    // Receive through a dedicated mmap ring
+    if (!rx_ring_->open(ifindex, rx_config)) {
+        std::cerr << "Receive ring unavailable on " << interface << ", running transmit-only" << std::endl;
+    } else if (rx_ring_->hardware_timestamps()) {
+        std::cout << "Hardware receive timestamps enabled on " << interface << std::endl;
+    }
+    return true;
+}
+
+void PacketSocketTransport::close() {
+    rx_ring_->close();
+    tx_queue_->close();
+
+    if (socket_ >= 0) {
+        ::close(socket_);
+        socket_ = -1;
+    }
+}
+
+bool PacketSocketTransport::send(const RawPacket& packet) {
+    // Serialized in place into a transmit slot and flushed in batches
+    return tx_queue_->enqueue(packet);
+}
+
+void PacketSocketTransport::flush() {
+    tx_queue_->flush();
+}
+
+size_t PacketSocketTransport::poll(int timeout_ms, const FrameHandler& handler) {
+    return rx_ring_->poll(timeout_ms, handler);
+}
+
+} // namespace nerd
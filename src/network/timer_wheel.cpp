@@ -0,0 +1,127 @@
+#include "network/timer_wheel.h"
+#include <algorithm>
+
+namespace nerd {
+
+TimerWheel::TimerWheel(uint64_t tick_us) : tick_us_(tick_us ? tick_us : 1), current_tick_(0), size_(0) {}
+
+void TimerWheel::reset(uint64_t now_us) {
+    current_tick_ = to_tick(now_us);
+}
+
+void TimerWheel::schedule(const TimerEvent& event) {
+    ++size_;
+    place(event);
+}
+
+void TimerWheel::place(const TimerEvent& event) {
+    // Rounded up, so an event never fires before its deadline
+    uint64_t deadline = std::max(deadline_tick(event.deadline), current_tick_);
+
+    // Lowest level whose parent window also holds the current tick
+    for (uint32_t level = 0; level < LEVELS; ++level) {
+        uint32_t parent_shift = SLOT_BITS * (level + 1);
+        if (((deadline ^ current_tick_) >> parent_shift) == 0) {
+            uint32_t slot = (deadline >> (SLOT_BITS * level)) & (SLOTS - 1);
+            wheel_[level][slot].push_back(event);
+            return;
+        }
+    }
+
+    overflow_.push_back(event);
+}
+
+void TimerWheel::advance(uint64_t now_us, std::vector<TimerEvent>& due) {
+    uint64_t target = to_tick(now_us);
+
+    if (size_ == 0) {
+        // Nothing pending: jump instead of walking idle ticks
+        current_tick_ = std::max(current_tick_, target);
+        return;
+    }
+
+    // Events already due in the current slot
+    if (target >= current_tick_) {
+        auto& bucket = wheel_[0][current_tick_ & (SLOTS - 1)];
+        if (!bucket.empty()) {
+            std::vector<TimerEvent> events;
+            events.swap(bucket);
+            for (const auto& event : events) {
+                if (deadline_tick(event.deadline) <= current_tick_) {
+                    due.push_back(event);
+                    --size_;
+                } else {
+                    place(event);
+                }
+            }
+        }
+    }
+
+    while (current_tick_ < target && size_ > 0) {
+        tick(due);
+    }
+    current_tick_ = std::max(current_tick_, target);
+}
+
+void TimerWheel::tick(std::vector<TimerEvent>& due) {
+    ++current_tick_;
+
+    // Find the highest level whose slot boundary we just crossed
+    uint32_t top = 0;
+    while (top + 1 < LEVELS && (current_tick_ & ((uint64_t(1) << (SLOT_BITS * (top + 1))) - 1)) == 0) {
+        ++top;
+    }
+
+    if (top + 1 == LEVELS && (current_tick_ & ((uint64_t(1) << (SLOT_BITS * LEVELS)) - 1)) == 0) {
+        std::vector<TimerEvent> events;
+        events.swap(overflow_);
+        for (const auto& event : events) {
+            place(event);
+        }
+    }
+
+    // Cascade from the coarsest level down so events settle in one pass
+    for (uint32_t level = top; level >= 1; --level) {
+        auto& bucket = wheel_[level][(current_tick_ >> (SLOT_BITS * level)) & (SLOTS - 1)];
+        if (bucket.empty()) {
+            continue;
+        }
+        std::vector<TimerEvent> events;
+        events.swap(bucket);
+        for (const auto& event : events) {
+            place(event);
+        }
+    }
+
+    auto& bucket = wheel_[0][current_tick_ & (SLOTS - 1)];
+    if (bucket.empty()) {
+        return;
+    }
+
+    std::vector<TimerEvent> events;
+    events.swap(bucket);
+    for (const auto& event : events) {
+        due.push_back(event);
+        --size_;
+    }
+}
+
+uint64_t TimerWheel::next_wakeup(uint64_t limit_us) const {
+    uint64_t limit = to_tick(limit_us);
+    if (size_ == 0) {
+        return limit_us;
+    }
+
+    // Next occupied level-0 slot within the current level-0 window
+    uint64_t window_end = (current_tick_ | (SLOTS - 1)) + 1;
+    for (uint64_t t = current_tick_; t < window_end && t <= limit; ++t) {
+        if (!wheel_[0][t & (SLOTS - 1)].empty()) {
+            return t * tick_us_;
+        }
+    }
+
+    // Otherwise wake at the next cascade boundary
+    return std::min(limit, window_end) * tick_us_;
+}
+
+} // namespace nerd
\ No newline at end of file
@@ -0,0 +1,301 @@
+#include "network/transport.h"
+#include "network/socket_transport.h"
+#include "network/udp_transport.h"
+#include "network/xdp_transport.h"
+#include <dirent.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+namespace nerd {
+
+namespace {
+
+// Receive queues the NIC exposes; 1 where sysfs does not say
+uint32_t nic_queue_count(const std::string& interface) {
+    uint32_t count = 0;
+    if (DIR* dir = opendir(("/sys/class/net/" + interface + "/queues").c_str())) {
+        while (struct dirent* entry = readdir(dir)) {
+            if (std::strncmp(entry->d_name, "rx-", 3) == 0) {
+                ++count;
+            }
+        }
+        closedir(dir);
+    }
+    return std::max(count, 1u);
+}
+
+// "0-3,8,10-11" as a list of CPUs
+std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        char* end = nullptr;
+        long first = std::strtol(range.c_str(), &end, 10);
+        if (end == range.c_str()) {
+            continue;
+        }
+        long last = *end == '-' ? std::strtol(end + 1, nullptr, 10) : first;
+        for (long cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+    }
+    return cpus;
+}
+
+std::string read_line(const std::string& path) {
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+// Receive vectors of the interface in /proc/interrupts order: named after
+// the interface ("eth0-TxRx-3", "eth0-rx-3") or, for drivers naming them
+// after the device, completion vectors on its PCI address ("mlx5_comp3@pci:...")
+std::vector<int> receive_irqs(const std::string& interface) {
+    char link[256];
+    ssize_t length = readlink(("/sys/class/net/" + interface + "/device").c_str(), link, sizeof(link) - 1);
+    std::string pci;
+    if (length > 0) {
+        link[length] = '\0';
+        pci = std::string("@pci:") + (std::strrchr(link, '/') ? std::strrchr(link, '/') + 1 : link);
+    }
+
+    std::vector<int> irqs;
+    std::ifstream interrupts("/proc/interrupts");
+    std::string line;
+    while (std::getline(interrupts, line)) {
+        std::stringstream fields(line);
+        std::string irq;
+        std::string name;
+        fields >> irq;
+        for (std::string field; fields >> field;) {
+            name = field;
+        }
+        std::string lower = name;
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+        bool named = name.compare(0, interface.size() + 1, interface + "-") == 0 &&
+                     !(lower.find("tx") != std::string::npos && lower.find("rx") == std::string::npos);
+        bool completion = !pci.empty() && lower.find("comp") != std::string::npos &&
+                          name.size() > pci.size() && name.compare(name.size() - pci.size(), pci.size(), pci) == 0;
+        if ((named || completion) && !irq.empty() && std::isdigit(static_cast<unsigned char>(irq[0]))) {
+            irqs.push_back(std::atoi(irq.c_str()));
+        }
+    }
+    return irqs;
+}
+
+// CPU each of count queues from first should be served on: the one its
+// interrupt is routed to, else round robin over the NIC's NUMA-local CPUs,
+// else -1
+std::vector<int> queue_cpus(const std::string& interface, uint32_t first, uint32_t count) {
+    std::vector<int> irqs = receive_irqs(interface);
+    std::vector<int> local = parse_cpu_list(read_line("/sys/class/net/" + interface + "/device/local_cpulist"));
+    std::vector<int> cpus;
+    for (uint32_t queue = first; queue < first + count; ++queue) {
+        int cpu = -1;
+        if (queue < irqs.size()) {
+            std::string irq = "/proc/irq/" + std::to_string(irqs[queue]);
+            std::vector<int> affinity = parse_cpu_list(read_line(irq + "/effective_affinity_list"));
+            if (affinity.empty()) {
+                affinity = parse_cpu_list(read_line(irq + "/smp_affinity_list"));
+            }
+            if (!affinity.empty()) {
+                cpu = affinity.front();
+            }
+        }
+        if (cpu < 0 && !local.empty()) {
+            cpu = local[(queue - first) % local.size()];
+        }
+        cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+} // namespace
+
+bool parse_transport_kind(const std::string& name, TransportKind& kind) {
+    if (name == "packet") {
+        kind = TransportKind::PACKET;
+    } else if (name == "xdp") {
+        kind = TransportKind::XDP;
+    } else if (name == "udp") {
+        kind = TransportKind::UDP_MULTICAST;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* transport_kind_name(TransportKind kind) {
+    switch (kind) {
+        case TransportKind::PACKET:
+            return "packet";
+        case TransportKind::XDP:
+            return "xdp";
+        case TransportKind::UDP_MULTICAST:
+            return "udp";
+    }
+    return "unknown";
+}
+
+bool parse_fanout_mode(const std::string& name, FanoutMode& mode) {
+    if (name == "hash") {
+        mode = FanoutMode::HASH;
+    } else if (name == "cpu") {
+        mode = FanoutMode::CPU;
+    } else if (name == "queue") {
+        mode = FanoutMode::QUEUE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::vector<std::unique_ptr<Transport>> open_transports(const std::string& interface, const TransportConfig& config,
+                                                        const TxQueueConfig& tx_config) {
+    std::vector<std::unique_ptr<Transport>> transports;
+    if (config.kind == TransportKind::UDP_MULTICAST) {
+        // No fallback: raw frames would not reach peers past the first router.
+        // Every socket on the group gets every datagram, so one is enough.
+        auto udp = std::make_unique<UdpMulticastTransport>();
+        if (udp->open(interface, config.multicast_group, config.multicast_ttl)) {
+            transports.push_back(std::move(udp));
+        }
+        return transports;
+    }
+
+    // One ring or socket per queue, so the count is capped before anything is sized by it
+    uint32_t queues = std::min(config.queues != 0 ? config.queues : nic_queue_count(interface), MAX_QUEUES);
+    if (config.kind == TransportKind::XDP) {
+        // One program for the interface, one socket per queue
+        auto program = std::make_shared<XdpProgram>();
+        bool zero_copy = false;
+        int ifindex = static_cast<int>(if_nametoindex(interface.c_str()));
+        
+        // The socket map is sized by the highest queue, which stays below MAX_QUEUES
+        uint32_t xdp_queues = config.xdp_queue < MAX_QUEUES ? std::min(queues, MAX_QUEUES - config.xdp_queue) : 0;
+        if (ifindex != 0 && xdp_queues != 0 && program->attach(ifindex, config.xdp_queue + xdp_queues)) {
+            std::vector<int> cpus = queue_cpus(interface, config.xdp_queue, xdp_queues);
+            for (uint32_t i = 0; i < xdp_queues; ++i) {
+                auto xdp = std::make_unique<XdpTransport>();
+                if (!xdp->open(interface, config.xdp_queue + i, program)) {
+                    break;
+                }
+                zero_copy = xdp->zero_copy();
+                xdp->set_receive_cpu(cpus[i]);
+                transports.push_back(std::move(xdp));
+            }
+        }
+        if (!transports.empty()) {
+            std::cout << "AF_XDP on " << interface;
+            if (transports.size() > 1) {
+                std::cout << " queues " << config.xdp_queue << "-" << config.xdp_queue + transports.size() - 1;
+            } else {
+                std::cout << " queue " << config.xdp_queue;
+            }
+            std::cout << (zero_copy ? " (zero-copy)" : " (copy mode)") << std::endl;
+            return transports;
+        }
+        std::cerr << "AF_XDP unavailable on " << interface << ", falling back to AF_PACKET" << std::endl;
+    }
+
+    // Several rings share the interface's frames through one fanout group
+    RxRingConfig rx_config;
+    rx_config.hardware_timestamps = config.hardware_timestamps;
+    std::vector<int> cpus;
+    if (queues > 1) {
+        rx_config.fanout = true;
+        switch (config.fanout) {
+            case FanoutMode::HASH:
+                rx_config.fanout_type = PACKET_FANOUT_CBPF;
+                break;
+            case FanoutMode::CPU:
+                rx_config.fanout_type = PACKET_FANOUT_CPU;
+                break;
+            case FanoutMode::QUEUE:
+                rx_config.fanout_type = PACKET_FANOUT_QM;
+                break;
+        }
+    }
+    if (config.fanout == FanoutMode::CPU) {
+        // Ring i takes what CPUs i, i + queues, ... take in
+        unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        for (uint32_t i = 0; i < queues; ++i) {
+            cpus.push_back(i < cores ? static_cast<int>(i) : -1);
+        }
+    } else {
+        cpus = queue_cpus(interface, 0, queues);
+    }
+
+    for (uint32_t i = 0; i < queues; ++i) {
+        auto packet = std::make_unique<PacketSocketTransport>();
+        if (!packet->open(interface, tx_config, rx_config)) {
+            break;
+        }
+        rx_config.fanout_group = packet->fanout_group();
+        bool receiving = packet->can_receive();
+        packet->set_receive_cpu(cpus[i]);
+        transports.push_back(std::move(packet));
+        if (!receiving) {
+            break;
+        }
+    }
+    if (transports.size() > 1) {
+        std::cout << "Receiving on " << interface << " through " << transports.size() << " fanout queues" << std::endl;
+    }
+    return transports;
+}
+
+FlushTimer::FlushTimer(uint32_t max_latency_us, std::function<void()> flush)
+    : max_latency_us_(max_latency_us), flush_(std::move(flush)), armed_(false), running_(true) {
+    thread_ = std::thread(&FlushTimer::worker, this);
+}
+
+FlushTimer::~FlushTimer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cv_.notify_one();
+    thread_.join();
+}
+
+void FlushTimer::arm() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!armed_) {
+        armed_ = true;
+        deadline_ = std::chrono::steady_clock::now() + std::chrono::microseconds(max_latency_us_);
+        cv_.notify_one();
+    }
+}
+
+void FlushTimer::worker() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+        if (!armed_) {
+            cv_.wait(lock);
+            continue;
+        }
+        cv_.wait_until(lock, deadline_);
+        if (armed_ && std::chrono::steady_clock::now() >= deadline_) {
+            // Unlocked, so a sender holding its own lock can still arm meanwhile
+            armed_ = false;
+            lock.unlock();
+            flush_();
+            lock.lock();
+        }
+    }
+}
+
+} // namespace nerd
@@ -0,0 +1,292 @@
+#include "network/tx_queue.h"
+#include "core/log.h"
+#include <sys/mman.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+namespace nerd {
+
+namespace {
+
+// TX ring blocks hold a whole number of frames
+const uint32_t TX_RING_BLOCK_SIZE = 1 << 16;
+
+// Offset of frame data inside a TPACKET_V2 slot
+const size_t TX_RING_DATA_OFFSET = TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+
+} // namespace
+
+TxQueue::TxQueue()
+    : socket_(-1), ring_(nullptr), ring_size_(0), ring_head_(0), pending_(0),
+      running_(false), frames_sent_(0), frames_dropped_(0), flush_count_(0) {
+    std::memset(source_, 0, sizeof(source_));
+}
+
+TxQueue::~TxQueue() {
+    close();
+}
+
+bool TxQueue::open(int socket, const TxQueueConfig& config) {
+    close();
+    socket_ = socket;
+    config_ = config;
+    pending_ = 0;
+
+    if (config_.flush_threshold == 0) {
+        config_.flush_threshold = 1;
+    }
+
+    if (!(config_.use_tx_ring && setup_tx_ring())) {
+        // Header staging slots for sendmmsg; payloads are gathered from the pool
+        staging_.assign(PACKET_HEADROOM * config_.frame_count, 0);
+        messages_.assign(config_.frame_count, mmsghdr());
+        iovecs_.assign(2 * static_cast<size_t>(config_.frame_count), iovec());
+        pending_payloads_.assign(config_.frame_count, PacketRef());
+        for (uint32_t i = 0; i < config_.frame_count; ++i) {
+            iovecs_[2 * i].iov_base = staging_.data() + static_cast<size_t>(i) * PACKET_HEADROOM;
+            messages_[i].msg_hdr.msg_iov = &iovecs_[2 * i];
+            messages_[i].msg_hdr.msg_iovlen = 2;
+        }
+    }
+
+    running_ = true;
+    flush_thread_ = std::thread(&TxQueue::flush_worker, this);
+    return true;
+}
+
+void TxQueue::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (socket_ >= 0) {
+            flush_locked();
+        }
+        running_ = false;
+    }
+    flush_cv_.notify_all();
+    if (flush_thread_.joinable()) {
+        flush_thread_.join();
+    }
+
+    if (ring_) {
+        munmap(ring_, ring_size_);
+        ring_ = nullptr;
+        ring_size_ = 0;
+    }
+    staging_.clear();
+    messages_.clear();
+    iovecs_.clear();
+    pending_payloads_.clear();
+
+    // The socket itself belongs to the caller
+    socket_ = -1;
+}
+
+bool TxQueue::enqueue(const RawPacket& packet) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (socket_ < 0) {
+        return false;
+    }
+
+    uint8_t* slot = acquire_slot();
+    if (!slot) {
+        return false;
+    }
+
+    size_t link = write_link_header(slot);
+
+    if (ring_) {
+        size_t capacity = config_.frame_size - TX_RING_DATA_OFFSET - link;
+        size_t length = packet.serialize_into(slot + link, capacity);
+        if (length == 0) {
+            return false;
+        }
+
+        auto* hdr = reinterpret_cast<tpacket2_hdr*>(ring_ + static_cast<size_t>(ring_head_) * config_.frame_size);
+        hdr->tp_len = link + length;
+        __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+        ring_head_ = (ring_head_ + 1) % config_.frame_count;
+    } else {
+        size_t header = packet.serialize_header_into(slot + link, PACKET_HEADROOM - link);
+        if (header == 0) {
+            return false;
+        }
+
+        // Gather the payload from its slab; the reference keeps it alive until flushed
+        iovec* iov = &iovecs_[2 * static_cast<size_t>(pending_)];
+        iov[0].iov_len = link + header;
+        iov[1].iov_base = const_cast<uint8_t*>(packet.payload());
+        iov[1].iov_len = packet.payload_size();
+        pending_payloads_[pending_] = packet.buffer();
+    }
+
+    if (pending_++ == 0) {
+        oldest_pending_ = std::chrono::steady_clock::now();
+        flush_cv_.notify_one();
+    }
+
+    if (pending_ >= config_.flush_threshold) {
+        flush_locked();
+    }
+
+    return true;
+}
+
+void TxQueue::flush() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    flush_locked();
+}
+
+bool TxQueue::setup_tx_ring() {
+    int version = TPACKET_V2;
+    if (setsockopt(socket_, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        return false;
+    }
+
+    uint32_t frames_per_block = TX_RING_BLOCK_SIZE / config_.frame_size;
+    if (frames_per_block == 0) {
+        return false;
+    }
+    uint32_t block_count = (config_.frame_count + frames_per_block - 1) / frames_per_block;
+
+    struct tpacket_req req;
+    std::memset(&req, 0, sizeof(req));
+    req.tp_block_size = TX_RING_BLOCK_SIZE;
+    req.tp_block_nr = block_count;
+    req.tp_frame_size = config_.frame_size;
+    req.tp_frame_nr = block_count * frames_per_block;
+
+    if (setsockopt(socket_, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+        std::cerr << "PACKET_TX_RING unavailable, using sendmmsg: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    ring_size_ = static_cast<size_t>(TX_RING_BLOCK_SIZE) * block_count;
+    void* map = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED, socket_, 0);
+    if (map == MAP_FAILED) {
+        std::cerr << "Failed to map transmit ring, using sendmmsg: " << strerror(errno) << std::endl;
+        // Tear the ring down again so plain sends keep working
+        std::memset(&req, 0, sizeof(req));
+        setsockopt(socket_, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req));
+        ring_size_ = 0;
+        return false;
+    }
+
+    ring_ = static_cast<uint8_t*>(map);
+    ring_head_ = 0;
+    config_.frame_count = req.tp_frame_nr;
+    return true;
+}
+
+uint8_t* TxQueue::acquire_slot() {
+    if (!ring_) {
+        if (pending_ == config_.frame_count) {
+            flush_locked();
+        }
+        return staging_.data() + static_cast<size_t>(pending_) * PACKET_HEADROOM;
+    }
+
+    uint8_t* frame = ring_ + static_cast<size_t>(ring_head_) * config_.frame_size;
+    auto* hdr = reinterpret_cast<tpacket2_hdr*>(frame);
+
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        uint32_t status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+        if (status == TP_STATUS_AVAILABLE) {
+            return frame + TX_RING_DATA_OFFSET;
+        }
+        if (status & TP_STATUS_WRONG_FORMAT) {
+            // The kernel rejected this frame earlier; reclaim the slot
+            __atomic_store_n(&hdr->tp_status, TP_STATUS_AVAILABLE, __ATOMIC_RELEASE);
+            return frame + TX_RING_DATA_OFFSET;
+        }
+
+        // Ring is full: kick the kernel and wait for it to drain
+        flush_locked();
+        struct pollfd pfd;
+        pfd.fd = socket_;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        ::poll(&pfd, 1, 10);
+    }
+
+    return nullptr;
+}
+
+void TxQueue::set_source_address(const uint8_t* mac) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::memcpy(source_, mac, ETH_ALEN);
+}
+
+size_t TxQueue::write_link_header(uint8_t* slot) const {
+    // Broadcast frame carrying the flow protocol
+    auto* eth = reinterpret_cast<struct ether_header*>(slot);
+    std::memset(eth->ether_dhost, 0xFF, ETH_ALEN);
+    std::memcpy(eth->ether_shost, source_, ETH_ALEN);
+    eth->ether_type = htons(FLOW_ETHERTYPE);
+    return sizeof(struct ether_header);
+}
+
+void TxQueue::flush_locked() {
+    if (pending_ == 0) {
+        return;
+    }
+
+    if (ring_) {
+        // One syscall hands every SEND_REQUEST slot to the kernel
+        if (send(socket_, nullptr, 0, MSG_DONTWAIT) < 0 && errno != EAGAIN && errno != ENOBUFS) {
+            static LogSite flush_log(1);
+            log_message(LogLevel::WARN, flush_log, "Transmit ring flush failed: ", strerror(errno));
+        }
+        frames_sent_.fetch_add(pending_, std::memory_order_relaxed);
+    } else {
+        uint32_t offset = 0;
+        while (offset < pending_) {
+            int sent = sendmmsg(socket_, messages_.data() + offset, pending_ - offset, 0);
+            if (sent <= 0) {
+                if (sent < 0 && errno == EINTR) {
+                    continue;
+                }
+                static LogSite sendmmsg_log(1);
+                log_message(LogLevel::WARN, sendmmsg_log, "Transmit batch failed, ", pending_ - offset,
+                            " frames dropped: ", sent < 0 ? strerror(errno) : "nothing sent");
+                break;
+            }
+            offset += sent;
+        }
+
+        for (uint32_t i = 0; i < pending_; ++i) {
+            pending_payloads_[i].reset();
+        }
+        
+        // Frames the kernel refused are gone; only the ones it took count as sent
+        frames_dropped_.fetch_add(pending_ - offset, std::memory_order_relaxed);
+        frames_sent_.fetch_add(offset, std::memory_order_relaxed);
+    }
+
+    flush_count_.fetch_add(1, std::memory_order_relaxed);
+    pending_ = 0;
+}
+
+void TxQueue::flush_worker() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+        if (pending_ == 0) {
+            flush_cv_.wait(lock);
+            continue;
+        }
+
+        // Bound the latency of the oldest queued frame
+        auto deadline = oldest_pending_ + std::chrono::microseconds(config_.max_latency_us);
+        flush_cv_.wait_until(lock, deadline);
+        if (pending_ > 0 && std::chrono::steady_clock::now() >= deadline) {
+            flush_locked();
+        }
+    }
+}
+
+} // namespace nerd
\ No newline at end of file
@@ -0,0 +1,357 @@
+#include "network/udp_transport.h"
+#include "core/log.h"
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+namespace nerd {
+
+namespace {
+
+// Largest frame queued; a flow frame is well under it
+const size_t MAX_FRAME = 2048;
+
+// Kernel limits on one GSO send: segment count, and the datagram size less
+// IP and UDP headers
+const uint16_t GSO_MAX_SEGMENTS = 64;
+const size_t GSO_MAX_BYTES = 65000;
+
+// Flush once this much is queued, and in any case within MAX_LATENCY_US
+const size_t FLUSH_BATCHES = 32;
+const size_t FLUSH_BYTES = 256 * 1024;
+const uint32_t MAX_LATENCY_US = 1000;
+
+// Messages per recvmmsg(), each with room for a full GRO buffer
+const size_t RECEIVE_BATCH = 16;
+const size_t RECEIVE_BUFFER = 65536;
+const size_t RECEIVE_CONTROL = CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(uint32_t));
+
+const int SOCKET_BUFFER_BYTES = 4 << 20;
+
+bool parse_group(const std::string& group, struct sockaddr_in& addr) {
+    size_t colon = group.rfind(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    std::string host = group.substr(0, colon);
+    char* end = nullptr;
+    unsigned long port = std::strtoul(group.c_str() + colon + 1, &end, 10);
+    if (*end != '\0' || port == 0 || port > 65535) {
+        return false;
+    }
+
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    return inet_pton(AF_INET, host.c_str(), &addr.sin_addr) == 1 && IN_MULTICAST(ntohl(addr.sin_addr.s_addr));
+}
+
+} // namespace
+
+UdpMulticastTransport::UdpMulticastTransport()
+    : send_socket_(-1), receive_socket_(-1), gso_(false), drops_(0) {
+    std::memset(&group_, 0, sizeof(group_));
+    std::memset(&self_, 0, sizeof(self_));
+}
+
+UdpMulticastTransport::~UdpMulticastTransport() {
+    close();
+}
+
+bool UdpMulticastTransport::open(const std::string& interface, const std::string& group, uint32_t ttl) {
+    const std::string& spec = group.empty() ? std::string(DEFAULT_GROUP) : group;
+    if (!parse_group(spec, group_)) {
+        std::cerr << "Invalid multicast group: " << spec << std::endl;
+        return false;
+    }
+    int ifindex = static_cast<int>(if_nametoindex(interface.c_str()));
+    if (ifindex == 0) {
+        std::cerr << "Failed to get interface index: " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (!open_sender(interface, ifindex, ttl) || !open_receiver(ifindex)) {
+        close();
+        return false;
+    }
+
+    flush_timer_ = std::make_unique<FlushTimer>(MAX_LATENCY_US, [this] { flush(); });
+    std::cout << "Joined multicast group " << spec << " on " << interface
+              << (gso_ ? " (segmentation offload)" : "") << std::endl;
+    return true;
+}
+
+bool UdpMulticastTransport::open_sender(const std::string& interface, int ifindex, uint32_t ttl) {
+    send_socket_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (send_socket_ < 0) {
+        std::cerr << "Failed to create UDP socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Out of the chosen interface, looped back for nodes on this host
+    struct ip_mreqn mreq;
+    std::memset(&mreq, 0, sizeof(mreq));
+    mreq.imr_ifindex = ifindex;
+    int loop = 1;
+    int hops = static_cast<int>(ttl);
+    int sndbuf = SOCKET_BUFFER_BYTES;
+    if (setsockopt(send_socket_, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq)) < 0 ||
+        setsockopt(send_socket_, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0 ||
+        setsockopt(send_socket_, IPPROTO_IP, IP_MULTICAST_TTL, &hops, sizeof(hops)) < 0) {
+        std::cerr << "Failed to configure multicast on " << interface << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    setsockopt(send_socket_, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    // Connected, so the kernel fixes the source address we filter on
+    socklen_t length = sizeof(self_);
+    if (connect(send_socket_, reinterpret_cast<struct sockaddr*>(&group_), sizeof(group_)) < 0 ||
+        getsockname(send_socket_, reinterpret_cast<struct sockaddr*>(&self_), &length) < 0) {
+        std::cerr << "Failed to connect UDP socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Probe for GSO: the option is per send, but setting it once shows support
+    int segment = 1400;
+    gso_ = setsockopt(send_socket_, IPPROTO_UDP, UDP_SEGMENT, &segment, sizeof(segment)) == 0;
+    if (gso_) {
+        segment = 0;
+        setsockopt(send_socket_, IPPROTO_UDP, UDP_SEGMENT, &segment, sizeof(segment));
+    }
+    return true;
+}
+
+bool UdpMulticastTransport::open_receiver(int ifindex) {
+    receive_socket_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (receive_socket_ < 0) {
+        std::cerr << "Failed to create UDP socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Every node on the host binds the group port and gets its own copy
+    int on = 1;
+    int rcvbuf = SOCKET_BUFFER_BYTES;
+    setsockopt(receive_socket_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(receive_socket_, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (bind(receive_socket_, reinterpret_cast<struct sockaddr*>(&group_), sizeof(group_)) < 0) {
+        std::cerr << "Failed to bind UDP socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct ip_mreqn mreq;
+    std::memset(&mreq, 0, sizeof(mreq));
+    mreq.imr_multiaddr = group_.sin_addr;
+    mreq.imr_ifindex = ifindex;
+    if (setsockopt(receive_socket_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        std::cerr << "Failed to join multicast group: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Coalesced receive and drop reporting are optional
+    setsockopt(receive_socket_, IPPROTO_UDP, UDP_GRO, &on, sizeof(on));
+    setsockopt(receive_socket_, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+
+    receive_buffers_.resize(RECEIVE_BATCH * RECEIVE_BUFFER);
+    receive_control_.resize(RECEIVE_BATCH * RECEIVE_CONTROL);
+    receive_messages_.resize(RECEIVE_BATCH);
+    receive_iovecs_.resize(RECEIVE_BATCH);
+    receive_sources_.resize(RECEIVE_BATCH);
+    return true;
+}
+
+void UdpMulticastTransport::close() {
+    // Stopped first: its flush uses everything below
+    flush_timer_.reset();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (send_socket_ >= 0) {
+            flush_locked();
+            ::close(send_socket_);
+            send_socket_ = -1;
+        }
+    }
+    if (receive_socket_ >= 0) {
+        ::close(receive_socket_);
+        receive_socket_ = -1;
+    }
+}
+
+bool UdpMulticastTransport::send(const RawPacket& packet) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (send_socket_ < 0) {
+        return false;
+    }
+
+    size_t offset = pending_.size();
+    pending_.resize(offset + MAX_FRAME);
+    size_t length = packet.serialize_into(pending_.data() + offset, MAX_FRAME);
+    pending_.resize(offset + length);
+    if (length == 0) {
+        return false;
+    }
+
+    // Joins the open batch when it keeps every segment but the last equal
+    Batch* batch = batches_.empty() ? nullptr : &batches_.back();
+    if (gso_ && batch && !batch->closed && length <= batch->segment && batch->segments < GSO_MAX_SEGMENTS &&
+        batch->length + length <= GSO_MAX_BYTES) {
+        batch->length += length;
+        batch->segments++;
+        batch->closed = length < batch->segment;
+    } else {
+        batches_.push_back({offset, length, static_cast<uint16_t>(length), 1, false});
+    }
+
+    if (offset == 0) {
+        flush_timer_->arm();
+    }
+    if (batches_.size() >= FLUSH_BATCHES || pending_.size() >= FLUSH_BYTES) {
+        flush_locked();
+    }
+    return true;
+}
+
+void UdpMulticastTransport::flush() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    flush_locked();
+}
+
+void UdpMulticastTransport::flush_locked() {
+    if (batches_.empty() || send_socket_ < 0) {
+        return;
+    }
+
+    // One message per batch with GSO, else one per frame
+    std::vector<struct mmsghdr> messages;
+    std::vector<struct iovec> iovecs;
+    std::vector<uint8_t> control;
+    auto build = [&]() {
+        messages.clear();
+        iovecs.clear();
+        for (const auto& batch : batches_) {
+            if (gso_ || batch.segments == 1) {
+                iovecs.push_back({pending_.data() + batch.offset, batch.length});
+                continue;
+            }
+            for (size_t at = 0; at < batch.length; at += batch.segment) {
+                iovecs.push_back({pending_.data() + batch.offset + at, std::min<size_t>(batch.segment, batch.length - at)});
+            }
+        }
+        messages.resize(iovecs.size());
+        control.assign(iovecs.size() * CMSG_SPACE(sizeof(uint16_t)), 0);
+        size_t index = 0;
+        for (const auto& batch : batches_) {
+            size_t count = gso_ || batch.segments == 1 ? 1 : batch.segments;
+            for (size_t i = 0; i < count; ++i, ++index) {
+                struct msghdr& msg = messages[index].msg_hdr;
+                std::memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = &iovecs[index];
+                msg.msg_iovlen = 1;
+                if (gso_ && batch.segments > 1) {
+                    msg.msg_control = control.data() + index * CMSG_SPACE(sizeof(uint16_t));
+                    msg.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+                    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+                    cmsg->cmsg_level = IPPROTO_UDP;
+                    cmsg->cmsg_type = UDP_SEGMENT;
+                    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                    std::memcpy(CMSG_DATA(cmsg), &batch.segment, sizeof(uint16_t));
+                }
+            }
+        }
+    };
+
+    build();
+    size_t sent = 0;
+    while (sent < messages.size()) {
+        int n = sendmmsg(send_socket_, messages.data() + sent, static_cast<unsigned>(messages.size() - sent), 0);
+        if (n > 0) {
+            sent += static_cast<size_t>(n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (gso_ && sent == 0 && (errno == EIO || errno == EINVAL || errno == EOPNOTSUPP)) {
+            // The route's device cannot segment: datagram by datagram from now on
+            gso_ = false;
+            build();
+            continue;
+        }
+        static LogSite send_log(1);
+        log_message(LogLevel::WARN, send_log, "Multicast send failed: ", strerror(errno));
+        break;
+    }
+    pending_.clear();
+    batches_.clear();
+}
+
+size_t UdpMulticastTransport::poll(int timeout_ms, const FrameHandler& handler) {
+    struct pollfd pfd = {receive_socket_, POLLIN, 0};
+    if (::poll(&pfd, 1, timeout_ms) <= 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < RECEIVE_BATCH; ++i) {
+        receive_iovecs_[i] = {receive_buffers_.data() + i * RECEIVE_BUFFER, RECEIVE_BUFFER};
+        struct msghdr& msg = receive_messages_[i].msg_hdr;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &receive_sources_[i];
+        msg.msg_namelen = sizeof(receive_sources_[i]);
+        msg.msg_iov = &receive_iovecs_[i];
+        msg.msg_iovlen = 1;
+        msg.msg_control = receive_control_.data() + i * RECEIVE_CONTROL;
+        msg.msg_controllen = RECEIVE_CONTROL;
+    }
+    int received = recvmmsg(receive_socket_, receive_messages_.data(), RECEIVE_BATCH, MSG_DONTWAIT, nullptr);
+    if (received <= 0) {
+        return 0;
+    }
+
+    uint64_t now = packet_timestamp_now();
+    size_t delivered = 0;
+    for (int i = 0; i < received; ++i) {
+        struct msghdr& msg = receive_messages_[i].msg_hdr;
+        size_t length = receive_messages_[i].msg_len;
+        size_t segment = length;
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+                int size;
+                std::memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+                segment = static_cast<size_t>(size);
+            } else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+                uint32_t overflow;
+                std::memcpy(&overflow, CMSG_DATA(cmsg), sizeof(overflow));
+                drops_.store(overflow, std::memory_order_relaxed);
+            }
+        }
+
+        // Our own datagrams come back through the loop
+        const struct sockaddr_in& source = receive_sources_[i];
+        if ((msg.msg_flags & MSG_TRUNC) || segment == 0 ||
+            (source.sin_addr.s_addr == self_.sin_addr.s_addr && source.sin_port == self_.sin_port)) {
+            continue;
+        }
+
+        // A GRO buffer holds equal segments, the last possibly shorter
+        const uint8_t* data = static_cast<const uint8_t*>(msg.msg_iov->iov_base);
+        for (size_t at = 0; at < length; at += segment) {
+            handler(data + at, std::min(segment, length - at), now);
+            ++delivered;
+        }
+    }
+    return delivered;
+}
+
+} // namespace nerd
@@ -0,0 +1,437 @@
+#include "network/xdp_transport.h"
+#include "core/log.h"
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+namespace nerd {
+
+namespace {
+
+// UMEM layout: FRAME_COUNT frames, the lower half for receive
+const uint32_t FRAME_SIZE = 2048;
+const uint32_t FRAME_COUNT = 4096;
+const uint32_t RX_FRAMES = FRAME_COUNT / 2;
+const uint32_t RING_SIZE = 2048;
+
+// Kick the kernel once this many frames wait, and in any case within
+// MAX_LATENCY_US
+const uint32_t FLUSH_FRAMES = 64;
+const uint32_t MAX_LATENCY_US = 1000;
+
+long bpf(int cmd, union bpf_attr& attr) {
+    return syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+}
+
+struct bpf_insn insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) {
+    struct bpf_insn in;
+    std::memset(&in, 0, sizeof(in));
+    in.code = code;
+    in.dst_reg = dst;
+    in.src_reg = src;
+    in.off = off;
+    in.imm = imm;
+    return in;
+}
+
+// The redirect program, as RxRing's socket filter: flow ethertype and the
+// magic (little-endian on the wire, so a native load on x86 compares equal)
+std::vector<struct bpf_insn> redirect_program(int map_fd) {
+    const int16_t to_pass_from_5 = 10;
+    const int16_t to_pass_from_7 = 8;
+    const int16_t to_pass_from_9 = 6;
+    return {
+        insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0),                              // 0: r6 = ctx
+        insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, data), 0),      // 1: r2 = data
+        insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_3, BPF_REG_6, offsetof(struct xdp_md, data_end), 0),  // 2: r3 = data_end
+        insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0),                              // 3
+        insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, sizeof(struct ether_header) + 4),        // 4: header + magic
+        insn(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, to_pass_from_5, 0),                   // 5: too short
+        insn(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, 12, 0),                               // 6: ethertype
+        insn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, to_pass_from_7, htons(FLOW_ETHERTYPE)),       // 7
+        insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_5, BPF_REG_2, sizeof(struct ether_header), 0),     // 8: magic
+        insn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, to_pass_from_9, static_cast<int32_t>(FLOW_MAGIC)),  // 9
+        insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index), 0),  // 10
+        insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd),                   // 11: r1 = xskmap
+        insn(0, 0, 0, 0, 0),                                                                         // 12
+        insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS),                               // 13: on a miss
+        insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),                                   // 14
+        insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),                                                        // 15
+        insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS),                               // 16: pass
+        insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),                                                        // 17
+    };
+}
+
+} // namespace
+
+XdpProgram::XdpProgram() : map_fd_(-1), program_fd_(-1), link_fd_(-1) {}
+
+XdpProgram::~XdpProgram() {
+    for (int fd : {link_fd_, program_fd_, map_fd_}) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+}
+
+bool XdpProgram::attach(int ifindex, uint32_t queue_count) {
+    union bpf_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = queue_count;
+    map_fd_ = static_cast<int>(bpf(BPF_MAP_CREATE, attr));
+    if (map_fd_ < 0) {
+        std::cerr << "Failed to create XSKMAP: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    std::vector<struct bpf_insn> program = redirect_program(map_fd_);
+    static const char license[] = "GPL";
+    char verifier_log[4096] = {0};
+    std::memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.expected_attach_type = BPF_XDP;
+    attr.insns = reinterpret_cast<uint64_t>(program.data());
+    attr.insn_cnt = static_cast<uint32_t>(program.size());
+    attr.license = reinterpret_cast<uint64_t>(license);
+    attr.log_buf = reinterpret_cast<uint64_t>(verifier_log);
+    attr.log_size = sizeof(verifier_log);
+    attr.log_level = 1;
+    program_fd_ = static_cast<int>(bpf(BPF_PROG_LOAD, attr));
+    if (program_fd_ < 0) {
+        std::cerr << "Failed to load XDP program: " << strerror(errno) << std::endl;
+        if (verifier_log[0]) {
+            std::cerr << verifier_log << std::endl;
+        }
+        return false;
+    }
+
+    // A link detaches the program when this process closes it or exits;
+    // until a queue's socket is registered its frames pass as before
+    std::memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = static_cast<uint32_t>(program_fd_);
+    attr.link_create.target_ifindex = static_cast<uint32_t>(ifindex);
+    attr.link_create.attach_type = BPF_XDP;
+    link_fd_ = static_cast<int>(bpf(BPF_LINK_CREATE, attr));
+    if (link_fd_ < 0) {
+        std::cerr << "Failed to attach XDP program: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool XdpProgram::add_socket(uint32_t queue_id, int socket) {
+    union bpf_attr attr;
+    uint32_t key = queue_id;
+    uint32_t value = static_cast<uint32_t>(socket);
+    std::memset(&attr, 0, sizeof(attr));
+    attr.map_fd = static_cast<uint32_t>(map_fd_);
+    attr.key = reinterpret_cast<uint64_t>(&key);
+    attr.value = reinterpret_cast<uint64_t>(&value);
+    if (bpf(BPF_MAP_UPDATE_ELEM, attr) < 0) {
+        std::cerr << "Failed to register AF_XDP socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+XdpTransport::XdpTransport()
+    : socket_(-1), zero_copy_(false), umem_(nullptr), tx_pending_(0) {
+    std::memset(source_, 0, sizeof(source_));
+    std::memset(&fill_, 0, sizeof(fill_));
+    std::memset(&completion_, 0, sizeof(completion_));
+    std::memset(&rx_, 0, sizeof(rx_));
+    std::memset(&tx_, 0, sizeof(tx_));
+}
+
+XdpTransport::~XdpTransport() {
+    close();
+}
+
+bool XdpTransport::open(const std::string& interface, uint32_t queue_id, std::shared_ptr<XdpProgram> program) {
+    int ifindex = static_cast<int>(if_nametoindex(interface.c_str()));
+    if (ifindex == 0) {
+        std::cerr << "Failed to get interface index: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Sent from the interface's own address, as PacketSocketTransport does
+    int probe = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (probe >= 0) {
+        struct ifreq ifr;
+        std::memset(&ifr, 0, sizeof(ifr));
+        std::strncpy(ifr.ifr_name, interface.c_str(), IFNAMSIZ - 1);
+        if (ioctl(probe, SIOCGIFHWADDR, &ifr) == 0) {
+            std::memcpy(source_, ifr.ifr_hwaddr.sa_data, sizeof(source_));
+        }
+        ::close(probe);
+    }
+
+    if (!program) {
+        program = std::make_shared<XdpProgram>();
+        if (!program->attach(ifindex, queue_id + 1)) {
+            return false;
+        }
+    }
+    program_ = std::move(program);
+    if (!open_socket(ifindex, queue_id) || !program_->add_socket(queue_id, socket_)) {
+        close();
+        return false;
+    }
+
+    free_frames_.clear();
+    for (uint32_t i = RX_FRAMES; i < FRAME_COUNT; ++i) {
+        free_frames_.push_back(static_cast<uint64_t>(i) * FRAME_SIZE);
+    }
+    flush_timer_ = std::make_unique<FlushTimer>(MAX_LATENCY_US, [this] { flush(); });
+    return true;
+}
+
+bool XdpTransport::open_socket(int ifindex, uint32_t queue_id) {
+    socket_ = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if (socket_ < 0) {
+        std::cerr << "Failed to create AF_XDP socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    void* umem = mmap(nullptr, static_cast<size_t>(FRAME_COUNT) * FRAME_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (umem == MAP_FAILED) {
+        std::cerr << "Failed to allocate UMEM: " << strerror(errno) << std::endl;
+        return false;
+    }
+    umem_ = static_cast<uint8_t*>(umem);
+
+    struct xdp_umem_reg reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.addr = reinterpret_cast<uint64_t>(umem_);
+    reg.len = static_cast<uint64_t>(FRAME_COUNT) * FRAME_SIZE;
+    reg.chunk_size = FRAME_SIZE;
+    uint32_t ring_size = RING_SIZE;
+    if (setsockopt(socket_, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0 ||
+        setsockopt(socket_, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        setsockopt(socket_, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        setsockopt(socket_, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        setsockopt(socket_, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size)) < 0) {
+        std::cerr << "Failed to configure AF_XDP rings: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct xdp_mmap_offsets offsets;
+    socklen_t length = sizeof(offsets);
+    if (getsockopt(socket_, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &length) < 0 ||
+        !map_ring(fill_, XDP_UMEM_PGOFF_FILL_RING, &offsets.fr, sizeof(uint64_t), RING_SIZE) ||
+        !map_ring(completion_, XDP_UMEM_PGOFF_COMPLETION_RING, &offsets.cr, sizeof(uint64_t), RING_SIZE) ||
+        !map_ring(rx_, XDP_PGOFF_RX_RING, &offsets.rx, sizeof(struct xdp_desc), RING_SIZE) ||
+        !map_ring(tx_, XDP_PGOFF_TX_RING, &offsets.tx, sizeof(struct xdp_desc), RING_SIZE)) {
+        std::cerr << "Failed to map AF_XDP rings: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Every receive frame starts out with the kernel
+    auto* fill = static_cast<uint64_t*>(fill_.entries);
+    for (uint32_t i = 0; i < RX_FRAMES; ++i) {
+        fill[i & fill_.mask] = static_cast<uint64_t>(i) * FRAME_SIZE;
+    }
+    __atomic_store_n(fill_.producer, RX_FRAMES, __ATOMIC_RELEASE);
+
+    struct sockaddr_xdp addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sxdp_family = AF_XDP;
+    addr.sxdp_ifindex = static_cast<uint32_t>(ifindex);
+    addr.sxdp_queue_id = queue_id;
+    addr.sxdp_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+    zero_copy_ = bind(socket_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0;
+    if (!zero_copy_) {
+        addr.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+        if (bind(socket_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+            std::cerr << "Failed to bind AF_XDP socket: " << strerror(errno) << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool XdpTransport::map_ring(Ring& ring, uint64_t offset, const void* offsets, size_t entry_size, uint32_t size) {
+    const auto& off = *static_cast<const struct xdp_ring_offset*>(offsets);
+    ring.map_size = off.desc + size * entry_size;
+    void* map = mmap(nullptr, ring.map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, socket_,
+                     static_cast<off_t>(offset));
+    if (map == MAP_FAILED) {
+        ring.map = nullptr;
+        return false;
+    }
+    auto* base = static_cast<uint8_t*>(map);
+    ring.map = map;
+    ring.producer = reinterpret_cast<uint32_t*>(base + off.producer);
+    ring.consumer = reinterpret_cast<uint32_t*>(base + off.consumer);
+    ring.flags = reinterpret_cast<uint32_t*>(base + off.flags);
+    ring.entries = base + off.desc;
+    ring.mask = size - 1;
+    return true;
+}
+
+void XdpTransport::close() {
+    // Stopped first: its flush uses the transmit ring
+    flush_timer_.reset();
+
+    if (socket_ >= 0) {
+        ::close(socket_);
+        socket_ = -1;
+    }
+    program_.reset();
+    for (Ring* ring : {&fill_, &completion_, &rx_, &tx_}) {
+        if (ring->map) {
+            munmap(ring->map, ring->map_size);
+        }
+        std::memset(ring, 0, sizeof(*ring));
+    }
+    if (umem_) {
+        munmap(umem_, static_cast<size_t>(FRAME_COUNT) * FRAME_SIZE);
+        umem_ = nullptr;
+    }
+    free_frames_.clear();
+    tx_pending_ = 0;
+}
+
+void XdpTransport::reclaim_completed() {
+    uint32_t consumer = *completion_.consumer;
+    uint32_t producer = __atomic_load_n(completion_.producer, __ATOMIC_ACQUIRE);
+    const auto* entries = static_cast<const uint64_t*>(completion_.entries);
+    for (; consumer != producer; ++consumer) {
+        free_frames_.push_back(entries[consumer & completion_.mask]);
+    }
+    __atomic_store_n(completion_.consumer, consumer, __ATOMIC_RELEASE);
+}
+
+bool XdpTransport::send(const RawPacket& packet) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (socket_ < 0) {
+        return false;
+    }
+
+    if (free_frames_.empty()) {
+        reclaim_completed();
+    }
+    uint32_t producer = *tx_.producer;
+    uint32_t consumer = __atomic_load_n(tx_.consumer, __ATOMIC_ACQUIRE);
+    if (free_frames_.empty() || producer - consumer > tx_.mask) {
+        flush_locked();
+        return false;
+    }
+
+    uint64_t frame = free_frames_.back();
+    uint8_t* slot = umem_ + frame;
+    auto* eth = reinterpret_cast<struct ether_header*>(slot);
+    std::memset(eth->ether_dhost, 0xFF, ETH_ALEN);
+    std::memcpy(eth->ether_shost, source_, ETH_ALEN);
+    eth->ether_type = htons(FLOW_ETHERTYPE);
+    size_t length = packet.serialize_into(slot + sizeof(struct ether_header), FRAME_SIZE - sizeof(struct ether_header));
+    if (length == 0) {
+        return false;
+    }
+    free_frames_.pop_back();
+
+    auto* desc = static_cast<struct xdp_desc*>(tx_.entries) + (producer & tx_.mask);
+    desc->addr = frame;
+    desc->len = static_cast<uint32_t>(sizeof(struct ether_header) + length);
+    desc->options = 0;
+    __atomic_store_n(tx_.producer, producer + 1, __ATOMIC_RELEASE);
+
+    if (tx_pending_++ == 0) {
+        flush_timer_->arm();
+    }
+    if (tx_pending_ >= FLUSH_FRAMES) {
+        flush_locked();
+    }
+    return true;
+}
+
+void XdpTransport::flush() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    flush_locked();
+}
+
+void XdpTransport::flush_locked() {
+    if (tx_pending_ == 0 || socket_ < 0) {
+        return;
+    }
+    tx_pending_ = 0;
+
+    // Copy mode transmits only from the syscall; zero-copy drivers say when
+    // they need it
+    if (!zero_copy_ || (__atomic_load_n(tx_.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP)) {
+        if (sendto(socket_, nullptr, 0, MSG_DONTWAIT, nullptr, 0) < 0 && errno != EAGAIN && errno != EBUSY &&
+            errno != ENOBUFS) {
+            static LogSite kick_log(1);
+            log_message(LogLevel::WARN, kick_log, "AF_XDP transmit failed: ", strerror(errno));
+        }
+    }
+    reclaim_completed();
+}
+
+size_t XdpTransport::poll(int timeout_ms, const FrameHandler& handler) {
+    uint32_t consumer = *rx_.consumer;
+    uint32_t producer = __atomic_load_n(rx_.producer, __ATOMIC_ACQUIRE);
+    if (consumer == producer) {
+        struct pollfd pfd = {socket_, POLLIN, 0};
+        if (::poll(&pfd, 1, timeout_ms) <= 0) {
+            return 0;
+        }
+        producer = __atomic_load_n(rx_.producer, __ATOMIC_ACQUIRE);
+    }
+
+    // Each frame goes straight back to the fill ring once handled; the ring
+    // holds every receive frame, so there is always room
+    uint64_t now = packet_timestamp_now();
+    const auto* descs = static_cast<const struct xdp_desc*>(rx_.entries);
+    auto* fill = static_cast<uint64_t*>(fill_.entries);
+    uint32_t fill_producer = *fill_.producer;
+    size_t delivered = 0;
+    for (; consumer != producer; ++consumer) {
+        const struct xdp_desc& desc = descs[consumer & rx_.mask];
+        if (desc.len > sizeof(struct ether_header)) {
+            handler(umem_ + desc.addr + sizeof(struct ether_header), desc.len - sizeof(struct ether_header), now);
+            ++delivered;
+        }
+        fill[fill_producer++ & fill_.mask] = desc.addr & ~static_cast<uint64_t>(FRAME_SIZE - 1);
+    }
+    __atomic_store_n(rx_.consumer, consumer, __ATOMIC_RELEASE);
+    __atomic_store_n(fill_.producer, fill_producer, __ATOMIC_RELEASE);
+
+    if (__atomic_load_n(fill_.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP) {
+        recvfrom(socket_, nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+    }
+    return delivered;
+}
+
+uint64_t XdpTransport::receive_drops() {
+    struct xdp_statistics stats;
+    socklen_t length = sizeof(stats);
+    if (socket_ < 0 || getsockopt(socket_, SOL_XDP, XDP_STATISTICS, &stats, &length) < 0) {
+        return 0;
+    }
+    return stats.rx_dropped + stats.rx_ring_full + stats.rx_fill_ring_empty_descs;
+}
+
+} // namespace nerd
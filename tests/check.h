@@ -0,0 +1,65 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+
+// Minimal test harness: no dependencies, so the tests build wherever the
+// engine does
+//
+// TEST_CASE(name) registers a case; CHECK reports a failed expression and
+// carries on, REQUIRE also ends the case. Each test binary runs its cases
+// in order and exits non-zero if any check failed.
+namespace nerd_test {
+
+using Case = void (*)();
+
+struct Registry {
+    std::vector<std::pair<const char*, Case>> cases;
+    int failures = 0;
+};
+
+inline Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+struct Registrar {
+    Registrar(const char* name, Case run) { registry().cases.emplace_back(name, run); }
+};
+
+inline bool check(bool ok, const char* expression, const char* file, int line) {
+    if (!ok) {
+        ++registry().failures;
+        std::cerr << file << ":" << line << ": check failed: " << expression << std::endl;
+    }
+    return ok;
+}
+
+template <typename A, typename B>
+bool check_eq(const A& actual, const B& expected, const char* expression, const char* file, int line) {
+    if (actual == expected) {
+        return true;
+    }
+    ++registry().failures;
+    std::cerr << file << ":" << line << ": check failed: " << expression << " (" << actual << " vs " << expected
+              << ")" << std::endl;
+    return false;
+}
+
+int run_all();
+
+} // namespace nerd_test
+
+#define TEST_CASE(name)                                                    \
+    void name();                                                           \
+    const nerd_test::Registrar name##_registrar(#name, name);              \
+    void name()
+
+#define CHECK(expr) nerd_test::check(static_cast<bool>(expr), #expr, __FILE__, __LINE__)
+#define CHECK_EQ(actual, expected) nerd_test::check_eq((actual), (expected), #actual " == " #expected, __FILE__, __LINE__)
+#define REQUIRE(expr)         \
+    do {                      \
+        if (!CHECK(expr)) {   \
+            return;           \
+        }                     \
+    } while (0)
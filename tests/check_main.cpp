@@ -0,0 +1,18 @@
+#include "check.h"
+
+namespace nerd_test {
+
+int run_all() {
+    for (const auto& entry : registry().cases) {
+        int before = registry().failures;
+        entry.second();
+        std::cout << (registry().failures == before ? "[ ok ] " : "[FAIL] ") << entry.first << std::endl;
+    }
+    return registry().failures == 0 ? 0 : 1;
+}
+
+} // namespace nerd_test
+
+int main() {
+    return nerd_test::run_all();
+}
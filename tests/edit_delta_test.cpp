@@ -0,0 +1,107 @@
+#include "core/edit_delta.h"
+#include "check.h"
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+using nerd::ContentSplice;
+using nerd::EditDeltaHeader;
+using nerd::SpliceRecord;
+
+std::vector<uint8_t> delta_of(uint64_t base_version, uint32_t splice_count, const std::vector<SpliceRecord>& records,
+                              const std::string& inserts) {
+    EditDeltaHeader header;
+    header.base_version = base_version;
+    header.splice_count = splice_count;
+    std::vector<uint8_t> payload(sizeof(header));
+    std::memcpy(payload.data(), &header, sizeof(header));
+    size_t position = 0;
+    for (const auto& record : records) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&record);
+        payload.insert(payload.end(), bytes, bytes + sizeof(record));
+        size_t take = std::min<size_t>(record.insert_length, inserts.size() - position);
+        payload.insert(payload.end(), inserts.begin() + position, inserts.begin() + position + take);
+        position += take;
+    }
+    return payload;
+}
+
+SpliceRecord record(uint32_t offset, uint32_t erase_length, uint32_t insert_length) {
+    SpliceRecord result;
+    result.offset = offset;
+    result.erase_length = erase_length;
+    result.insert_length = insert_length;
+    return result;
+}
+
+// An insert too large for one payload continues in the next, against the
+// version the previous one produces
+TEST_CASE(edit_delta_round_trips_across_payloads) {
+    std::vector<ContentSplice> splices = {ContentSplice(3, 2, std::string(100, 'a')), ContentSplice(0, 1, "")};
+    auto payloads = nerd::encode_edit_deltas(splices, 7, 64);
+    REQUIRE(payloads.size() > 1u);
+
+    std::string inserted;
+    for (size_t i = 0; i < payloads.size(); ++i) {
+        REQUIRE(payloads[i].size() <= 64u);
+        uint64_t base_version = 0;
+        std::vector<ContentSplice> decoded;
+        REQUIRE(nerd::decode_edit_delta(payloads[i].data(), payloads[i].size(), base_version, decoded));
+        CHECK_EQ(base_version, 7 + i);
+        for (const auto& splice : decoded) {
+            inserted += splice.insert;
+        }
+    }
+    CHECK_EQ(inserted, std::string(100, 'a'));
+}
+
+TEST_CASE(edit_delta_refuses_truncated_header) {
+    auto payload = delta_of(1, 0, {}, "");
+    uint64_t base_version = 0;
+    std::vector<ContentSplice> splices;
+    CHECK(nerd::decode_edit_delta(payload.data(), payload.size(), base_version, splices));
+    CHECK(!nerd::decode_edit_delta(payload.data(), sizeof(EditDeltaHeader) - 1, base_version, splices));
+}
+
+// A count the payload cannot hold is refused before anything is reserved for it
+TEST_CASE(edit_delta_refuses_forged_splice_count) {
+    auto payload = delta_of(1, 0xffffffff, {record(0, 0, 1)}, "x");
+    uint64_t base_version = 0;
+    std::vector<ContentSplice> splices;
+    CHECK(!nerd::decode_edit_delta(payload.data(), payload.size(), base_version, splices));
+}
+
+TEST_CASE(edit_delta_refuses_insert_past_payload) {
+    auto payload = delta_of(1, 1, {record(0, 0, 1000)}, "short");
+    uint64_t base_version = 0;
+    std::vector<ContentSplice> splices;
+    CHECK(!nerd::decode_edit_delta(payload.data(), payload.size(), base_version, splices));
+}
+
+TEST_CASE(edit_delta_refuses_trailing_bytes) {
+    auto payload = delta_of(1, 1, {record(0, 0, 1)}, "x");
+    payload.push_back(0);
+    uint64_t base_version = 0;
+    std::vector<ContentSplice> splices;
+    CHECK(!nerd::decode_edit_delta(payload.data(), payload.size(), base_version, splices));
+}
+
+// Ranges are checked against the length each earlier splice leaves, and a
+// splice that does not fit leaves the content untouched
+TEST_CASE(edit_delta_applies_only_in_range_splices) {
+    nerd::TextBuffer content;
+    content.replace(0, 0, "hello");
+    CHECK(nerd::splices_in_range(5, {ContentSplice(5, 0, " world"), ContentSplice(10, 1, "D")}));
+    CHECK(!nerd::splices_in_range(5, {ContentSplice(0, 5, ""), ContentSplice(1, 0, "x")}));
+    CHECK(!nerd::splices_in_range(5, {ContentSplice(3, 0xffffffff, "")}));
+
+    CHECK(!nerd::apply_splices(content, {ContentSplice(0, 1, "H"), ContentSplice(9, 0, "!")}));
+    CHECK_EQ(content.to_string(), "hello");
+    CHECK(nerd::apply_splices(content, {ContentSplice(0, 1, "H"), ContentSplice(5, 0, "!")}));
+    CHECK_EQ(content.to_string(), "Hello!");
+}
+
+} // namespace
@@ -0,0 +1,89 @@
+#include "core/fec.h"
+#include "check.h"
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace {
+
+const size_t BLOCK = 64;
+
+struct Group {
+    std::vector<std::vector<uint8_t>> data;
+    std::vector<std::vector<uint8_t>> parity;
+
+    Group(size_t data_count, size_t parity_count)
+        : data(data_count, std::vector<uint8_t>(BLOCK)), parity(parity_count, std::vector<uint8_t>(BLOCK)) {
+        std::mt19937 rng(static_cast<uint32_t>(data_count * 131 + parity_count));
+        for (auto& block : data) {
+            for (auto& byte : block) {
+                byte = static_cast<uint8_t>(rng());
+            }
+        }
+        std::vector<const uint8_t*> in;
+        for (const auto& block : data) {
+            in.push_back(block.data());
+        }
+        std::vector<uint8_t*> out;
+        for (auto& block : parity) {
+            out.push_back(block.data());
+        }
+        nerd::fec_encode(in.data(), data.size(), out.data(), parity.size(), BLOCK);
+    }
+
+    // Recover the erased columns from the parity rows given, checking each
+    // comes back as encoded
+    bool recover(const std::vector<uint32_t>& erased, const std::vector<uint32_t>& rows) const {
+        std::vector<const uint8_t*> in;
+        for (size_t i = 0; i < data.size(); ++i) {
+            in.push_back(data[i].data());
+        }
+        for (uint32_t column : erased) {
+            in[column] = nullptr;
+        }
+        std::vector<const uint8_t*> parity_in;
+        for (uint32_t row : rows) {
+            parity_in.push_back(parity[row].data());
+        }
+        std::vector<std::vector<uint8_t>> recovered(erased.size(), std::vector<uint8_t>(BLOCK));
+        std::vector<uint8_t*> out;
+        for (auto& block : recovered) {
+            out.push_back(block.data());
+        }
+        if (!nerd::fec_recover(in.data(), data.size(), erased, parity_in.data(), rows.data(), out.data(), BLOCK)) {
+            return false;
+        }
+        for (size_t i = 0; i < erased.size(); ++i) {
+            CHECK(recovered[i] == data[erased[i]]);
+        }
+        return true;
+    }
+};
+
+// Row 0 is all ones, so one parity block is the XOR of the group
+TEST_CASE(fec_single_parity_is_xor) {
+    Group group(5, 1);
+    for (size_t byte = 0; byte < BLOCK; ++byte) {
+        uint8_t expected = 0;
+        for (const auto& block : group.data) {
+            expected ^= block[byte];
+        }
+        CHECK_EQ(group.parity[0][byte], expected);
+    }
+    CHECK(group.recover({3}, {0}));
+}
+
+TEST_CASE(fec_recovers_from_any_parity_rows) {
+    Group group(10, 4);
+    CHECK(group.recover({0, 9}, {1, 3}));
+    CHECK(group.recover({2, 4, 7}, {0, 2, 3}));
+    CHECK(group.recover({1, 2, 3, 4}, {0, 1, 2, 3}));
+    CHECK(!group.recover({1, 1}, {0, 1}));
+}
+
+TEST_CASE(fec_largest_group) {
+    Group group(nerd::FEC_MAX_DATA, 3);
+    CHECK(group.recover({0, 64, 127}, {0, 1, 2}));
+}
+
+} // namespace
@@ -0,0 +1,162 @@
+#include "core/flow_file.h"
+#include "core/flow_snapshot.h"
+#include "network/crc32c.h"
+#include "network/flow_id.h"
+#include "check.h"
+#include <unistd.h>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using nerd::ContentSplice;
+using nerd::FlowFile;
+using nerd::RawPacket;
+
+const nerd::FlowID FLOW = 7;
+
+std::vector<uint8_t> delta_payload(uint64_t base_version, const ContentSplice& splice) {
+    return nerd::encode_edit_deltas({splice}, base_version, 1400).front();
+}
+
+void receive(FlowFile& flow, const std::vector<uint8_t>& payload) {
+    flow.receive_edit(RawPacket(FLOW, nerd::FLOW_EDIT, payload));
+}
+
+// A delta against the current version applies unless the copy is resyncing
+size_t next_applies(FlowFile& flow) {
+    receive(flow, delta_payload(flow.version(), ContentSplice(0, 0, "#")));
+    return flow.apply_received_edits();
+}
+
+// Two peers' deltas against version 1 of "hello\n"; every holder keeps the
+// one whose payload has the larger CRC
+struct ConcurrentEdits {
+    std::vector<uint8_t> winner = delta_payload(1, ContentSplice(6, 0, "x\n"));
+    std::vector<uint8_t> loser = delta_payload(1, ContentSplice(6, 0, "y\n"));
+    std::string winner_text = "hello\nx\n";
+    FlowFile flow{FLOW, "doc"};
+
+    ConcurrentEdits() {
+        if (nerd::crc32c(0, winner.data(), winner.size()) < nerd::crc32c(0, loser.data(), loser.size())) {
+            std::swap(winner, loser);
+            winner_text = "hello\ny\n";
+        }
+        flow.write_to_flow("hello\n");
+    }
+};
+
+TEST_CASE(concurrent_edits_in_one_batch_keep_larger_crc) {
+    ConcurrentEdits edits;
+    receive(edits.flow, edits.loser);
+    receive(edits.flow, edits.winner);
+    CHECK_EQ(edits.flow.apply_received_edits(), 1u);
+    CHECK_EQ(edits.flow.version(), 2u);
+    CHECK_EQ(edits.flow.content(), edits.winner_text);
+    CHECK_EQ(next_applies(edits.flow), 1u);
+}
+
+TEST_CASE(concurrent_edits_winner_first_ignores_loser) {
+    ConcurrentEdits edits;
+    receive(edits.flow, edits.winner);
+    CHECK_EQ(edits.flow.apply_received_edits(), 1u);
+    receive(edits.flow, edits.loser);
+    CHECK_EQ(edits.flow.apply_received_edits(), 0u);
+    CHECK_EQ(edits.flow.content(), edits.winner_text);
+    CHECK_EQ(next_applies(edits.flow), 1u);
+}
+
+// A holder that applied the losing delta stops serving its copy and takes
+// no further deltas until it has refetched a holder's
+TEST_CASE(concurrent_edits_loser_first_resyncs) {
+    ConcurrentEdits edits;
+    receive(edits.flow, edits.loser);
+    CHECK_EQ(edits.flow.apply_received_edits(), 1u);
+    receive(edits.flow, edits.winner);
+    CHECK_EQ(edits.flow.apply_received_edits(), 0u);
+    CHECK_EQ(edits.flow.version(), 2u);
+    CHECK_EQ(next_applies(edits.flow), 0u);
+    CHECK_EQ(edits.flow.version(), 2u);
+}
+
+TEST_CASE(concurrent_edits_duplicate_is_harmless) {
+    ConcurrentEdits edits;
+    receive(edits.flow, edits.loser);
+    edits.flow.apply_received_edits();
+    receive(edits.flow, edits.loser);
+    CHECK_EQ(edits.flow.apply_received_edits(), 0u);
+    CHECK_EQ(next_applies(edits.flow), 1u);
+}
+
+// A delta that does not fit the content means the copy is not what its
+// version says: the version does not advance and the flow resyncs
+TEST_CASE(out_of_range_delta_resyncs) {
+    ConcurrentEdits edits;
+    receive(edits.flow, delta_payload(1, ContentSplice(600, 0, "z")));
+    CHECK_EQ(edits.flow.apply_received_edits(), 0u);
+    CHECK_EQ(edits.flow.version(), 1u);
+    CHECK_EQ(edits.flow.content(), "hello\n");
+    CHECK_EQ(next_applies(edits.flow), 0u);
+}
+
+std::string snapshot_path(const char* name) {
+    const char* dir = std::getenv("TMPDIR");
+    return std::string(dir ? dir : "/tmp") + "/nerd_" + name + "_" + std::to_string(getpid()) + ".snap";
+}
+
+TEST_CASE(snapshot_restores_content_and_version) {
+    std::string path = snapshot_path("restore");
+    std::string text;
+    for (int i = 0; i < 500; ++i) {
+        text += "line " + std::to_string(i) + " of a flow spanning several chunks\n";
+    }
+    FlowFile saved(FLOW, "doc");
+    saved.write_to_flow(text);
+    saved.append_content("tail");
+    uint64_t key = nerd::flow_name_key("", "doc");
+    REQUIRE(saved.save_snapshot(path, key));
+
+    nerd::FlowSnapshot snapshot;
+    bool opened = snapshot.open(path);
+    unlink(path.c_str());   // The mapping outlives the name
+    REQUIRE(opened);
+    CHECK(snapshot.complete());
+    CHECK_EQ(snapshot.name(), "doc");
+    CHECK_EQ(snapshot.header().name_key, key);
+    CHECK_EQ(snapshot.header().version, saved.version());
+
+    FlowFile restored(FLOW, "doc");
+    restored.restore_snapshot(snapshot);
+    CHECK(restored.content() == saved.content());
+    CHECK_EQ(restored.version(), saved.version());
+    CHECK_EQ(restored.line_count(), saved.line_count());
+}
+
+TEST_CASE(snapshot_refuses_corrupt_content) {
+    std::string path = snapshot_path("corrupt");
+    FlowFile saved(FLOW, "doc");
+    saved.write_to_flow("content to be damaged\n");
+    REQUIRE(saved.save_snapshot(path, 1));
+
+    uint64_t content_offset = 0;
+    {
+        nerd::FlowSnapshot snapshot;
+        REQUIRE(snapshot.open(path));
+        content_offset = snapshot.header().content_offset;
+    }
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(static_cast<std::streamoff>(content_offset));
+    file.put('C');
+    file.close();
+
+    nerd::FlowSnapshot snapshot;
+    CHECK(!snapshot.open(path));
+    CHECK(!snapshot.is_open());
+    unlink(path.c_str());
+}
+
+} // namespace
@@ -0,0 +1,84 @@
+#include "network/packet.h"
+#include "check.h"
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace {
+
+using nerd::PacketStream;
+using nerd::RawPacket;
+
+const nerd::FlowID FLOW = 0x1234;
+
+RawPacket chunk(uint32_t sequence) {
+    RawPacket packet(FLOW, nerd::FLOW_DATA, std::vector<uint8_t>(16, static_cast<uint8_t>(sequence)));
+    packet.set_sequence(sequence);
+    return packet;
+}
+
+// A full window starting mid-ring slides forward a slot at a time, reusing
+// the slots the oldest packets leave
+TEST_CASE(packet_stream_wraps_and_slides_at_capacity) {
+    PacketStream stream(FLOW, 64);
+    for (uint32_t sequence = 100; sequence < 164; ++sequence) {
+        stream.add_packet(chunk(sequence));
+    }
+    CHECK_EQ(stream.size(), 64u);
+    CHECK_EQ(stream.contiguous_from(100), 64u);
+
+    stream.add_packet(chunk(164));
+    CHECK_EQ(stream.size(), 64u);
+    CHECK_EQ(stream.window_base(), 101u);
+    CHECK_EQ(stream.window_end(), 165u);
+    CHECK(stream.find(100) == nullptr);
+    REQUIRE(stream.find(164) != nullptr);
+    CHECK_EQ(stream.find(164)->header().sequence, 164u);
+    CHECK_EQ(stream.find(101)->header().sequence, 101u);
+    CHECK_EQ(stream.dropped(), 1u);
+
+    // Behind the window: refused rather than sliding it back
+    stream.add_packet(chunk(100));
+    CHECK(stream.find(100) == nullptr);
+    CHECK_EQ(stream.dropped(), 2u);
+}
+
+TEST_CASE(packet_stream_jump_past_window_evicts_everything) {
+    PacketStream stream(FLOW, 64);
+    for (uint32_t sequence = 0; sequence < 10; ++sequence) {
+        stream.add_packet(chunk(sequence));
+    }
+    stream.add_packet(chunk(1000));
+    CHECK_EQ(stream.size(), 1u);
+    CHECK_EQ(stream.window_base(), 1000u);
+    CHECK_EQ(stream.window_end(), 1001u);
+    CHECK(stream.find(1000) != nullptr);
+    CHECK_EQ(stream.dropped(), 10u);
+}
+
+TEST_CASE(packet_stream_grows_and_tracks_gaps) {
+    PacketStream stream(FLOW);
+    stream.add_packet(chunk(0));
+    stream.add_packet(chunk(1));
+    stream.add_packet(chunk(1000));
+    CHECK_EQ(stream.size(), 3u);
+    CHECK_EQ(stream.contiguous_from(0), 2u);
+    CHECK_EQ(stream.next_missing(0, 1001), 2u);
+    CHECK_EQ(stream.next_present(2, 1001), 1000u);
+    CHECK_EQ(stream.find(1000)->header().sequence, 1000u);
+
+    stream.remove_packet(0);
+    CHECK_EQ(stream.window_base(), 1u);
+    stream.remove_packet(1000);
+    CHECK_EQ(stream.window_end(), 2u);
+}
+
+// The window is [base, end), so the last sequence could only wrap end
+TEST_CASE(packet_stream_refuses_last_sequence) {
+    PacketStream stream(FLOW);
+    stream.add_packet(chunk(std::numeric_limits<uint32_t>::max()));
+    CHECK(stream.empty());
+    CHECK_EQ(stream.dropped(), 1u);
+}
+
+} // namespace
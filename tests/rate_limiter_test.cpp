@@ -0,0 +1,69 @@
+#include "network/rate_limiter.h"
+#include "check.h"
+#include <cstdint>
+
+namespace {
+
+using nerd::RateLimiter;
+using nerd::TransmitLimits;
+
+TEST_CASE(rate_limiter_unlimited_never_waits) {
+    RateLimiter limiter;
+    CHECK(!limiter.limited());
+    for (int i = 0; i < 1000; ++i) {
+        CHECK_EQ(limiter.reserve(1500, 0), 0u);
+    }
+    CHECK_EQ(limiter.deferred(), 0u);
+}
+
+// 1000 packets per second holds a 10 ms burst of 10; past it each frame
+// waits for the debt it added, so senders leave 1 ms apart
+TEST_CASE(rate_limiter_packet_debt_spaces_senders) {
+    RateLimiter limiter;
+    TransmitLimits limits;
+    limits.max_packets_per_second = 1000;
+    limiter.configure(limits, 0);
+
+    for (int i = 0; i < 10; ++i) {
+        CHECK_EQ(limiter.reserve(100, 0), 0u);
+    }
+    CHECK_EQ(limiter.reserve(100, 0), 1000u);
+    CHECK_EQ(limiter.reserve(100, 0), 2000u);
+    CHECK_EQ(limiter.deferred(), 2u);
+
+    // Refilled credit pays the debt down before it lets anything through
+    CHECK_EQ(limiter.reserve(100, 1000), 2000u);
+    CHECK_EQ(limiter.reserve(100, 10000), 0u);
+}
+
+// Credit for frames that never went out comes back
+TEST_CASE(rate_limiter_refund_clears_debt) {
+    RateLimiter limiter;
+    TransmitLimits limits;
+    limits.max_packets_per_second = 1000;
+    limiter.configure(limits, 0);
+
+    for (int i = 0; i < 12; ++i) {
+        limiter.reserve(100, 0);
+    }
+    limiter.refund(3, 300);
+    CHECK_EQ(limiter.reserve(100, 0), 0u);
+    CHECK_EQ(limiter.reserve(100, 0), 1000u);
+}
+
+TEST_CASE(rate_limiter_byte_budget) {
+    RateLimiter limiter;
+    TransmitLimits limits;
+    limits.max_bytes_per_second = 1000000;
+    limiter.configure(limits, 0);
+
+    // A 10 ms burst is 10000 bytes; the next 1000 wait 1 ms
+    for (int i = 0; i < 10; ++i) {
+        CHECK_EQ(limiter.reserve(1000, 0), 0u);
+    }
+    CHECK_EQ(limiter.reserve(1000, 0), 1000u);
+    limiter.refund(1, 1000);
+    CHECK_EQ(limiter.reserve(500, 0), 500u);
+}
+
+} // namespace
@@ -0,0 +1,90 @@
+#include "network/timer_wheel.h"
+#include "check.h"
+#include <cstdint>
+#include <vector>
+
+namespace {
+
+using nerd::TimerEvent;
+using nerd::TimerWheel;
+
+TimerEvent event_at(uint64_t deadline, nerd::FlowID flow_id) {
+    TimerEvent event;
+    event.deadline = deadline;
+    event.flow_id = flow_id;
+    return event;
+}
+
+// Advance one tick at a time, recording the tick each flow's event fired on
+std::vector<uint64_t> run_until(TimerWheel& wheel, uint64_t from, uint64_t to, size_t flows) {
+    std::vector<uint64_t> fired(flows, 0);
+    std::vector<TimerEvent> due;
+    for (uint64_t now = from; now <= to; ++now) {
+        due.clear();
+        wheel.advance(now, due);
+        for (const auto& event : due) {
+            CHECK_EQ(fired[event.flow_id], 0u);   // Each event fires once
+            fired[event.flow_id] = now;
+        }
+    }
+    return fired;
+}
+
+// Events on levels 1 and 2 cascade down and fire on their own tick, not at
+// the boundary that moved them
+TEST_CASE(timer_wheel_cascades_to_exact_tick) {
+    TimerWheel wheel(1);
+    wheel.reset(0);
+    wheel.schedule(event_at(5, 1));
+    wheel.schedule(event_at(300, 2));
+    wheel.schedule(event_at(256 * 256 + 7, 3));
+    wheel.schedule(event_at(256 * 3, 4));
+    CHECK_EQ(wheel.size(), 4u);
+
+    std::vector<uint64_t> fired = run_until(wheel, 1, 256 * 256 + 10, 5);
+    CHECK_EQ(fired[1], 5u);
+    CHECK_EQ(fired[2], 300u);
+    CHECK_EQ(fired[3], 256u * 256 + 7);
+    CHECK_EQ(fired[4], 256u * 3);
+    CHECK(wheel.empty());
+}
+
+// Deadlines round up to the tick, so nothing fires early
+TEST_CASE(timer_wheel_never_fires_early) {
+    TimerWheel wheel(1000);
+    wheel.reset(0);
+    wheel.schedule(event_at(1500, 1));
+    std::vector<TimerEvent> due;
+    wheel.advance(1999, due);
+    CHECK(due.empty());
+    wheel.advance(2000, due);
+    REQUIRE(due.size() == 1u);
+    CHECK_EQ(due[0].flow_id, 1u);
+}
+
+// Past the top level's horizon an event waits in overflow and is placed
+// again when the wheel turns over
+TEST_CASE(timer_wheel_overflow_fires_after_rollover) {
+    const uint64_t horizon = uint64_t(1) << (TimerWheel::SLOT_BITS * TimerWheel::LEVELS);
+    TimerWheel wheel(1);
+    wheel.reset(horizon - 10);
+    wheel.schedule(event_at(horizon + 5, 1));
+    wheel.schedule(event_at(horizon - 3, 2));
+
+    std::vector<uint64_t> fired = run_until(wheel, horizon - 9, horizon + 10, 3);
+    CHECK_EQ(fired[2], horizon - 3);
+    CHECK_EQ(fired[1], horizon + 5);
+    CHECK(wheel.empty());
+}
+
+TEST_CASE(timer_wheel_past_deadline_fires_on_next_advance) {
+    TimerWheel wheel(1);
+    wheel.reset(100);
+    wheel.schedule(event_at(50, 1));
+    std::vector<TimerEvent> due;
+    wheel.advance(100, due);
+    REQUIRE(due.size() == 1u);
+    CHECK(wheel.empty());
+}
+
+} // namespace